@@ -0,0 +1,599 @@
+#ifndef AGGREGATE_H
+#define AGGREGATE_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+#include <unistd.h>
+#include "planner.h"
+#include "types.h"
+
+// Aggregates and group by for `select <list> from <table> ...`.
+//
+// Execution is a partitioned hash aggregation. Every pool thread scans
+// its share of the table into its own hash tables, one per partition (by
+// hash of the group key), so no locks are taken per row. Partition p of all
+// workers is then merged by a single thread, with partitions spread across
+// threads. A worker that goes over its memory share writes its partial
+// groups to one spill file per partition and starts again empty; a spilled
+// partition is merged from its files plus whatever is still in memory, so
+// only one partition of groups has to fit at a time.
+
+enum class AggregateFunction
+{
+    Count,
+    Sum,
+    Min,
+    Max,
+    Avg
+};
+
+// One item of the select list: an aggregate or a group by column
+struct OutputColumn
+{
+    bool isAggregate = false;
+    AggregateFunction function = AggregateFunction::Count;
+    std::string column; // empty for count(*)
+    std::string label;  // as written, used for the header line
+    size_t position = 0;
+    ColumnType type;
+    size_t groupIndex = 0; // for group columns: place in the group key
+};
+
+struct AggregateQuery
+{
+    std::vector<OutputColumn> outputs;
+    std::vector<std::string> groupBy;
+    std::vector<size_t> groupPositions;
+    std::vector<ColumnType> groupTypes;
+};
+
+// Resolve names against the table. Plain columns must be grouped on, and
+// sum/avg need a number (text columns are summed where they parse).
+inline bool bindAggregate(AggregateQuery &query, const Table &table, std::string &error)
+{
+    const auto &schema = table.getSchema();
+    const RowFormat &format = table.getFormat();
+    auto resolve = [&](const std::string &column, size_t &position)
+    {
+        if (column == "unique_id")
+        {
+            position = 0;
+            return true;
+        }
+        auto it = std::find(schema.begin(), schema.end(), column);
+        if (it == schema.end())
+        {
+            error = "Column '" + column + "' not found in table '" + table.getName() + "'";
+            return false;
+        }
+        position = (it - schema.begin()) + 1;
+        return true;
+    };
+
+    query.groupPositions.clear();
+    query.groupTypes.clear();
+    for (const auto &column : query.groupBy)
+    {
+        size_t position;
+        if (!resolve(column, position))
+            return false;
+        query.groupPositions.push_back(position);
+        query.groupTypes.push_back(format.typeAt(position));
+    }
+
+    for (auto &output : query.outputs)
+    {
+        if (!output.isAggregate)
+        {
+            auto it = std::find(query.groupBy.begin(), query.groupBy.end(), output.column);
+            if (it == query.groupBy.end())
+            {
+                error = "Column '" + output.column + "' must appear in group by or inside an aggregate";
+                return false;
+            }
+            output.groupIndex = it - query.groupBy.begin();
+            output.position = query.groupPositions[output.groupIndex];
+            output.type = query.groupTypes[output.groupIndex];
+            continue;
+        }
+        if (output.column.empty())
+            continue;
+        if (!resolve(output.column, output.position))
+            return false;
+        output.type = format.typeAt(output.position);
+        bool summing = output.function == AggregateFunction::Sum || output.function == AggregateFunction::Avg;
+        if (summing && output.type.kind == ColumnKind::Timestamp)
+        {
+            error = output.label + ": cannot sum or average a timestamp";
+            return false;
+        }
+    }
+    return true;
+}
+
+// Running state of one aggregate within one group
+struct AggregateState
+{
+    int64_t count = 0;   // rows (count) or values added (sum/avg)
+    int64_t intSum = 0;  // integer and bool columns
+    double sum = 0;      // double and text columns
+    std::string min, max; // stored form
+};
+
+class HashAggregator
+{
+private:
+    static constexpr size_t PARTITION_BITS = 6;
+    static constexpr size_t PARTITIONS = size_t(1) << PARTITION_BITS;
+    static constexpr size_t PAGES_PER_TASK = 64;
+    static constexpr size_t GROUP_OVERHEAD = 96; // hash node and vector bookkeeping per group
+
+    using GroupTable = std::unordered_map<std::string, std::vector<AggregateState>>;
+
+    struct Worker
+    {
+        std::vector<GroupTable> partitions = std::vector<GroupTable>(PARTITIONS);
+        size_t bytes = 0;
+    };
+
+    const Table &table;
+    const ScanPlan &plan;
+    const AggregateQuery &query;
+    std::vector<const OutputColumn *> aggregates;
+    size_t memoryBudget;
+    std::string spillPrefix;
+    size_t workerFiles = 0;       // spill files per partition, one per worker
+    std::vector<uint8_t> written; // per worker and partition: whether that spill file exists
+    QueryProfile *profile = nullptr;
+
+    static size_t partitionOf(const std::string &key)
+    {
+        return std::hash<std::string>{}(key) >> (sizeof(size_t) * 8 - PARTITION_BITS);
+    }
+
+    std::string spillPath(size_t worker, size_t partition) const
+    {
+        return spillPrefix + std::to_string(worker) + "." + std::to_string(partition);
+    }
+
+    uint8_t &spillWritten(size_t worker, size_t partition) { return written[worker * PARTITIONS + partition]; }
+
+    // Group key: every group column's stored bytes, length-prefixed
+    void groupKey(std::string_view record, std::string &key) const
+    {
+        const RowFormat &format = table.getFormat();
+        key.clear();
+        for (size_t position : query.groupPositions)
+        {
+            std::string_view field = format.field(record, position);
+            char length[sizeof(uint16_t)];
+            putValue(length, static_cast<uint16_t>(field.size()));
+            key.append(length, sizeof(length));
+            key.append(field.data(), field.size());
+        }
+    }
+
+    void accumulate(std::vector<AggregateState> &states, std::string_view record) const
+    {
+        const RowFormat &format = table.getFormat();
+        for (size_t i = 0; i < aggregates.size(); ++i)
+        {
+            const OutputColumn &output = *aggregates[i];
+            AggregateState &state = states[i];
+            if (output.function == AggregateFunction::Count)
+            {
+                ++state.count;
+                continue;
+            }
+
+            std::string_view field = format.field(record, output.position);
+            switch (output.function)
+            {
+            case AggregateFunction::Min:
+                if (state.count++ == 0 || field < std::string_view(state.min))
+                    state.min.assign(field.data(), field.size());
+                break;
+            case AggregateFunction::Max:
+                if (state.count++ == 0 || field > std::string_view(state.max))
+                    state.max.assign(field.data(), field.size());
+                break;
+            default:
+                switch (output.type.kind)
+                {
+                case ColumnKind::Double:
+                    state.sum += ValueCodec::decodeDouble(field);
+                    break;
+                case ColumnKind::Varchar:
+                {
+                    // Text columns count only the values that read as numbers
+                    std::string text(field);
+                    char *end = nullptr;
+                    double value = std::strtod(text.c_str(), &end);
+                    if (text.empty() || end != text.c_str() + text.size())
+                        continue;
+                    state.sum += value;
+                    break;
+                }
+                default:
+                    state.intSum += ValueCodec::decodeInteger(output.type, field);
+                    break;
+                }
+                ++state.count;
+                break;
+            }
+        }
+    }
+
+    void mergeState(std::vector<AggregateState> &into, const std::vector<AggregateState> &from) const
+    {
+        for (size_t i = 0; i < aggregates.size(); ++i)
+        {
+            AggregateState &a = into[i];
+            const AggregateState &b = from[i];
+            if (b.count == 0)
+                continue;
+            if (aggregates[i]->function == AggregateFunction::Min && (a.count == 0 || b.min < a.min))
+                a.min = b.min;
+            if (aggregates[i]->function == AggregateFunction::Max && (a.count == 0 || b.max > a.max))
+                a.max = b.max;
+            a.count += b.count;
+            a.intSum += b.intSum;
+            a.sum += b.sum;
+        }
+    }
+
+    // Append every partition of a worker to its spill files and empty it
+    void spill(Worker &worker, size_t workerNo)
+    {
+        for (size_t p = 0; p < PARTITIONS; ++p)
+        {
+            GroupTable &groups = worker.partitions[p];
+            if (groups.empty())
+                continue;
+            std::string path = spillPath(workerNo, p);
+            std::ofstream out(path, std::ios::binary | std::ios::app);
+            if (!out.is_open())
+                throw std::runtime_error("Cannot create aggregate spill file " + path);
+            spillWritten(workerNo, p) = 1;
+            std::string buffer;
+            auto write = [&]()
+            {
+                out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+                if (!out)
+                    throw std::runtime_error("Failed to write aggregate spill file " + path);
+                if (profile)
+                    profile->spillBytes += buffer.size();
+                buffer.clear();
+            };
+            for (const auto &[key, states] : groups)
+            {
+                char word[sizeof(uint64_t)];
+                auto put = [&buffer, &word](auto value)
+                {
+                    putValue(word, value);
+                    buffer.append(word, sizeof(value));
+                };
+                put(static_cast<uint32_t>(key.size()));
+                buffer += key;
+                for (const auto &state : states)
+                {
+                    put(state.count);
+                    put(state.intSum);
+                    put(state.sum);
+                    put(static_cast<uint16_t>(state.min.size()));
+                    buffer += state.min;
+                    put(static_cast<uint16_t>(state.max.size()));
+                    buffer += state.max;
+                }
+                if (buffer.size() >= (1 << 16))
+                    write();
+            }
+            write();
+            out.close();
+            if (!out)
+                throw std::runtime_error("Failed to write aggregate spill file " + path);
+            GroupTable().swap(groups);
+        }
+        worker.bytes = 0;
+    }
+
+    // Fold one spill file back into a partition's table
+    void readSpill(const std::string &path, GroupTable &groups) const
+    {
+        std::ifstream in(path, std::ios::binary | std::ios::ate);
+        if (!in.is_open())
+            throw std::runtime_error("Cannot open aggregate spill file " + path);
+        std::streamsize size = in.tellg();
+        std::string data(static_cast<size_t>(std::max<std::streamsize>(size, 0)), '\0');
+        in.seekg(0);
+        if (size < 0 || !in.read(data.data(), size))
+            throw std::runtime_error("Failed to read aggregate spill file " + path);
+
+        const char *cursor = data.data();
+        const char *end = cursor + data.size();
+        auto need = [&](size_t bytes)
+        {
+            if (static_cast<size_t>(end - cursor) < bytes)
+                throw std::runtime_error("Truncated aggregate spill file " + path);
+        };
+        auto take = [&](auto &value)
+        {
+            need(sizeof(value));
+            value = getValue<std::remove_reference_t<decltype(value)>>(cursor);
+            cursor += sizeof(value);
+        };
+        auto takeText = [&](std::string &text, size_t length)
+        {
+            need(length);
+            text.assign(cursor, length);
+            cursor += length;
+        };
+
+        std::vector<AggregateState> states(aggregates.size());
+        std::string key;
+        while (cursor < end)
+        {
+            uint32_t keyLength;
+            take(keyLength);
+            takeText(key, keyLength);
+            for (auto &state : states)
+            {
+                uint16_t length;
+                take(state.count);
+                take(state.intSum);
+                take(state.sum);
+                take(length);
+                takeText(state.min, length);
+                take(length);
+                takeText(state.max, length);
+            }
+
+            auto [it, inserted] = groups.try_emplace(key);
+            if (inserted)
+                it->second = states;
+            else
+                mergeState(it->second, states);
+        }
+    }
+
+    // Scan a range into a worker, spilling whenever it holds more than share
+    void scanInto(Worker &worker, size_t workerNo, const ScanOptions &options, size_t share)
+    {
+        std::string key;
+        executeScanRecords(table, plan, [&](RowId, std::string_view record)
+                           {
+                               groupKey(record, key);
+                               GroupTable &groups = worker.partitions[partitionOf(key)];
+                               auto it = groups.find(key);
+                               if (it == groups.end())
+                               {
+                                   it = groups.emplace(key, std::vector<AggregateState>(aggregates.size())).first;
+                                   worker.bytes += key.size() + aggregates.size() * sizeof(AggregateState) + GROUP_OVERHEAD;
+                               }
+                               accumulate(it->second, record);
+                               if (worker.bytes > share)
+                                   spill(worker, workerNo);
+                               return true; },
+                           options);
+    }
+
+    // Text row for one group, in select-list order
+    std::vector<std::string> outputRow(const std::string &key, const std::vector<AggregateState> &states) const
+    {
+        std::vector<std::string_view> groupValues;
+        for (size_t pos = 0; pos < key.size();)
+        {
+            uint16_t length = getValue<uint16_t>(key.data() + pos);
+            pos += sizeof(uint16_t);
+            groupValues.emplace_back(key.data() + pos, length);
+            pos += length;
+        }
+
+        std::vector<std::string> row;
+        size_t next = 0;
+        for (const auto &output : query.outputs)
+        {
+            if (!output.isAggregate)
+            {
+                row.push_back(ValueCodec::decode(output.type, groupValues[output.groupIndex]));
+                continue;
+            }
+
+            const AggregateState &state = states[next++];
+            bool integral = output.type.isFixed() && output.type.kind != ColumnKind::Double;
+            switch (output.function)
+            {
+            case AggregateFunction::Count:
+                row.push_back(std::to_string(state.count));
+                break;
+            case AggregateFunction::Min:
+                row.push_back(state.count ? ValueCodec::decode(output.type, state.min) : "");
+                break;
+            case AggregateFunction::Max:
+                row.push_back(state.count ? ValueCodec::decode(output.type, state.max) : "");
+                break;
+            case AggregateFunction::Sum:
+                row.push_back(integral ? std::to_string(state.intSum) : ValueCodec::formatDouble(state.sum));
+                break;
+            default:
+                row.push_back(state.count == 0 ? ""
+                                               : ValueCodec::formatDouble((integral ? static_cast<double>(state.intSum) : state.sum) /
+                                                                          static_cast<double>(state.count)));
+                break;
+            }
+        }
+        return row;
+    }
+
+public:
+    HashAggregator(const Table &source, const ScanPlan &scanPlan, const AggregateQuery &aggregateQuery)
+        : table(source), plan(scanPlan), query(aggregateQuery)
+    {
+        for (const auto &output : query.outputs)
+        {
+            if (output.isAggregate)
+                aggregates.push_back(&output);
+        }
+
+        // NOSQLITE_AGG_MEMORY_MB bounds the partial groups held in memory
+        // across all workers before they spill
+        const char *env = std::getenv("NOSQLITE_AGG_MEMORY_MB");
+        size_t megabytes = env ? std::strtoull(env, nullptr, 10) : 256;
+        memoryBudget = std::max<size_t>(megabytes, 1) * 1024 * 1024;
+
+        static std::atomic<uint64_t> aggregations{0};
+        std::filesystem::path base(table.getFilePath());
+        spillPrefix = (base.parent_path() / (table.getName() + ".agg." + std::to_string(::getpid()) + "." +
+                                             std::to_string(aggregations.fetch_add(1)) + "."))
+                          .string();
+    }
+
+    HashAggregator(const HashAggregator &) = delete;
+    HashAggregator &operator=(const HashAggregator &) = delete;
+
+    // Spill files a failed run left behind
+    ~HashAggregator()
+    {
+        std::error_code ignored;
+        for (size_t w = 0; w < workerFiles; ++w)
+        {
+            for (size_t p = 0; p < PARTITIONS; ++p)
+            {
+                if (spillWritten(w, p))
+                    std::filesystem::remove(spillPath(w, p), ignored);
+            }
+        }
+    }
+
+    // Threads a run with this degree (0 for the whole pool) uses over a
+    // table of pages pages. Full scans split into page ranges handed out to
+    // the pool; index and key lookups are already narrow and run on one.
+    static size_t threadsFor(const ScanPlan &plan, uint32_t pages, size_t degree)
+    {
+        if (plan.kind != ScanPlan::Kind::FullScan || pages <= PAGES_PER_TASK)
+            return 1;
+        if (degree == 0)
+            degree = ThreadPool::instance().size();
+        return std::clamp<size_t>(degree, 1, (pages + PAGES_PER_TASK - 1) / PAGES_PER_TASK);
+    }
+
+    static constexpr size_t pagesPerTask() { return PAGES_PER_TASK; }
+    size_t getMemoryBudget() const { return memoryBudget; }
+
+    // Run the query on up to degree pool threads (0 for the whole pool),
+    // handing each result row to emit until it returns false. Every range
+    // reads the same snapshot. With a profile, the scan and the merge are
+    // timed and spills measured. Returns the number of worker threads used.
+    // Throws std::runtime_error if a spill file cannot be written or read.
+    size_t run(const std::function<bool(const std::vector<std::string> &)> &emit, size_t degree = 0,
+               QueryProfile *queryProfile = nullptr)
+    {
+        profile = queryProfile;
+        ReadView view = table.snapshot();
+        uint32_t pages = view.pageCount;
+        size_t threadCount = threadsFor(plan, pages, degree);
+        size_t share = memoryBudget / threadCount;
+        workerFiles = threadCount;
+        written.assign(workerFiles * PARTITIONS, 0);
+
+        std::vector<Worker> workers(threadCount);
+        std::atomic<uint32_t> nextPage{1};
+        if (threadCount == 1)
+        {
+            ScanOptions options;
+            options.view = &view;
+            options.profile = profile;
+            scanInto(workers[0], 0, options, share);
+        }
+        else
+            runParallel(threadCount, [this, pages, share, &view, &workers, &nextPage](size_t w)
+                        {
+                            uint32_t from;
+                            while ((from = nextPage.fetch_add(PAGES_PER_TASK)) < pages)
+                            {
+                                ScanOptions options;
+                                options.start = RowId{from, 0};
+                                options.endPage = from + PAGES_PER_TASK;
+                                options.view = &view;
+                                options.profile = profile;
+                                scanInto(workers[w], w, options, share);
+                            } });
+
+        // Merge partition by partition, in parallel
+        std::vector<std::vector<std::vector<std::string>>> results(PARTITIONS);
+        std::atomic<size_t> nextPartition{0};
+        auto mergePartitions = [&]()
+        {
+            auto started = std::chrono::steady_clock::now();
+            size_t p;
+            while ((p = nextPartition.fetch_add(1)) < PARTITIONS)
+            {
+                GroupTable merged = std::move(workers[0].partitions[p]);
+                for (size_t w = 1; w < workers.size(); ++w)
+                {
+                    for (auto &[key, states] : workers[w].partitions[p])
+                    {
+                        auto [it, inserted] = merged.try_emplace(key);
+                        if (inserted)
+                            it->second = std::move(states);
+                        else
+                            mergeState(it->second, states);
+                    }
+                    GroupTable().swap(workers[w].partitions[p]);
+                }
+                for (size_t w = 0; w < workers.size(); ++w)
+                {
+                    if (!spillWritten(w, p))
+                        continue;
+                    std::string path = spillPath(w, p);
+                    readSpill(path, merged);
+                    std::error_code ignored;
+                    std::filesystem::remove(path, ignored);
+                    spillWritten(w, p) = 0;
+                }
+                for (const auto &[key, states] : merged)
+                    results[p].push_back(outputRow(key, states));
+            }
+            if (profile)
+                profile->mergeNanos += QueryProfile::since(started);
+        };
+        runParallel(threadCount, [&mergePartitions](size_t)
+                    { mergePartitions(); });
+
+        // Without group by there is exactly one row, even over no rows
+        if (query.groupBy.empty() && std::all_of(results.begin(), results.end(), [](const auto &rows)
+                                                 { return rows.empty(); }))
+        {
+            results[0].push_back(outputRow("", std::vector<AggregateState>(aggregates.size())));
+        }
+        if (profile)
+        {
+            profile->threads = threadCount;
+            for (const auto &rows : results)
+                profile->groups += rows.size();
+        }
+
+        for (const auto &rows : results)
+        {
+            for (const auto &row : rows)
+            {
+                if (!emit(row))
+                    return threadCount;
+            }
+        }
+        return threadCount;
+    }
+};
+
+#endif // AGGREGATE_H
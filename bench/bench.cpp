@@ -0,0 +1,440 @@
+// bench.cpp
+// nosqlite_bench: times ingest, scans, lookups, deletes and startup on
+// synthetic data and prints the results as JSON, one entry per benchmark
+// with its latency percentiles and throughput.
+//
+//   nosqlite_bench [--rows N] [--columns N] [--cardinality N] [--width N]
+//                  [--ops N] [--batch N] [--repeat N] [--seed N]
+//                  [--engine heap|lsm] [--durability none|fsync|group]
+//                  [--dir path]
+//
+// Every statement goes through QueryHelper, as a client's would, so the
+// timings include parsing and planning. The data lives under --dir, whose
+// account/ and database/ are replaced on every run.
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <streambuf>
+#include <string>
+#include <vector>
+#include "helper.h"
+
+namespace
+{
+
+struct Options
+{
+    size_t rows = 100000;
+    size_t columns = 4;
+    size_t cardinality = 1000;
+    size_t width = 16;
+    size_t ops = 1000;
+    size_t batch = 1000;
+    size_t repeat = 5;
+    uint64_t seed = 42;
+    std::string engine = "heap";
+    std::string durability = "fsync";
+    std::string dir = "nosqlite-bench";
+};
+
+// Deterministic values for a given seed (splitmix64)
+class Generator
+{
+private:
+    uint64_t state;
+    const Options &options;
+    std::vector<std::string> words;
+
+public:
+    Generator(const Options &opts) : state(opts.seed), options(opts)
+    {
+        // A fixed vocabulary of cardinality strings, each width bytes
+        static const char ALPHABET[] = "abcdefghijklmnopqrstuvwxyz0123456789";
+        words.reserve(options.cardinality);
+        for (size_t i = 0; i < options.cardinality; ++i)
+        {
+            std::string word(options.width, 'a');
+            for (char &c : word)
+                c = ALPHABET[next() % (sizeof(ALPHABET) - 1)];
+            words.push_back(std::move(word));
+        }
+    }
+
+    uint64_t next()
+    {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+
+    // Columns cycle through int64, varchar and double
+    std::string schema() const
+    {
+        std::string result;
+        for (size_t i = 0; i < options.columns; ++i)
+        {
+            static const char *const TYPES[] = {"int64", "varchar", "double"};
+            result += (i > 0 ? ", c" : "c") + std::to_string(i) + " " + TYPES[i % 3];
+            if (i % 3 == 1)
+                result += "(" + std::to_string(options.width) + ")";
+        }
+        return result;
+    }
+
+    // One row as the values of an insert: (v1, v2, ...)
+    void row(std::string &out)
+    {
+        out += '(';
+        for (size_t i = 0; i < options.columns; ++i)
+        {
+            if (i > 0)
+                out += ", ";
+            uint64_t value = next() % options.cardinality;
+            switch (i % 3)
+            {
+            case 0:
+                out += std::to_string(value);
+                break;
+            case 1:
+                out += words[value];
+                break;
+            default:
+                out += std::to_string(value) + ".5";
+                break;
+            }
+        }
+        out += ')';
+    }
+};
+
+// Discards what the engine prints while it is being timed
+class NullBuffer : public std::streambuf
+{
+protected:
+    int overflow(int c) override { return c; }
+    std::streamsize xsputn(const char *, std::streamsize n) override { return n; }
+};
+
+struct Result
+{
+    std::string name;
+    size_t ops = 0;
+    size_t rows = 0; // rows written or read, 0 where it means nothing
+    double seconds = 0;
+    std::vector<double> latencies; // microseconds per op
+};
+
+class Bench
+{
+private:
+    const Options &options;
+    Generator generator;
+    std::unique_ptr<QueryHelper> helper;
+    std::vector<Result> results;
+    std::vector<std::string> ids;
+    NullBuffer nullBuffer;
+    std::ostream discard{&nullBuffer};
+
+    using Clock = std::chrono::steady_clock;
+
+    static double micros(Clock::time_point start, Clock::time_point end)
+    {
+        return std::chrono::duration<double, std::micro>(end - start).count();
+    }
+
+    // Run query, failing the benchmark on an error message. Messages that
+    // report success start with these.
+    std::string run(const std::string &query, std::ostream &out)
+    {
+        std::string result = helper->executeQuery(query, out);
+        static const char *const OK[] = {"", "Inserted", "Generated", "Record deleted", "Opened", "Database", "Table",
+                                         "Durability", "Checkpoint"};
+        for (const char *ok : OK)
+        {
+            if (result.rfind(ok, 0) == 0 && (*ok != '\0' || result.empty()))
+                return result;
+        }
+        throw std::runtime_error("'" + query.substr(0, 80) + "' failed: " + result);
+    }
+
+    std::string run(const std::string &query) { return run(query, discard); }
+
+    // Log in and open the benchmark database in a fresh session
+    void connect()
+    {
+        helper = std::make_unique<QueryHelper>();
+        if (!helper->login("admin", "admin"))
+            throw std::runtime_error("Cannot log in as admin");
+        run("open bench");
+        run("set durability " + options.durability);
+    }
+
+    // Time op once per i in [0, count)
+    template <typename Op>
+    void measure(const std::string &name, size_t count, Op op)
+    {
+        Result result;
+        result.name = name;
+        result.ops = count;
+        result.latencies.reserve(count);
+        auto begin = Clock::now();
+        for (size_t i = 0; i < count; ++i)
+        {
+            auto start = Clock::now();
+            result.rows += op(i);
+            result.latencies.push_back(micros(start, Clock::now()));
+        }
+        result.seconds = micros(begin, Clock::now()) / 1e6;
+        results.push_back(std::move(result));
+    }
+
+    std::string insertRows(size_t count)
+    {
+        std::string query = "insert into t ";
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (i > 0)
+                query += ", ";
+            generator.row(query);
+        }
+        return query;
+    }
+
+    // Rows in the output of a select, after its header line
+    static size_t countRows(const std::string &output)
+    {
+        size_t lines = std::count(output.begin(), output.end(), '\n');
+        return lines > 0 ? lines - 1 : 0;
+    }
+
+    // Every unique_id in the table, in file order
+    void collectIds()
+    {
+        std::stringstream out;
+        run("select from t", out);
+        std::string line;
+        std::getline(out, line); // header
+        ids.clear();
+        while (std::getline(out, line))
+        {
+            if (!line.empty())
+                ids.push_back(line.substr(0, line.find(',')));
+        }
+    }
+
+    void ingest()
+    {
+        // Statements are generated up front so only their execution is timed.
+        // Bulk goes first, so the single-row inserts land on a full table.
+        std::vector<std::string> queries;
+        for (size_t done = 0; done < options.rows; done += options.batch)
+            queries.push_back(insertRows(std::min(options.batch, options.rows - done)));
+        measure("insert_bulk", queries.size(), [&](size_t i)
+                {
+                    run(queries[i]);
+                    return std::min(options.batch, options.rows - i * options.batch); });
+
+        queries.clear();
+        for (size_t i = 0; i < options.ops; ++i)
+            queries.push_back(insertRows(1));
+        measure("insert_single", queries.size(), [&](size_t i)
+                {
+                    run(queries[i]);
+                    return size_t(1); });
+    }
+
+    void read()
+    {
+        measure("scan_full", options.repeat, [&](size_t)
+                {
+                    std::stringstream out;
+                    run("select from t", out);
+                    return countRows(out.str()); });
+
+        measure("select_limit", options.ops, [&](size_t)
+                {
+                    std::stringstream out;
+                    run("select from t 100", out);
+                    return countRows(out.str()); });
+
+        measure("select_last", options.ops, [&](size_t)
+                {
+                    std::stringstream out;
+                    run("select from t 100 last", out);
+                    return countRows(out.str()); });
+
+        collectIds();
+        if (ids.empty())
+            throw std::runtime_error("The table holds no rows");
+        measure("lookup", options.ops, [&](size_t)
+                {
+                    std::stringstream out;
+                    run("select from t id:" + ids[generator.next() % ids.size()], out);
+                    return countRows(out.str()); });
+    }
+
+    void remove()
+    {
+        // Distinct ids spread over the table
+        size_t count = std::min(options.ops, ids.size());
+        size_t stride = std::max<size_t>(1, ids.size() / std::max<size_t>(1, count));
+        measure("delete", count, [&](size_t i)
+                {
+                    run("delete from t id:" + ids[(i * stride) % ids.size()]);
+                    return size_t(1); });
+    }
+
+    // Close the database, then time a new session up to its first answer
+    void startup()
+    {
+        run("checkpoint");
+        measure("startup", options.repeat, [&](size_t)
+                {
+                    helper.reset();
+                    connect();
+                    std::stringstream out;
+                    run("select from t id:" + ids.back(), out);
+                    return size_t(0); });
+    }
+
+public:
+    explicit Bench(const Options &opts) : options(opts), generator(opts) {}
+
+    void runAll()
+    {
+        std::filesystem::create_directories(options.dir);
+        std::filesystem::current_path(options.dir);
+        std::filesystem::remove_all("account");
+        std::filesystem::remove_all("database");
+
+        helper = std::make_unique<QueryHelper>();
+        if (!helper->login("admin", "admin"))
+            throw std::runtime_error("Cannot log in as admin");
+        run("create bench");
+        connect();
+        run("create table t (" + generator.schema() + ")" + (options.engine == "lsm" ? " engine=lsm" : ""));
+
+        ingest();
+        read();
+        remove();
+        startup();
+        helper.reset();
+    }
+
+    static double percentile(std::vector<double> sorted, double p)
+    {
+        if (sorted.empty())
+            return 0;
+        std::sort(sorted.begin(), sorted.end());
+        size_t rank = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+        return sorted[std::min(rank, sorted.size() - 1)];
+    }
+
+    void print(std::ostream &out) const
+    {
+        out << std::fixed << std::setprecision(3);
+        out << "{\n  \"config\": {\"rows\": " << options.rows << ", \"columns\": " << options.columns
+            << ", \"cardinality\": " << options.cardinality << ", \"width\": " << options.width
+            << ", \"ops\": " << options.ops << ", \"batch\": " << options.batch << ", \"repeat\": " << options.repeat
+            << ", \"seed\": " << options.seed << ", \"engine\": \"" << options.engine << "\", \"durability\": \""
+            << options.durability << "\"},\n  \"benchmarks\": [\n";
+        for (size_t i = 0; i < results.size(); ++i)
+        {
+            const Result &r = results[i];
+            double seconds = r.seconds > 0 ? r.seconds : 1e-9;
+            out << "    {\"name\": \"" << r.name << "\", \"ops\": " << r.ops << ", \"rows\": " << r.rows
+                << ", \"seconds\": " << r.seconds << ", \"ops_per_sec\": " << r.ops / seconds
+                << ", \"rows_per_sec\": " << r.rows / seconds << ", \"p50_us\": " << percentile(r.latencies, 0.50)
+                << ", \"p99_us\": " << percentile(r.latencies, 0.99) << "}" << (i + 1 < results.size() ? "," : "")
+                << "\n";
+        }
+        out << "  ]\n}\n";
+    }
+};
+
+bool parseNumber(const std::string &text, uint64_t &value)
+{
+    auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+    return ec == std::errc() && end == text.data() + text.size();
+}
+
+bool parseOptions(int argc, char *argv[], Options &options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string flag = argv[i];
+        if (i + 1 >= argc)
+            return false;
+        std::string value = argv[++i];
+        size_t *count = flag == "--rows"          ? &options.rows
+                        : flag == "--columns"     ? &options.columns
+                        : flag == "--cardinality" ? &options.cardinality
+                        : flag == "--width"       ? &options.width
+                        : flag == "--ops"         ? &options.ops
+                        : flag == "--batch"       ? &options.batch
+                        : flag == "--repeat"      ? &options.repeat
+                                                  : nullptr;
+        uint64_t number = 0;
+        bool numeric = parseNumber(value, number);
+        if (count)
+        {
+            if (!numeric || number == 0)
+                return false;
+            *count = static_cast<size_t>(number);
+        }
+        else if (flag == "--seed")
+        {
+            if (!numeric)
+                return false;
+            options.seed = number;
+        }
+        else if (flag == "--engine" && (value == "heap" || value == "lsm"))
+            options.engine = value;
+        else if (flag == "--durability")
+            options.durability = value == "group" ? "group 64 1000" : value;
+        else if (flag == "--dir")
+            options.dir = value;
+        else
+            return false;
+    }
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    Options options;
+    if (!parseOptions(argc, argv, options))
+    {
+        std::cerr << "Usage: nosqlite_bench [--rows N] [--columns N] [--cardinality N] [--width N] [--ops N]\n"
+                  << "                      [--batch N] [--repeat N] [--seed N] [--engine heap|lsm]\n"
+                  << "                      [--durability none|fsync|group] [--dir path]\n";
+        return 1;
+    }
+
+    // The engine reports progress on std::cout; keep it out of the JSON
+    Bench bench(options);
+    NullBuffer silence;
+    std::streambuf *console = std::cout.rdbuf(&silence);
+    try
+    {
+        bench.runAll();
+    }
+    catch (const std::exception &e)
+    {
+        std::cout.rdbuf(console);
+        std::cerr << "nosqlite_bench: " << e.what() << std::endl;
+        return 1;
+    }
+    std::cout.rdbuf(console);
+    bench.print(std::cout);
+    return 0;
+}
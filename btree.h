@@ -0,0 +1,499 @@
+#ifndef BTREE_H
+#define BTREE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "page.h"
+#include "bufferpool.h"
+
+// Disk-resident B+tree mapping column values to row locations
+// (<table>.<index>.idx), read and written through the buffer pool.
+//
+//   page 0      header: magic, version, root page, page count, entry
+//               count, the table counters it was last synced against and
+//               an unclean flag
+//   page 1..n   nodes
+//
+// Nodes can reach disk through eviction at any time, so the first change
+// after a sync makes the unclean flag durable before touching a node, and
+// only sync clears it; a tree opened unclean is rebuilt.
+//
+// Entries are ordered by (key bytes, RowId), which keeps duplicate column
+// values distinct so deletes can find their exact entry. Leaves are chained
+// left to right for range scans. Deletes remove entries without merging
+// nodes; a rebuild compacts the tree again.
+
+constexpr char BTREE_MAGIC[8] = {'N', 'S', 'Q', 'L', 'B', 'T', 'R', '\0'};
+constexpr uint32_t BTREE_VERSION = 1;
+
+struct IndexEntry
+{
+    std::string key;
+    RowId rid;
+};
+
+inline int compareIndexEntry(std::string_view keyA, RowId ridA, std::string_view keyB, RowId ridB)
+{
+    int c = keyA.compare(keyB);
+    if (c != 0)
+        return c < 0 ? -1 : 1;
+    if (ridA.pageNo != ridB.pageNo)
+        return ridA.pageNo < ridB.pageNo ? -1 : 1;
+    if (ridA.slot != ridB.slot)
+        return ridA.slot < ridB.slot ? -1 : 1;
+    return 0;
+}
+
+class BPlusTree
+{
+public:
+    // Keys longer than this are indexed by their prefix; callers recheck
+    // the predicate against the row
+    static constexpr size_t MAX_KEY_SIZE = 256;
+
+private:
+    static constexpr size_t NODE_HEADER = 12; // u8 leaf, u8 pad, u16 count, u32 next, u32 first child
+    static constexpr double BULK_FILL = 0.9;
+    static constexpr size_t UNCLEAN_OFFSET = 40;
+
+    struct Node
+    {
+        bool leaf = true;
+        uint32_t next = 0;       // right sibling (leaves only)
+        uint32_t firstChild = 0; // leftmost child (internal only)
+        std::vector<IndexEntry> entries;
+        std::vector<uint32_t> children; // child right of entries[i] (internal only)
+
+        size_t entrySize(size_t i) const
+        {
+            return sizeof(uint16_t) + entries[i].key.size() + sizeof(uint32_t) + sizeof(uint16_t) +
+                   (leaf ? 0 : sizeof(uint32_t));
+        }
+
+        size_t byteSize() const
+        {
+            size_t size = NODE_HEADER;
+            for (size_t i = 0; i < entries.size(); ++i)
+                size += entrySize(i);
+            return size;
+        }
+    };
+
+    std::string path;
+    uint32_t fileId = 0;
+    uint32_t rootPage = 0;
+    uint32_t pageCount = 0;
+    uint64_t entryCount = 0;
+    bool unclean = false; // the header on disk says so
+
+    static std::string_view clip(std::string_view key) { return key.substr(0, MAX_KEY_SIZE); }
+
+    Node readNode(uint32_t pageNo) const
+    {
+        PageGuard page(fileId, pageNo);
+        const char *in = page.get();
+        Node node;
+        node.leaf = in[0] != 0;
+        uint16_t count = getValue<uint16_t>(in + 2);
+        node.next = getValue<uint32_t>(in + 4);
+        node.firstChild = getValue<uint32_t>(in + 8);
+        in += NODE_HEADER;
+
+        node.entries.resize(count);
+        if (!node.leaf)
+            node.children.resize(count);
+        for (uint16_t i = 0; i < count; ++i)
+        {
+            uint16_t length = getValue<uint16_t>(in);
+            in += sizeof(uint16_t);
+            node.entries[i].key.assign(in, length);
+            in += length;
+            node.entries[i].rid.pageNo = getValue<uint32_t>(in);
+            in += sizeof(uint32_t);
+            node.entries[i].rid.slot = getValue<uint16_t>(in);
+            in += sizeof(uint16_t);
+            if (!node.leaf)
+            {
+                node.children[i] = getValue<uint32_t>(in);
+                in += sizeof(uint32_t);
+            }
+        }
+        return node;
+    }
+
+    void writeNode(uint32_t pageNo, const Node &node)
+    {
+        PageGuard page(fileId, pageNo);
+        char *out = page.get();
+        std::memset(out, 0, PAGE_SIZE);
+        out[0] = node.leaf ? 1 : 0;
+        putValue(out + 2, static_cast<uint16_t>(node.entries.size()));
+        putValue(out + 4, node.next);
+        putValue(out + 8, node.firstChild);
+        out += NODE_HEADER;
+
+        for (size_t i = 0; i < node.entries.size(); ++i)
+        {
+            const auto &entry = node.entries[i];
+            putValue(out, static_cast<uint16_t>(entry.key.size()));
+            out += sizeof(uint16_t);
+            std::memcpy(out, entry.key.data(), entry.key.size());
+            out += entry.key.size();
+            putValue(out, entry.rid.pageNo);
+            out += sizeof(uint32_t);
+            putValue(out, entry.rid.slot);
+            out += sizeof(uint16_t);
+            if (!node.leaf)
+            {
+                putValue(out, node.children[i]);
+                out += sizeof(uint32_t);
+            }
+        }
+        page.markDirty();
+    }
+
+    uint32_t allocatePage() { return pageCount++; }
+
+    // Child of an internal node that may contain (key, rid)
+    static uint32_t childFor(const Node &node, std::string_view key, RowId rid)
+    {
+        auto it = std::upper_bound(node.entries.begin(), node.entries.end(), 0,
+                                   [&](int, const IndexEntry &e)
+                                   { return compareIndexEntry(key, rid, e.key, e.rid) < 0; });
+        size_t index = it - node.entries.begin();
+        return index == 0 ? node.firstChild : node.children[index - 1];
+    }
+
+    // Split an overfull node in half by bytes. Returns the new right node's
+    // page and the separator to push into the parent.
+    std::pair<uint32_t, IndexEntry> splitNode(uint32_t pageNo, Node &node)
+    {
+        size_t total = node.byteSize();
+        size_t running = NODE_HEADER;
+        size_t mid = 0;
+        while (mid < node.entries.size() - 1 && running + node.entrySize(mid) < total / 2)
+            running += node.entrySize(mid++);
+        mid = std::max<size_t>(mid, 1);
+
+        Node right;
+        right.leaf = node.leaf;
+        uint32_t rightPage = allocatePage();
+        IndexEntry separator = node.entries[mid];
+
+        if (node.leaf)
+        {
+            right.entries.assign(node.entries.begin() + mid, node.entries.end());
+            node.entries.resize(mid);
+            right.next = node.next;
+            node.next = rightPage;
+        }
+        else
+        {
+            // The separator moves up; its right child becomes the new node's first
+            right.firstChild = node.children[mid];
+            right.entries.assign(node.entries.begin() + mid + 1, node.entries.end());
+            right.children.assign(node.children.begin() + mid + 1, node.children.end());
+            node.entries.resize(mid);
+            node.children.resize(mid);
+        }
+
+        writeNode(pageNo, node);
+        writeNode(rightPage, right);
+        return {rightPage, separator};
+    }
+
+    // Locate the leaf that holds (key, rid) and the path leading to it
+    uint32_t findLeaf(std::string_view key, RowId rid, std::vector<uint32_t> *path = nullptr) const
+    {
+        uint32_t pageNo = rootPage;
+        while (true)
+        {
+            Node node = readNode(pageNo);
+            if (node.leaf)
+                return pageNo;
+            if (path)
+                path->push_back(pageNo);
+            pageNo = childFor(node, key, rid);
+        }
+    }
+
+    void writeHeader(uint32_t tablePages, uint64_t tableRows)
+    {
+        PageGuard header(fileId, 0);
+        char *out = header.get();
+        std::memset(out, 0, PAGE_SIZE);
+        std::memcpy(out, BTREE_MAGIC, sizeof(BTREE_MAGIC));
+        putValue(out + 8, BTREE_VERSION);
+        putValue(out + 12, rootPage);
+        putValue(out + 16, pageCount);
+        putValue(out + 20, entryCount);
+        putValue(out + 28, tablePages);
+        putValue(out + 32, tableRows);
+        header.markDirty();
+    }
+
+    // Before the first change since the last sync, put the unclean flag on
+    // disk so a crash after any node is evicted forces a rebuild
+    void markChanged()
+    {
+        if (unclean)
+            return;
+        {
+            PageGuard header(fileId, 0);
+            header.get()[UNCLEAN_OFFSET] = 1;
+            header.markDirty();
+        }
+        BufferPool::instance().syncFile(fileId);
+        unclean = true;
+    }
+
+public:
+    explicit BPlusTree(const std::string &filePath) : path(filePath) {}
+
+    BPlusTree(const BPlusTree &) = delete;
+    BPlusTree &operator=(const BPlusTree &) = delete;
+
+    ~BPlusTree() { close(); }
+
+    void close()
+    {
+        if (fileId != 0)
+        {
+            BufferPool::instance().closeFile(fileId);
+            fileId = 0;
+        }
+    }
+
+    // Open an existing tree; false if missing or out of date with the table
+    bool open(uint32_t tablePages, uint64_t tableRows)
+    {
+        if (!std::filesystem::exists(path))
+            return false;
+
+        fileId = BufferPool::instance().openFile(path);
+        PageGuard header(fileId, 0);
+        const char *in = header.get();
+        if (std::memcmp(in, BTREE_MAGIC, sizeof(BTREE_MAGIC)) != 0 ||
+            getValue<uint32_t>(in + 8) != BTREE_VERSION ||
+            getValue<uint32_t>(in + 28) != tablePages || getValue<uint64_t>(in + 32) != tableRows ||
+            in[UNCLEAN_OFFSET] != 0)
+            return false;
+
+        rootPage = getValue<uint32_t>(in + 12);
+        pageCount = getValue<uint32_t>(in + 16);
+        entryCount = getValue<uint64_t>(in + 20);
+        return rootPage != 0;
+    }
+
+    // Build the tree bottom-up from entries sorted by (key, rid): pack
+    // leaves left to right, chain them, then stack internal levels on the
+    // first entry of each child until one root remains
+    void bulkLoad(std::vector<IndexEntry> entries)
+    {
+        close();
+        std::ofstream(path, std::ios::binary | std::ios::trunc);
+        fileId = BufferPool::instance().openFile(path);
+        pageCount = 1;
+        entryCount = entries.size();
+        unclean = false; // no header on disk until the first sync
+
+        for (auto &entry : entries)
+        {
+            if (entry.key.size() > MAX_KEY_SIZE)
+                entry.key.resize(MAX_KEY_SIZE);
+        }
+
+        const size_t budget = static_cast<size_t>(PAGE_SIZE * BULK_FILL);
+
+        // Leaf level
+        std::vector<std::pair<uint32_t, IndexEntry>> level; // page, first entry
+        Node leaf;
+        uint32_t leafPage = allocatePage();
+        size_t leafBytes = NODE_HEADER;
+        for (auto &entry : entries)
+        {
+            size_t size = sizeof(uint16_t) + entry.key.size() + sizeof(uint32_t) + sizeof(uint16_t);
+            if (!leaf.entries.empty() && leafBytes + size > budget)
+            {
+                uint32_t nextPage = allocatePage();
+                leaf.next = nextPage;
+                level.emplace_back(leafPage, leaf.entries.front());
+                writeNode(leafPage, leaf);
+                leaf = Node{};
+                leafPage = nextPage;
+                leafBytes = NODE_HEADER;
+            }
+            leafBytes += size;
+            leaf.entries.push_back(std::move(entry));
+        }
+        level.emplace_back(leafPage, leaf.entries.empty() ? IndexEntry{} : leaf.entries.front());
+        writeNode(leafPage, leaf);
+
+        // Internal levels
+        while (level.size() > 1)
+        {
+            std::vector<std::pair<uint32_t, IndexEntry>> parents;
+            Node node;
+            node.leaf = false;
+            size_t nodeBytes = NODE_HEADER;
+            IndexEntry first;
+            for (size_t i = 0; i < level.size(); ++i)
+            {
+                auto &child = level[i];
+                size_t size = sizeof(uint16_t) + child.second.key.size() + 2 * sizeof(uint32_t) + sizeof(uint16_t);
+                if (node.firstChild == 0)
+                {
+                    node.firstChild = child.first;
+                    first = child.second;
+                    continue;
+                }
+                if (nodeBytes + size > budget)
+                {
+                    uint32_t page = allocatePage();
+                    writeNode(page, node);
+                    parents.emplace_back(page, first);
+                    node = Node{};
+                    node.leaf = false;
+                    node.firstChild = child.first;
+                    first = child.second;
+                    nodeBytes = NODE_HEADER;
+                    continue;
+                }
+                nodeBytes += size;
+                node.entries.push_back(child.second);
+                node.children.push_back(child.first);
+            }
+            uint32_t page = allocatePage();
+            writeNode(page, node);
+            parents.emplace_back(page, first);
+            level = std::move(parents);
+        }
+        rootPage = level.front().first;
+    }
+
+    void insert(std::string_view fullKey, RowId rid)
+    {
+        markChanged();
+        std::string_view key = clip(fullKey);
+        std::vector<uint32_t> path;
+        uint32_t pageNo = findLeaf(key, rid, &path);
+
+        Node node = readNode(pageNo);
+        auto it = std::lower_bound(node.entries.begin(), node.entries.end(), 0,
+                                   [&](const IndexEntry &e, int)
+                                   { return compareIndexEntry(e.key, e.rid, key, rid) < 0; });
+        node.entries.insert(it, IndexEntry{std::string(key), rid});
+        ++entryCount;
+
+        // Split upward while nodes overflow
+        while (node.byteSize() > PAGE_SIZE)
+        {
+            auto [rightPage, separator] = splitNode(pageNo, node);
+            if (path.empty())
+            {
+                Node root;
+                root.leaf = false;
+                root.firstChild = pageNo;
+                root.entries.push_back(separator);
+                root.children.push_back(rightPage);
+                rootPage = allocatePage();
+                writeNode(rootPage, root);
+                return;
+            }
+
+            pageNo = path.back();
+            path.pop_back();
+            node = readNode(pageNo);
+            auto pos = std::upper_bound(node.entries.begin(), node.entries.end(), 0,
+                                        [&](int, const IndexEntry &e)
+                                        { return compareIndexEntry(separator.key, separator.rid, e.key, e.rid) < 0; });
+            size_t index = pos - node.entries.begin();
+            node.entries.insert(pos, separator);
+            node.children.insert(node.children.begin() + index, rightPage);
+        }
+        writeNode(pageNo, node);
+    }
+
+    bool erase(std::string_view fullKey, RowId rid)
+    {
+        std::string_view key = clip(fullKey);
+        uint32_t pageNo = findLeaf(key, rid);
+        Node node = readNode(pageNo);
+        for (size_t i = 0; i < node.entries.size(); ++i)
+        {
+            if (compareIndexEntry(node.entries[i].key, node.entries[i].rid, key, rid) == 0)
+            {
+                markChanged();
+                node.entries.erase(node.entries.begin() + i);
+                writeNode(pageNo, node);
+                --entryCount;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Visit entries with low <= key <= high in key order (either bound may
+    // be absent; exclusive bounds are honoured). Stops when visit returns false.
+    void scan(const std::string *low, bool lowInclusive, const std::string *high, bool highInclusive,
+              const std::function<bool(const std::string &, RowId)> &visit) const
+    {
+        if (fileId == 0 || rootPage == 0)
+            return;
+
+        std::string lowKey = low ? std::string(clip(*low)) : std::string();
+        std::string highKey = high ? std::string(clip(*high)) : std::string();
+        uint32_t pageNo = findLeaf(lowKey, RowId{0, 0});
+
+        while (pageNo != 0)
+        {
+            Node node = readNode(pageNo);
+            for (const auto &entry : node.entries)
+            {
+                if (low)
+                {
+                    int c = entry.key.compare(lowKey);
+                    if (c < 0 || (c == 0 && !lowInclusive && low->size() <= MAX_KEY_SIZE))
+                        continue;
+                }
+                if (high)
+                {
+                    int c = entry.key.compare(highKey);
+                    // Clipped keys equal to a clipped bound may still match
+                    if (c > 0 || (c == 0 && !highInclusive && high->size() <= MAX_KEY_SIZE))
+                        return;
+                }
+                if (!visit(entry.key, entry.rid))
+                    return;
+            }
+            pageNo = node.next;
+        }
+    }
+
+    uint64_t size() const { return entryCount; }
+
+    void sync(uint32_t tablePages, uint64_t tableRows)
+    {
+        if (fileId == 0)
+            return;
+        BufferPool::instance().syncFile(fileId);
+        writeHeader(tablePages, tableRows);
+        BufferPool::instance().syncFile(fileId);
+        unclean = false;
+    }
+
+    void destroy()
+    {
+        close();
+        std::filesystem::remove(path);
+    }
+};
+
+#endif // BTREE_H
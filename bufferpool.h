@@ -0,0 +1,493 @@
+#ifndef BUFFERPOOL_H
+#define BUFFERPOOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include "page.h"
+#include "metrics.h"
+
+// Eviction policies decide which unpinned frame gives up its page when the
+// pool is full. The pool reports every access and eviction; the policy
+// only ever sees frame numbers.
+class EvictionPolicy
+{
+public:
+    virtual ~EvictionPolicy() = default;
+    virtual const char *name() const = 0;
+    virtual void reset(size_t frameCount) = 0;
+    virtual void recordAccess(size_t frame) = 0;
+    virtual void recordEvict(size_t frame) = 0;
+    virtual bool pickVictim(const std::function<bool(size_t)> &evictable, size_t &victim) = 0;
+};
+
+// Second-chance CLOCK: one reference bit per frame and a sweeping hand
+class ClockPolicy : public EvictionPolicy
+{
+private:
+    std::vector<uint8_t> referenced;
+    size_t hand = 0;
+
+public:
+    const char *name() const override { return "clock"; }
+
+    void reset(size_t frameCount) override
+    {
+        referenced.assign(frameCount, 0);
+        hand = 0;
+    }
+
+    void recordAccess(size_t frame) override { referenced[frame] = 1; }
+    void recordEvict(size_t frame) override { referenced[frame] = 0; }
+
+    bool pickVictim(const std::function<bool(size_t)> &evictable, size_t &victim) override
+    {
+        // Two full sweeps are enough: the first clears reference bits
+        for (size_t step = 0; step < 2 * referenced.size(); ++step)
+        {
+            size_t frame = hand;
+            hand = (hand + 1) % referenced.size();
+            if (!evictable(frame))
+                continue;
+            if (referenced[frame])
+            {
+                referenced[frame] = 0;
+                continue;
+            }
+            victim = frame;
+            return true;
+        }
+        return false;
+    }
+};
+
+// LRU-K: evict the frame whose K-th most recent access is oldest. Frames
+// with fewer than K accesses count as infinitely old and fall back to
+// plain LRU among themselves, which keeps one-off scans from flushing
+// the hot set.
+class LruKPolicy : public EvictionPolicy
+{
+private:
+    size_t k;
+    uint64_t clock = 0;
+    std::vector<std::vector<uint64_t>> history; // most recent access last
+
+public:
+    explicit LruKPolicy(size_t kValue = 2) : k(kValue < 1 ? 1 : kValue) {}
+
+    const char *name() const override { return k == 2 ? "lru-2" : "lru-k"; }
+
+    void reset(size_t frameCount) override
+    {
+        history.assign(frameCount, {});
+        clock = 0;
+    }
+
+    void recordAccess(size_t frame) override
+    {
+        auto &accesses = history[frame];
+        accesses.push_back(++clock);
+        if (accesses.size() > k)
+            accesses.erase(accesses.begin());
+    }
+
+    void recordEvict(size_t frame) override { history[frame].clear(); }
+
+    bool pickVictim(const std::function<bool(size_t)> &evictable, size_t &victim) override
+    {
+        bool found = false;
+        bool bestInfinite = false;
+        uint64_t bestStamp = 0;
+        for (size_t frame = 0; frame < history.size(); ++frame)
+        {
+            if (!evictable(frame))
+                continue;
+
+            const auto &accesses = history[frame];
+            bool infinite = accesses.size() < k;
+            // K-th most recent access, or the latest one for LRU tie-breaking
+            uint64_t stamp = accesses.empty() ? 0 : (infinite ? accesses.back() : accesses.front());
+
+            if (!found || (infinite && !bestInfinite) ||
+                (infinite == bestInfinite && stamp < bestStamp))
+            {
+                found = true;
+                bestInfinite = infinite;
+                bestStamp = stamp;
+                victim = frame;
+            }
+        }
+        return found;
+    }
+};
+
+struct BufferPoolStats
+{
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t writebacks;
+    size_t frames;
+    size_t budgetBytes;
+    std::string policy;
+};
+
+// Process-wide cache of fixed-size page frames shared by every table file.
+// Files are registered once and keep their descriptor open; pages are read
+// with pread on a miss and written back with pwrite when a dirty frame is
+// evicted or its file is flushed. The read on a miss and the write-back of
+// an evicted page run without the pool mutex: the frame is marked busy
+// meanwhile, and anyone fetching its page waits for the I/O to finish.
+class BufferPool
+{
+private:
+    struct Frame
+    {
+        uint32_t fileId = 0;
+        uint32_t pageNo = 0;
+        int pinCount = 0;
+        bool dirty = false;
+        bool valid = false;
+        bool busy = false; // being read in or written back, mutex released
+    };
+
+    struct OpenFile
+    {
+        int fd;
+        std::string path;
+    };
+
+    mutable std::mutex mutex;
+    std::condition_variable ioDone; // a busy frame finished its I/O
+    std::unique_ptr<char[]> arena;
+    std::vector<Frame> frames;
+    std::vector<size_t> freeFrames;
+    std::unordered_map<uint64_t, size_t> pageTable;
+    std::unordered_map<uint32_t, OpenFile> files;
+    std::unique_ptr<EvictionPolicy> policy;
+    uint32_t nextFileId = 1;
+    size_t budgetBytes = 0;
+
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> misses{0};
+    std::atomic<uint64_t> evictions{0};
+    std::atomic<uint64_t> writebacks{0};
+
+    static uint64_t pageKey(uint32_t fileId, uint32_t pageNo)
+    {
+        return (static_cast<uint64_t>(fileId) << 32) | pageNo;
+    }
+
+    char *frameData(size_t frame) const { return arena.get() + frame * PAGE_SIZE; }
+
+    static std::unique_ptr<EvictionPolicy> makePolicy(const std::string &policyName)
+    {
+        if (policyName == "lru-k" || policyName == "lru-2" || policyName == "lruk")
+            return std::make_unique<LruKPolicy>(2);
+        return std::make_unique<ClockPolicy>();
+    }
+
+    BufferPool()
+    {
+        size_t megabytes = 64;
+        if (const char *env = std::getenv("NOSQLITE_BUFFER_POOL_MB"))
+        {
+            megabytes = std::max(1L, std::atol(env));
+        }
+        const char *policyEnv = std::getenv("NOSQLITE_EVICTION");
+        rebuild(megabytes * 1024 * 1024, makePolicy(policyEnv ? policyEnv : "clock"));
+    }
+
+    void rebuild(size_t budget, std::unique_ptr<EvictionPolicy> newPolicy)
+    {
+        size_t frameCount = std::max<size_t>(budget / PAGE_SIZE, 8);
+        budgetBytes = frameCount * PAGE_SIZE;
+        arena.reset(new char[budgetBytes]);
+        frames.assign(frameCount, Frame{});
+        freeFrames.clear();
+        for (size_t i = frameCount; i > 0; --i)
+            freeFrames.push_back(i - 1);
+        pageTable.clear();
+        policy = std::move(newPolicy);
+        policy->reset(frameCount);
+    }
+
+    static void writePage(const OpenFile &file, const char *data, uint32_t pageNo)
+    {
+        ssize_t written = ::pwrite(file.fd, data, PAGE_SIZE, static_cast<off_t>(pageNo) * PAGE_SIZE);
+        if (written != static_cast<ssize_t>(PAGE_SIZE))
+            throw std::runtime_error("Failed to write page to " + file.path);
+        Metrics::instance().bytesWritten(PAGE_SIZE);
+    }
+
+    void writeBack(size_t frame)
+    {
+        Frame &f = frames[frame];
+        auto it = files.find(f.fileId);
+        if (it == files.end())
+            return;
+        writePage(it->second, frameData(frame), f.pageNo);
+        f.dirty = false;
+        ++writebacks;
+    }
+
+    // Take a free frame or evict one. A dirty victim is written back with
+    // the mutex released; it stays busy, and so unpinnable, until then.
+    size_t acquireFrame(std::unique_lock<std::mutex> &lock)
+    {
+        if (!freeFrames.empty())
+        {
+            size_t frame = freeFrames.back();
+            freeFrames.pop_back();
+            return frame;
+        }
+
+        size_t victim;
+        bool found = policy->pickVictim([this](size_t frame)
+                                        { return frames[frame].pinCount == 0 && !frames[frame].busy; },
+                                        victim);
+        if (!found)
+            throw std::runtime_error("Buffer pool exhausted: all frames are pinned");
+
+        auto file = files.find(frames[victim].fileId);
+        if (frames[victim].dirty && file != files.end())
+        {
+            OpenFile target = file->second;
+            uint32_t pageNo = frames[victim].pageNo;
+            frames[victim].busy = true;
+            lock.unlock();
+            try
+            {
+                writePage(target, frameData(victim), pageNo);
+            }
+            catch (...)
+            {
+                lock.lock();
+                frames[victim].busy = false;
+                ioDone.notify_all();
+                throw;
+            }
+            lock.lock();
+            frames[victim].busy = false;
+            frames[victim].dirty = false;
+            ++writebacks;
+            // Fetchers of the page waited on busy and cannot run before
+            // the mutex is released again, so it is still unpinned
+            ioDone.notify_all();
+        }
+
+        Frame &f = frames[victim];
+        pageTable.erase(pageKey(f.fileId, f.pageNo));
+        policy->recordEvict(victim);
+        f = Frame{};
+        ++evictions;
+        return victim;
+    }
+
+public:
+    BufferPool(const BufferPool &) = delete;
+    BufferPool &operator=(const BufferPool &) = delete;
+
+    static BufferPool &instance()
+    {
+        static BufferPool pool;
+        return pool;
+    }
+
+    // Change the memory budget and eviction policy. Dirty pages are written
+    // back first; fails while any page is pinned.
+    bool configure(size_t budget, const std::string &policyName)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const auto &f : frames)
+        {
+            if (f.valid && (f.pinCount > 0 || f.busy))
+                return false;
+        }
+        for (size_t frame = 0; frame < frames.size(); ++frame)
+        {
+            if (frames[frame].valid && frames[frame].dirty)
+                writeBack(frame);
+        }
+        rebuild(budget, makePolicy(policyName));
+        return true;
+    }
+
+    uint32_t openFile(const std::string &path)
+    {
+        int fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd < 0)
+            throw std::runtime_error("Failed to open file: " + path);
+        Metrics::instance().fileOpened();
+
+        std::lock_guard<std::mutex> lock(mutex);
+        uint32_t fileId = nextFileId++;
+        files[fileId] = OpenFile{fd, path};
+        return fileId;
+    }
+
+    // Write back and drop every cached page of the file, then close it
+    void closeFile(uint32_t fileId)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        auto it = files.find(fileId);
+        if (it == files.end())
+            return;
+        // The descriptor stays open until no write-back is using it
+        ioDone.wait(lock, [this, fileId]
+                    { return std::none_of(frames.begin(), frames.end(), [fileId](const Frame &f)
+                                          { return f.busy && f.fileId == fileId; }); });
+
+        for (size_t frame = 0; frame < frames.size(); ++frame)
+        {
+            Frame &f = frames[frame];
+            if (!f.valid || f.fileId != fileId)
+                continue;
+            if (f.dirty)
+                writeBack(frame);
+            pageTable.erase(pageKey(f.fileId, f.pageNo));
+            policy->recordEvict(frame);
+            f = Frame{};
+            freeFrames.push_back(frame);
+        }
+        ::close(it->second.fd);
+        files.erase(it);
+    }
+
+    void flushFile(uint32_t fileId)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t frame = 0; frame < frames.size(); ++frame)
+        {
+            if (frames[frame].valid && frames[frame].fileId == fileId && frames[frame].dirty)
+                writeBack(frame);
+        }
+    }
+
+    // Write back the file's dirty pages and force them to stable storage
+    void syncFile(uint32_t fileId)
+    {
+        flushFile(fileId);
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = files.find(fileId);
+        if (it != files.end() && ::fdatasync(it->second.fd) != 0)
+            throw std::runtime_error("Failed to sync " + it->second.path);
+    }
+
+    // Pin a page and return its frame memory. Pages past the end of the
+    // file come back zero-filled, which is how new pages are allocated.
+    char *fetchPage(uint32_t fileId, uint32_t pageNo)
+    {
+        uint64_t key = pageKey(fileId, pageNo);
+        std::unique_lock<std::mutex> lock(mutex);
+        size_t frame;
+        while (true)
+        {
+            auto found = pageTable.find(key);
+            if (found != pageTable.end())
+            {
+                // Being read in or written back: look again once it is done
+                if (frames[found->second].busy)
+                {
+                    ioDone.wait(lock);
+                    continue;
+                }
+                ++hits;
+                frames[found->second].pinCount++;
+                policy->recordAccess(found->second);
+                return frameData(found->second);
+            }
+
+            if (files.find(fileId) == files.end())
+                throw std::runtime_error("Page requested for unknown file");
+            frame = acquireFrame(lock);
+            // A write-back released the mutex: another fetcher may have
+            // started reading the same page, or the file may be closed
+            if (pageTable.find(key) == pageTable.end() && files.find(fileId) != files.end())
+                break;
+            freeFrames.push_back(frame);
+        }
+
+        ++misses;
+        OpenFile file = files.find(fileId)->second;
+        frames[frame] = Frame{fileId, pageNo, 1, false, true, true};
+        pageTable[key] = frame;
+        policy->recordAccess(frame);
+
+        char *data = frameData(frame);
+        lock.unlock();
+        ssize_t bytes = ::pread(file.fd, data, PAGE_SIZE, static_cast<off_t>(pageNo) * PAGE_SIZE);
+        lock.lock();
+        if (bytes < 0)
+        {
+            pageTable.erase(key);
+            policy->recordEvict(frame);
+            frames[frame] = Frame{};
+            freeFrames.push_back(frame);
+            ioDone.notify_all();
+            throw std::runtime_error("Failed to read page from " + file.path);
+        }
+        Metrics::instance().bytesRead(static_cast<uint64_t>(bytes));
+        if (bytes < static_cast<ssize_t>(PAGE_SIZE))
+            std::memset(data + bytes, 0, PAGE_SIZE - bytes);
+        frames[frame].busy = false;
+        ioDone.notify_all();
+        return data;
+    }
+
+    void unpinPage(uint32_t fileId, uint32_t pageNo, bool dirty)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = pageTable.find(pageKey(fileId, pageNo));
+        if (found == pageTable.end())
+            return;
+        Frame &f = frames[found->second];
+        if (f.pinCount > 0)
+            f.pinCount--;
+        f.dirty = f.dirty || dirty;
+    }
+
+    BufferPoolStats stats() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return BufferPoolStats{hits.load(), misses.load(), evictions.load(), writebacks.load(),
+                               frames.size(), budgetBytes, policy->name()};
+    }
+};
+
+// RAII pin on one page: unpins (and records dirtiness) when it goes out of scope
+class PageGuard
+{
+private:
+    uint32_t fileId;
+    uint32_t pageNo;
+    char *data;
+    bool dirty = false;
+
+public:
+    PageGuard(uint32_t file, uint32_t page)
+        : fileId(file), pageNo(page), data(BufferPool::instance().fetchPage(file, page)) {}
+
+    ~PageGuard() { BufferPool::instance().unpinPage(fileId, pageNo, dirty); }
+
+    PageGuard(const PageGuard &) = delete;
+    PageGuard &operator=(const PageGuard &) = delete;
+
+    char *get() { return data; }
+    const char *get() const { return data; }
+    void markDirty() { dirty = true; }
+};
+
+#endif // BUFFERPOOL_H
@@ -0,0 +1,230 @@
+#ifndef CATALOG_H
+#define CATALOG_H
+
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "page.h"
+#include "types.h"
+#include "table.h"
+
+// What a database knows about one of its tables without opening it
+struct CatalogEntry
+{
+    std::string name;
+    TableEngine engine = TableEngine::Heap;
+    uint32_t formatVersion = TABLE_FORMAT_VERSION;
+    uint64_t rowCount = 0; // as of the last checkpoint
+    std::vector<std::string> columns;
+    std::vector<ColumnType> types;
+    std::vector<std::pair<std::string, std::string>> indexes; // name, column
+
+    static CatalogEntry describe(const Table &table)
+    {
+        CatalogEntry entry;
+        entry.name = table.getName();
+        entry.engine = table.getEngine();
+        entry.formatVersion = table.getFormatVersion();
+        entry.rowCount = table.getRowCount();
+        entry.columns = table.getSchema();
+        entry.types = table.getTypes();
+        entry.indexes = table.getIndexes();
+        return entry;
+    }
+};
+
+// Binary catalog of a database's tables (<db>/catalog), read once at open
+// through a private mapping so a database with thousands of tables opens
+// without touching a single table file:
+//
+//   magic | u32 version | u64 last unique_id | u32 table count, then per
+//   table name | u8 engine | u32 format version | u64 row count |
+//   u16 columns, each name | u8 kind | u16 length |
+//   u16 indexes, each name | column
+//
+// Strings are a u16 length followed by the bytes. The file is replaced
+// atomically whenever a table is created, dropped or indexed, and at
+// every checkpoint to refresh the row counts and the last unique_id
+// handed out, which a restart must not hand out again. Version 1 catalogs
+// have no last unique_id.
+namespace Catalog
+{
+    constexpr char MAGIC[8] = {'N', 'S', 'Q', 'L', 'C', 'A', 'T', '\0'};
+    constexpr uint32_t VERSION = 2;
+
+    inline void appendString(std::string &out, const std::string &value)
+    {
+        char length[sizeof(uint16_t)];
+        putValue(length, static_cast<uint16_t>(value.size()));
+        out.append(length, sizeof(length));
+        out += value;
+    }
+
+    template <typename T>
+    inline void appendValue(std::string &out, T value)
+    {
+        char bytes[sizeof(T)];
+        putValue(bytes, value);
+        out.append(bytes, sizeof(T));
+    }
+
+    // False if the file is missing or damaged
+    inline bool load(const std::string &path, std::vector<CatalogEntry> &entries, uint64_t &lastId)
+    {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat st;
+        if (::fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(MAGIC) + 2 * sizeof(uint32_t)))
+        {
+            ::close(fd);
+            return false;
+        }
+        size_t size = static_cast<size_t>(st.st_size);
+        void *mapped = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (mapped == MAP_FAILED)
+            return false;
+
+        const char *in = static_cast<const char *>(mapped);
+        const char *end = in + size;
+        bool ok = true;
+        auto need = [&in, end, &ok](size_t bytes)
+        {
+            ok = ok && static_cast<size_t>(end - in) >= bytes;
+            return ok;
+        };
+        auto readString = [&in, &need]()
+        {
+            std::string value;
+            if (!need(sizeof(uint16_t)))
+                return value;
+            uint16_t length = getValue<uint16_t>(in);
+            in += sizeof(uint16_t);
+            if (need(length))
+            {
+                value.assign(in, length);
+                in += length;
+            }
+            return value;
+        };
+        auto readU8 = [&in, &need]()
+        {
+            return need(1) ? static_cast<uint8_t>(*in++) : uint8_t(0);
+        };
+
+        entries.clear();
+        lastId = 0;
+        uint32_t version = getValue<uint32_t>(in + sizeof(MAGIC));
+        ok = std::memcmp(in, MAGIC, sizeof(MAGIC)) == 0 && version >= 1 && version <= VERSION;
+        in += sizeof(MAGIC) + sizeof(uint32_t);
+        if (ok && version >= 2 && need(sizeof(uint64_t)))
+        {
+            lastId = getValue<uint64_t>(in);
+            in += sizeof(uint64_t);
+        }
+        uint32_t count = ok && need(sizeof(uint32_t)) ? getValue<uint32_t>(in) : 0;
+        in += sizeof(uint32_t);
+        for (uint32_t i = 0; ok && i < count; ++i)
+        {
+            CatalogEntry entry;
+            entry.name = readString();
+            entry.engine = static_cast<TableEngine>(readU8());
+            if (!need(sizeof(uint32_t) + sizeof(uint64_t) + sizeof(uint16_t)))
+                break;
+            entry.formatVersion = getValue<uint32_t>(in);
+            entry.rowCount = getValue<uint64_t>(in + sizeof(uint32_t));
+            uint16_t columns = getValue<uint16_t>(in + sizeof(uint32_t) + sizeof(uint64_t));
+            in += sizeof(uint32_t) + sizeof(uint64_t) + sizeof(uint16_t);
+            for (uint16_t c = 0; ok && c < columns; ++c)
+            {
+                entry.columns.push_back(readString());
+                ColumnType type;
+                type.kind = static_cast<ColumnKind>(readU8());
+                if (need(sizeof(uint16_t)))
+                {
+                    type.length = getValue<uint16_t>(in);
+                    in += sizeof(uint16_t);
+                }
+                entry.types.push_back(type);
+            }
+            if (!need(sizeof(uint16_t)))
+                break;
+            uint16_t indexes = getValue<uint16_t>(in);
+            in += sizeof(uint16_t);
+            for (uint16_t x = 0; ok && x < indexes; ++x)
+            {
+                std::string indexName = readString();
+                entry.indexes.emplace_back(indexName, readString());
+            }
+            entries.push_back(std::move(entry));
+        }
+
+        ::munmap(mapped, size);
+        return ok;
+    }
+
+    inline bool save(const std::string &path, const std::vector<CatalogEntry> &entries, uint64_t lastId)
+    {
+        std::string data(MAGIC, sizeof(MAGIC));
+        appendValue(data, VERSION);
+        appendValue(data, lastId);
+        appendValue(data, static_cast<uint32_t>(entries.size()));
+        for (const auto &entry : entries)
+        {
+            appendString(data, entry.name);
+            appendValue(data, static_cast<uint8_t>(entry.engine));
+            appendValue(data, entry.formatVersion);
+            appendValue(data, entry.rowCount);
+            appendValue(data, static_cast<uint16_t>(entry.columns.size()));
+            for (size_t c = 0; c < entry.columns.size(); ++c)
+            {
+                appendString(data, entry.columns[c]);
+                appendValue(data, static_cast<uint8_t>(entry.types[c].kind));
+                appendValue(data, entry.types[c].length);
+            }
+            appendValue(data, static_cast<uint16_t>(entry.indexes.size()));
+            for (const auto &[indexName, column] : entry.indexes)
+            {
+                appendString(data, indexName);
+                appendString(data, column);
+            }
+        }
+
+        std::string tmpPath = path + ".tmp";
+        int fd = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+            return false;
+        size_t done = 0;
+        while (done < data.size())
+        {
+            ssize_t written = ::write(fd, data.data() + done, data.size() - done);
+            if (written < 0)
+            {
+                ::close(fd);
+                return false;
+            }
+            done += static_cast<size_t>(written);
+        }
+        bool synced = ::fdatasync(fd) == 0;
+        ::close(fd);
+        std::error_code error;
+        if (synced)
+            std::filesystem::rename(tmpPath, path, error);
+        if (!synced || error)
+        {
+            std::filesystem::remove(tmpPath, error);
+            return false;
+        }
+        return true;
+    }
+}
+
+#endif // CATALOG_H
@@ -3,8 +3,15 @@
 
 #include <string>
 #include <vector>
+#include <set>
+#include <algorithm>
+#include <atomic>
 #include <memory>
+#include <mutex>
+#include <unordered_map>
 #include "table.h"
+#include "catalog.h"
+#include "wal.h"
 #include <filesystem>
 #include <fstream>
 #include <iostream>
@@ -12,34 +19,118 @@
 class Database
 {
 private:
+    // A table the catalog knows about, opened on first use
+    struct TableSlot
+    {
+        CatalogEntry entry;
+        std::shared_ptr<Table> table;
+        bool rollbackPending = false; // recovery left state for the first open
+        TableCheckpoint rollback{};
+    };
+
     std::string name;
     std::string owner;
-    std::vector<std::shared_ptr<Table>> tables;
+    std::unordered_map<std::string, TableSlot> tables;
     std::string basePath;
+    std::unique_ptr<WriteAheadLog> wal;
+    bool recovering = false;
+
+    // Changes whenever a table or index is created or dropped. Versions
+    // come from one process-wide counter, so no two databases share one.
+    std::atomic<uint64_t> schemaVersion{nextSchemaVersion()};
+
+    // Guards the table map; sessions of a server share one Database
+    mutable std::recursive_mutex tablesMutex;
+
+    // Checkpoint once the log grows past this size
+    static constexpr uint64_t CHECKPOINT_LOG_BYTES = 64ull * 1024 * 1024;
+
+    static uint64_t nextSchemaVersion()
+    {
+        static std::atomic<uint64_t> counter{0};
+        return ++counter;
+    }
 
 public:
     Database(const std::string &dbName, const std::string &ownerName)
         : name(dbName), owner(ownerName)
     {
         basePath = "database/" + owner + "/" + name + "/";
-        loadExistingTables();
+        std::filesystem::create_directories(basePath);
+        loadCatalog();
+        recover();
+    }
+
+    Database(const Database &) = delete;
+    Database &operator=(const Database &) = delete;
+
+    ~Database()
+    {
+        try
+        {
+            checkpoint();
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Error checkpointing database " << name << ": " << e.what() << std::endl;
+        }
+    }
+
+    // The process-wide instance of a database, opened on first request, so
+    // every session working on it shares tables, indexes and the log
+    static std::shared_ptr<Database> open(const std::string &dbName, const std::string &ownerName)
+    {
+        static std::mutex registryMutex;
+        static std::unordered_map<std::string, std::weak_ptr<Database>> registry;
+
+        std::lock_guard<std::mutex> lock(registryMutex);
+        std::weak_ptr<Database> &slot = registry[ownerName + "/" + dbName];
+        auto db = slot.lock();
+        if (!db)
+        {
+            db = std::make_shared<Database>(dbName, ownerName);
+            slot = db;
+        }
+        return db;
     }
 
     const std::string &getName() const { return name; }
     const std::string &getOwner() const { return owner; }
-    const std::vector<std::shared_ptr<Table>> &getTables() const { return tables; }
 
-    bool createTable(const std::string &tableName, const std::vector<std::string> &schema)
+    // Plans chosen under one version stay valid until it changes
+    uint64_t getSchemaVersion() const { return schemaVersion.load(); }
+
+    // Catalog entries of every table, by name, without opening any of them
+    std::vector<CatalogEntry> listTables() const
     {
+        std::lock_guard<std::recursive_mutex> lock(tablesMutex);
+        std::vector<CatalogEntry> entries;
+        for (const auto &[tableName, slot] : tables)
+            entries.push_back(slot.entry);
+        std::sort(entries.begin(), entries.end(), [](const CatalogEntry &a, const CatalogEntry &b)
+                  { return a.name < b.name; });
+        return entries;
+    }
+
+    bool createTable(const std::string &tableName, const std::vector<std::string> &schema,
+                     const std::vector<ColumnType> &types = {}, TableEngine engine = TableEngine::Heap)
+    {
+        std::lock_guard<std::recursive_mutex> lock(tablesMutex);
         try
         {
             std::filesystem::create_directories(basePath);
 
-            auto newTable = std::make_shared<Table>(tableName, schema, basePath);
+            auto newTable = std::make_shared<Table>(tableName, schema, basePath, types, engine);
 
             if (newTable->initialize())
             {
-                tables.push_back(newTable);
+                newTable->attachLog(wal.get());
+                TableSlot &slot = tables[tableName];
+                slot = TableSlot{};
+                slot.entry = CatalogEntry::describe(*newTable);
+                slot.table = newTable;
+                schemaVersion = nextSchemaVersion();
+                saveCatalog();
                 return true;
             }
             return false;
@@ -51,32 +142,279 @@ public:
         }
     }
 
+    // Remove a table and its files. The log restarts from a checkpoint so a
+    // table recreated under the same name never sees the dropped table's
+    // inserts replayed into it.
+    bool dropTable(const std::string &tableName)
+    {
+        std::lock_guard<std::recursive_mutex> lock(tablesMutex);
+        auto table = getTable(tableName);
+        if (!table)
+            return false;
+        {
+            // Writers in other sessions finish, or find the table closed
+            auto writer = table->lockWrites();
+            table->dropFiles();
+        }
+        tables.erase(tableName);
+        schemaVersion = nextSchemaVersion();
+        saveCatalog();
+        checkpoint();
+        return true;
+    }
+
+    bool createIndex(const std::string &tableName, const std::string &indexName, const std::string &column)
+    {
+        std::lock_guard<std::recursive_mutex> lock(tablesMutex);
+        auto table = getTable(tableName);
+        if (!table || !table->createIndex(indexName, column))
+            return false;
+        tables[tableName].entry.indexes = table->getIndexes();
+        schemaVersion = nextSchemaVersion();
+        saveCatalog();
+        return true;
+    }
+
+    void setDurability(const DurabilityConfig &config) { wal->setDurability(config); }
+    DurabilityConfig getDurability() const { return wal->getDurability(); }
+
+    // Make every open table durable, then restart the log from a checkpoint
+    // record describing where each table ends. Tables never opened keep the
+    // state they were left in, including one recovery still has to apply.
+    void checkpoint()
+    {
+        std::lock_guard<std::recursive_mutex> lock(tablesMutex);
+        if (!wal)
+            return;
+
+        // A table created after the last checkpoint and untouched by the log
+        // has no recorded state: only its files know where it ends
+        std::vector<std::string> unknown;
+        for (const auto &[tableName, slot] : tables)
+        {
+            if (!slot.table && !slot.rollbackPending)
+                unknown.push_back(tableName);
+        }
+        for (const auto &tableName : unknown)
+            getTable(tableName);
+
+        // Writers stay out until the log restarts, so no commit falls
+        // between a table's recorded state and the truncation
+        std::vector<std::unique_lock<std::mutex>> writers;
+        for (auto &[tableName, slot] : tables)
+        {
+            if (slot.table)
+                writers.push_back(slot.table->lockWrites());
+        }
+
+        std::vector<TableCheckpoint> states;
+        for (auto &[tableName, slot] : tables)
+        {
+            if (slot.table)
+            {
+                slot.table->sync();
+                states.push_back(slot.table->checkpointState());
+                slot.entry.rowCount = slot.table->getRowCount();
+            }
+            else if (slot.rollbackPending)
+            {
+                states.push_back(slot.rollback);
+                slot.entry.rowCount = slot.rollback.rowCount;
+            }
+            // A table that failed to open stays out of the checkpoint: its
+            // files remain its baseline and the catalog keeps its row count
+        }
+        // The catalog's last unique_id must cover the rows whose inserts
+        // the truncated log held, so it reaches disk first
+        saveCatalog();
+        wal->checkpoint(states);
+    }
+
+    void maybeCheckpoint()
+    {
+        if (wal && wal->sizeBytes() > CHECKPOINT_LOG_BYTES)
+            checkpoint();
+    }
+
+    // Open the table on first use. A table whose files have gone missing
+    // is dropped from the catalog; one that fails to load for any other
+    // reason keeps its entry and pending rollback so a later open can retry.
     std::shared_ptr<Table> getTable(const std::string &tableName)
     {
-        auto it = std::find_if(tables.begin(), tables.end(),
-                               [&tableName](const auto &table)
-                               {
-                                   return table->getName() == tableName;
-                               });
-        return (it != tables.end()) ? *it : nullptr;
+        std::lock_guard<std::recursive_mutex> lock(tablesMutex);
+        auto it = tables.find(tableName);
+        if (it == tables.end())
+            return nullptr;
+        TableSlot &slot = it->second;
+        if (slot.table)
+            return slot.table;
+
+        auto table = std::make_shared<Table>(tableName, std::vector<std::string>{}, basePath);
+        if (!table->load())
+        {
+            std::cerr << "Failed to open table " << tableName << " of " << name << std::endl;
+            if (!std::filesystem::exists(basePath + tableName + ".tbl") &&
+                !std::filesystem::exists(basePath + tableName + ".csv"))
+            {
+                tables.erase(it);
+                saveCatalog();
+            }
+            return nullptr;
+        }
+        slot.table = table;
+        if (slot.rollbackPending)
+        {
+            table->rollbackTo(slot.rollback);
+            slot.rollbackPending = false;
+        }
+        if (!recovering)
+        {
+            table->finishRecovery();
+            table->attachLog(wal.get());
+        }
+        return table;
     }
 
 private:
+    // Roll back to the last checkpoint and re-apply the logged changes after
+    // it. Only tables the log touches are opened here; the others keep the
+    // checkpointed state and roll back to it when first opened. Tables
+    // missing from the checkpoint were created later, so their baseline is
+    // empty.
+    void recover()
+    {
+        wal = std::make_unique<WriteAheadLog>(basePath + "wal.log");
+        recovering = true;
+
+        std::set<std::string> rolledBack;
+        auto rollback = [this, &rolledBack](const TableCheckpoint &state)
+        {
+            rolledBack.insert(state.table);
+            auto it = tables.find(state.table);
+            if (it == tables.end())
+                return;
+            if (it->second.table)
+            {
+                it->second.table->rollbackTo(state);
+            }
+            else
+            {
+                it->second.rollbackPending = true;
+                it->second.rollback = state;
+            }
+        };
+
+        uint64_t replayed = 0;
+        WalReplayHandler handler;
+        handler.onCheckpoint = [&rollback](const std::vector<TableCheckpoint> &states)
+        {
+            for (const auto &state : states)
+                rollback(state);
+        };
+        handler.onInsert = [this, &rollback, &rolledBack, &replayed](const std::string &tableName, std::string_view record)
+        {
+            if (rolledBack.count(tableName) == 0)
+                rollback(TableCheckpoint{tableName, 1, 0, 0, 0, 0});
+            auto table = getTable(tableName);
+            if (table && table->replayInsert(record))
+                ++replayed;
+        };
+        handler.onDelete = [this, &replayed](const std::string &tableName, RowId rid)
+        {
+            auto table = getTable(tableName);
+            if (!table)
+                return;
+            table->replayDelete(rid);
+            ++replayed;
+        };
+        handler.onDeleteKey = [this, &replayed](const std::string &tableName, const std::string &id)
+        {
+            auto table = getTable(tableName);
+            if (!table)
+                return;
+            table->replayDeleteKey(id);
+            ++replayed;
+        };
+        wal->replay(handler);
+
+        if (replayed > 0)
+        {
+            std::cout << "Recovered " << replayed << " rows from the log of " << name << std::endl;
+        }
+
+        recovering = false;
+        for (auto &[tableName, slot] : tables)
+        {
+            if (slot.table)
+            {
+                slot.table->finishRecovery();
+                slot.table->attachLog(wal.get());
+            }
+        }
+        checkpoint();
+    }
+
+    std::string catalogPath() const { return basePath + "catalog"; }
+
+    void saveCatalog()
+    {
+        std::vector<CatalogEntry> entries;
+        entries.reserve(tables.size());
+        for (const auto &[tableName, slot] : tables)
+            entries.push_back(slot.entry);
+        if (!Catalog::save(catalogPath(), entries, IdGenerator::instance().lastIssued()))
+            std::cerr << "Failed to write the catalog of " << name << std::endl;
+    }
+
+    void loadCatalog()
+    {
+        std::vector<CatalogEntry> entries;
+        uint64_t lastId = 0;
+        if (Catalog::load(catalogPath(), entries, lastId))
+        {
+            IdGenerator::instance().advancePast(lastId);
+            tables.reserve(entries.size());
+            for (auto &entry : entries)
+            {
+                std::string tableName = entry.name;
+                tables[tableName].entry = std::move(entry);
+            }
+            return;
+        }
+
+        // First open since the catalog was introduced, or a damaged one:
+        // open every table once and describe it
+        loadExistingTables();
+        saveCatalog();
+    }
+
     void loadExistingTables()
     {
         if (!std::filesystem::exists(basePath))
             return;
 
+        // Collect names first: converting a legacy .csv table creates and
+        // removes files, which must not race with the directory iteration.
+        // Paged tables use .tbl; a .csv without a .tbl next to it is a legacy
+        // table that load() converts on first open.
+        std::set<std::string> tableNames;
         for (const auto &entry : std::filesystem::directory_iterator(basePath))
         {
-            if (entry.is_regular_file() && entry.path().extension() == ".csv")
+            auto extension = entry.path().extension();
+            if (entry.is_regular_file() && (extension == ".tbl" || extension == ".csv"))
+            {
+                tableNames.insert(entry.path().stem().string());
+            }
+        }
+
+        for (const auto &tableName : tableNames)
+        {
+            auto table = std::make_shared<Table>(tableName, std::vector<std::string>{}, basePath);
+            if (table->load())
             {
-                std::string tableName = entry.path().stem().string();
-                auto table = std::make_shared<Table>(tableName, std::vector<std::string>{}, basePath);
-                if (table->load())
-                {
-                    tables.push_back(table);
-                }
+                TableSlot &slot = tables[tableName];
+                slot.entry = CatalogEntry::describe(*table);
+                slot.table = table;
             }
         }
     }
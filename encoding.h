@@ -0,0 +1,791 @@
+#ifndef ENCODING_H
+#define ENCODING_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "page.h"
+#include "types.h"
+#include "filter.h"
+
+// Lightweight encodings for the blocks of LSM segments. Each column of a
+// block gets whichever of these is smallest for the values in it:
+//
+//   plain               values as stored
+//   dictionary          distinct strings once, sorted, then a bit-packed
+//                       code per row
+//   run length          one value per run of equal values, with the run
+//                       lengths
+//   frame of reference  integers as bit-packed offsets from the block
+//                       minimum
+//   delta               differences between neighbouring integers,
+//                       zigzagged and packed by frame of reference, so a
+//                       monotonic timestamp costs a few bits a row
+//
+// Fixed-width columns are handled as unsigned integers: their stored bytes
+// are big-endian and memcomparable (types.h), so integer order is stored
+// order and the integer encodings serve int32, int64, bool, timestamp and
+// double alike. Bit packing moves whole words and assumes a little-endian
+// host, as the page formats do.
+//
+// A block (its rows in key order, tombstones included) is laid out as
+//
+//   u16 rows | u8 has tombstones | tombstone bit per row, if it has any |
+//   keys, front coded | u16 columns | per column u8 encoding | values |
+//   BLOCK_PADDING zero bytes, so unpacking may read two words past any
+//   packed value
+//
+// where the columns hold live rows only. Keys are front coded: each one as
+// the length of the prefix it shares with the one before, then the rest.
+namespace ColumnCodec
+{
+    constexpr size_t BLOCK_PADDING = 2 * sizeof(uint64_t);
+
+    enum class Encoding : uint8_t
+    {
+        Plain = 0,
+        Dictionary = 1,
+        RunLength = 2,
+        FrameOfReference = 3,
+        Delta = 4
+    };
+
+    // Bits needed to hold value
+    inline uint8_t bitWidth(uint64_t value) { return value == 0 ? 0 : static_cast<uint8_t>(64 - __builtin_clzll(value)); }
+
+    inline size_t packedBytes(size_t count, uint8_t width) { return (count * width + 7) / 8; }
+
+    template <typename T>
+    inline void append(std::string &out, T value)
+    {
+        char bytes[sizeof(T)];
+        putValue(bytes, value);
+        out.append(bytes, sizeof(bytes));
+    }
+
+    template <typename T>
+    inline bool take(const char *&in, const char *end, T &value)
+    {
+        if (end - in < static_cast<std::ptrdiff_t>(sizeof(T)))
+            return false;
+        value = getValue<T>(in);
+        in += sizeof(T);
+        return true;
+    }
+
+    // Append count values of width bits each, lowest bits first; every
+    // value must fit in width bits
+    inline void packBits(const uint64_t *values, size_t count, uint8_t width, std::string &out)
+    {
+        if (width == 0 || count == 0)
+            return;
+        size_t start = out.size();
+        size_t bytes = packedBytes(count, width);
+        out.resize(start + bytes + sizeof(uint64_t), '\0'); // room to write whole words
+        char *base = out.data() + start;
+        size_t bit = 0;
+        for (size_t i = 0; i < count; ++i, bit += width)
+        {
+            char *at = base + bit / 8;
+            unsigned shift = bit % 8;
+            uint64_t word = getValue<uint64_t>(at);
+            putValue(at, word | (values[i] << shift));
+            if (shift + width > 64)
+                at[sizeof(uint64_t)] |= static_cast<char>(values[i] >> (64 - shift));
+        }
+        out.resize(start + bytes);
+    }
+
+    // Read count values of width bits each, adding base to every one
+    inline bool unpackBits(const char *&in, const char *end, size_t count, uint8_t width, uint64_t base,
+                           uint64_t *values)
+    {
+        size_t bytes = packedBytes(count, width);
+        if (width > 64 || static_cast<size_t>(end - in) < bytes)
+            return false;
+        if (width == 0)
+        {
+            std::fill(values, values + count, base);
+            return true;
+        }
+        uint64_t mask = width == 64 ? ~0ull : (1ull << width) - 1;
+        size_t bit = 0;
+        size_t i = 0;
+        if (static_cast<size_t>(end - in) >= bytes + BLOCK_PADDING)
+        {
+            // Every word read stays inside the buffer: no bounds checks
+            if (width <= 56)
+            {
+                for (; i < count; ++i, bit += width)
+                    values[i] = base + ((getValue<uint64_t>(in + bit / 8) >> (bit % 8)) & mask);
+            }
+            for (; i < count; ++i, bit += width)
+            {
+                unsigned shift = bit % 8;
+                uint64_t value = getValue<uint64_t>(in + bit / 8) >> shift;
+                if (shift + width > 64)
+                    value |= getValue<uint64_t>(in + bit / 8 + sizeof(uint64_t)) << (64 - shift);
+                values[i] = base + (value & mask);
+            }
+        }
+        for (; i < count; ++i, bit += width)
+        {
+            size_t byte = bit / 8;
+            unsigned shift = bit % 8;
+            char word[2 * sizeof(uint64_t)] = {};
+            std::memcpy(word, in + byte, std::min(sizeof(word), bytes - byte));
+            uint64_t value = getValue<uint64_t>(word) >> shift;
+            if (shift + width > 64)
+                value |= getValue<uint64_t>(word + sizeof(uint64_t)) << (64 - shift);
+            values[i] = base + (value & mask);
+        }
+        in += bytes;
+        return true;
+    }
+
+    // Frame of reference: u64 minimum | u8 width | offsets from the minimum
+    inline size_t frameSize(size_t count, uint64_t low, uint64_t high)
+    {
+        return sizeof(uint64_t) + 1 + packedBytes(count, bitWidth(high - low));
+    }
+
+    inline void encodeFrame(const std::vector<uint64_t> &values, std::string &out)
+    {
+        uint64_t low = values.empty() ? 0 : *std::min_element(values.begin(), values.end());
+        uint64_t high = values.empty() ? 0 : *std::max_element(values.begin(), values.end());
+        uint8_t width = bitWidth(high - low);
+        append(out, low);
+        out += static_cast<char>(width);
+        std::vector<uint64_t> offsets(values.size());
+        for (size_t i = 0; i < values.size(); ++i)
+            offsets[i] = values[i] - low;
+        packBits(offsets.data(), offsets.size(), width, out);
+    }
+
+    inline bool decodeFrame(const char *&in, const char *end, size_t count, std::vector<uint64_t> &values)
+    {
+        uint64_t low;
+        uint8_t width;
+        values.resize(count);
+        return take(in, end, low) && take(in, end, width) && unpackBits(in, end, count, width, low, values.data());
+    }
+
+    inline uint64_t zigzag(uint64_t delta) { return (delta << 1) ^ (static_cast<int64_t>(delta) < 0 ? ~0ull : 0); }
+    inline uint64_t unzigzag(uint64_t value) { return (value >> 1) ^ (0 - (value & 1)); }
+
+    // Values of a fixed-width column (as integers), chosen by size
+    inline void encodeFixed(const std::vector<uint64_t> &values, uint8_t width, std::string &out)
+    {
+        size_t count = values.size();
+        uint64_t low = ~0ull, high = 0;
+        uint64_t deltaLow = ~0ull, deltaHigh = 0;
+        size_t runs = 0;
+        for (size_t i = 0; i < count; ++i)
+        {
+            low = std::min(low, values[i]);
+            high = std::max(high, values[i]);
+            if (i == 0 || values[i] != values[i - 1])
+                ++runs;
+            if (i > 0)
+            {
+                uint64_t delta = zigzag(values[i] - values[i - 1]);
+                deltaLow = std::min(deltaLow, delta);
+                deltaHigh = std::max(deltaHigh, delta);
+            }
+        }
+
+        Encoding best = Encoding::Plain;
+        size_t bestSize = count * width;
+        auto consider = [&](Encoding encoding, size_t size)
+        {
+            if (size < bestSize)
+            {
+                best = encoding;
+                bestSize = size;
+            }
+        };
+        if (count > 0)
+        {
+            consider(Encoding::FrameOfReference, frameSize(count, low, high));
+            consider(Encoding::RunLength, sizeof(uint16_t) + frameSize(runs, low, high) + frameSize(runs, 1, count));
+        }
+        if (count > 1)
+            consider(Encoding::Delta, sizeof(uint64_t) + frameSize(count - 1, deltaLow, deltaHigh));
+
+        out += static_cast<char>(best);
+        switch (best)
+        {
+        case Encoding::FrameOfReference:
+            encodeFrame(values, out);
+            break;
+        case Encoding::RunLength:
+        {
+            std::vector<uint64_t> runValues, runLengths;
+            for (size_t i = 0; i < count; ++i)
+            {
+                if (i == 0 || values[i] != values[i - 1])
+                {
+                    runValues.push_back(values[i]);
+                    runLengths.push_back(0);
+                }
+                ++runLengths.back();
+            }
+            append(out, static_cast<uint16_t>(runs));
+            encodeFrame(runValues, out);
+            encodeFrame(runLengths, out);
+            break;
+        }
+        case Encoding::Delta:
+        {
+            std::vector<uint64_t> deltas(count - 1);
+            for (size_t i = 1; i < count; ++i)
+                deltas[i - 1] = zigzag(values[i] - values[i - 1]);
+            append(out, values[0]);
+            encodeFrame(deltas, out);
+            break;
+        }
+        default:
+            for (uint64_t value : values)
+                ValueCodec::putBigEndian(out, value, width);
+            break;
+        }
+    }
+
+    inline bool decodeFixed(const char *&in, const char *end, size_t count, uint8_t width,
+                            std::vector<uint64_t> &values)
+    {
+        uint8_t encoding;
+        if (!take(in, end, encoding))
+            return false;
+        switch (static_cast<Encoding>(encoding))
+        {
+        case Encoding::Plain:
+            if (static_cast<size_t>(end - in) < count * width)
+                return false;
+            values.resize(count);
+            for (size_t i = 0; i < count; ++i, in += width)
+                values[i] = ValueCodec::getBigEndian(std::string_view(in, width));
+            return true;
+        case Encoding::FrameOfReference:
+            return decodeFrame(in, end, count, values);
+        case Encoding::RunLength:
+        {
+            uint16_t runs;
+            std::vector<uint64_t> runValues, runLengths;
+            if (!take(in, end, runs) || !decodeFrame(in, end, runs, runValues) || !decodeFrame(in, end, runs, runLengths))
+                return false;
+            values.clear();
+            values.reserve(count);
+            for (size_t run = 0; run < runs; ++run)
+            {
+                if (runLengths[run] > count - values.size())
+                    return false;
+                values.insert(values.end(), runLengths[run], runValues[run]);
+            }
+            return values.size() == count;
+        }
+        case Encoding::Delta:
+        {
+            uint64_t first;
+            if (count == 0 || !take(in, end, first) || !decodeFrame(in, end, count - 1, values))
+                return false;
+            values.insert(values.begin(), first);
+            for (size_t i = 1; i < count; ++i)
+                values[i] = values[i - 1] + unzigzag(values[i]);
+            return true;
+        }
+        default:
+            return false;
+        }
+    }
+
+    // A varchar column as decoded: each row points at one of entries, which
+    // is every distinct value (dictionary), every run (run length) or every
+    // row (plain). A filter is evaluated once per entry.
+    struct Strings
+    {
+        std::vector<std::string_view> entries;
+        std::vector<uint32_t> codes; // entry of each row
+    };
+
+    // Lengths, then bytes, of a list of strings
+    inline void encodeStringList(const std::vector<std::string_view> &values, std::string &out)
+    {
+        std::vector<uint64_t> lengths;
+        for (auto value : values)
+            lengths.push_back(value.size());
+        encodeFrame(lengths, out);
+        for (auto value : values)
+            out += value;
+    }
+
+    inline bool decodeStringList(const char *&in, const char *end, size_t count, std::vector<std::string_view> &values)
+    {
+        std::vector<uint64_t> lengths;
+        if (!decodeFrame(in, end, count, lengths))
+            return false;
+        values.resize(count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (static_cast<uint64_t>(end - in) < lengths[i])
+                return false;
+            values[i] = std::string_view(in, lengths[i]);
+            in += lengths[i];
+        }
+        return true;
+    }
+
+    // Values of a varchar column, chosen by size
+    inline void encodeVarying(const std::vector<std::string_view> &values, std::string &out)
+    {
+        size_t count = values.size();
+        uint64_t shortest = ~0ull, longest = 0;
+        size_t bytes = 0, runs = 0, runBytes = 0;
+        std::unordered_map<std::string_view, uint32_t> distinct;
+        size_t distinctBytes = 0;
+        for (size_t i = 0; i < count; ++i)
+        {
+            shortest = std::min<uint64_t>(shortest, values[i].size());
+            longest = std::max<uint64_t>(longest, values[i].size());
+            bytes += values[i].size();
+            if (i == 0 || values[i] != values[i - 1])
+            {
+                ++runs;
+                runBytes += values[i].size();
+            }
+            if (distinct.emplace(values[i], 0).second)
+                distinctBytes += values[i].size();
+        }
+
+        Encoding best = Encoding::Plain;
+        size_t bestSize = count ? frameSize(count, shortest, longest) + bytes : 0;
+        auto consider = [&](Encoding encoding, size_t size)
+        {
+            if (size < bestSize)
+            {
+                best = encoding;
+                bestSize = size;
+            }
+        };
+        if (count > 0)
+        {
+            consider(Encoding::Dictionary, sizeof(uint16_t) + frameSize(distinct.size(), shortest, longest) +
+                                               distinctBytes + frameSize(count, 0, distinct.size() - 1));
+            consider(Encoding::RunLength, sizeof(uint16_t) + frameSize(runs, 1, count) +
+                                              frameSize(runs, shortest, longest) + runBytes);
+        }
+
+        out += static_cast<char>(best);
+        switch (best)
+        {
+        case Encoding::Dictionary:
+        {
+            std::vector<std::string_view> dictionary;
+            for (const auto &[value, code] : distinct)
+                dictionary.push_back(value);
+            std::sort(dictionary.begin(), dictionary.end());
+            for (size_t code = 0; code < dictionary.size(); ++code)
+                distinct[dictionary[code]] = static_cast<uint32_t>(code);
+            std::vector<uint64_t> codes;
+            for (auto value : values)
+                codes.push_back(distinct[value]);
+            append(out, static_cast<uint16_t>(dictionary.size()));
+            encodeStringList(dictionary, out);
+            encodeFrame(codes, out);
+            break;
+        }
+        case Encoding::RunLength:
+        {
+            std::vector<std::string_view> runValues;
+            std::vector<uint64_t> runLengths;
+            for (size_t i = 0; i < count; ++i)
+            {
+                if (i == 0 || values[i] != values[i - 1])
+                {
+                    runValues.push_back(values[i]);
+                    runLengths.push_back(0);
+                }
+                ++runLengths.back();
+            }
+            append(out, static_cast<uint16_t>(runs));
+            encodeFrame(runLengths, out);
+            encodeStringList(runValues, out);
+            break;
+        }
+        default:
+            encodeStringList(values, out);
+            break;
+        }
+    }
+
+    inline bool decodeVarying(const char *&in, const char *end, size_t count, Strings &column)
+    {
+        uint8_t encoding;
+        if (!take(in, end, encoding))
+            return false;
+        column.codes.resize(count);
+        switch (static_cast<Encoding>(encoding))
+        {
+        case Encoding::Plain:
+            for (size_t i = 0; i < count; ++i)
+                column.codes[i] = static_cast<uint32_t>(i);
+            return decodeStringList(in, end, count, column.entries);
+        case Encoding::Dictionary:
+        {
+            uint16_t entries;
+            std::vector<uint64_t> codes;
+            if (!take(in, end, entries) || !decodeStringList(in, end, entries, column.entries) ||
+                !decodeFrame(in, end, count, codes))
+                return false;
+            for (size_t i = 0; i < count; ++i)
+            {
+                if (codes[i] >= entries)
+                    return false;
+                column.codes[i] = static_cast<uint32_t>(codes[i]);
+            }
+            return true;
+        }
+        case Encoding::RunLength:
+        {
+            uint16_t runs;
+            std::vector<uint64_t> runLengths;
+            if (!take(in, end, runs) || !decodeFrame(in, end, runs, runLengths) ||
+                !decodeStringList(in, end, runs, column.entries))
+                return false;
+            size_t row = 0;
+            for (size_t run = 0; run < runs; ++run)
+            {
+                if (runLengths[run] > count - row)
+                    return false;
+                std::fill_n(column.codes.begin() + row, runLengths[run], static_cast<uint32_t>(run));
+                row += runLengths[run];
+            }
+            return row == count;
+        }
+        default:
+            return false;
+        }
+    }
+
+    // Encode the entries of one block whose values are records of format.
+    // False if this block cannot be laid out by column.
+    inline bool encodeBlock(const RowFormat &format, const std::vector<std::string_view> &keys,
+                            const std::vector<bool> &tombstones, const std::vector<std::string_view> &records,
+                            std::string &out)
+    {
+        const std::vector<ColumnType> &types = format.getTypes();
+        size_t rows = keys.size();
+        if (format.isLegacy() || rows == 0 || rows > UINT16_MAX || types.size() > UINT16_MAX)
+            return false;
+
+        out.clear();
+        append(out, static_cast<uint16_t>(rows));
+        bool anyTombstone = std::find(tombstones.begin(), tombstones.end(), true) != tombstones.end();
+        out += static_cast<char>(anyTombstone ? 1 : 0);
+        if (anyTombstone)
+        {
+            std::vector<uint64_t> bits(tombstones.begin(), tombstones.end());
+            packBits(bits.data(), rows, 1, out);
+        }
+
+        std::vector<uint64_t> shared(rows), suffixLengths(rows);
+        for (size_t i = 0; i < rows; ++i)
+        {
+            size_t prefix = 0;
+            if (i > 0)
+            {
+                size_t limit = std::min(keys[i].size(), keys[i - 1].size());
+                while (prefix < limit && keys[i][prefix] == keys[i - 1][prefix])
+                    ++prefix;
+            }
+            shared[i] = prefix;
+            suffixLengths[i] = keys[i].size() - prefix;
+        }
+        encodeFrame(shared, out);
+        encodeFrame(suffixLengths, out);
+        for (size_t i = 0; i < rows; ++i)
+            out += keys[i].substr(shared[i]);
+
+        append(out, static_cast<uint16_t>(types.size()));
+        std::vector<uint64_t> fixed;
+        std::vector<std::string_view> varying;
+        for (size_t column = 0; column < types.size(); ++column)
+        {
+            fixed.clear();
+            varying.clear();
+            for (size_t i = 0; i < rows; ++i)
+            {
+                if (tombstones[i])
+                    continue;
+                std::string_view field = format.field(records[i], column + 1);
+                if (types[column].isFixed())
+                    fixed.push_back(ValueCodec::getBigEndian(field));
+                else
+                    varying.push_back(field);
+            }
+            if (types[column].isFixed())
+                encodeFixed(fixed, static_cast<uint8_t>(types[column].width()), out);
+            else
+                encodeVarying(varying, out);
+        }
+        out.append(BLOCK_PADDING, '\0');
+        return true;
+    }
+
+    // One block's columns as decoded, live rows only
+    struct DecodedColumns
+    {
+        std::vector<std::vector<uint64_t>> fixed; // by column; empty for varchar
+        std::vector<Strings> varying;             // by column; empty for fixed
+        std::vector<uint32_t> liveRows;           // block row of each live row
+    };
+
+    inline bool fixedMatches(const Filter &filter, uint64_t value, const std::vector<uint64_t> &keys)
+    {
+        switch (filter.kind)
+        {
+        case Filter::Kind::In:
+            return std::find(keys.begin(), keys.end(), value) != keys.end();
+        case Filter::Kind::Between:
+            return value >= keys[0] && value <= keys[1];
+        default:
+            if (value == keys[0])
+                return compareMatches(filter.op, 0);
+            return compareMatches(filter.op, value < keys[0] ? -1 : 1);
+        }
+    }
+
+    // Set bit i of selected (zeroed, one word per 64 live rows) for each
+    // live row i that passes filter, reading the encoded columns: a varchar
+    // test runs once per dictionary entry or run, a fixed-width one on
+    // integers. Tests this cannot decide pass every row.
+    inline void selectRows(const Filter &filter, const RowFormat &format, const DecodedColumns &columns,
+                           const std::vector<std::string_view> &keys, std::vector<uint64_t> &selected)
+    {
+        size_t live = columns.liveRows.size();
+        auto setAll = [&]()
+        {
+            std::fill(selected.begin(), selected.end(), ~0ull);
+            if (live % 64 != 0 && !selected.empty())
+                selected.back() = (1ull << (live % 64)) - 1;
+        };
+
+        if (filter.kind == Filter::Kind::And || filter.kind == Filter::Kind::Or)
+        {
+            bool isAnd = filter.kind == Filter::Kind::And;
+            if (isAnd)
+                setAll();
+            std::vector<uint64_t> child(selected.size());
+            for (const auto &operand : filter.children)
+            {
+                std::fill(child.begin(), child.end(), 0);
+                selectRows(operand, format, columns, keys, child);
+                for (size_t w = 0; w < selected.size(); ++w)
+                    selected[w] = isAnd ? selected[w] & child[w] : selected[w] | child[w];
+            }
+            return;
+        }
+
+        const std::vector<ColumnType> &types = format.getTypes();
+        if (filter.position == 0)
+        {
+            for (size_t i = 0; i < live; ++i)
+            {
+                if (fieldMatches(filter, keys[columns.liveRows[i]]))
+                    selected[i / 64] |= 1ull << (i % 64);
+            }
+            return;
+        }
+        size_t column = filter.position - 1;
+        if (column >= types.size())
+        {
+            setAll();
+            return;
+        }
+
+        if (!types[column].isFixed())
+        {
+            const Strings &strings = columns.varying[column];
+            std::vector<char> matches(strings.entries.size());
+            for (size_t e = 0; e < strings.entries.size(); ++e)
+                matches[e] = fieldMatches(filter, strings.entries[e]);
+            for (size_t i = 0; i < live; ++i)
+            {
+                if (matches[strings.codes[i]])
+                    selected[i / 64] |= 1ull << (i % 64);
+            }
+            return;
+        }
+
+        std::vector<uint64_t> constants;
+        for (const auto &key : filter.keys)
+        {
+            if (key.size() != types[column].width())
+            {
+                setAll();
+                return;
+            }
+            constants.push_back(ValueCodec::getBigEndian(key));
+        }
+        const std::vector<uint64_t> &values = columns.fixed[column];
+        for (size_t i = 0; i < live; ++i)
+        {
+            if (fixedMatches(filter, values[i], constants))
+                selected[i / 64] |= 1ull << (i % 64);
+        }
+    }
+
+    // Decode a block written by encodeBlock, calling visit(key, tombstone,
+    // record) for each entry in order. With a filter, live rows that fail
+    // it are left out without their records being rebuilt; filtered says
+    // how many. False if the block is damaged.
+    template <typename Visit>
+    bool decodeBlock(const RowFormat &format, std::string_view data, const Filter *filter, Visit visit,
+                     size_t *filtered = nullptr)
+    {
+        const char *in = data.data();
+        const char *end = in + data.size();
+        uint16_t rows;
+        uint8_t anyTombstone;
+        if (!take(in, end, rows) || !take(in, end, anyTombstone))
+            return false;
+        std::vector<uint64_t> tombstones(rows, 0);
+        if (anyTombstone && !unpackBits(in, end, rows, 1, 0, tombstones.data()))
+            return false;
+
+        std::vector<uint64_t> shared, suffixLengths;
+        if (!decodeFrame(in, end, rows, shared) || !decodeFrame(in, end, rows, suffixLengths))
+            return false;
+        // Keys are rebuilt into one buffer, each from the start of the one
+        // before it and its own suffix
+        size_t keyLength = 0, suffixBytes = 0, previousLength = 0;
+        for (size_t i = 0; i < rows; ++i)
+        {
+            if (shared[i] > previousLength || suffixLengths[i] > static_cast<uint64_t>(end - in) - suffixBytes ||
+                shared[i] + suffixLengths[i] > UINT16_MAX)
+                return false;
+            previousLength = shared[i] + suffixLengths[i];
+            keyLength += previousLength;
+            suffixBytes += suffixLengths[i];
+        }
+        std::string keyBytes(keyLength, '\0');
+        std::vector<std::string_view> keys(rows);
+        char *key = keyBytes.data();
+        const char *previous = key;
+        for (size_t i = 0; i < rows; ++i)
+        {
+            std::memmove(key, previous, shared[i]);
+            std::memcpy(key + shared[i], in, suffixLengths[i]);
+            in += suffixLengths[i];
+            keys[i] = std::string_view(key, shared[i] + suffixLengths[i]);
+            previous = key;
+            key += keys[i].size();
+        }
+
+        const std::vector<ColumnType> &types = format.getTypes();
+        uint16_t columnCount;
+        if (!take(in, end, columnCount) || columnCount != types.size())
+            return false;
+        DecodedColumns columns;
+        for (uint32_t i = 0; i < rows; ++i)
+        {
+            if (!tombstones[i])
+                columns.liveRows.push_back(i);
+        }
+        size_t live = columns.liveRows.size();
+        columns.fixed.resize(types.size());
+        columns.varying.resize(types.size());
+        for (size_t column = 0; column < types.size(); ++column)
+        {
+            bool ok = types[column].isFixed()
+                          ? decodeFixed(in, end, live, static_cast<uint8_t>(types[column].width()), columns.fixed[column])
+                          : decodeVarying(in, end, live, columns.varying[column]);
+            if (!ok)
+                return false;
+        }
+
+        std::vector<uint64_t> selected((live + 63) / 64, 0);
+        if (filter)
+            selectRows(*filter, format, columns, keys, selected);
+
+        // Records are written in RowFormat::assemble's layout: u16 id length
+        // | id | fixed area | varchar bytes
+        struct Placement
+        {
+            uint16_t offset;             // in the fixed area
+            uint16_t width;              // 0 for varchar
+            const uint64_t *values;      // fixed
+            const Strings *strings;      // varchar
+        };
+        std::vector<Placement> placements;
+        for (size_t column = 0; column < types.size(); ++column)
+        {
+            bool isFixed = types[column].isFixed();
+            placements.push_back(Placement{format.offsetOf(column), isFixed ? types[column].width() : uint16_t(0),
+                                           columns.fixed[column].data(), &columns.varying[column]});
+        }
+        std::vector<char> record(MAX_RECORD_SIZE);
+        uint16_t fixedSize = format.getFixedSize();
+        size_t liveIndex = 0;
+        for (size_t i = 0; i < rows; ++i)
+        {
+            if (tombstones[i])
+            {
+                visit(keys[i], true, std::string_view());
+                continue;
+            }
+            size_t row = liveIndex++;
+            if (filter && !(selected[row / 64] >> (row % 64) & 1))
+            {
+                if (filtered)
+                    ++*filtered;
+                continue;
+            }
+
+            size_t fixedStart = sizeof(uint16_t) + keys[i].size();
+            size_t size = fixedStart + fixedSize;
+            if (size > record.size())
+                return false;
+            char *out = record.data();
+            putValue(out, static_cast<uint16_t>(keys[i].size()));
+            std::memcpy(out + sizeof(uint16_t), keys[i].data(), keys[i].size());
+            for (const Placement &column : placements)
+            {
+                char *slot = out + fixedStart + column.offset;
+                if (column.width != 0)
+                {
+                    uint64_t bigEndian = __builtin_bswap64(column.values[row]);
+                    const char *bytes = reinterpret_cast<const char *>(&bigEndian);
+                    switch (column.width)
+                    {
+                    case 1:
+                        *slot = bytes[7];
+                        break;
+                    case 4:
+                        std::memcpy(slot, bytes + 4, 4);
+                        break;
+                    default:
+                        std::memcpy(slot, bytes, 8);
+                        break;
+                    }
+                    continue;
+                }
+                std::string_view value = column.strings->entries[column.strings->codes[row]];
+                if (size + value.size() > record.size())
+                    return false;
+                putValue(slot, static_cast<uint16_t>(size));
+                putValue(slot + sizeof(uint16_t), static_cast<uint16_t>(value.size()));
+                std::memcpy(out + size, value.data(), value.size());
+                size += value.size();
+            }
+            visit(keys[i], false, std::string_view(out, size));
+        }
+        return true;
+    }
+}
+
+#endif // ENCODING_H
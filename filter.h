@@ -0,0 +1,506 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <string_view>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#include "page.h"
+#include "types.h"
+
+// Boolean filters from a where clause and their evaluation, either one row
+// at a time or over a whole page of rows at once.
+
+enum class CompareOp
+{
+    Eq,
+    Ne,
+    Lt,
+    Le,
+    Gt,
+    Ge
+};
+
+inline const char *compareOpText(CompareOp op)
+{
+    switch (op)
+    {
+    case CompareOp::Eq:
+        return "=";
+    case CompareOp::Ne:
+        return "!=";
+    case CompareOp::Lt:
+        return "<";
+    case CompareOp::Le:
+        return "<=";
+    case CompareOp::Gt:
+        return ">";
+    default:
+        return ">=";
+    }
+}
+
+// Whether a three-way comparison result satisfies op
+inline bool compareMatches(CompareOp op, int c)
+{
+    switch (op)
+    {
+    case CompareOp::Eq:
+        return c == 0;
+    case CompareOp::Ne:
+        return c != 0;
+    case CompareOp::Lt:
+        return c < 0;
+    case CompareOp::Le:
+        return c <= 0;
+    case CompareOp::Gt:
+        return c > 0;
+    default:
+        return c >= 0;
+    }
+}
+
+// A where clause as a tree. Leaves test one column: a comparison, an
+// `in (v1, v2, ...)` list or `between low and high` (both ends inclusive).
+// `and` binds tighter than `or`; parentheses group.
+struct Filter
+{
+    enum class Kind
+    {
+        Compare,
+        In,
+        Between,
+        And,
+        Or
+    };
+
+    Kind kind = Kind::Compare;
+    std::string column;
+    size_t position = 0; // column within a row (unique_id is 0), set by bindFilter
+    CompareOp op = CompareOp::Eq;
+    std::vector<std::string> values; // Compare: one, In: the list, Between: low and high
+    std::vector<std::string> keys;   // values in stored form, set by bindFilter
+    bool exact = false;              // stored values fit a prefix key, so equal prefixes are equal values
+    std::vector<Filter> children;    // And / Or operands
+};
+
+inline std::string filterText(const Filter &filter)
+{
+    switch (filter.kind)
+    {
+    case Filter::Kind::Compare:
+        return filter.column + " " + compareOpText(filter.op) + " " + filter.values[0];
+    case Filter::Kind::Between:
+        return filter.column + " between " + filter.values[0] + " and " + filter.values[1];
+    case Filter::Kind::In:
+    {
+        std::string text = filter.column + " in (";
+        for (size_t i = 0; i < filter.values.size(); ++i)
+            text += (i > 0 ? ", " : "") + filter.values[i];
+        return text + ")";
+    }
+    default:
+    {
+        std::string text;
+        for (const auto &child : filter.children)
+        {
+            if (!text.empty())
+                text += filter.kind == Filter::Kind::And ? " and " : " or ";
+            bool group = filter.kind == Filter::Kind::And && child.kind == Filter::Kind::Or;
+            text += group ? "(" + filterText(child) + ")" : filterText(child);
+        }
+        return text;
+    }
+    }
+}
+
+// Resolve column names against a schema and convert constants to the
+// column's stored form. On failure error says which column or value is
+// wrong.
+inline bool bindFilter(Filter &filter, const std::vector<std::string> &schema, const RowFormat &format,
+                       std::string &error)
+{
+    if (filter.kind == Filter::Kind::And || filter.kind == Filter::Kind::Or)
+    {
+        for (auto &child : filter.children)
+        {
+            if (!bindFilter(child, schema, format, error))
+                return false;
+        }
+        return true;
+    }
+
+    auto it = std::find(schema.begin(), schema.end(), filter.column);
+    if (filter.column == "unique_id")
+        filter.position = 0;
+    else if (it != schema.end())
+        filter.position = (it - schema.begin()) + 1;
+    else
+    {
+        error = "Column '" + filter.column + "' not found";
+        return false;
+    }
+
+    ColumnType type = format.typeAt(filter.position);
+    filter.exact = type.isFixed() && type.width() <= 8;
+    filter.keys.resize(filter.values.size());
+    for (size_t i = 0; i < filter.values.size(); ++i)
+    {
+        if (!ValueCodec::encode(type, filter.values[i], filter.keys[i]))
+        {
+            error = "Invalid " + type.name() + " value '" + filter.values[i] + "' for column '" + filter.column + "'";
+            return false;
+        }
+    }
+    return true;
+}
+
+// Does one stored value pass a bound leaf (Compare, In or Between)?
+inline bool fieldMatches(const Filter &filter, std::string_view field)
+{
+    switch (filter.kind)
+    {
+    case Filter::Kind::In:
+        for (const auto &key : filter.keys)
+        {
+            if (field == key)
+                return true;
+        }
+        return false;
+    case Filter::Kind::Between:
+        return field.compare(filter.keys[0]) >= 0 && field.compare(filter.keys[1]) <= 0;
+    default:
+        return compareMatches(filter.op, field.compare(filter.keys[0]));
+    }
+}
+
+// Row-at-a-time evaluation against a stored record, used to recheck rows
+// fetched through an index
+inline bool evaluateFilter(const Filter &filter, const RowFormat &format, std::string_view record)
+{
+    switch (filter.kind)
+    {
+    case Filter::Kind::And:
+        for (const auto &child : filter.children)
+        {
+            if (!evaluateFilter(child, format, record))
+                return false;
+        }
+        return true;
+    case Filter::Kind::Or:
+        for (const auto &child : filter.children)
+        {
+            if (evaluateFilter(child, format, record))
+                return true;
+        }
+        return false;
+    default:
+        break;
+    }
+
+    return fieldMatches(filter, format.field(record, filter.position));
+}
+
+// Batch evaluation. A page of rows is split into column vectors of views
+// into the page, and each column is summarised by a prefix key: its first
+// eight stored bytes packed big-endian, so unsigned integer order matches
+// stored order. For numeric, bool and timestamp columns the prefix key is
+// the whole value. Comparisons run over the prefix keys several rows per
+// instruction and only string rows whose prefix ties with the constant fall
+// back to a full compare. Results are selection bitmaps, one bit per row, combined
+// word by word for and/or.
+
+using Selection = std::vector<uint64_t>;
+
+constexpr uint64_t PREFIX_SIGN = 0x8000000000000000ull;
+
+// Prefix keys are stored with the sign bit flipped so that the signed
+// 64-bit compares SIMD offers give unsigned order
+inline uint64_t prefixKey(std::string_view value)
+{
+    uint64_t key = 0;
+    size_t length = value.size() < 8 ? value.size() : 8;
+    for (size_t i = 0; i < length; ++i)
+        key |= static_cast<uint64_t>(static_cast<unsigned char>(value[i])) << (56 - 8 * i);
+    return key ^ PREFIX_SIGN;
+}
+
+// Set bit i of less/equal where keys[i] < constant / keys[i] == constant.
+// Both bitmaps must be zeroed and hold at least (count + 63) / 64 words.
+using PrefixCompareKernel = void (*)(const uint64_t *keys, size_t count, uint64_t constant,
+                                     uint64_t *less, uint64_t *equal);
+
+// Rows [begin, count) one at a time; also finishes the tail for the SIMD kernels
+inline void comparePrefixesFrom(size_t begin, const uint64_t *keys, size_t count, uint64_t constant,
+                                uint64_t *less, uint64_t *equal)
+{
+    int64_t c = static_cast<int64_t>(constant);
+    for (size_t i = begin; i < count; ++i)
+    {
+        int64_t k = static_cast<int64_t>(keys[i]);
+        less[i / 64] |= static_cast<uint64_t>(k < c) << (i % 64);
+        equal[i / 64] |= static_cast<uint64_t>(k == c) << (i % 64);
+    }
+}
+
+inline void comparePrefixesScalar(const uint64_t *keys, size_t count, uint64_t constant,
+                                  uint64_t *less, uint64_t *equal)
+{
+    comparePrefixesFrom(0, keys, count, constant, less, equal);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse4.2"))) inline void comparePrefixesSse42(const uint64_t *keys, size_t count, uint64_t constant,
+                                                                   uint64_t *less, uint64_t *equal)
+{
+    const __m128i c = _mm_set1_epi64x(static_cast<long long>(constant));
+    size_t i = 0;
+    for (; i + 2 <= count; i += 2)
+    {
+        __m128i k = _mm_loadu_si128(reinterpret_cast<const __m128i *>(keys + i));
+        uint64_t lt = static_cast<uint64_t>(_mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(c, k))));
+        uint64_t eq = static_cast<uint64_t>(_mm_movemask_pd(_mm_castsi128_pd(_mm_cmpeq_epi64(c, k))));
+        less[i / 64] |= lt << (i % 64);
+        equal[i / 64] |= eq << (i % 64);
+    }
+    comparePrefixesFrom(i, keys, count, constant, less, equal);
+}
+
+__attribute__((target("avx2"))) inline void comparePrefixesAvx2(const uint64_t *keys, size_t count, uint64_t constant,
+                                                                uint64_t *less, uint64_t *equal)
+{
+    const __m256i c = _mm256_set1_epi64x(static_cast<long long>(constant));
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m256i k = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(keys + i));
+        uint64_t lt = static_cast<uint64_t>(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(c, k))));
+        uint64_t eq = static_cast<uint64_t>(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(c, k))));
+        less[i / 64] |= lt << (i % 64);
+        equal[i / 64] |= eq << (i % 64);
+    }
+    comparePrefixesFrom(i, keys, count, constant, less, equal);
+}
+#endif
+
+// Widest kernel the CPU supports, picked once. NOSQLITE_SIMD=scalar|sse4.2
+// caps the choice, which is handy when comparing the paths.
+inline PrefixCompareKernel prefixCompareKernel()
+{
+    static const PrefixCompareKernel kernel = []() -> PrefixCompareKernel
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        const char *cap = std::getenv("NOSQLITE_SIMD");
+        std::string limit = cap ? cap : "";
+        if (limit != "scalar")
+        {
+            __builtin_cpu_init();
+            if (limit != "sse4.2" && __builtin_cpu_supports("avx2"))
+                return comparePrefixesAvx2;
+            if (__builtin_cpu_supports("sse4.2"))
+                return comparePrefixesSse42;
+        }
+#endif
+        return comparePrefixesScalar;
+    }();
+    return kernel;
+}
+
+// Live rows of one page, with the columns a filter reads split out
+struct RowBatch
+{
+    size_t size = 0;
+    std::vector<uint16_t> slots;
+    std::vector<std::string_view> records;
+    std::vector<std::vector<std::string_view>> columns; // by row position, empty if unused
+    std::vector<std::vector<uint64_t>> prefixes;
+
+    // Which row positions a filter reads
+    static void collectColumns(const Filter &filter, std::vector<bool> &used)
+    {
+        if (filter.kind == Filter::Kind::And || filter.kind == Filter::Kind::Or)
+        {
+            for (const auto &child : filter.children)
+                collectColumns(child, used);
+            return;
+        }
+        if (used.size() <= filter.position)
+            used.resize(filter.position + 1, false);
+        used[filter.position] = true;
+    }
+
+    void load(const SlottedPage &page, const std::vector<bool> &used, const RowFormat &format)
+    {
+        size = 0;
+        slots.clear();
+        records.clear();
+        columns.resize(used.size());
+        prefixes.resize(used.size());
+        for (size_t c = 0; c < used.size(); ++c)
+        {
+            columns[c].clear();
+            prefixes[c].clear();
+        }
+
+        for (uint16_t slot = 0; slot < page.slotCount(); ++slot)
+        {
+            if (page.isDeleted(slot))
+                continue;
+            std::string_view record = page.get(slot);
+            slots.push_back(slot);
+            records.push_back(record);
+
+            for (size_t c = 0; c < used.size(); ++c)
+            {
+                if (!used[c])
+                    continue;
+                std::string_view field = format.field(record, c);
+                columns[c].push_back(field);
+                prefixes[c].push_back(prefixKey(field));
+            }
+            ++size;
+        }
+    }
+};
+
+inline size_t selectionWords(size_t rows) { return (rows + 63) / 64; }
+
+// Clear the bits past the last row
+inline void trimSelection(Selection &selection, size_t rows)
+{
+    if (rows % 64 != 0 && !selection.empty())
+        selection.back() &= (uint64_t(1) << (rows % 64)) - 1;
+}
+
+inline void selectAll(Selection &selection, size_t rows)
+{
+    selection.assign(selectionWords(rows), ~uint64_t(0));
+    trimSelection(selection, rows);
+}
+
+// Rows of one column that compare to a stored-form value as op says. With
+// exact set, equal prefix keys already mean equal values.
+inline void compareColumn(const RowBatch &batch, size_t position, CompareOp op, const std::string &value,
+                          bool exact, Selection &selection)
+{
+    size_t words = selectionWords(batch.size);
+    Selection less(words, 0), equal(words, 0);
+    prefixCompareKernel()(batch.prefixes[position].data(), batch.size, prefixKey(value), less.data(), equal.data());
+
+    // Rows decided by the prefix alone
+    selection.assign(words, 0);
+    for (size_t w = 0; w < words; ++w)
+    {
+        uint64_t greater = ~(less[w] | equal[w]);
+        switch (op)
+        {
+        case CompareOp::Lt:
+        case CompareOp::Le:
+            selection[w] = less[w];
+            break;
+        case CompareOp::Gt:
+        case CompareOp::Ge:
+            selection[w] = greater;
+            break;
+        case CompareOp::Ne:
+            selection[w] = ~equal[w];
+            break;
+        default:
+            break;
+        }
+    }
+
+    // Prefix ties are equal values when the prefix is the whole value;
+    // otherwise they need the full compare
+    if (exact)
+    {
+        if (compareMatches(op, 0))
+        {
+            for (size_t w = 0; w < words; ++w)
+                selection[w] |= equal[w];
+        }
+    }
+    else
+    {
+        const auto &column = batch.columns[position];
+        for (size_t w = 0; w < words; ++w)
+        {
+            for (uint64_t bits = equal[w]; bits != 0; bits &= bits - 1)
+            {
+                size_t row = w * 64 + __builtin_ctzll(bits);
+                if (compareMatches(op, column[row].compare(value)))
+                    selection[w] |= uint64_t(1) << (row % 64);
+            }
+        }
+    }
+    trimSelection(selection, batch.size);
+}
+
+// Evaluate a bound filter over a batch into one bit per row
+inline void evaluateBatch(const Filter &filter, const RowBatch &batch, Selection &selection)
+{
+    size_t words = selectionWords(batch.size);
+    switch (filter.kind)
+    {
+    case Filter::Kind::Compare:
+        compareColumn(batch, filter.position, filter.op, filter.keys[0], filter.exact, selection);
+        return;
+
+    case Filter::Kind::Between:
+    {
+        Selection upper;
+        compareColumn(batch, filter.position, CompareOp::Ge, filter.keys[0], filter.exact, selection);
+        compareColumn(batch, filter.position, CompareOp::Le, filter.keys[1], filter.exact, upper);
+        for (size_t w = 0; w < words; ++w)
+            selection[w] &= upper[w];
+        return;
+    }
+
+    case Filter::Kind::In:
+    {
+        Selection match;
+        selection.assign(words, 0);
+        for (const auto &key : filter.keys)
+        {
+            compareColumn(batch, filter.position, CompareOp::Eq, key, filter.exact, match);
+            for (size_t w = 0; w < words; ++w)
+                selection[w] |= match[w];
+        }
+        return;
+    }
+
+    case Filter::Kind::And:
+    {
+        Selection operand;
+        evaluateBatch(filter.children[0], batch, selection);
+        for (size_t i = 1; i < filter.children.size(); ++i)
+        {
+            evaluateBatch(filter.children[i], batch, operand);
+            for (size_t w = 0; w < words; ++w)
+                selection[w] &= operand[w];
+        }
+        return;
+    }
+
+    default:
+    {
+        Selection operand;
+        evaluateBatch(filter.children[0], batch, selection);
+        for (size_t i = 1; i < filter.children.size(); ++i)
+        {
+            evaluateBatch(filter.children[i], batch, operand);
+            for (size_t w = 0; w < words; ++w)
+                selection[w] |= operand[w];
+        }
+        return;
+    }
+    }
+}
+
+#endif // FILTER_H
@@ -0,0 +1,471 @@
+#ifndef HASHINDEX_H
+#define HASHINDEX_H
+
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "page.h"
+#include "bufferpool.h"
+
+// Persistent extendible hash index from unique_id to RowId (<table>.pk).
+//
+//   page 0      header: magic, version, global depth, page count, entry
+//               count, the table counters it was last synced against and
+//               an unclean flag
+//   page 1..n   buckets: local depth, entry count, overflow page, entries
+//
+// The directory (2^globalDepth bucket page numbers) is kept in memory and
+// written to <table>.pkd on sync. Bucket pages can reach disk through
+// eviction at any time, so the first change after a sync makes the unclean
+// flag durable before touching a bucket, and only sync clears it; an index
+// opened unclean is rebuilt. A lookup is one directory probe plus one
+// bucket page, independent of table size. Buckets only grow overflow
+// chains when every entry shares the same hash, i.e. for duplicate IDs
+// that splitting cannot separate.
+
+constexpr char HASH_INDEX_MAGIC[8] = {'N', 'S', 'Q', 'L', 'P', 'K', 'X', '\0'};
+constexpr uint32_t HASH_INDEX_VERSION = 1;
+
+class HashIndex
+{
+private:
+    // Keys longer than this are stored truncated; callers verify candidates
+    // against the row itself
+    static constexpr size_t KEY_SIZE = 24;
+    static constexpr size_t ENTRY_SIZE = 32; // u8 length, key, u32 page, u16 slot, pad
+    static constexpr size_t BUCKET_HEADER = 8;
+    static constexpr uint16_t BUCKET_CAPACITY = (PAGE_SIZE - BUCKET_HEADER) / ENTRY_SIZE;
+    static constexpr uint32_t MAX_GLOBAL_DEPTH = 26;
+    static constexpr size_t UNCLEAN_OFFSET = 40;
+
+    struct Entry
+    {
+        std::string key;
+        RowId rid;
+    };
+
+    std::string path;
+    std::string dirPath;
+    uint32_t fileId = 0;
+    uint32_t globalDepth = 0;
+    uint32_t pageCount = 0;
+    uint64_t entryCount = 0;
+    std::vector<uint32_t> directory;
+    bool unclean = false; // the header on disk says so
+
+    static uint64_t hashKey(std::string_view key)
+    {
+        // FNV-1a: stable across runs, which the on-disk layout depends on
+        uint64_t hash = 1469598103934665603ull;
+        for (char c : key)
+        {
+            hash ^= static_cast<uint8_t>(c);
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    static std::string_view truncate(std::string_view key) { return key.substr(0, KEY_SIZE); }
+
+    static uint16_t localDepth(const char *page) { return getValue<uint16_t>(page); }
+    static uint16_t count(const char *page) { return getValue<uint16_t>(page + 2); }
+    static uint32_t overflow(const char *page) { return getValue<uint32_t>(page + 4); }
+
+    static void setBucketHeader(char *page, uint16_t depth, uint16_t entries, uint32_t next)
+    {
+        putValue(page, depth);
+        putValue(page + 2, entries);
+        putValue(page + 4, next);
+    }
+
+    static Entry readEntry(const char *page, uint16_t i)
+    {
+        const char *e = page + BUCKET_HEADER + i * ENTRY_SIZE;
+        uint8_t length = static_cast<uint8_t>(e[0]);
+        return Entry{std::string(e + 1, length),
+                     RowId{getValue<uint32_t>(e + 1 + KEY_SIZE), getValue<uint16_t>(e + 5 + KEY_SIZE)}};
+    }
+
+    static bool entryMatches(const char *page, uint16_t i, std::string_view key)
+    {
+        const char *e = page + BUCKET_HEADER + i * ENTRY_SIZE;
+        return static_cast<uint8_t>(e[0]) == key.size() && std::memcmp(e + 1, key.data(), key.size()) == 0;
+    }
+
+    static void writeEntry(char *page, uint16_t i, std::string_view key, RowId rid)
+    {
+        char *e = page + BUCKET_HEADER + i * ENTRY_SIZE;
+        std::memset(e, 0, ENTRY_SIZE);
+        e[0] = static_cast<char>(key.size());
+        std::memcpy(e + 1, key.data(), key.size());
+        putValue(e + 1 + KEY_SIZE, rid.pageNo);
+        putValue(e + 5 + KEY_SIZE, rid.slot);
+    }
+
+    uint32_t allocatePage()
+    {
+        return pageCount++;
+    }
+
+    void writeHeader(uint32_t tablePages, uint64_t tableRows)
+    {
+        PageGuard header(fileId, 0);
+        char *out = header.get();
+        std::memset(out, 0, PAGE_SIZE);
+        std::memcpy(out, HASH_INDEX_MAGIC, sizeof(HASH_INDEX_MAGIC));
+        putValue(out + 8, HASH_INDEX_VERSION);
+        putValue(out + 12, globalDepth);
+        putValue(out + 16, pageCount);
+        putValue(out + 20, entryCount);
+        putValue(out + 28, tablePages);
+        putValue(out + 32, tableRows);
+        header.markDirty();
+    }
+
+    // Before the first change since the last sync, put the unclean flag on
+    // disk so a crash after any bucket is evicted forces a rebuild
+    void markChanged()
+    {
+        if (unclean)
+            return;
+        {
+            PageGuard header(fileId, 0);
+            header.get()[UNCLEAN_OFFSET] = 1;
+            header.markDirty();
+        }
+        BufferPool::instance().syncFile(fileId);
+        unclean = true;
+    }
+
+    // Rewrite a bucket chain with the given entries, reusing the chain's
+    // pages and appending overflow pages when they run out
+    void writeChain(uint32_t firstPage, uint16_t depth, const std::vector<Entry> &entries)
+    {
+        size_t next = 0;
+        uint32_t pageNo = firstPage;
+        while (true)
+        {
+            PageGuard page(fileId, pageNo);
+            char *data = page.get();
+            uint32_t existingOverflow = overflow(data);
+            uint16_t n = static_cast<uint16_t>(std::min<size_t>(BUCKET_CAPACITY, entries.size() - next));
+            for (uint16_t i = 0; i < n; ++i)
+                writeEntry(data, i, entries[next + i].key, entries[next + i].rid);
+            next += n;
+
+            uint32_t nextPage = 0;
+            if (next < entries.size())
+                nextPage = existingOverflow ? existingOverflow : allocatePage();
+            setBucketHeader(data, depth, n, nextPage);
+            page.markDirty();
+
+            if (nextPage == 0)
+                return;
+            if (!existingOverflow)
+            {
+                PageGuard fresh(fileId, nextPage);
+                setBucketHeader(fresh.get(), depth, 0, 0);
+                fresh.markDirty();
+            }
+            pageNo = nextPage;
+        }
+    }
+
+    std::vector<Entry> readChain(uint32_t pageNo) const
+    {
+        std::vector<Entry> entries;
+        while (pageNo != 0)
+        {
+            PageGuard page(fileId, pageNo);
+            const char *data = page.get();
+            for (uint16_t i = 0; i < count(data); ++i)
+                entries.push_back(readEntry(data, i));
+            pageNo = overflow(data);
+        }
+        return entries;
+    }
+
+    // Split the bucket behind directory slot `index`. Returns false when the
+    // bucket cannot be split further (all entries hash identically).
+    bool split(size_t index)
+    {
+        uint32_t oldPage = directory[index];
+        std::vector<Entry> entries = readChain(oldPage);
+        uint16_t depth;
+        {
+            PageGuard page(fileId, oldPage);
+            depth = localDepth(page.get());
+        }
+
+        uint64_t firstHash = hashKey(entries.front().key);
+        bool separable = false;
+        for (const auto &entry : entries)
+        {
+            if (hashKey(entry.key) != firstHash)
+            {
+                separable = true;
+                break;
+            }
+        }
+        if (!separable)
+            return false;
+
+        if (depth == globalDepth)
+        {
+            if (globalDepth >= MAX_GLOBAL_DEPTH)
+                return false;
+            size_t size = directory.size();
+            directory.resize(size * 2);
+            for (size_t i = 0; i < size; ++i)
+                directory[size + i] = directory[i];
+            ++globalDepth;
+        }
+
+        uint16_t newDepth = depth + 1;
+        uint64_t bit = 1ull << depth;
+        uint32_t newPage = allocatePage();
+        {
+            PageGuard fresh(fileId, newPage);
+            setBucketHeader(fresh.get(), newDepth, 0, 0);
+            fresh.markDirty();
+        }
+
+        std::vector<Entry> stay, move;
+        for (auto &entry : entries)
+            ((hashKey(entry.key) & bit) ? move : stay).push_back(std::move(entry));
+
+        writeChain(oldPage, newDepth, stay);
+        writeChain(newPage, newDepth, move);
+
+        for (size_t i = 0; i < directory.size(); ++i)
+        {
+            if (directory[i] == oldPage && (i & bit))
+                directory[i] = newPage;
+        }
+        return true;
+    }
+
+public:
+    explicit HashIndex(const std::string &basePathAndName)
+        : path(basePathAndName + ".pk"), dirPath(basePathAndName + ".pkd") {}
+
+    HashIndex(const HashIndex &) = delete;
+    HashIndex &operator=(const HashIndex &) = delete;
+
+    ~HashIndex() { close(); }
+
+    void close()
+    {
+        if (fileId != 0)
+        {
+            BufferPool::instance().closeFile(fileId);
+            fileId = 0;
+        }
+    }
+
+    // Open an existing index. Returns false if it is missing, unreadable or
+    // was last synced against different table counters; the caller then
+    // rebuilds it from the table.
+    bool open(uint32_t tablePages, uint64_t tableRows)
+    {
+        if (!std::filesystem::exists(path) || !std::filesystem::exists(dirPath))
+            return false;
+
+        fileId = BufferPool::instance().openFile(path);
+        PageGuard header(fileId, 0);
+        const char *in = header.get();
+        if (std::memcmp(in, HASH_INDEX_MAGIC, sizeof(HASH_INDEX_MAGIC)) != 0 ||
+            getValue<uint32_t>(in + 8) != HASH_INDEX_VERSION ||
+            getValue<uint32_t>(in + 28) != tablePages || getValue<uint64_t>(in + 32) != tableRows ||
+            in[UNCLEAN_OFFSET] != 0)
+            return false;
+
+        globalDepth = getValue<uint32_t>(in + 12);
+        pageCount = getValue<uint32_t>(in + 16);
+        entryCount = getValue<uint64_t>(in + 20);
+
+        std::ifstream dir(dirPath, std::ios::binary);
+        directory.assign(size_t(1) << globalDepth, 0);
+        dir.read(reinterpret_cast<char *>(directory.data()),
+                 static_cast<std::streamsize>(directory.size() * sizeof(uint32_t)));
+        return dir.gcount() == static_cast<std::streamsize>(directory.size() * sizeof(uint32_t));
+    }
+
+    // Start an empty index: global depth 0 and a single bucket
+    void create()
+    {
+        close();
+        std::ofstream(path, std::ios::binary | std::ios::trunc);
+        fileId = BufferPool::instance().openFile(path);
+        globalDepth = 0;
+        pageCount = 1;
+        entryCount = 0;
+        unclean = false;
+        directory.assign(1, allocatePage());
+        PageGuard bucket(fileId, directory[0]);
+        setBucketHeader(bucket.get(), 0, 0, 0);
+        bucket.markDirty();
+    }
+
+    void insert(std::string_view fullKey, RowId rid)
+    {
+        std::string_view key = truncate(fullKey);
+        uint64_t hash = hashKey(key);
+        markChanged();
+        while (true)
+        {
+            size_t index = hash & ((1ull << globalDepth) - 1);
+            uint32_t pageNo = directory[index];
+
+            // Find room anywhere in the chain
+            uint32_t tail = pageNo;
+            bool chained = false;
+            while (tail != 0)
+            {
+                PageGuard page(fileId, tail);
+                char *data = page.get();
+                uint16_t n = count(data);
+                if (n < BUCKET_CAPACITY)
+                {
+                    writeEntry(data, n, key, rid);
+                    setBucketHeader(data, localDepth(data), n + 1, overflow(data));
+                    page.markDirty();
+                    ++entryCount;
+                    return;
+                }
+                chained = chained || overflow(data) != 0;
+                if (overflow(data) == 0)
+                    break;
+                tail = overflow(data);
+            }
+
+            // A chained bucket holds one hash only; splitting it is pointless
+            // unless this key brings a different one
+            bool sameHash = false;
+            if (chained)
+            {
+                PageGuard first(fileId, pageNo);
+                sameHash = hashKey(readEntry(first.get(), 0).key) == hash;
+            }
+            if (!sameHash && split(index))
+                continue;
+
+            // Unsplittable: extend the chain with an overflow page
+            uint32_t fresh = allocatePage();
+            {
+                PageGuard page(fileId, tail);
+                char *data = page.get();
+                setBucketHeader(data, localDepth(data), count(data), fresh);
+                page.markDirty();
+            }
+            PageGuard page(fileId, fresh);
+            PageGuard first(fileId, pageNo);
+            setBucketHeader(page.get(), localDepth(first.get()), 1, 0);
+            writeEntry(page.get(), 0, key, rid);
+            page.markDirty();
+            ++entryCount;
+            return;
+        }
+    }
+
+    // Candidate locations for a key. With truncated or duplicate IDs there
+    // can be several; the caller checks each row's actual ID.
+    std::vector<RowId> find(std::string_view fullKey) const
+    {
+        std::string_view key = truncate(fullKey);
+        std::vector<RowId> result;
+        if (fileId == 0)
+            return result;
+
+        uint32_t pageNo = directory[hashKey(key) & ((1ull << globalDepth) - 1)];
+        while (pageNo != 0)
+        {
+            PageGuard page(fileId, pageNo);
+            const char *data = page.get();
+            for (uint16_t i = 0; i < count(data); ++i)
+            {
+                if (entryMatches(data, i, key))
+                    result.push_back(readEntry(data, i).rid);
+            }
+            pageNo = overflow(data);
+        }
+        return result;
+    }
+
+    bool erase(std::string_view fullKey, RowId rid)
+    {
+        std::string_view key = truncate(fullKey);
+        markChanged();
+        uint32_t pageNo = directory[hashKey(key) & ((1ull << globalDepth) - 1)];
+        while (pageNo != 0)
+        {
+            PageGuard page(fileId, pageNo);
+            char *data = page.get();
+            uint16_t n = count(data);
+            for (uint16_t i = 0; i < n; ++i)
+            {
+                if (entryMatches(data, i, key) && readEntry(data, i).rid == rid)
+                {
+                    // Move the last entry into the hole
+                    if (i != n - 1)
+                    {
+                        std::memcpy(data + BUCKET_HEADER + i * ENTRY_SIZE,
+                                    data + BUCKET_HEADER + (n - 1) * ENTRY_SIZE, ENTRY_SIZE);
+                    }
+                    setBucketHeader(data, localDepth(data), n - 1, overflow(data));
+                    page.markDirty();
+                    --entryCount;
+                    return true;
+                }
+            }
+            pageNo = overflow(data);
+        }
+        return false;
+    }
+
+    uint64_t size() const { return entryCount; }
+
+    // Persist pages and directory, stamped with the table counters they
+    // match. The header is marked clean only once everything else is on disk.
+    void sync(uint32_t tablePages, uint64_t tableRows)
+    {
+        if (fileId == 0)
+            return;
+        BufferPool::instance().syncFile(fileId);
+
+        std::string tmpPath = dirPath + ".tmp";
+        {
+            std::ofstream dir(tmpPath, std::ios::binary | std::ios::trunc);
+            dir.write(reinterpret_cast<const char *>(directory.data()),
+                      static_cast<std::streamsize>(directory.size() * sizeof(uint32_t)));
+            dir.flush();
+            if (!dir.good())
+                throw std::runtime_error("Failed to write " + tmpPath);
+        }
+        int fd = ::open(tmpPath.c_str(), O_RDONLY);
+        bool synced = fd >= 0 && ::fdatasync(fd) == 0;
+        if (fd >= 0)
+            ::close(fd);
+        if (!synced)
+            throw std::runtime_error("Failed to sync " + tmpPath);
+        std::filesystem::rename(tmpPath, dirPath);
+
+        writeHeader(tablePages, tableRows);
+        BufferPool::instance().syncFile(fileId);
+        unclean = false;
+    }
+
+    void destroy()
+    {
+        close();
+        std::filesystem::remove(path);
+        std::filesystem::remove(dirPath);
+    }
+};
+
+#endif // HASHINDEX_H
@@ -7,34 +7,138 @@
 #include <sstream>
 #include <algorithm>
 #include <cctype>
+#include <charconv>
+#include <chrono>
+#include <fstream>
+#include <deque>
+#include <optional>
+#include <unordered_map>
 #include "user.h"
 #include "db.h"
 #include "table.h"
+#include "planner.h"
+#include "aggregate.h"
+#include "sort.h"
+#include "join.h"
+#include "parser.h"
+#include "plancache.h"
+#include "metrics.h"
 
 class QueryHelper
 {
 private:
     std::shared_ptr<Database> currentDatabase;
 
-    // Helper function to split string by delimiter
+    // Where select streams its rows while executeQuery(query, out) runs
+    std::ostream *resultSink = nullptr;
+
+    // What selects measure of themselves while explain analyze runs them
+    QueryProfile *profile = nullptr;
+
+    // Rows load appends and commits at a time
+    static constexpr size_t LOAD_BATCH_ROWS = 8192;
+
+    // Parsed inserts, selects and deletes of this session
+    PlanCache planCache;
+
+    // A statement prepared under a name: its cached form, and the constants
+    // lifted out of its text (std::nullopt for each `?`, in order)
+    struct PreparedStatement
+    {
+        std::shared_ptr<CachedStatement> cached;
+        std::vector<std::optional<std::string>> literals;
+        size_t parameters = 0;
+    };
+    std::unordered_map<std::string, PreparedStatement> prepared;
+
+    // Longer statements, such as large multi-row inserts, are not worth a
+    // cache entry keyed by their whole text
+    static constexpr size_t MAX_CACHED_TOKENS = 512;
+
+    // Split a CSV line by delimiter, trimming each field. Empty fields are
+    // kept, a trailing one included, so "a,b," has three values.
     static std::vector<std::string> split(const std::string &str, char delim)
     {
         std::vector<std::string> tokens;
-        std::string token;
-        std::istringstream tokenStream(str);
-        while (std::getline(tokenStream, token, delim))
+        size_t start = 0;
+        while (true)
         {
-            tokens.push_back(trim(token));
+            size_t end = str.find(delim, start);
+            if (end == std::string::npos)
+            {
+                tokens.push_back(trim(str.substr(start)));
+                return tokens;
+            }
+            tokens.push_back(trim(str.substr(start, end - start)));
+            start = end + 1;
         }
-        return tokens;
     }
 
-    // Helper function to parse attribute list from string
-    static std::vector<std::string> parseAttributeList(const std::string &str)
+    static std::string formatRate(size_t rows, double seconds)
     {
-        // Remove parentheses and split by comma
-        std::string cleaned = str.substr(1, str.length() - 2);
-        return split(cleaned, ',');
+        std::stringstream result;
+        result.precision(3);
+        result << std::fixed << seconds << " s, "
+               << static_cast<uint64_t>(seconds > 0 ? rows / seconds : rows) << " rows/sec";
+        return result.str();
+    }
+
+    // A whole non-negative number, as limit and parallel take
+    static bool parseCount(const std::string &text, long &value)
+    {
+        auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+        return ec == std::errc() && end == text.data() + text.size() && value >= 0;
+    }
+
+    // Tokens of one statement without its trailing ';'
+    static bool tokenizeStatement(const std::string &text, std::vector<Token> &tokens, std::string &error)
+    {
+        if (!tokenize(text, tokens, error))
+            return false;
+        if (!tokens.empty() && tokens.back().kind == TokenKind::Symbol && tokens.back().text == ";")
+            tokens.pop_back();
+        if (tokens.empty())
+        {
+            error = "Empty query";
+            return false;
+        }
+        return true;
+    }
+
+    // Only inserts, selects and deletes are cached and prepared
+    static bool isCacheable(const std::vector<Token> &tokens)
+    {
+        const Token &first = tokens.front();
+        return first.kind == TokenKind::Word &&
+               (sameWord(first.text, "insert") || sameWord(first.text, "select") || sameWord(first.text, "delete"));
+    }
+
+    // The cached form of an insert, select or delete, parsed with its
+    // constants lifted out on a miss. nullptr if it does not parse that way,
+    // as when an unquoted value holds a space and a number.
+    std::shared_ptr<CachedStatement> cachedStatement(const std::vector<Token> &tokens,
+                                                     std::vector<std::optional<std::string>> &literals)
+    {
+        std::vector<Token> normalized;
+        std::string key = normalizeStatement(tokens, normalized, literals);
+        auto cached = planCache.find(key);
+        if (cached)
+            return cached;
+
+        cached = std::make_shared<CachedStatement>();
+        std::string error;
+        if (!parseStatement(normalized, cached->statement, error, true))
+            return nullptr;
+        planCache.insert(key, cached);
+        return cached;
+    }
+
+    // Run a cached statement with values for all its parameters
+    std::string runCached(CachedStatement &cached, const std::vector<std::string> &values)
+    {
+        Statement statement = cached.statement;
+        bindParameters(statement, values);
+        return dispatch(statement, &cached);
     }
 
 public:
@@ -51,27 +155,135 @@ public:
         return str.substr(first, last - first + 1);
     }
 
+    // Log in as username, replacing the session's user on success
+    bool login(const std::string &username, const std::string &password)
+    {
+        User loginUser;
+        if (!loginUser.login(username, password))
+            return false;
+        currentUser = std::make_shared<User>(loginUser);
+        currentDatabase = nullptr;
+        return true;
+    }
+
+    // Execute query, streaming select results to out as they are read.
+    // Returns the remaining result message.
+    std::string executeQuery(const std::string &query, std::ostream &out)
+    {
+        resultSink = &out;
+        try
+        {
+            std::string result = executeQuery(query);
+            resultSink = nullptr;
+            return result;
+        }
+        catch (...)
+        {
+            resultSink = nullptr;
+            throw;
+        }
+    }
+
     // Execute query and return result message
     std::string executeQuery(const std::string &query)
     {
-        std::string q = trim(query);
-        if (q.empty())
-            return "Empty query";
+        std::vector<Token> tokens;
+        std::string error;
+        if (!tokenizeStatement(query, tokens, error))
+        {
+            return error;
+        }
+
+        // The same insert, select or delete with other constants is parsed
+        // and planned once
+        if (tokens.size() <= MAX_CACHED_TOKENS && isCacheable(tokens))
+        {
+            std::vector<std::optional<std::string>> literals;
+            if (auto cached = cachedStatement(tokens, literals))
+            {
+                std::vector<std::string> values;
+                for (auto &literal : literals)
+                {
+                    if (!literal)
+                        return "Parameters (?) are only allowed in prepared statements";
+                    values.push_back(std::move(*literal));
+                }
+                return runCached(*cached, values);
+            }
+        }
+
+        Statement statement;
+        if (!parseStatement(tokens, statement, error))
+        {
+            return error;
+        }
+        return dispatch(statement, nullptr);
+    }
+
+    // Parse an insert, select or delete once and keep it as name. Each `?`
+    // in it is a parameter, given a value by every execute in order.
+    bool prepare(const std::string &name, const std::string &text, std::string &error)
+    {
+        std::vector<Token> tokens;
+        if (!tokenizeStatement(text, tokens, error))
+        {
+            return false;
+        }
 
-        // Remove semicolon if present
-        if (q.back() == ';')
+        PreparedStatement statement;
+        if (isCacheable(tokens))
         {
-            q = q.substr(0, q.length() - 1);
+            statement.cached = cachedStatement(tokens, statement.literals);
+        }
+        if (!statement.cached)
+        {
+            // Report what is wrong with it
+            Statement parsed;
+            if (parseStatement(tokens, parsed, error, true))
+            {
+                error = isCacheable(tokens) ? "Cannot prepare a statement with unquoted values that hold spaces"
+                                            : "Only insert, select and delete statements can be prepared";
+            }
+            return false;
         }
 
-        // Convert to lowercase for command matching
-        std::string lowerQuery = q;
-        std::transform(lowerQuery.begin(), lowerQuery.end(), lowerQuery.begin(), ::tolower);
+        statement.parameters = std::count(statement.literals.begin(), statement.literals.end(), std::nullopt);
+        prepared[name] = std::move(statement);
+        return true;
+    }
 
-        // Login command
-        if (lowerQuery.substr(0, 5) == "login")
+    // Run the statement prepared as name with one value per parameter
+    std::string execute(const std::string &name, const std::vector<std::string> &values)
+    {
+        auto it = prepared.find(name);
+        if (it == prepared.end())
+        {
+            return "Prepared statement '" + name + "' not found";
+        }
+        const PreparedStatement &statement = it->second;
+        if (values.size() != statement.parameters)
         {
-            return handleLogin(q.substr(5));
+            return "Prepared statement '" + name + "' takes " + std::to_string(statement.parameters) +
+                   " parameters, got " + std::to_string(values.size());
+        }
+
+        std::vector<std::string> bound;
+        bound.reserve(statement.literals.size());
+        auto next = values.begin();
+        for (const auto &literal : statement.literals)
+        {
+            bound.push_back(literal ? *literal : *next++);
+        }
+        return runCached(*statement.cached, bound);
+    }
+
+private:
+    std::string dispatch(Statement &statement, CachedStatement *cached)
+    {
+        LatencyTimer timer(Metrics::instance().command(static_cast<size_t>(statement.kind)));
+        if (statement.kind == StatementKind::Login)
+        {
+            return handleLogin();
         }
 
         // Check if user is logged in
@@ -80,73 +292,507 @@ public:
             return "Not logged in. Please login first.";
         }
 
-        // Show databases command
-        if (lowerQuery == "show")
+        switch (statement.kind)
         {
+        case StatementKind::Show:
             return handleShow();
+        case StatementKind::ShowPool:
+            return handleShowPool();
+        case StatementKind::ShowScans:
+            return handleShowScans();
+        case StatementKind::Stats:
+            return statsReport(&planCache);
+        case StatementKind::SetStats:
+            return handleSetStats(statement);
+        case StatementKind::SetPool:
+            return handleSetPool(statement.words);
+        case StatementKind::CreateDatabase:
+            return handleCreateDatabase(statement.name);
+        case StatementKind::Open:
+            return handleOpenDatabase(statement.name);
+        case StatementKind::Drop:
+            return currentDatabase ? handleDropTable(statement.name) : handleDropDatabase(statement.name);
+        case StatementKind::Prepare:
+            return handlePrepare(statement);
+        case StatementKind::Execute:
+            return execute(statement.name, statement.rows[0]);
+        case StatementKind::Deallocate:
+            return prepared.erase(statement.name) ? "Deallocated '" + statement.name + "'"
+                                                  : "Prepared statement '" + statement.name + "' not found";
+        case StatementKind::Explain:
+            return handleExplain(statement);
+        default:
+            break;
         }
 
-        // Create database command
-        if (lowerQuery.substr(0, 6) == "create")
+        // Commands that require an open database
+        if (!currentDatabase)
         {
-            if (lowerQuery.substr(7, 5) == "table" && currentDatabase)
-            {
-                return handleCreateTable(q.substr(13));
-            }
-            return handleCreateDatabase(q.substr(7));
+            return "No database opened. Use 'open <database>' first.";
+        }
+
+        switch (statement.kind)
+        {
+        case StatementKind::SetDurability:
+            return handleSetDurability(statement.words);
+        case StatementKind::Checkpoint:
+            currentDatabase->checkpoint();
+            return "Checkpoint complete";
+        case StatementKind::CreateTable:
+            return handleCreateTable(statement);
+        case StatementKind::CreateIndex:
+            return handleCreateIndex(statement);
+        case StatementKind::Insert:
+            return handleInsert(statement);
+        case StatementKind::Load:
+            return handleLoad(statement);
+        case StatementKind::Delete:
+            return handleDelete(statement);
+        case StatementKind::Select:
+            return handleSelect(statement, cached);
+        default:
+            return handleAggregate(statement, cached);
+        }
+    }
+
+    std::string handlePrepare(const Statement &statement)
+    {
+        std::string error;
+        if (!prepare(statement.name, statement.body, error))
+        {
+            return error;
+        }
+        size_t parameters = prepared[statement.name].parameters;
+        return "Prepared '" + statement.name + "' with " + std::to_string(parameters) +
+               (parameters == 1 ? " parameter" : " parameters");
+    }
+
+    // The access path of a select. A cached statement keeps the path it
+    // chose until the schema changes and only binds this run's constants.
+    bool planStatement(const Table &table, const Statement &statement, CachedStatement *cached, ScanPlan &plan,
+                       std::string &error)
+    {
+        const Filter *filter = statement.hasFilter ? &statement.filter : nullptr;
+        if (!cached)
+        {
+            return planScan(table, filter, plan, error);
+        }
+
+        uint64_t version = currentDatabase->getSchemaVersion();
+        if (cached->schemaVersion != version)
+        {
+            choosePlan(table, filter, cached->plan);
+            cached->schemaVersion = version;
         }
+        plan = cached->plan;
+        if (filter)
+        {
+            plan.filter = *filter;
+        }
+        return bindPlan(table, plan, error);
+    }
+
+private:
+    // Counts the lines a statement run by explain analyze writes, and drops
+    // them
+    class LineCounter : public std::streambuf
+    {
+    public:
+        uint64_t lines = 0;
 
-        // Open database command
-        if (lowerQuery.substr(0, 4) == "open")
+    protected:
+        int overflow(int c) override
         {
-            return handleOpenDatabase(q.substr(5));
+            lines += c == '\n';
+            return c;
         }
+        std::streamsize xsputn(const char *data, std::streamsize n) override
+        {
+            lines += static_cast<uint64_t>(std::count(data, data + n, '\n'));
+            return n;
+        }
+    };
 
-        // Drop command
-        if (lowerQuery.substr(0, 4) == "drop")
+    // One operator of an explained plan, with what analyze measured of it
+    enum class PlanOperator
+    {
+        None,
+        Output,
+        Aggregate,
+        Sort,
+        Join,
+        Scan
+    };
+    struct PlanNode
+    {
+        PlanOperator op = PlanOperator::None;
+        std::string text;
+        std::vector<std::string> details;
+    };
+
+    static std::string formatMillis(uint64_t nanos)
+    {
+        std::stringstream text;
+        text << std::fixed;
+        text.precision(3);
+        text << nanos / 1e6;
+        return text.str();
+    }
+
+    // Full selects of more than one morsel go to the pool
+    static bool selectRunsParallel(const ScanPlan &plan, size_t degree, uint32_t pages)
+    {
+        return plan.kind == ScanPlan::Kind::FullScan && degree > 1 && pages > MORSEL_PAGES + 1;
+    }
+
+    // How a scan reads its table: the access path, the blocks its filter
+    // lets it pass by and the threads that share it
+    static PlanNode scanNode(const Table &table, const ScanPlan &plan, size_t threads, const std::string &unit)
+    {
+        bool lsm = table.getEngine() == TableEngine::Lsm;
+        PlanNode node{PlanOperator::Scan, "Scan " + table.getName() + (lsm ? " (lsm): " : " (heap): ") + plan.describe(),
+                      {}};
+        switch (plan.kind)
         {
-            if (currentDatabase)
+        case ScanPlan::Kind::PrimaryLookup:
+            node.details.push_back(lsm ? "memtables, then segments; Bloom filters pass by segments without the key"
+                                       : "hash index on unique_id");
+            break;
+        case ScanPlan::Kind::IndexScan:
+            node.details.push_back("B+tree range on " + plan.indexColumn + ", rows fetched by location");
+            node.details.push_back("whole filter rechecked on every row");
+            break;
+        default:
+            if (plan.hasFilter)
             {
-                return handleDropTable(q.substr(5));
+                uint64_t blocks = 0, skippable = 0;
+                table.countSkippableBlocks(plan.filter, blocks, skippable);
+                node.details.push_back("zone maps: " + std::to_string(skippable) + " of " + std::to_string(blocks) +
+                                       (lsm ? " segment blocks pruned" : " zones pruned"));
+                node.details.push_back(lsm ? "filter pushed down to encoded segment columns, then run a page at a time"
+                                           : "filter run a page at a time");
             }
-            return handleDropDatabase(q.substr(5));
+            break;
         }
+        node.details.push_back(threads > 1 ? "parallel: " + std::to_string(threads) + " threads, " + unit : "serial");
+        return node;
+    }
 
-        // Commands that require an open database
-        if (!currentDatabase)
+    // Reads and row writes go through a plan; everything else runs directly
+    static bool hasPlan(StatementKind kind)
+    {
+        return kind == StatementKind::Select || kind == StatementKind::Aggregate || kind == StatementKind::Insert ||
+               kind == StatementKind::Load || kind == StatementKind::Delete;
+    }
+
+    // The operators statement runs, outermost first. False with the error
+    // the statement itself would give when it would fail before running.
+    bool planNodes(const Statement &statement, std::vector<PlanNode> &nodes, std::string &error)
+    {
+        if (!hasPlan(statement.kind))
         {
-            return "No database opened. Use 'open <database>' first.";
+            nodes.push_back(PlanNode{PlanOperator::None,
+                                     std::string(statementName(statement.kind)) + ": runs directly, without a plan",
+                                     {}});
+            return true;
         }
 
-        // Insert command
-        if (lowerQuery.substr(0, 11) == "insert into")
+        std::shared_ptr<Table> table = currentDatabase ? currentDatabase->getTable(statement.name) : nullptr;
+        if (!table)
         {
-            return handleInsert(q.substr(12));
+            error = currentDatabase ? "Table not found" : "No database opened. Use 'open <database>' first.";
+            return false;
         }
+        bool lsm = table->getEngine() == TableEngine::Lsm;
+        const std::string &name = statement.name;
 
-        // Delete command
-        if (lowerQuery.substr(0, 11) == "delete from")
+        switch (statement.kind)
         {
-            return handleDelete(q.substr(12));
+        case StatementKind::Insert:
+            nodes.push_back(PlanNode{PlanOperator::None,
+                                     "Insert into " + name + ": " + std::to_string(statement.rows.size()) +
+                                         (statement.rows.size() == 1 ? " row" : " rows") + ", one log commit",
+                                     {lsm ? "rows go to the memtable" : "rows appended to the last pages"}});
+            return true;
+        case StatementKind::Load:
+            nodes.push_back(PlanNode{PlanOperator::None, "Load into " + name + " from '" + statement.path + "'",
+                                     {"batches of " + std::to_string(LOAD_BATCH_ROWS) + " rows, one log commit each"}});
+            return true;
+        case StatementKind::Delete:
+            nodes.push_back(PlanNode{PlanOperator::None, "Delete from " + name + ": unique_id = " + statement.id,
+                                     {lsm ? "tombstone written to the memtable"
+                                          : "hash index on unique_id; rows tombstoned in place"}});
+            return true;
+        default:
+            break;
         }
 
-        // Select command
-        if (lowerQuery.substr(0, 11) == "select from")
+        long limit = -1, degree = 0;
+        if ((statement.limit && !parseCount(*statement.limit, limit)) ||
+            (statement.degree && (!parseCount(*statement.degree, degree) || degree < 1)))
         {
-            return handleSelect(q.substr(12));
+            error = "Invalid syntax. Use: [limit] [last] [parallel N] with N at least 1";
+            return false;
         }
 
-        return "Unknown command";
+        AggregateQuery query;
+        if (statement.kind == StatementKind::Aggregate)
+        {
+            query.outputs = statement.outputs;
+            query.groupBy = statement.groupBy;
+            if (!bindAggregate(query, *table, error))
+                return false;
+        }
+        ScanPlan plan;
+        if (!planStatement(*table, statement, nullptr, plan, error))
+        {
+            error += " in table '" + name + "'";
+            return false;
+        }
+        uint32_t pages = table->snapshot().pageCount;
+        std::string stop = limit == 0 ? ", limit 0: nothing is read"
+                           : limit > 0 ? ", stops after " + std::to_string(limit) + " rows"
+                                       : "";
+
+        if (statement.kind == StatementKind::Select && !statement.joinTable.empty())
+        {
+            std::shared_ptr<Table> right = currentDatabase->getTable(statement.joinTable);
+            size_t leftPosition = 0, rightPosition = 0;
+            if (!right)
+            {
+                error = "Table not found";
+                return false;
+            }
+            if (!bindJoin(*table, *right, statement.joinLeft, statement.joinRight, leftPosition, rightPosition, error))
+                return false;
+            HashJoin join(*table, leftPosition, *right, rightPosition);
+            const Table &build = join.buildsLeft() ? *table : *right;
+            const Table &probe = join.buildsLeft() ? *right : *table;
+            size_t buildThreads = HashJoin::threadsFor(build, build.snapshot().pageCount, static_cast<size_t>(degree));
+            size_t probeThreads = HashJoin::threadsFor(probe, probe.snapshot().pageCount, static_cast<size_t>(degree));
+            size_t partitions = join.getPartitions();
+            std::string buildText = "build " + build.getName() + ": full scan of " +
+                                    std::to_string(build.getRowCount()) + " rows" +
+                                    (buildThreads > 1 ? " on " + std::to_string(buildThreads) + " threads" : "") +
+                                    " into " +
+                                    (partitions == 1 ? std::string("one open-addressing table")
+                                                     : std::to_string(partitions) +
+                                                           " radix partitions, an open-addressing table each");
+            nodes.push_back(PlanNode{PlanOperator::Output, "Output: rows as text" + stop, {}});
+            nodes.push_back(PlanNode{PlanOperator::Join,
+                                     "Hash join: " + statement.joinLeft + " = " + statement.joinRight,
+                                     {buildText, "partitions spill to disk past " +
+                                                     std::to_string(join.getMemoryBudget() / (1024 * 1024)) + " MB"}});
+            nodes.push_back(scanNode(probe, ScanPlan{}, probeThreads,
+                                     "ranges of " + std::to_string(HashJoin::pagesPerTask()) + " pages"));
+            return true;
+        }
+
+        if (statement.kind == StatementKind::Select && !statement.orderBy.empty())
+        {
+            size_t position = 0;
+            if (!bindSortColumn(*table, statement.orderBy, position, error))
+                return false;
+            size_t threads =
+                RowSorter::threadsFor(*table, plan, pages, statement.degree ? static_cast<size_t>(degree) : 0);
+            RowSorter sorter(*table, plan, position, statement.descending);
+            std::string order = "Sort: by " + statement.orderBy + (statement.descending ? " desc" : " asc");
+            std::string method =
+                RowSorter::usesHeap(limit)
+                    ? "top " + std::to_string(limit) + " kept in a bounded heap per thread"
+                    : "external merge sort: runs spill to disk past " +
+                          std::to_string(sorter.getMemoryBudget() / (1024 * 1024)) + " MB, merged " +
+                          std::to_string(RowSorter::mergeWays()) + " at a time";
+            if (statement.last && limit > 0)
+                stop = ", last " + std::to_string(limit) + " rows in sort order";
+            nodes.push_back(PlanNode{PlanOperator::Output, "Output: rows as text" + stop, {}});
+            nodes.push_back(PlanNode{PlanOperator::Sort, order, {method}});
+            nodes.push_back(scanNode(*table, plan, threads,
+                                     "ranges of " + std::to_string(RowSorter::pagesPerTask()) + " pages"));
+            return true;
+        }
+        if (statement.kind == StatementKind::Select)
+        {
+            size_t threads = statement.degree ? static_cast<size_t>(degree) : ThreadPool::instance().size();
+            threads = selectRunsParallel(plan, threads, pages) ? threads : 1;
+            if (statement.last && limit > 0)
+                stop = ", last " + std::to_string(limit) +
+                       (plan.kind == ScanPlan::Kind::FullScan && !lsm ? " rows: walks back from the end, then forward"
+                                                                      : " rows: keeps a window of the last ones");
+            nodes.push_back(PlanNode{PlanOperator::Output, "Output: rows as text" + stop, {}});
+            nodes.push_back(scanNode(*table, plan, threads, "morsels of " + std::to_string(MORSEL_PAGES) + " pages"));
+            return true;
+        }
+
+        std::string outputs, groupBy;
+        for (const auto &output : query.outputs)
+            outputs += (outputs.empty() ? "" : ", ") + output.label;
+        for (const auto &column : query.groupBy)
+            groupBy += (groupBy.empty() ? " group by " : ", ") + column;
+        HashAggregator aggregator(*table, plan, query);
+        size_t threads = HashAggregator::threadsFor(plan, pages, static_cast<size_t>(degree));
+        nodes.push_back(PlanNode{PlanOperator::Output, "Output: rows as text" + stop, {}});
+        nodes.push_back(PlanNode{PlanOperator::Aggregate, "Hash aggregate: " + outputs + groupBy,
+                                 {"partial groups spill to disk past " +
+                                  std::to_string(aggregator.getMemoryBudget() / (1024 * 1024)) + " MB"}});
+        nodes.push_back(scanNode(*table, plan, threads,
+                                 "ranges of " + std::to_string(HashAggregator::pagesPerTask()) + " pages"));
+        return true;
     }
 
-private:
-    std::string handleLogin(const std::string &params)
+    // One operator per line, each inside the one that consumes its rows
+    static std::string renderPlan(const std::vector<PlanNode> &nodes, const std::vector<std::string> &actuals)
     {
-        if (!params.empty())
+        std::string text;
+        for (size_t i = 0; i < nodes.size(); ++i)
+        {
+            std::string indent(i * 4, ' ');
+            text += indent + (i > 0 ? "-> " : "") + nodes[i].text + "\n";
+            indent += i > 0 ? "     " : "  ";
+            for (const auto &detail : nodes[i].details)
+                text += indent + detail + "\n";
+            if (i < actuals.size())
+                text += indent + "actual: " + actuals[i] + "\n";
+        }
+        return text;
+    }
+
+    // explain [analyze] <statement>: the operators the statement would run.
+    // With analyze the statement runs, its rows are counted instead of
+    // shown, and each operator reports its time and rows. Scans on several
+    // threads report their time summed over the threads. Bytes, buffer
+    // pool and zone map counts are process-wide, so other sessions running
+    // at the same time add to them.
+    std::string handleExplain(const Statement &explain)
+    {
+        std::vector<Token> tokens;
+        Statement statement;
+        std::string error;
+        if (!tokenizeStatement(explain.body, tokens, error) || !parseStatement(tokens, statement, error))
+        {
+            return error;
+        }
+        if (statement.kind == StatementKind::Explain || statement.kind == StatementKind::Login)
+        {
+            return "Cannot explain " + std::string(statementName(statement.kind));
+        }
+
+        std::vector<PlanNode> nodes;
+        if (!planNodes(statement, nodes, error))
+        {
+            return error;
+        }
+        if (!explain.analyze)
         {
-            return "Usage: login";
+            return renderPlan(nodes, {});
+        }
+        // Only planned statements are run: the server decides which ones
+        // run alone from the statement text, which here starts "explain"
+        if (!hasPlan(statement.kind))
+        {
+            return "Cannot analyze " + std::string(statementName(statement.kind)) + ": it runs directly, without a plan";
         }
 
+        QueryProfile queryProfile;
+        LineCounter counter;
+        std::ostream sink(&counter);
+        IoStats io = Metrics::instance().io();
+        BufferPoolStats pool = BufferPool::instance().stats();
+        ScanSkipStats skips = ScanSkipCounters::instance().stats();
+        std::ostream *callerSink = resultSink;
+        resultSink = &sink;
+        profile = &queryProfile;
+        auto started = std::chrono::steady_clock::now();
+        std::string result;
+        try
+        {
+            result = dispatch(statement, nullptr);
+        }
+        catch (...)
+        {
+            resultSink = callerSink;
+            profile = nullptr;
+            throw;
+        }
+        uint64_t total = QueryProfile::since(started);
+        resultSink = callerSink;
+        profile = nullptr;
+
+        IoStats ioAfter = Metrics::instance().io();
+        BufferPoolStats poolAfter = BufferPool::instance().stats();
+        ScanSkipStats skipsAfter = ScanSkipCounters::instance().stats();
+        uint64_t rowsOut = counter.lines > 0 ? counter.lines - 1 : 0; // after the header line
+        bool aggregate = statement.kind == StatementKind::Aggregate;
+        bool joined = statement.kind == StatementKind::Select && !statement.joinTable.empty();
+        bool sorted = joined || (statement.kind == StatementKind::Select && !statement.orderBy.empty());
+        auto rows = [](uint64_t in, uint64_t out)
+        { return ", rows in " + std::to_string(in) + ", out " + std::to_string(out); };
+
+        std::vector<std::string> actuals;
+        for (const PlanNode &node : nodes)
+        {
+            const QueryProfile &p = queryProfile;
+            switch (node.op)
+            {
+            case PlanOperator::Output:
+                actuals.push_back("time " +
+                                  formatMillis(aggregate || sorted ? p.outputNanos.load()
+                                                                   : p.downstreamNanos + p.outputNanos) +
+                                  " ms" +
+                                  rows(aggregate ? p.groups.load() : joined ? rowsOut : p.rowsMatched.load(), rowsOut));
+                break;
+            case PlanOperator::Join:
+            {
+                // Joined rows are handed on from inside the probe
+                uint64_t joining = p.buildNanos + p.downstreamNanos + p.mergeNanos;
+                joining -= std::min<uint64_t>(joining, p.outputNanos);
+                actuals.push_back("time " + formatMillis(joining) + " ms, build " + formatMillis(p.buildNanos) + " ms over " +
+                                  std::to_string(p.buildRows) + " rows" + rows(p.rowsMatched, rowsOut) +
+                                  ", spilled " + std::to_string(p.spillBytes) + " bytes");
+                break;
+            }
+            case PlanOperator::Sort:
+                actuals.push_back("time " + formatMillis(p.downstreamNanos + p.mergeNanos) + " ms" +
+                                  rows(p.rowsMatched, rowsOut) + ", spilled " + std::to_string(p.spillBytes) +
+                                  " bytes");
+                break;
+            case PlanOperator::Aggregate:
+                actuals.push_back("time " + formatMillis(p.downstreamNanos + p.mergeNanos) + " ms" +
+                                  rows(p.rowsMatched, p.groups) + ", spilled " + std::to_string(p.spillBytes) +
+                                  " bytes");
+                break;
+            case PlanOperator::Scan:
+                actuals.push_back(
+                    "time " + formatMillis(p.scanNanos) + " ms" +
+                    (p.threads > 1 ? " over " + std::to_string(p.threads) + " threads" : "") +
+                    rows(p.rowsRead, p.rowsMatched) + ", bytes read " +
+                    std::to_string(ioAfter.bytesRead - io.bytesRead) + ", buffer pool hits " +
+                    std::to_string(poolAfter.hits - pool.hits) + ", misses " +
+                    std::to_string(poolAfter.misses - pool.misses) + ", zone map blocks skipped " +
+                    std::to_string(skipsAfter.blocksSkipped - skips.blocksSkipped) +
+                    (skipsAfter.encodedRowsDropped > skips.encodedRowsDropped
+                         ? ", rows dropped on encoded columns " +
+                               std::to_string(skipsAfter.encodedRowsDropped - skips.encodedRowsDropped)
+                         : ""));
+                break;
+            default:
+                actuals.push_back("time " + formatMillis(total) + " ms, rows written " +
+                                  std::to_string(ioAfter.rowsWritten - io.rowsWritten) + ", bytes written " +
+                                  std::to_string(ioAfter.bytesWritten - io.bytesWritten));
+                break;
+            }
+        }
+
+        std::string text = renderPlan(nodes, actuals) + "Total: " + formatMillis(total) + " ms\n";
+        if (!result.empty())
+        {
+            text += "Result: " + result + (result.back() == '\n' ? "" : "\n");
+        }
+        return text;
+    }
+
+    std::string handleLogin()
+    {
         std::string username, password;
         std::cout << "Username: ";
         std::getline(std::cin, username);
@@ -165,25 +811,184 @@ private:
     {
         std::stringstream result;
         result << "Available databases:\n";
-        for (const auto &db : currentUser->getDatabases())
+        for (const auto &dbName : currentUser->getDatabaseNames())
         {
-            result << "- " << db.first << "\n";
+            result << "- " << dbName << "\n";
         }
         return result.str();
     }
 
+    static std::string handleShowPool()
+    {
+        BufferPoolStats stats = BufferPool::instance().stats();
+        uint64_t lookups = stats.hits + stats.misses;
+        std::stringstream result;
+        result << "Buffer pool (" << stats.policy << "): "
+               << stats.frames << " frames, " << stats.budgetBytes / (1024 * 1024) << " MB\n"
+               << "  hits:       " << stats.hits << "\n"
+               << "  misses:     " << stats.misses << "\n"
+               << "  hit ratio:  " << (lookups ? 100.0 * stats.hits / lookups : 0.0) << "%\n"
+               << "  evictions:  " << stats.evictions << "\n"
+               << "  writebacks: " << stats.writebacks << "\n";
+        return result.str();
+    }
+
+    // How much reading zone maps and Bloom filters have saved so far
+    static std::string handleShowScans()
+    {
+        ScanSkipStats stats = ScanSkipCounters::instance().stats();
+        uint64_t blocks = stats.blocksRead + stats.blocksSkipped;
+        std::stringstream result;
+        result << "Filtered scans (zone maps):\n"
+               << "  blocks read:    " << stats.blocksRead << "\n"
+               << "  blocks skipped: " << stats.blocksSkipped << "\n"
+               << "  skip ratio:     " << (blocks ? 100.0 * stats.blocksSkipped / blocks : 0.0) << "%\n"
+               << "Point lookups (Bloom filters):\n"
+               << "  segment probes: " << stats.bloomProbes << "\n"
+               << "  segments skipped: " << stats.bloomSkips << "\n"
+               << "Encoded blocks (LSM):\n"
+               << "  rows checked: " << stats.encodedRowsChecked << "\n"
+               << "  rows dropped: " << stats.encodedRowsDropped << "\n";
+        return result.str();
+    }
+
+    // Latency per kind of command, rows and bytes moved, and the buffer
+    // pool, scan and plan cache counters, in one report. Plan cache counts
+    // are per session and left out without one.
+    static std::string statsReport(const PlanCache *cache)
+    {
+        const Metrics &metrics = Metrics::instance();
+        std::stringstream result;
+        result << "Commands (latency in ms):\n"
+               << "  command            count       mean        p50        p90        p99        max\n";
+        for (size_t kind = 0; kind <= static_cast<size_t>(StatementKind::Explain); ++kind)
+        {
+            const LatencyHistogram &histogram = metrics.command(kind);
+            if (histogram.count() == 0)
+                continue;
+            std::string name = statementName(static_cast<StatementKind>(kind));
+            result << "  " << name << std::string(name.size() < 17 ? 17 - name.size() : 1, ' ');
+            std::string count = std::to_string(histogram.count());
+            result << std::string(count.size() < 7 ? 7 - count.size() : 1, ' ') << count;
+            for (uint64_t nanos : {histogram.mean(), histogram.percentile(0.5), histogram.percentile(0.9),
+                                   histogram.percentile(0.99), histogram.max()})
+            {
+                std::string value = formatMillis(nanos);
+                result << std::string(value.size() < 11 ? 11 - value.size() : 1, ' ') << value;
+            }
+            result << "\n";
+        }
+
+        IoStats io = metrics.io();
+        result << "Rows:\n"
+               << "  read:    " << io.rowsRead << "\n"
+               << "  written: " << io.rowsWritten << "\n"
+               << "Files:\n"
+               << "  opens:         " << io.fileOpens << "\n"
+               << "  bytes read:    " << io.bytesRead << "\n"
+               << "  bytes written: " << io.bytesWritten << "\n"
+               << handleShowPool() << handleShowScans();
+        if (cache)
+        {
+            uint64_t lookups = cache->getHits() + cache->getMisses();
+            result << "Plan cache (this session): " << cache->size() << " statements\n"
+                   << "  hits:      " << cache->getHits() << "\n"
+                   << "  misses:    " << cache->getMisses() << "\n"
+                   << "  hit ratio: " << (lookups ? 100.0 * cache->getHits() / lookups : 0.0) << "%\n";
+        }
+        return result.str();
+    }
+
+    // set stats '<file>' <seconds> | set stats off
+    std::string handleSetStats(const Statement &statement)
+    {
+        if (statement.path.empty())
+        {
+            Metrics::instance().stopDump();
+            return "Stats dump stopped";
+        }
+
+        long seconds = 0;
+        if (!parseCount(statement.words[0], seconds) || seconds == 0 || seconds > UINT32_MAX)
+        {
+            return "Invalid syntax. Use: set stats '<file>' <seconds> or set stats off";
+        }
+        if (!Metrics::instance().startDump(statement.path, static_cast<uint32_t>(seconds),
+                                           []()
+                                           { return statsReport(nullptr); }))
+        {
+            return "Cannot write to '" + statement.path + "'";
+        }
+        return "Writing stats to '" + statement.path + "' every " + std::to_string(seconds) + " s";
+    }
+
+    std::string handleSetPool(const std::vector<std::string> &parts)
+    {
+        long megabytes = 0;
+        try
+        {
+            megabytes = parts.empty() ? 0 : std::stol(parts[0]);
+        }
+        catch (...)
+        {
+        }
+        if (megabytes <= 0)
+        {
+            return "Invalid syntax. Use: set pool <megabytes> [clock|lru-k]";
+        }
+
+        std::string policy = parts.size() > 1 ? parts[1] : BufferPool::instance().stats().policy;
+        if (!BufferPool::instance().configure(static_cast<size_t>(megabytes) * 1024 * 1024, policy))
+        {
+            return "Buffer pool is busy; try again";
+        }
+        return "Buffer pool resized to " + std::to_string(megabytes) + " MB";
+    }
+
+    std::string handleSetDurability(const std::vector<std::string> &parts)
+    {
+        DurabilityConfig config;
+        if (parts.size() == 1 && parts[0] == "none")
+        {
+            config.mode = Durability::None;
+        }
+        else if (parts.size() == 1 && parts[0] == "fsync")
+        {
+            config.mode = Durability::Fsync;
+        }
+        else if (parts.size() == 3 && parts[0] == "group")
+        {
+            try
+            {
+                config.mode = Durability::Group;
+                config.groupRows = static_cast<uint32_t>(std::stoul(parts[1]));
+                config.groupMicros = static_cast<uint32_t>(std::stoul(parts[2]));
+            }
+            catch (...)
+            {
+                return "Invalid group settings. Use: set durability group <rows> <microseconds>";
+            }
+        }
+        else
+        {
+            return "Invalid syntax. Use: set durability none|fsync|group <rows> <microseconds>";
+        }
+
+        currentDatabase->setDurability(config);
+        return "Durability set to " + config.describe();
+    }
+
     std::string handleCreateDatabase(const std::string &dbName)
     {
-        if (currentUser->createDatabase(trim(dbName)))
+        if (currentUser->createDatabase(dbName))
         {
             return "Database '" + dbName + "' created successfully";
         }
         return "Failed to create database";
     }
 
-    std::string handleOpenDatabase(const std::string &dbName)
+    std::string handleOpenDatabase(const std::string &name)
     {
-        std::string name = trim(dbName);
         auto db = currentUser->getDatabase(name);
         if (db)
         {
@@ -191,48 +996,118 @@ private:
             std::stringstream result;
             result << "Opened database '" << name << "'\n";
             result << "Available tables:\n";
-            for (const auto &table : db->getTables())
+            for (const CatalogEntry &table : db->listTables())
             {
-                result << "- " << table->getName() << "\n";
+                result << "- " << table.name << " (";
+                for (size_t i = 0; i < table.columns.size(); ++i)
+                {
+                    result << (i > 0 ? ", " : "") << table.columns[i] << " " << table.types[i].name();
+                }
+                result << ")" << (table.engine == TableEngine::Lsm ? " engine=lsm" : "") << "\n";
+                for (const auto &[indexName, column] : table.indexes)
+                {
+                    result << "    index " << indexName << " on " << column << "\n";
+                }
             }
             return result.str();
         }
         return "Database not found or access denied";
     }
 
-    std::string handleCreateTable(const std::string &params)
+    std::string handleCreateTable(const Statement &statement)
     {
-        size_t parensStart = params.find('(');
-        if (parensStart == std::string::npos)
+        if (currentDatabase->createTable(statement.name, statement.columns, statement.types, statement.engine))
         {
-            return "Invalid syntax. Use: create table name (attr1, attr2, ...)";
+            return "Table '" + statement.name + "' created successfully";
         }
+        return "Failed to create table";
+    }
 
-        // Extract table name - trim the name before the parenthesis
-        std::string tableName = trim(params.substr(0, parensStart));
-        std::string attrList = params.substr(parensStart);
+    // create index <name> on <table>(<column>)
+    std::string handleCreateIndex(const Statement &statement)
+    {
+        const std::string &indexName = statement.name;
+        const std::string &tableName = statement.table;
+        const std::string &column = statement.column;
 
-        // Parse attribute list, excluding the table name from schema
-        auto attributes = parseAttributeList(attrList);
+        auto table = currentDatabase->getTable(tableName);
+        if (!table)
+        {
+            return "Table not found";
+        }
+        const auto &schema = table->getSchema();
+        if (std::find(schema.begin(), schema.end(), column) == schema.end())
+        {
+            return "Column '" + column + "' not found in table '" + tableName + "'";
+        }
+        if (table->getEngine() == TableEngine::Lsm)
+        {
+            return "Table '" + tableName + "' uses the lsm engine, which has no secondary indexes";
+        }
+        if (table->hasIndex(indexName))
+        {
+            return "Index '" + indexName + "' already exists";
+        }
+        if (!table->indexOn(column).empty())
+        {
+            return "Column '" + column + "' is already indexed by '" + table->indexOn(column) + "'";
+        }
 
-        if (currentDatabase->createTable(tableName, attributes))
+        if (!currentDatabase->createIndex(tableName, indexName, column))
         {
-            return "Table '" + tableName + "' created successfully";
+            return "Failed to create index";
         }
-        return "Failed to create table";
+        return "Index '" + indexName + "' created on " + tableName + "(" + column + ")";
     }
 
-    std::string handleInsert(const std::string &params)
+    std::string handleInsert(Statement &statement)
     {
-        size_t parensStart = params.find('(');
-        if (parensStart == std::string::npos)
+        const std::string &tableName = statement.name;
+        std::vector<std::vector<std::string>> &rows = statement.rows;
+
+        auto table = currentDatabase->getTable(tableName);
+        if (!table)
         {
-            return "Invalid syntax. Use: insert into table_name (value1, value2, ...)";
+            return "Table not found";
         }
 
-        std::string tableName = trim(params.substr(0, parensStart));
-        std::string valueList = params.substr(parensStart);
-        auto values = parseAttributeList(valueList);
+        for (size_t i = 0; i < rows.size(); ++i)
+        {
+            if (rows[i].size() != table->getSchema().size())
+            {
+                return "Row " + std::to_string(i + 1) + " has " + std::to_string(rows[i].size()) +
+                       " values, expected " + std::to_string(table->getSchema().size());
+            }
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        std::string error;
+        size_t failedRow = 0;
+        std::string id;
+        size_t inserted = table->insertRows(rows, &error, &failedRow, &id);
+        if (inserted == 0)
+        {
+            if (error.empty())
+                return "Failed to insert data";
+            return rows.size() == 1 ? error : "Row " + std::to_string(failedRow + 1) + ": " + error;
+        }
+        currentDatabase->maybeCheckpoint();
+
+        if (rows.size() == 1)
+        {
+            return "Generated unique ID: " + id;
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        return "Inserted " + std::to_string(inserted) + " rows in " + formatRate(inserted, elapsed.count());
+    }
+
+    // load into <table> from '<file.csv>'
+    // Streams the file in batches so each batch is validated, appended and
+    // committed as a unit. A first line naming the columns is skipped.
+    std::string handleLoad(const Statement &statement)
+    {
+        const std::string &tableName = statement.name;
+        const std::string &path = statement.path;
 
         auto table = currentDatabase->getTable(tableName);
         if (!table)
@@ -240,23 +1115,87 @@ private:
             return "Table not found";
         }
 
-        if (table->insertRow(values))
+        std::ifstream file(path);
+        if (!file.is_open())
         {
-            return "";
+            return "Failed to open file: " + path;
         }
-        return "Failed to insert data";
-    }
 
-    std::string handleDelete(const std::string &params)
-    {
-        auto parts = split(params, ' ');
-        if (parts.size() != 2 || parts[1].substr(0, 3) != "id:")
+        const size_t batchSize = LOAD_BATCH_ROWS;
+        const auto &schema = table->getSchema();
+        std::vector<std::vector<std::string>> batch;
+        std::vector<size_t> batchLines;
+        batch.reserve(batchSize);
+        batchLines.reserve(batchSize);
+        size_t loaded = 0;
+        size_t lineNo = 0;
+        std::string line;
+        std::string error;
+
+        auto start = std::chrono::steady_clock::now();
+        auto flushBatch = [&]()
+        {
+            if (batch.empty())
+                return true;
+            size_t failedRow = 0;
+            size_t inserted = table->insertRows(batch, &error, &failedRow);
+            if (inserted == 0)
+            {
+                error = "Line " + std::to_string(batchLines[failedRow]) + ": " +
+                        (error.empty() ? "failed to insert" : error) + "; loaded " +
+                        std::to_string(loaded) + " rows before its batch";
+            }
+            batch.clear();
+            batchLines.clear();
+            currentDatabase->maybeCheckpoint();
+            loaded += inserted;
+            return inserted > 0;
+        };
+
+        while (std::getline(file, line))
+        {
+            ++lineNo;
+            if (!line.empty() && line.back() == '\r')
+                line.pop_back();
+            if (trim(line).empty())
+                continue;
+
+            auto values = split(line, ',');
+            if (lineNo == 1 && (values == schema ||
+                                (!values.empty() && values.front() == "unique_id" &&
+                                 std::equal(values.begin() + 1, values.end(), schema.begin(), schema.end()))))
+            {
+                continue;
+            }
+            // Rejected before its batch is committed, like a row the table
+            // itself refuses
+            if (values.size() != schema.size())
+            {
+                return "Line " + std::to_string(lineNo) + " has " + std::to_string(values.size()) +
+                       " values, expected " + std::to_string(schema.size()) + "; loaded " +
+                       std::to_string(loaded) + " rows before its batch";
+            }
+
+            batch.push_back(std::move(values));
+            batchLines.push_back(lineNo);
+            if (batch.size() == batchSize && !flushBatch())
+            {
+                return error;
+            }
+        }
+        if (!flushBatch())
         {
-            return "Invalid syntax. Use: delete from table_name id:value";
+            return error;
         }
 
-        std::string tableName = parts[0];
-        std::string id = parts[1].substr(3);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        return "Loaded " + std::to_string(loaded) + " rows in " + formatRate(loaded, elapsed.count());
+    }
+
+    std::string handleDelete(const Statement &statement)
+    {
+        const std::string &tableName = statement.name;
+        const std::string &id = statement.id;
 
         auto table = currentDatabase->getTable(tableName);
         if (!table)
@@ -264,39 +1203,91 @@ private:
             return "Table not found";
         }
 
-        // Implementation for deletion goes here
-        return "Record deleted successfully";
+        size_t deleted = table->deleteById(id);
+        if (deleted == 0)
+        {
+            return "Record not found";
+        }
+        currentDatabase->maybeCheckpoint();
+        return deleted == 1 ? "Record deleted successfully"
+                            : std::to_string(deleted) + " records deleted successfully";
     }
 
-    std::string handleSelect(const std::string &params)
+    // Buffers result lines and hands them to the output stream in blocks of
+    // about CHUNK_SIZE bytes, so a large select never holds more than one
+    // block in memory
+    class ChunkedWriter
     {
-        auto parts = split(params, ' ');
-        if (parts.empty())
+    private:
+        static constexpr size_t CHUNK_SIZE = 64 * 1024;
+        std::ostream &out;
+        std::string buffer;
+
+    public:
+        explicit ChunkedWriter(std::ostream &stream) : out(stream) { buffer.reserve(CHUNK_SIZE); }
+
+        void write(const std::string &line)
         {
-            return "Invalid syntax. Use: select from table_name [limit] [last]";
+            buffer += line;
+            buffer += '\n';
+            if (buffer.size() >= CHUNK_SIZE)
+                flush();
         }
 
-        std::string tableName = parts[0];
-        int limit = -1;
-        bool last = false;
-
-        if (parts.size() > 1)
+        void write(const std::vector<std::string> &fields)
         {
-            try
+            for (size_t i = 0; i < fields.size(); ++i)
             {
-                limit = std::stoi(parts[1]);
-                if (parts.size() > 2 && parts[2] == "last")
-                {
-                    last = true;
-                }
-            }
-            catch (...)
-            {
-                if (parts[1] == "last")
-                {
-                    last = true;
-                }
+                if (i > 0)
+                    buffer += ',';
+                buffer += fields[i];
             }
+            buffer += '\n';
+            if (buffer.size() >= CHUNK_SIZE)
+                flush();
+        }
+
+        // Lines that are already newline-terminated
+        void writeLines(std::string_view lines)
+        {
+            buffer += lines;
+            if (buffer.size() >= CHUNK_SIZE)
+                flush();
+        }
+
+        void flush()
+        {
+            out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+            buffer.clear();
+        }
+    };
+
+    // select from <table> [where <condition> | id:<value>] [limit] [last] [parallel N]
+    std::string handleSelect(const Statement &statement, CachedStatement *cached)
+    {
+        if (!statement.joinTable.empty())
+        {
+            return handleJoin(statement);
+        }
+        const std::string &tableName = statement.name;
+        long limit = -1;
+        bool last = statement.last;
+        if (statement.limit && !parseCount(*statement.limit, limit))
+        {
+            return "Invalid syntax. Use: select from table_name [where condition | id:value] "
+                   "[order by c [asc|desc]] [limit] [last] [parallel N]";
+        }
+
+        // Full scans use the whole pool unless the query asks for fewer
+        size_t degree = ThreadPool::instance().size();
+        long requested = 0;
+        if (statement.degree && (!parseCount(*statement.degree, requested) || requested < 1))
+        {
+            return "Invalid syntax. Use: parallel N with N at least 1";
+        }
+        if (statement.degree)
+        {
+            degree = static_cast<size_t>(requested);
         }
 
         auto table = currentDatabase->getTable(tableName);
@@ -305,65 +1296,273 @@ private:
             return "Table not found";
         }
 
-        // Open the table's CSV file
-        std::ifstream file(currentDatabase->getName() + "/" + tableName + ".csv");
-        if (!file.is_open())
+        // Pick a full scan or an index; id:<value> is a unique_id lookup
+        ScanPlan plan;
+        std::string error;
+        if (!planStatement(*table, statement, cached, plan, error))
         {
-            return "Failed to open table file";
+            return error + " in table '" + tableName + "'";
+        }
+        size_t sortPosition = 0;
+        if (!statement.orderBy.empty() && !bindSortColumn(*table, statement.orderBy, sortPosition, error))
+        {
+            return error;
         }
 
-        // Read the header
-        std::string headerLine;
-        std::getline(file, headerLine);
+        // Rows go out in chunks as they are read; without a caller supplied
+        // stream they are collected into the returned string instead
+        std::ostringstream collected;
+        ChunkedWriter writer(resultSink ? *resultSink : collected);
 
-        // Store all rows
-        std::vector<std::string> rows;
-        std::string row;
-        while (std::getline(file, row))
+        // Header line mirrors the column list
+        std::string headerLine = "unique_id";
+        for (const auto &column : table->getSchema())
         {
-            rows.push_back(row);
+            headerLine += "," + column;
         }
+        writer.write(headerLine);
 
-        // Process rows based on limit and last options
-        std::stringstream result;
-        result << headerLine << "\n";
-
-        if (limit == -1)
+        auto emit = [&writer](RowId, const std::vector<std::string> &fields)
+        {
+            writer.write(fields);
+            return true;
+        };
+
+        // Every pass of the statement reads one snapshot
+        ScanOptions options;
+        ReadView view = table->snapshot();
+        options.view = &view;
+        options.profile = profile;
+
+        // Full scans of more than one morsel go to the pool. Morsel outputs
+        // come back in page order, so limit and last see file order.
+        const RowFormat &format = table->getFormat();
+        bool parallel = selectRunsParallel(plan, degree, view.pageCount);
+        if (profile && parallel)
+            profile->threads = degree;
+        auto render = [&format](std::string_view record, std::string &out)
         {
-            // Return all rows
-            for (const auto &r : rows)
+            std::vector<std::string> fields = format.decode(record);
+            for (size_t i = 0; i < fields.size(); ++i)
             {
-                result << r << "\n";
+                if (i > 0)
+                    out += ',';
+                out += fields[i];
             }
+            out += '\n';
+        };
+        auto scanParallel = [&](const ScanOptions &scanOptions)
+        {
+            size_t remaining = limit < 0 ? SIZE_MAX : static_cast<size_t>(limit);
+            parallelScan(*table, plan, degree, scanOptions, remaining, render, [&](const MorselOutput &output)
+                         {
+                             size_t rows = std::min(remaining, output.rowEnds.size());
+                             auto started = std::chrono::steady_clock::now();
+                             if (rows > 0)
+                                 writer.writeLines(std::string_view(output.text.data(), output.rowEnds[rows - 1]));
+                             if (profile)
+                                 profile->outputNanos += QueryProfile::since(started);
+                             remaining -= rows;
+                             return remaining > 0; });
+        };
+
+        if (limit == 0)
+        {
+            // Nothing to read
+        }
+        else if (!statement.orderBy.empty())
+        {
+            // Sorted rows come out of the sorter; last takes the final
+            // 'limit' of them, still in sort order
+            RowSorter sorter(*table, plan, sortPosition, statement.descending);
+            sorter.run([&](std::string_view record)
+                       { writer.write(format.decode(record));
+                         return true; },
+                       limit, last, degree, profile);
+        }
+        else if ((!last || limit < 0) && parallel)
+        {
+            scanParallel(options);
+        }
+        else if (!last || limit < 0)
+        {
+            // Stop reading once 'limit' rows have gone out
+            long remaining = limit;
+            executeScan(*table, plan, [&](RowId rid, const std::vector<std::string> &fields)
+                        { emit(rid, fields);
+                          return remaining < 0 || --remaining > 0; }, options);
+        }
+        else if (plan.kind == ScanPlan::Kind::FullScan && table->getEngine() == TableEngine::Heap)
+        {
+            // Walk backwards from the end of the file to the 'limit'-th
+            // matching row, then stream forward from there
+            long remaining = limit;
+            RowId start{1, 0};
+            ScanOptions backward = options;
+            backward.reverse = true;
+            executeScan(*table, plan, [&](RowId rid, const std::vector<std::string> &)
+                        { start = rid;
+                          return --remaining > 0; }, backward);
+
+            ScanOptions forward = options;
+            forward.start = start;
+            if (parallel)
+                scanParallel(forward);
+            else
+                executeScan(*table, plan, emit, forward);
         }
         else
         {
-            if (last)
+            // Index order is not file order, and LSM tables cannot walk
+            // backwards cheaply, so keep a window of the last rows
+            std::deque<std::vector<std::string>> window;
+            executeScan(*table, plan, [&](RowId, const std::vector<std::string> &fields)
+                        { window.push_back(fields);
+                          if (window.size() > static_cast<size_t>(limit))
+                              window.pop_front();
+                          return true; }, options);
+            auto started = std::chrono::steady_clock::now();
+            for (const auto &fields : window)
             {
-                // Get the last 'limit' rows
-                int startIndex = std::max(0, static_cast<int>(rows.size() - limit));
-                for (int i = startIndex; i < rows.size(); ++i)
-                {
-                    result << rows[i] << "\n";
-                }
+                writer.write(fields);
             }
-            else
+            if (profile)
+                profile->outputNanos += QueryProfile::since(started);
+        }
+
+        writer.flush();
+        return collected.str();
+    }
+
+    // select from <left> join <right> on <left>.x = <right>.y [limit] [parallel N]
+    std::string handleJoin(const Statement &statement)
+    {
+        long limit = -1;
+        long degree = 0;
+        if ((statement.limit && !parseCount(*statement.limit, limit)) ||
+            (statement.degree && (!parseCount(*statement.degree, degree) || degree < 1)))
+        {
+            return "Invalid syntax. Use: select from table_name join other on table_name.c = other.c [limit] "
+                   "[parallel N]";
+        }
+
+        auto left = currentDatabase->getTable(statement.name);
+        auto right = currentDatabase->getTable(statement.joinTable);
+        if (!left || !right)
+        {
+            return "Table not found";
+        }
+        size_t leftPosition = 0, rightPosition = 0;
+        std::string error;
+        if (!bindJoin(*left, *right, statement.joinLeft, statement.joinRight, leftPosition, rightPosition, error))
+        {
+            return error;
+        }
+
+        std::ostringstream collected;
+        ChunkedWriter writer(resultSink ? *resultSink : collected);
+
+        // Columns are qualified with their table, left columns first
+        std::string headerLine;
+        for (const auto &table : {left, right})
+        {
+            headerLine += (headerLine.empty() ? "" : ",") + table->getName() + ".unique_id";
+            for (const auto &column : table->getSchema())
             {
-                // Get the first 'limit' rows
-                for (int i = 0; i < std::min(limit, static_cast<int>(rows.size())); ++i)
-                {
-                    result << rows[i] << "\n";
-                }
+                headerLine += "," + table->getName() + "." + column;
             }
         }
+        writer.write(headerLine);
 
-        return result.str();
+        const RowFormat &leftFormat = left->getFormat();
+        const RowFormat &rightFormat = right->getFormat();
+        auto render = [&leftFormat, &rightFormat](std::string_view leftRecord, std::string_view rightRecord,
+                                                  std::string &out)
+        {
+            for (const auto &field : leftFormat.decode(leftRecord))
+            {
+                out += field;
+                out += ',';
+            }
+            std::vector<std::string> fields = rightFormat.decode(rightRecord);
+            for (size_t i = 0; i < fields.size(); ++i)
+            {
+                if (i > 0)
+                    out += ',';
+                out += fields[i];
+            }
+            out += '\n';
+        };
+
+        HashJoin join(*left, leftPosition, *right, rightPosition);
+        join.run(render, [&writer](std::string_view lines)
+                 { writer.writeLines(lines);
+                   return true; },
+                 limit, static_cast<size_t>(degree), profile);
+        writer.flush();
+        return collected.str();
+    }
+
+    // select <list> from <table> [where <condition>] [group by <col>, ...] [limit] [parallel N]
+    std::string handleAggregate(const Statement &statement, CachedStatement *cached)
+    {
+        const std::string &tableName = statement.name;
+        long limit = -1;
+        long degree = 0;
+        if ((statement.limit && !parseCount(*statement.limit, limit)) ||
+            (statement.degree && (!parseCount(*statement.degree, degree) || degree < 1)))
+        {
+            return "Invalid syntax. Use: select count(*)|sum(c)|min(c)|max(c)|avg(c)|c, ... "
+                   "from table_name [where condition] [group by c, ...] [limit] [parallel N]";
+        }
+
+        AggregateQuery query;
+        query.outputs = statement.outputs;
+        query.groupBy = statement.groupBy;
+        std::string error;
+        auto table = currentDatabase->getTable(tableName);
+        if (!table)
+        {
+            return "Table not found";
+        }
+        if (!bindAggregate(query, *table, error))
+        {
+            return error;
+        }
+        ScanPlan plan;
+        if (!planStatement(*table, statement, cached, plan, error))
+        {
+            return error + " in table '" + tableName + "'";
+        }
+
+        std::ostringstream collected;
+        ChunkedWriter writer(resultSink ? *resultSink : collected);
+        std::string headerLine;
+        for (const auto &output : query.outputs)
+        {
+            headerLine += (headerLine.empty() ? "" : ",") + output.label;
+        }
+        writer.write(headerLine);
+
+        long remaining = limit;
+        if (limit != 0)
+        {
+            QueryProfile *timing = profile;
+            HashAggregator(*table, plan, query).run([&writer, &remaining, timing](const std::vector<std::string> &row)
+                                                    {
+                                                        auto started = std::chrono::steady_clock::now();
+                                                        writer.write(row);
+                                                        if (timing)
+                                                            timing->outputNanos += QueryProfile::since(started);
+                                                        return remaining < 0 || --remaining > 0; },
+                                                    static_cast<size_t>(degree), profile);
+        }
+        writer.flush();
+        return collected.str();
     }
 
-    std::string handleDropTable(const std::string &tableName)
+    std::string handleDropTable(const std::string &name)
     {
-        // Trim the table name to remove any extra whitespace
-        std::string name = trim(tableName);
 
         // Check if a database is currently open
         if (!currentDatabase)
@@ -380,30 +1579,12 @@ private:
 
         try
         {
-            // Construct the full file path for the table
-            std::string filePath = "database/" + currentUser->getName() + "/" +
-                                   currentDatabase->getName() + "/" + name + ".csv";
-
-            // Remove the table file
-            if (std::filesystem::exists(filePath))
-            {
-                std::filesystem::remove(filePath);
-            }
-            else
+            if (!std::filesystem::exists(table->getFilePath()))
             {
                 return "Table file not found";
             }
-
-            // Remove the table from the database's tables vector
-            auto &tables = const_cast<std::vector<std::shared_ptr<Table>> &>(currentDatabase->getTables());
-            tables.erase(
-                std::remove_if(tables.begin(), tables.end(),
-                               [&name](const std::shared_ptr<Table> &t)
-                               {
-                                   return t->getName() == name;
-                               }),
-                tables.end());
-
+            // Remove the table file and its index files
+            currentDatabase->dropTable(name);
             return "Table '" + name + "' dropped successfully";
         }
         catch (const std::filesystem::filesystem_error &e)
@@ -418,10 +1599,8 @@ private:
         }
     }
 
-    std::string handleDropDatabase(const std::string &dbName)
+    std::string handleDropDatabase(const std::string &name)
     {
-        // Trim the database name to remove any extra whitespace
-        std::string name = trim(dbName);
 
         // Check if the user has this database
         if (!currentUser->hasDatabaseAccess(name))
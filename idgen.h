@@ -0,0 +1,143 @@
+#ifndef IDGEN_H
+#define IDGEN_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Snowflake-style unique_id generator. An ID is a 64-bit number laid out,
+// from the top bit down, as
+//
+//   0 | 41 bits: milliseconds since ID_EPOCH_MS | 12 bits: sequence | 10 bits: node
+//
+// so IDs from one process increase with time and IDs from different nodes
+// (NOSQLITE_NODE_ID, 0..1023) never meet. The whole state is one atomic
+// word holding the last ID handed out; the next one is the larger of "now
+// with sequence 0" and "last plus one sequence step", claimed with a
+// compare-and-swap. More than 4096 IDs in a millisecond carry into the
+// timestamp field, which runs a little ahead of the clock until real time
+// catches up, and a clock that steps backwards is ignored the same way.
+//
+// The text form is the number in base 36, zero-padded to ID_LENGTH
+// characters, so string order is numeric order.
+//
+// A burst can leave the last ID well ahead of the clock, so a restart
+// soon after it would hand the same IDs out again. Databases save the last
+// ID in their catalog at every checkpoint and, on open, advance the
+// generator past it and past every ID their log replays.
+class IdGenerator
+{
+private:
+    static constexpr uint64_t ID_EPOCH_MS = 1704067200000ull; // 2024-01-01T00:00:00Z
+    static constexpr int NODE_BITS = 10;
+    static constexpr int SEQUENCE_BITS = 12;
+    static constexpr uint64_t SEQUENCE_STEP = 1ull << NODE_BITS;
+
+    std::atomic<uint64_t> last{0};
+    uint64_t node = 0;
+
+    IdGenerator()
+    {
+        const char *env = std::getenv("NOSQLITE_NODE_ID");
+        node = env ? std::strtoull(env, nullptr, 10) & ((1ull << NODE_BITS) - 1) : 0;
+    }
+
+    uint64_t clockFloor() const
+    {
+        auto now = std::chrono::system_clock::now();
+        uint64_t millis = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+                                                    now.time_since_epoch())
+                                                    .count());
+        millis = millis > ID_EPOCH_MS ? millis - ID_EPOCH_MS : 0;
+        return (millis << (SEQUENCE_BITS + NODE_BITS)) | node;
+    }
+
+public:
+    static constexpr size_t ID_LENGTH = 13;
+
+    static IdGenerator &instance()
+    {
+        static IdGenerator generator;
+        return generator;
+    }
+
+    IdGenerator(const IdGenerator &) = delete;
+    IdGenerator &operator=(const IdGenerator &) = delete;
+
+    // Claim count consecutive IDs and return the first; the others follow
+    // at SEQUENCE_STEP intervals
+    uint64_t reserve(size_t count)
+    {
+        uint64_t floor = clockFloor();
+        uint64_t previous = last.load(std::memory_order_relaxed);
+        uint64_t first, end;
+        do
+        {
+            first = previous == 0 ? floor : std::max(floor, previous + SEQUENCE_STEP);
+            end = first + (count - 1) * SEQUENCE_STEP;
+        } while (!last.compare_exchange_weak(previous, end, std::memory_order_relaxed));
+        return first;
+    }
+
+    // The last ID handed out, or 0
+    uint64_t lastIssued() const { return last.load(std::memory_order_relaxed); }
+
+    // Hand out only IDs above id from now on
+    void advancePast(uint64_t id)
+    {
+        uint64_t previous = last.load(std::memory_order_relaxed);
+        while (previous < id && !last.compare_exchange_weak(previous, id, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    // The number behind an ID's text form; false if it is not one
+    static bool parse(std::string_view text, uint64_t &id)
+    {
+        if (text.size() != ID_LENGTH)
+            return false;
+        id = 0;
+        for (char c : text)
+        {
+            uint64_t digit;
+            if (c >= '0' && c <= '9')
+                digit = static_cast<uint64_t>(c - '0');
+            else if (c >= 'a' && c <= 'z')
+                digit = static_cast<uint64_t>(c - 'a' + 10);
+            else
+                return false;
+            if (id > (UINT64_MAX - digit) / 36)
+                return false;
+            id = id * 36 + digit;
+        }
+        return (id >> 63) == 0; // the top bit of an ID is always clear
+    }
+
+    static std::string format(uint64_t id)
+    {
+        static const char digits[] = "0123456789abcdefghijklmnopqrstuvwxyz";
+        std::string text(ID_LENGTH, '0');
+        for (size_t i = ID_LENGTH; i-- > 0 && id > 0; id /= 36)
+            text[i] = digits[id % 36];
+        return text;
+    }
+
+    std::vector<std::string> next(size_t count)
+    {
+        std::vector<std::string> ids;
+        if (count == 0)
+            return ids;
+        ids.reserve(count);
+        uint64_t id = reserve(count);
+        for (size_t i = 0; i < count; ++i, id += SEQUENCE_STEP)
+            ids.push_back(format(id));
+        return ids;
+    }
+};
+
+#endif // IDGEN_H
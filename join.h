@@ -0,0 +1,673 @@
+#ifndef JOIN_H
+#define JOIN_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unistd.h>
+#include "page.h"
+#include "planner.h"
+#include "threadpool.h"
+#include "types.h"
+
+// Resolve `on <first> = <second>` for `<left> join <right>`. Columns may be
+// qualified with their table's name, in either order; unqualified ones are
+// taken as left then right.
+inline bool bindJoin(const Table &left, const Table &right, const std::string &first, const std::string &second,
+                     size_t &leftPosition, size_t &rightPosition, std::string &error)
+{
+    auto split = [](const std::string &text, std::string &qualifier, std::string &column)
+    {
+        size_t dot = text.find('.');
+        qualifier = dot == std::string::npos ? "" : text.substr(0, dot);
+        column = dot == std::string::npos ? text : text.substr(dot + 1);
+    };
+    std::string firstTable, firstColumn, secondTable, secondColumn;
+    split(first, firstTable, firstColumn);
+    split(second, secondTable, secondColumn);
+    if (left.getName() != right.getName() && firstTable == right.getName() &&
+        (secondTable.empty() || secondTable == left.getName()))
+    {
+        std::swap(firstTable, secondTable);
+        std::swap(firstColumn, secondColumn);
+    }
+    if ((!firstTable.empty() && firstTable != left.getName()) ||
+        (!secondTable.empty() && secondTable != right.getName()))
+    {
+        error = "Join columns must belong to '" + left.getName() + "' and '" + right.getName() + "'";
+        return false;
+    }
+
+    auto resolve = [&error](const Table &table, const std::string &column, size_t &position)
+    {
+        if (column == "unique_id")
+        {
+            position = 0;
+            return true;
+        }
+        const auto &schema = table.getSchema();
+        auto it = std::find(schema.begin(), schema.end(), column);
+        if (it == schema.end())
+        {
+            error = "Column '" + column + "' not found in table '" + table.getName() + "'";
+            return false;
+        }
+        position = (it - schema.begin()) + 1;
+        return true;
+    };
+    return resolve(left, firstColumn, leftPosition) && resolve(right, secondColumn, rightPosition);
+}
+
+// Equi-joins for `select from <left> join <right> on <left>.x = <right>.y`.
+//
+// The side with fewer rows is the build side. Its rows are hashed on the
+// join column and radix-partitioned on the top bits of the hash, enough
+// partitions that each holds about PARTITION_ROWS rows, and every partition
+// gets its own open-addressing table, small enough to stay in cache while
+// it is probed. Both sides are scanned in page ranges on the pool, so the
+// probe runs on every thread at once and each thread writes its own output.
+//
+// A build worker that goes over its share of the memory budget moves its
+// largest partition to disk, and from then on every worker writes that
+// partition's rows to its own file (Grace hash join). Probe rows that hash
+// to a spilled partition are written out the same way, and each spilled
+// partition is joined from its files afterwards, one partition per thread
+// at a time. A spilled partition's build rows are reloaded whole, without
+// partitioning them further, so each must fit in memory on its own. The
+// partition count aims at a quarter of the budget per partition, which a
+// skewed key or a build side of more than MAX_PARTITIONS quarters can
+// still exceed. A spill file that cannot be written or read back fails
+// the join.
+//
+// Keys compare as stored bytes when both columns store them alike and as
+// text otherwise (int32 against int64, or a table in the legacy format).
+class HashJoin
+{
+private:
+    static constexpr size_t PAGES_PER_TASK = 64;
+    static constexpr size_t PARTITION_ROWS = 1 << 16;
+    static constexpr size_t MAX_PARTITIONS = 256;
+    static constexpr size_t SPILL_BUFFER = 1 << 15;
+    static constexpr size_t OUTPUT_BUFFER = 1 << 16;
+    static constexpr size_t ROW_HEADER = sizeof(uint64_t) + 2 * sizeof(uint32_t);
+    static constexpr size_t TABLE_BYTES_PER_ROW = 40; // entry plus two slots
+
+    // A build row as held in memory and in spill files: its hash, key and
+    // record lengths, then the key and the record
+    struct Entry
+    {
+        const char *data;
+        uint32_t keyLength;
+        uint32_t recordLength;
+        uint64_t hash;
+
+        std::string_view key() const { return std::string_view(data, keyLength); }
+        std::string_view record() const { return std::string_view(data + keyLength, recordLength); }
+    };
+
+    // Open addressing with linear probing. A slot holds the top half of its
+    // entry's hash next to the entry number, so most mismatches are settled
+    // without touching the entry.
+    class PartitionTable
+    {
+    private:
+        std::vector<Entry> entries;
+        std::vector<uint64_t> slots; // (hash >> 32) << 32 | (entry + 1), 0 when empty
+        size_t mask = 0;
+
+    public:
+        void build(std::vector<Entry> rows)
+        {
+            entries = std::move(rows);
+            size_t capacity = 16;
+            while (capacity < entries.size() * 2)
+                capacity <<= 1;
+            slots.assign(capacity, 0);
+            mask = capacity - 1;
+            for (size_t i = 0; i < entries.size(); ++i)
+            {
+                size_t slot = entries[i].hash & mask;
+                while (slots[slot] != 0)
+                    slot = (slot + 1) & mask;
+                slots[slot] = ((entries[i].hash >> 32) << 32) | (i + 1);
+            }
+        }
+
+        // visit(record) for every build row with this key until it returns false
+        template <typename Visit>
+        bool probe(uint64_t hash, std::string_view key, Visit visit) const
+        {
+            if (entries.empty())
+                return true;
+            for (size_t slot = hash & mask; slots[slot] != 0; slot = (slot + 1) & mask)
+            {
+                if ((slots[slot] >> 32) != (hash >> 32))
+                    continue;
+                const Entry &entry = entries[(slots[slot] & 0xffffffffu) - 1];
+                if (entry.hash == hash && entry.key() == key && !visit(entry.record()))
+                    return false;
+            }
+            return true;
+        }
+    };
+
+    // Reads rows in the Entry layout back from a spill file. Throws if the
+    // file cannot be opened or ends inside a row.
+    class SpillReader
+    {
+    private:
+        std::string path;
+        std::vector<char> buffer;
+        std::ifstream in;
+        std::string current;
+        uint32_t keyLength = 0;
+        uint64_t rowHash = 0;
+
+    public:
+        explicit SpillReader(const std::string &spillPath) : path(spillPath), buffer(SPILL_BUFFER)
+        {
+            in.rdbuf()->pubsetbuf(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+            in.open(path, std::ios::binary);
+            if (!in.is_open())
+                throw std::runtime_error("Cannot open join spill file " + path);
+        }
+
+        bool next()
+        {
+            char header[ROW_HEADER];
+            if (!in.read(header, sizeof(header)))
+            {
+                if (in.gcount() != 0 || in.bad())
+                    throw std::runtime_error("Failed to read join spill file " + path);
+                return false;
+            }
+            rowHash = getValue<uint64_t>(header);
+            keyLength = getValue<uint32_t>(header + sizeof(uint64_t));
+            current.resize(keyLength + getValue<uint32_t>(header + sizeof(uint64_t) + sizeof(uint32_t)));
+            if (!in.read(current.data(), static_cast<std::streamsize>(current.size())))
+                throw std::runtime_error("Failed to read join spill file " + path);
+            return true;
+        }
+
+        uint64_t hash() const { return rowHash; }
+        std::string_view key() const { return std::string_view(current).substr(0, keyLength); }
+        std::string_view record() const { return std::string_view(current).substr(keyLength); }
+    };
+
+    // One side of the join as scanned: the table, its join column and
+    // whether the column's stored bytes must be turned into text to compare
+    struct Side
+    {
+        const Table *table;
+        size_t position;
+        bool asText;
+        const ReadView *view = nullptr;
+    };
+
+    struct Worker
+    {
+        std::vector<std::string> rows; // per partition, in memory or waiting to be written
+        size_t bytes = 0;
+        std::string key;                // scratch for keys compared as text
+        std::string text;               // joined rows not yet handed on
+        std::vector<size_t> rowEnds;
+    };
+
+    Side build;
+    Side probe;
+    bool buildIsLeft;
+    size_t partitions = 1;
+    unsigned radixBits = 0;
+    size_t memoryBudget = 0;
+    std::string spillPrefix;
+    std::unique_ptr<std::atomic<bool>[]> spilled;
+    size_t workerFiles = 0; // spill files per partition and side, one per worker
+    std::vector<uint8_t> written; // per side, partition and worker: whether that spill file exists
+    std::vector<PartitionTable> tables;
+
+    std::mutex outputMutex;
+    std::atomic<bool> stopped{false};
+    size_t remaining = SIZE_MAX;
+    QueryProfile *profile = nullptr;
+
+    static uint64_t hashOf(std::string_view key)
+    {
+        // std::hash need not mix its high bits, which pick the partition
+        uint64_t hash = std::hash<std::string_view>{}(key);
+        hash ^= hash >> 33;
+        hash *= 0xff51afd7ed558ccdULL;
+        hash ^= hash >> 33;
+        return hash;
+    }
+
+    size_t partitionOf(uint64_t hash) const { return radixBits == 0 ? 0 : hash >> (64 - radixBits); }
+
+    std::string spillPath(const Side &side, size_t partition, size_t worker) const
+    {
+        return spillPrefix + (&side == &build ? "b" : "p") + std::to_string(partition) + "." + std::to_string(worker);
+    }
+
+    uint8_t &spillWritten(const Side &side, size_t partition, size_t worker)
+    {
+        return written[((&side == &build ? 0 : partitions) + partition) * workerFiles + worker];
+    }
+
+    std::string_view keyOf(const Side &side, std::string_view record, std::string &scratch) const
+    {
+        const RowFormat &format = side.table->getFormat();
+        std::string_view field = format.field(record, side.position);
+        if (!side.asText)
+            return field;
+        scratch = ValueCodec::decode(format.typeAt(side.position), field);
+        return scratch;
+    }
+
+    static void appendRow(std::string &out, uint64_t hash, std::string_view key, std::string_view record)
+    {
+        char header[ROW_HEADER];
+        putValue(header, hash);
+        putValue(header + sizeof(uint64_t), static_cast<uint32_t>(key.size()));
+        putValue(header + sizeof(uint64_t) + sizeof(uint32_t), static_cast<uint32_t>(record.size()));
+        out.append(header, sizeof(header));
+        out.append(key.data(), key.size());
+        out.append(record.data(), record.size());
+    }
+
+    // Every row of one partition's rows as entries pointing into them
+    static void parseRows(const std::string &rows, std::vector<Entry> &entries)
+    {
+        for (size_t pos = 0; pos + ROW_HEADER <= rows.size();)
+        {
+            const char *header = rows.data() + pos;
+            Entry entry{header + ROW_HEADER, getValue<uint32_t>(header + sizeof(uint64_t)),
+                        getValue<uint32_t>(header + sizeof(uint64_t) + sizeof(uint32_t)), getValue<uint64_t>(header)};
+            entries.push_back(entry);
+            pos += ROW_HEADER + entry.keyLength + entry.recordLength;
+        }
+    }
+
+    // Append the whole of a spill file to rows
+    static void readSpill(const std::string &path, std::string &rows)
+    {
+        std::ifstream in(path, std::ios::binary | std::ios::ate);
+        if (!in.is_open())
+            throw std::runtime_error("Cannot open join spill file " + path);
+        std::streamsize size = in.tellg();
+        size_t offset = rows.size();
+        rows.resize(offset + static_cast<size_t>(std::max<std::streamsize>(size, 0)));
+        in.seekg(0);
+        if (size < 0 || !in.read(rows.data() + offset, size))
+            throw std::runtime_error("Failed to read join spill file " + path);
+    }
+
+    // Append rows of a spilled partition to the worker's file and empty them
+    void writeRows(std::string &rows, const Side &side, size_t partition, size_t workerNo)
+    {
+        if (rows.empty())
+            return;
+        std::string path = spillPath(side, partition, workerNo);
+        std::ofstream out(path, std::ios::binary | std::ios::app);
+        if (!out.is_open())
+            throw std::runtime_error("Cannot create join spill file " + path);
+        spillWritten(side, partition, workerNo) = 1;
+        out.write(rows.data(), static_cast<std::streamsize>(rows.size()));
+        out.close();
+        if (!out)
+            throw std::runtime_error("Failed to write join spill file " + path);
+        if (profile)
+            profile->spillBytes += rows.size();
+        if (rows.capacity() > 2 * SPILL_BUFFER)
+            std::string().swap(rows);
+        else
+            rows.clear();
+    }
+
+    void flush(Worker &worker, const Side &side, size_t partition, size_t workerNo)
+    {
+        worker.bytes -= std::min(worker.bytes, worker.rows[partition].size());
+        writeRows(worker.rows[partition], side, partition, workerNo);
+    }
+
+    // Bring a build worker back under its share: write out what it holds of
+    // partitions already spilled, then spill its largest partitions
+    void makeRoom(Worker &worker, size_t workerNo, size_t share)
+    {
+        for (size_t p = 0; p < partitions; ++p)
+        {
+            if (spilled[p].load(std::memory_order_relaxed))
+                flush(worker, build, p, workerNo);
+        }
+        while (worker.bytes > share)
+        {
+            size_t largest = partitions;
+            for (size_t p = 0; p < partitions; ++p)
+            {
+                if (!spilled[p].load(std::memory_order_relaxed) && !worker.rows[p].empty() &&
+                    (largest == partitions || worker.rows[p].size() > worker.rows[largest].size()))
+                    largest = p;
+            }
+            if (largest == partitions)
+                return;
+            spilled[largest].store(true);
+            flush(worker, build, largest, workerNo);
+        }
+    }
+
+    // Hand a worker's joined rows on, no more than the limit allows
+    void deliver(Worker &worker, const std::function<bool(std::string_view)> &emit)
+    {
+        if (worker.rowEnds.empty())
+            return;
+        std::lock_guard<std::mutex> lock(outputMutex);
+        size_t rows = std::min(remaining, worker.rowEnds.size());
+        if (rows > 0 && !stopped.load())
+        {
+            auto started = std::chrono::steady_clock::now();
+            if (!emit(std::string_view(worker.text.data(), worker.rowEnds[rows - 1])))
+                remaining = rows;
+            if (profile)
+                profile->outputNanos += QueryProfile::since(started);
+            remaining -= rows;
+        }
+        if (remaining == 0)
+            stopped.store(true);
+        worker.text.clear();
+        worker.rowEnds.clear();
+    }
+
+    using Render = std::function<void(std::string_view, std::string_view, std::string &)>;
+
+    // Join one probe row against the rows of a partition's table
+    void join(Worker &worker, const PartitionTable &table, uint64_t hash, std::string_view key,
+              std::string_view record, const Render &render, const std::function<bool(std::string_view)> &emit)
+    {
+        table.probe(hash, key, [&](std::string_view buildRecord)
+                    {
+                        if (buildIsLeft)
+                            render(buildRecord, record, worker.text);
+                        else
+                            render(record, buildRecord, worker.text);
+                        worker.rowEnds.push_back(worker.text.size());
+                        return true; });
+        if (worker.text.size() >= OUTPUT_BUFFER)
+            deliver(worker, emit);
+    }
+
+    // Scan one side on threadCount threads, in page ranges when there are
+    // several, calling visit(worker, workerNo, record)
+    template <typename Visit>
+    void scanSide(const Side &side, size_t threadCount, const ScanOptions &base, Visit visit)
+    {
+        ScanPlan plan;
+        if (threadCount == 1)
+        {
+            executeScanRecords(*side.table, plan, [&](RowId, std::string_view record)
+                               { return visit(0, record); },
+                               base);
+            return;
+        }
+        std::atomic<uint32_t> nextPage{1};
+        uint32_t pages = side.view->pageCount;
+        runParallel(threadCount, [&](size_t w)
+                    {
+                        uint32_t from;
+                        while (!stopped.load() && (from = nextPage.fetch_add(PAGES_PER_TASK)) < pages)
+                        {
+                            ScanOptions options = base;
+                            options.start = RowId{from, 0};
+                            options.endPage = from + PAGES_PER_TASK;
+                            executeScanRecords(*side.table, plan, [&](RowId, std::string_view record)
+                                               { return visit(w, record); },
+                                               options);
+                        } });
+    }
+
+public:
+    // Join left and right on the row positions leftPosition and
+    // rightPosition (unique_id is 0)
+    HashJoin(const Table &left, size_t leftPosition, const Table &right, size_t rightPosition)
+    {
+        buildIsLeft = left.getRowCount() < right.getRowCount();
+        const ColumnType leftType = left.getFormat().typeAt(leftPosition);
+        const ColumnType rightType = right.getFormat().typeAt(rightPosition);
+        bool leftLegacy = left.getFormat().isLegacy(), rightLegacy = right.getFormat().isLegacy();
+        bool sameBytes = leftLegacy == rightLegacy && (leftLegacy || leftType.kind == rightType.kind);
+        Side leftSide{&left, leftPosition, !sameBytes && !leftLegacy};
+        Side rightSide{&right, rightPosition, !sameBytes && !rightLegacy};
+        build = buildIsLeft ? leftSide : rightSide;
+        probe = buildIsLeft ? rightSide : leftSide;
+
+        // NOSQLITE_JOIN_MEMORY_MB bounds the build rows held in memory
+        // across all workers before partitions spill
+        const char *env = std::getenv("NOSQLITE_JOIN_MEMORY_MB");
+        size_t megabytes = env ? std::strtoull(env, nullptr, 10) : 256;
+        memoryBudget = std::max<size_t>(megabytes, 1) * 1024 * 1024;
+
+        // Enough partitions for cache-sized tables, and for a build side
+        // larger than memory to spill a part of it at a time
+        uint64_t rows = build.table->getRowCount();
+        uint64_t bytes = build.table->getEngine() == TableEngine::Heap
+                             ? static_cast<uint64_t>(build.table->getPageCount()) * PAGE_SIZE
+                             : 0;
+        while (partitions < MAX_PARTITIONS &&
+               (rows > partitions * PARTITION_ROWS || bytes > partitions * (memoryBudget / 4)))
+        {
+            partitions <<= 1;
+            ++radixBits;
+        }
+
+        static std::atomic<uint64_t> joins{0};
+        std::filesystem::path base(build.table->getFilePath());
+        spillPrefix = (base.parent_path() / (build.table->getName() + ".join." + std::to_string(::getpid()) + "." +
+                                             std::to_string(joins.fetch_add(1)) + "."))
+                          .string();
+    }
+
+    HashJoin(const HashJoin &) = delete;
+    HashJoin &operator=(const HashJoin &) = delete;
+
+    ~HashJoin()
+    {
+        std::error_code ignored;
+        if (!spilled)
+            return;
+        for (size_t p = 0; p < partitions; ++p)
+        {
+            if (!spilled[p].load())
+                continue;
+            for (size_t w = 0; w < workerFiles; ++w)
+            {
+                std::filesystem::remove(spillPath(build, p, w), ignored);
+                std::filesystem::remove(spillPath(probe, p, w), ignored);
+            }
+        }
+    }
+
+    // Threads a scan of one side with this degree (0 for the whole pool)
+    // uses: heap tables split into page ranges, LSM tables scan on one
+    static size_t threadsFor(const Table &table, uint32_t pages, size_t degree)
+    {
+        if (table.getEngine() != TableEngine::Heap || pages <= PAGES_PER_TASK)
+            return 1;
+        if (degree == 0)
+            degree = ThreadPool::instance().size();
+        return std::clamp<size_t>(degree, 1, (pages + PAGES_PER_TASK - 1) / PAGES_PER_TASK);
+    }
+
+    static constexpr size_t pagesPerTask() { return PAGES_PER_TASK; }
+    bool buildsLeft() const { return buildIsLeft; }
+    size_t getPartitions() const { return partitions; }
+    size_t getMemoryBudget() const { return memoryBudget; }
+
+    // Join on up to degree pool threads (0 for the whole pool). render(left,
+    // right, out) appends one output line for a matching pair of records;
+    // emit is handed whole lines, one thread at a time, until it returns
+    // false or limit lines (negative for no limit) have gone out. Both
+    // tables are read from snapshots taken when the join starts. With a
+    // profile the build is timed on its own, the probe scan as a scan and
+    // the spilled partitions as the merge. Returns the probe threads used.
+    // Throws std::runtime_error if a spill file cannot be written or read
+    // back, possibly after some lines have gone to emit.
+    size_t run(const Render &render, const std::function<bool(std::string_view)> &emit, long limit = -1,
+               size_t degree = 0, QueryProfile *queryProfile = nullptr)
+    {
+        profile = queryProfile;
+        remaining = limit < 0 ? SIZE_MAX : static_cast<size_t>(limit);
+        if (remaining == 0)
+            return 1;
+        ReadView buildView = build.table->snapshot();
+        ReadView probeView = probe.table->snapshot();
+        build.view = &buildView;
+        probe.view = &probeView;
+        spilled = std::make_unique<std::atomic<bool>[]>(partitions);
+        for (size_t p = 0; p < partitions; ++p)
+            spilled[p].store(false);
+
+        // Build: every worker partitions the rows it reads
+        auto started = std::chrono::steady_clock::now();
+        size_t buildThreads = threadsFor(*build.table, buildView.pageCount, degree);
+        size_t probeThreads = threadsFor(*probe.table, probeView.pageCount, degree);
+        workerFiles = std::max(probeThreads, buildThreads);
+        written.assign(2 * partitions * workerFiles, 0);
+        size_t share = memoryBudget / buildThreads;
+        std::vector<Worker> builders(buildThreads);
+        for (auto &worker : builders)
+            worker.rows.resize(partitions);
+        std::atomic<uint64_t> buildRows{0};
+        ScanOptions buildOptions;
+        buildOptions.view = &buildView;
+        scanSide(build, buildThreads, buildOptions, [&](size_t w, std::string_view record)
+                 {
+                     Worker &worker = builders[w];
+                     std::string_view key = keyOf(build, record, worker.key);
+                     uint64_t hash = hashOf(key);
+                     size_t p = partitionOf(hash);
+                     std::string &rows = worker.rows[p];
+                     size_t before = rows.size();
+                     appendRow(rows, hash, key, record);
+                     worker.bytes += rows.size() - before + TABLE_BYTES_PER_ROW;
+                     buildRows.fetch_add(1, std::memory_order_relaxed);
+                     if (spilled[p].load(std::memory_order_relaxed))
+                     {
+                         if (rows.size() >= SPILL_BUFFER)
+                             flush(worker, build, p, w);
+                     }
+                     else if (worker.bytes > share)
+                         makeRoom(worker, w, share);
+                     return true; });
+
+        // One table per partition still in memory, over every worker's rows
+        tables.assign(partitions, PartitionTable());
+        std::atomic<size_t> nextPartition{0};
+        runParallel(buildThreads, [&](size_t)
+                    {
+                        size_t p;
+                        while (!stopped.load() && (p = nextPartition.fetch_add(1)) < partitions)
+                        {
+                            std::vector<Entry> entries;
+                            for (size_t w = 0; w < builders.size(); ++w)
+                            {
+                                if (spilled[p].load())
+                                    writeRows(builders[w].rows[p], build, p, w);
+                                else
+                                    parseRows(builders[w].rows[p], entries);
+                            }
+                            tables[p].build(std::move(entries));
+                        } });
+        if (profile)
+        {
+            profile->buildNanos += QueryProfile::since(started);
+            profile->buildRows += buildRows.load();
+        }
+
+        // Probe: rows of partitions in memory join at once, the rest are
+        // written out next to their build rows
+        std::vector<Worker> probers(workerFiles);
+        for (auto &worker : probers)
+            worker.rows.resize(partitions);
+        ScanOptions probeOptions;
+        probeOptions.view = &probeView;
+        probeOptions.profile = profile;
+        scanSide(probe, probeThreads, probeOptions, [&](size_t w, std::string_view record)
+                 {
+                     Worker &worker = probers[w];
+                     std::string_view key = keyOf(probe, record, worker.key);
+                     uint64_t hash = hashOf(key);
+                     size_t p = partitionOf(hash);
+                     if (spilled[p].load(std::memory_order_relaxed))
+                     {
+                         appendRow(worker.rows[p], hash, key, record);
+                         if (worker.rows[p].size() >= SPILL_BUFFER)
+                             flush(worker, probe, p, w);
+                     }
+                     else
+                         join(worker, tables[p], hash, key, record, render, emit);
+                     return !stopped.load(std::memory_order_relaxed); });
+        for (size_t w = 0; w < probers.size(); ++w)
+        {
+            for (size_t p = 0; p < partitions; ++p)
+                flush(probers[w], probe, p, w);
+            deliver(probers[w], emit);
+        }
+        std::vector<PartitionTable>().swap(tables);
+        builders.clear();
+
+        // Spilled partitions, each from its build and probe files
+        started = std::chrono::steady_clock::now();
+        nextPartition = 0;
+        runParallel(probers.size(), [&](size_t w)
+                    {
+                        Worker &worker = probers[w];
+                        size_t p;
+                        while (!stopped.load() && (p = nextPartition.fetch_add(1)) < partitions)
+                        {
+                            if (!spilled[p].load())
+                                continue;
+                            std::string rows;
+                            for (size_t f = 0; f < workerFiles; ++f)
+                            {
+                                if (spillWritten(build, p, f))
+                                    readSpill(spillPath(build, p, f), rows);
+                            }
+                            std::vector<Entry> entries;
+                            parseRows(rows, entries);
+                            PartitionTable table;
+                            table.build(std::move(entries));
+                            for (size_t f = 0; f < workerFiles && !stopped.load(); ++f)
+                            {
+                                if (!spillWritten(probe, p, f))
+                                    continue;
+                                SpillReader reader(spillPath(probe, p, f));
+                                while (!stopped.load() && reader.next())
+                                    join(worker, table, reader.hash(), reader.key(), reader.record(),
+                                         render, emit);
+                            }
+                            deliver(worker, emit);
+                            for (size_t f = 0; f < workerFiles; ++f)
+                            {
+                                std::error_code ignored;
+                                std::filesystem::remove(spillPath(build, p, f), ignored);
+                                std::filesystem::remove(spillPath(probe, p, f), ignored);
+                            }
+                        } });
+        if (profile)
+        {
+            profile->mergeNanos += QueryProfile::since(started);
+            profile->threads = probeThreads;
+        }
+        return probeThreads;
+    }
+};
+
+#endif // JOIN_H
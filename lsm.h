@@ -0,0 +1,1367 @@
+#ifndef LSM_H
+#define LSM_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include "page.h"
+#include "zonemap.h"
+#include "encoding.h"
+#include "metrics.h"
+
+// Log-structured storage for tables created with engine=lsm, kept in the
+// directory <table>.lsm next to the table file.
+//
+// Writes go to a skiplist memtable keyed by unique_id. A full memtable is
+// frozen and the background thread writes it out as an immutable sorted
+// segment in level 0. Every deeper level holds one sorted run cut into
+// segments with disjoint key ranges, each level LEVEL_RATIO times larger
+// than the one above. Compaction, on the same thread, merges all of level
+// 0, or one segment of an oversized level, with the overlapping segments
+// one level down. The newest version of a key wins, and deletes
+// (tombstones) are dropped once they reach the deepest level covering
+// their key range. Compaction output is paced by a token bucket
+// (NOSQLITE_COMPACTION_MB_PER_SEC) so it leaves disk bandwidth to queries.
+// Writers stall while level 0 is backed up, which bounds a point read to
+// the memtables, at most L0_STOP level 0 segments and one segment per
+// deeper level.
+//
+// Each segment carries a Bloom filter over its keys, checked before a
+// point read touches the segment, and, when the tree knows the row format,
+// a zone map per block that lets filtered scans skip blocks. With a row
+// format blocks are also stored column by column in the encodings of
+// encoding.h, and a filtered scan tests rows on the encoded columns before
+// rebuilding the records of those that pass.
+//
+// MANIFEST lists the live segments and is replaced atomically after each
+// flush or compaction; other segment files are leftovers of an interrupted
+// one. The memtable is made durable by the database's WAL until the next
+// checkpoint flushes it.
+
+// Memtable: skiplist ordered by key, then newest version first. One writer
+// at a time (the tree's mutex); readers walk it without locking.
+class Memtable
+{
+public:
+    struct Node
+    {
+        std::string key;
+        std::string value;
+        uint64_t seq;
+        bool tombstone;
+        std::vector<std::atomic<Node *>> next;
+
+        Node(std::string_view k, std::string_view v, uint64_t s, bool dead, int height)
+            : key(k), value(v), seq(s), tombstone(dead), next(height)
+        {
+            for (auto &link : next)
+                link.store(nullptr, std::memory_order_relaxed);
+        }
+    };
+
+private:
+    static constexpr int MAX_HEIGHT = 12;
+
+    Node head{"", "", 0, false, MAX_HEIGHT};
+    std::vector<std::unique_ptr<Node>> nodes;
+    std::atomic<int> height{1};
+    std::atomic<size_t> bytes{0};
+    uint64_t random = 0x9E3779B97F4A7C15ull;
+
+    int randomHeight()
+    {
+        int level = 1;
+        while (level < MAX_HEIGHT)
+        {
+            random ^= random << 13;
+            random ^= random >> 7;
+            random ^= random << 17;
+            if (random % 4 != 0)
+                break;
+            ++level;
+        }
+        return level;
+    }
+
+    // Does node sort before (key, seq)?
+    static bool before(const Node *node, std::string_view key, uint64_t seq)
+    {
+        int c = node->key.compare(key);
+        return c < 0 || (c == 0 && node->seq > seq);
+    }
+
+    const Node *findGreaterOrEqual(std::string_view key, uint64_t seq, Node **prev) const
+    {
+        const Node *node = &head;
+        for (int level = height.load(std::memory_order_acquire) - 1; level >= 0; --level)
+        {
+            const Node *next;
+            while ((next = node->next[level].load(std::memory_order_acquire)) && before(next, key, seq))
+                node = next;
+            if (prev)
+                prev[level] = const_cast<Node *>(node);
+        }
+        return node->next[0].load(std::memory_order_acquire);
+    }
+
+public:
+    void insert(std::string_view key, std::string_view value, bool tombstone, uint64_t seq)
+    {
+        Node *prev[MAX_HEIGHT];
+        for (auto &p : prev)
+            p = &head;
+        findGreaterOrEqual(key, seq, prev);
+
+        int nodeHeight = randomHeight();
+        if (nodeHeight > height.load(std::memory_order_relaxed))
+            height.store(nodeHeight, std::memory_order_release);
+
+        nodes.push_back(std::make_unique<Node>(key, value, seq, tombstone, nodeHeight));
+        Node *node = nodes.back().get();
+        for (int level = 0; level < nodeHeight; ++level)
+        {
+            node->next[level].store(prev[level]->next[level].load(std::memory_order_relaxed),
+                                    std::memory_order_relaxed);
+            prev[level]->next[level].store(node, std::memory_order_release);
+        }
+        bytes.fetch_add(sizeof(Node) + key.size() + value.size() + nodeHeight * sizeof(void *),
+                        std::memory_order_relaxed);
+    }
+
+    // Newest version of key written at or before maxSeq; false if the
+    // memtable has none
+    bool get(std::string_view key, std::string &value, bool &tombstone, uint64_t maxSeq = UINT64_MAX) const
+    {
+        const Node *node = findGreaterOrEqual(key, maxSeq, nullptr);
+        if (!node || node->key != key)
+            return false;
+        tombstone = node->tombstone;
+        if (!tombstone)
+            value = node->value;
+        return true;
+    }
+
+    const Node *first() const { return head.next[0].load(std::memory_order_acquire); }
+    const Node *seek(std::string_view key) const { return findGreaterOrEqual(key, UINT64_MAX, nullptr); }
+    static const Node *next(const Node *node) { return node->next[0].load(std::memory_order_acquire); }
+
+    size_t approximateBytes() const { return bytes.load(std::memory_order_relaxed); }
+    bool empty() const { return first() == nullptr; }
+};
+
+// Segment file layout:
+//
+//   data blocks   entries of u16 key length | key | u8 tombstone |
+//                 u32 value length | value, about BLOCK_SIZE bytes each
+//                 before encoding; a columnar block is ColumnCodec's
+//                 layout of the same entries
+//   index         u32 block count, then per block u16 first-key length |
+//                 first key | u64 offset | u32 length | u8 flags | zone
+//                 map if flagged; then the last key, the Bloom filter and
+//                 u16 column count | u8 kind per column of the records
+//   footer        u64 index offset | u64 index length | u64 entries |
+//                 u32 format version | u32 magic
+//
+// Version 1 segments have neither flags, zone maps nor a Bloom filter;
+// version 2 ones have no columnar blocks and no column kinds.
+constexpr uint32_t SEGMENT_MAGIC = 0x534D534C; // "LSMS"
+constexpr uint32_t SEGMENT_FORMAT_VERSION = 3;
+constexpr uint8_t BLOCK_HAS_TOMBSTONES = 1;
+constexpr uint8_t BLOCK_HAS_ZONE = 2;
+constexpr uint8_t BLOCK_COLUMNAR = 4;
+constexpr size_t SEGMENT_FOOTER_SIZE = 3 * sizeof(uint64_t) + 2 * sizeof(uint32_t);
+
+inline bool parseLsmEntry(const char *&in, const char *end, std::string_view &key, bool &tombstone,
+                          std::string_view &value)
+{
+    if (end - in < static_cast<std::ptrdiff_t>(sizeof(uint16_t)))
+        return false;
+    uint16_t keyLength = getValue<uint16_t>(in);
+    const char *keyStart = in + sizeof(uint16_t);
+    const char *valueHeader = keyStart + keyLength + 1;
+    if (valueHeader + sizeof(uint32_t) > end)
+        return false;
+    uint32_t valueLength = getValue<uint32_t>(valueHeader);
+    const char *valueStart = valueHeader + sizeof(uint32_t);
+    if (valueStart + valueLength > end)
+        return false;
+    key = std::string_view(keyStart, keyLength);
+    tombstone = keyStart[keyLength] != 0;
+    value = std::string_view(valueStart, valueLength);
+    in = valueStart + valueLength;
+    return true;
+}
+
+inline void appendLsmEntry(std::string &out, std::string_view key, bool tombstone, std::string_view value)
+{
+    size_t start = out.size();
+    out.resize(start + sizeof(uint16_t) + key.size() + 1 + sizeof(uint32_t) + value.size());
+    char *entry = out.data() + start;
+    putValue(entry, static_cast<uint16_t>(key.size()));
+    entry += sizeof(uint16_t);
+    std::memcpy(entry, key.data(), key.size());
+    entry += key.size();
+    *entry++ = tombstone ? 1 : 0;
+    putValue(entry, static_cast<uint32_t>(value.size()));
+    std::memcpy(entry + sizeof(uint32_t), value.data(), value.size());
+}
+
+// Immutable sorted segment. The block index stays in memory; blocks are
+// read with pread on demand. Once a compaction has replaced it the file is
+// unlinked as soon as the last reader lets go.
+class Segment
+{
+private:
+    struct Block
+    {
+        std::string firstKey;
+        uint64_t offset;
+        uint32_t length;
+        uint8_t flags = 0;
+        ZoneMap zone;
+    };
+
+    std::string path;
+    uint64_t number;
+    int fd = -1;
+    std::vector<Block> blocks;
+    std::string smallest, largest;
+    uint64_t entries = 0;
+    uint64_t fileSize = 0;
+    bool hasBloom = false;
+    BloomFilter bloom;
+    RowFormat format; // of columnar blocks
+    std::atomic<bool> obsolete{false};
+
+    Segment(const std::string &segmentPath, uint64_t segmentNumber) : path(segmentPath), number(segmentNumber) {}
+
+public:
+    static constexpr size_t BLOCK_SIZE = 16 * 1024;
+
+    // Null if the file is missing or damaged
+    static std::shared_ptr<Segment> open(const std::string &path, uint64_t number)
+    {
+        std::shared_ptr<Segment> segment(new Segment(path, number));
+        segment->fd = ::open(path.c_str(), O_RDONLY);
+        if (segment->fd < 0)
+            return nullptr;
+        Metrics::instance().fileOpened();
+        off_t size = ::lseek(segment->fd, 0, SEEK_END);
+        if (size < static_cast<off_t>(SEGMENT_FOOTER_SIZE))
+            return nullptr;
+        segment->fileSize = static_cast<uint64_t>(size);
+
+        char footer[SEGMENT_FOOTER_SIZE];
+        if (::pread(segment->fd, footer, sizeof(footer), size - SEGMENT_FOOTER_SIZE) != static_cast<ssize_t>(sizeof(footer)))
+            return nullptr;
+        uint64_t indexOffset = getValue<uint64_t>(footer);
+        uint64_t indexLength = getValue<uint64_t>(footer + 8);
+        segment->entries = getValue<uint64_t>(footer + 16);
+        uint32_t version = getValue<uint32_t>(footer + 24);
+        if (getValue<uint32_t>(footer + 28) != SEGMENT_MAGIC || version < 1 || version > SEGMENT_FORMAT_VERSION ||
+            indexOffset + indexLength + SEGMENT_FOOTER_SIZE != segment->fileSize)
+            return nullptr;
+
+        std::string index(indexLength, '\0');
+        if (::pread(segment->fd, index.data(), indexLength, static_cast<off_t>(indexOffset)) != static_cast<ssize_t>(indexLength))
+            return nullptr;
+        const char *in = index.data();
+        const char *end = in + index.size();
+        // Every field is checked against end: a damaged index fails here
+        auto takeKey = [&in, end](std::string &key)
+        {
+            uint16_t length;
+            if (!ColumnCodec::take(in, end, length) || end - in < length)
+                return false;
+            key.assign(in, length);
+            in += length;
+            return true;
+        };
+        uint32_t count;
+        if (!ColumnCodec::take(in, end, count))
+            return nullptr;
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            Block block;
+            if (!takeKey(block.firstKey) || !ColumnCodec::take(in, end, block.offset) ||
+                !ColumnCodec::take(in, end, block.length) || block.offset + block.length > indexOffset)
+                return nullptr;
+            if (version >= 2)
+            {
+                if (!ColumnCodec::take(in, end, block.flags))
+                    return nullptr;
+                if ((block.flags & BLOCK_HAS_ZONE) && !block.zone.decode(in, end))
+                    return nullptr;
+            }
+            else
+            {
+                block.flags = BLOCK_HAS_TOMBSTONES; // unknown, so never skipped
+            }
+            segment->blocks.push_back(std::move(block));
+        }
+        if (!takeKey(segment->largest))
+            return nullptr;
+        if (version >= 2)
+        {
+            if (!segment->bloom.decode(in, end))
+                return nullptr;
+            segment->hasBloom = true;
+        }
+        if (version >= 3)
+        {
+            uint16_t columns;
+            if (!ColumnCodec::take(in, end, columns) || end - in < columns)
+                return nullptr;
+            std::vector<ColumnType> types;
+            for (uint16_t i = 0; i < columns; ++i)
+                types.push_back(ColumnType{static_cast<ColumnKind>(*in++)});
+            segment->format = RowFormat(std::vector<std::string>(columns), types, false);
+        }
+        if (!segment->blocks.empty())
+            segment->smallest = segment->blocks.front().firstKey;
+        return segment;
+    }
+
+    ~Segment()
+    {
+        if (fd >= 0)
+            ::close(fd);
+        // Often the last reference goes on the background thread, where
+        // a throw would terminate; a leftover file is removed on open
+        std::error_code ignored;
+        if (obsolete.load())
+            std::filesystem::remove(path, ignored);
+    }
+
+    Segment(const Segment &) = delete;
+    Segment &operator=(const Segment &) = delete;
+
+    uint64_t getNumber() const { return number; }
+    uint64_t getEntries() const { return entries; }
+    uint64_t getFileSize() const { return fileSize; }
+    const std::string &getSmallest() const { return smallest; }
+    const std::string &getLargest() const { return largest; }
+    size_t blockCount() const { return blocks.size(); }
+
+    // Can a scan with this filter pass block i by? Blocks holding
+    // tombstones are always read, or the rows they delete would reappear.
+    bool canSkipBlock(size_t i, const Filter &filter) const
+    {
+        return (blocks[i].flags & BLOCK_HAS_ZONE) && !(blocks[i].flags & BLOCK_HAS_TOMBSTONES) &&
+               !zoneMayMatch(filter, blocks[i].zone);
+    }
+    void markObsolete() { obsolete.store(true); }
+
+    bool overlaps(std::string_view low, std::string_view high) const
+    {
+        return !blocks.empty() && !(largest < low) && !(high < smallest);
+    }
+
+    // Block i as entries. A columnar block is decoded first; with a filter,
+    // its live rows that fail the filter are left out.
+    bool readBlock(size_t i, std::string &out, const Filter *filter = nullptr) const
+    {
+        bool columnar = blocks[i].flags & BLOCK_COLUMNAR;
+        std::string encoded;
+        std::string &data = columnar ? encoded : out;
+        data.resize(blocks[i].length);
+        if (::pread(fd, data.data(), data.size(), static_cast<off_t>(blocks[i].offset)) !=
+            static_cast<ssize_t>(data.size()))
+            return false;
+        Metrics::instance().bytesRead(data.size());
+        if (!columnar)
+            return true;
+
+        out.clear();
+        out.reserve(BLOCK_SIZE + BLOCK_SIZE / 4);
+        size_t filtered = 0;
+        bool ok = ColumnCodec::decodeBlock(format, encoded, filter, [&out](std::string_view key, bool tombstone, std::string_view value)
+                                           { appendLsmEntry(out, key, tombstone, value); },
+                                           &filtered);
+        if (filter)
+            ScanSkipCounters::instance().encodedRows(blocks[i].zone.rows, filtered);
+        return ok;
+    }
+
+    // Look key up in the one block that can hold it
+    bool get(std::string_view key, std::string &value, bool &tombstone) const
+    {
+        if (blocks.empty() || key < smallest || largest < key)
+            return false;
+        if (hasBloom)
+        {
+            bool absent = !bloom.mayContain(key);
+            ScanSkipCounters::instance().bloomProbe(absent);
+            if (absent)
+                return false;
+        }
+        auto it = std::upper_bound(blocks.begin(), blocks.end(), key, [](std::string_view k, const Block &b)
+                                   { return k < b.firstKey; });
+        std::string block;
+        if (!readBlock(static_cast<size_t>(it - blocks.begin()) - 1, block))
+            return false;
+
+        const char *in = block.data();
+        const char *end = in + block.size();
+        std::string_view entryKey, entryValue;
+        while (parseLsmEntry(in, end, entryKey, tombstone, entryValue))
+        {
+            if (entryKey == key)
+            {
+                value.assign(entryValue);
+                return true;
+            }
+            if (key < entryKey)
+                break;
+        }
+        return false;
+    }
+};
+
+// Writes one segment front to back. Every block written goes through
+// throttle, which compaction uses for rate limiting.
+class SegmentWriter
+{
+private:
+    std::string path;
+    int fd = -1;
+    std::string block;
+    std::string encoded;
+    std::string index;
+    std::string blockFirstKey;
+    std::string lastKey;
+    const RowFormat *format;
+    ZoneMap blockZone;
+    uint8_t blockFlags = 0;
+    std::vector<uint64_t> keyHashes;
+    uint32_t blockCount = 0;
+    uint64_t offset = 0;
+    uint64_t entries = 0;
+    std::function<void(size_t)> throttle;
+
+    bool writeAll(const std::string &data)
+    {
+        size_t done = 0;
+        while (done < data.size())
+        {
+            ssize_t written = ::write(fd, data.data() + done, data.size() - done);
+            if (written < 0)
+                return false;
+            done += static_cast<size_t>(written);
+        }
+        Metrics::instance().bytesWritten(data.size());
+        if (throttle)
+            throttle(data.size());
+        return true;
+    }
+
+    // Re-lay the block column by column if that makes it smaller
+    void encodeBlock()
+    {
+        std::vector<std::string_view> keys, records;
+        std::vector<bool> tombstones;
+        const char *in = block.data();
+        const char *end = in + block.size();
+        std::string_view key, value;
+        bool tombstone;
+        while (parseLsmEntry(in, end, key, tombstone, value))
+        {
+            keys.push_back(key);
+            tombstones.push_back(tombstone);
+            records.push_back(value);
+        }
+        if (ColumnCodec::encodeBlock(*format, keys, tombstones, records, encoded) && encoded.size() < block.size())
+        {
+            block.swap(encoded);
+            blockFlags |= BLOCK_COLUMNAR;
+        }
+    }
+
+    bool finishBlock()
+    {
+        if (block.empty())
+            return true;
+        if (format && !format->isLegacy())
+            encodeBlock();
+        char header[sizeof(uint16_t)];
+        putValue(header, static_cast<uint16_t>(blockFirstKey.size()));
+        index.append(header, sizeof(header));
+        index += blockFirstKey;
+        char location[sizeof(uint64_t) + sizeof(uint32_t)];
+        putValue(location, offset);
+        putValue(location + sizeof(uint64_t), static_cast<uint32_t>(block.size()));
+        index.append(location, sizeof(location));
+        if (format && blockZone.rows > 0)
+            blockFlags |= BLOCK_HAS_ZONE;
+        index += static_cast<char>(blockFlags);
+        if (blockFlags & BLOCK_HAS_ZONE)
+            blockZone.encode(index);
+        blockZone = ZoneMap{};
+        blockFlags = 0;
+        ++blockCount;
+
+        if (!writeAll(block))
+            return false;
+        offset += block.size();
+        block.clear();
+        return true;
+    }
+
+public:
+    // With a row format, values are records and every block gets a zone map
+    SegmentWriter(const std::string &segmentPath, const RowFormat *rowFormat,
+                  std::function<void(size_t)> onWrite = nullptr)
+        : path(segmentPath), format(rowFormat), throttle(std::move(onWrite))
+    {
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd >= 0)
+            Metrics::instance().fileOpened();
+        block.reserve(Segment::BLOCK_SIZE + 256);
+    }
+
+    ~SegmentWriter()
+    {
+        if (fd >= 0)
+            ::close(fd);
+    }
+
+    SegmentWriter(const SegmentWriter &) = delete;
+    SegmentWriter &operator=(const SegmentWriter &) = delete;
+
+    bool isOpen() const { return fd >= 0; }
+    uint64_t bytesWritten() const { return offset + block.size(); }
+    uint64_t entryCount() const { return entries; }
+
+    // Keys must arrive in ascending order
+    bool add(std::string_view key, bool tombstone, std::string_view value)
+    {
+        if (block.empty())
+            blockFirstKey.assign(key);
+        appendLsmEntry(block, key, tombstone, value);
+        lastKey.assign(key);
+        keyHashes.push_back(BloomFilter::keyHash(key));
+        if (tombstone)
+            blockFlags |= BLOCK_HAS_TOMBSTONES;
+        else if (format)
+            blockZone.add(*format, value);
+        ++entries;
+        return block.size() < Segment::BLOCK_SIZE || finishBlock();
+    }
+
+    // Write the index and footer and make the file durable
+    bool finish()
+    {
+        if (!finishBlock())
+            return false;
+        std::string tail;
+        char count[sizeof(uint32_t)];
+        putValue(count, blockCount);
+        tail.append(count, sizeof(count));
+        tail += index;
+        char lastLength[sizeof(uint16_t)];
+        putValue(lastLength, static_cast<uint16_t>(lastKey.size()));
+        tail.append(lastLength, sizeof(lastLength));
+        tail += lastKey;
+        BloomFilter bloom;
+        bloom.build(keyHashes);
+        bloom.encode(tail);
+        bool columnar = format && !format->isLegacy();
+        ColumnCodec::append(tail, static_cast<uint16_t>(columnar ? format->getTypes().size() : 0));
+        for (size_t i = 0; columnar && i < format->getTypes().size(); ++i)
+            tail += static_cast<char>(format->getTypes()[i].kind);
+
+        char footer[SEGMENT_FOOTER_SIZE];
+        putValue(footer, offset);
+        putValue(footer + 8, static_cast<uint64_t>(tail.size()));
+        putValue(footer + 16, entries);
+        putValue(footer + 24, SEGMENT_FORMAT_VERSION);
+        putValue(footer + 28, SEGMENT_MAGIC);
+        tail.append(footer, sizeof(footer));
+
+        if (!writeAll(tail) || ::fdatasync(fd) != 0)
+            return false;
+        ::close(fd);
+        fd = -1;
+        return true;
+    }
+};
+
+// Ordered stream of entries from one source of a merge
+class LsmCursor
+{
+public:
+    virtual ~LsmCursor() = default;
+    virtual bool valid() const = 0;
+    virtual std::string_view key() const = 0;
+    virtual std::string_view value() const = 0;
+    virtual bool tombstone() const = 0;
+    virtual void next() = 0;
+};
+
+// Newest version of every key in a memtable
+class MemtableCursor : public LsmCursor
+{
+private:
+    std::shared_ptr<const Memtable> table;
+    const Memtable::Node *node;
+    uint64_t maxSeq;
+
+    // Versions written after maxSeq are invisible to this cursor
+    void settle()
+    {
+        while (node && node->seq > maxSeq)
+            node = Memtable::next(node);
+    }
+
+public:
+    explicit MemtableCursor(std::shared_ptr<const Memtable> memtable, uint64_t maxSequence = UINT64_MAX)
+        : table(std::move(memtable)), node(table->first()), maxSeq(maxSequence)
+    {
+        settle();
+    }
+
+    bool valid() const override { return node != nullptr; }
+    std::string_view key() const override { return node->key; }
+    std::string_view value() const override { return node->value; }
+    bool tombstone() const override { return node->tombstone; }
+
+    void next() override
+    {
+        const Memtable::Node *current = node;
+        do
+            node = Memtable::next(node);
+        while (node && node->key == current->key);
+        settle();
+    }
+};
+
+// Segments with disjoint, ascending key ranges read one block at a time
+class RunCursor : public LsmCursor
+{
+private:
+    std::vector<std::shared_ptr<Segment>> segments;
+    const Filter *filter;
+    size_t segment = 0;
+    size_t block = 0;
+    std::string buffer;
+    const char *in = nullptr;
+    const char *end = nullptr;
+    std::string_view currentKey, currentValue;
+    bool currentTombstone = false;
+    bool isValid = false;
+
+    void advance()
+    {
+        while (true)
+        {
+            if (in && parseLsmEntry(in, end, currentKey, currentTombstone, currentValue))
+            {
+                isValid = true;
+                return;
+            }
+            while (segment < segments.size() &&
+                   (block >= segments[segment]->blockCount() || (filter && segments[segment]->canSkipBlock(block, *filter))))
+            {
+                if (block < segments[segment]->blockCount())
+                {
+                    ScanSkipCounters::instance().blockSkipped();
+                    ++block;
+                    continue;
+                }
+                ++segment;
+                block = 0;
+            }
+            if (segment < segments.size() && filter)
+                ScanSkipCounters::instance().blockRead();
+            if (segment >= segments.size() || !segments[segment]->readBlock(block++, buffer, filter))
+            {
+                isValid = false;
+                return;
+            }
+            in = buffer.data();
+            end = in + buffer.size();
+        }
+    }
+
+public:
+    // With a filter, blocks whose zone map fails it are passed over and
+    // rows of columnar blocks that fail it are left out. The filter must
+    // outlive the cursor.
+    explicit RunCursor(std::vector<std::shared_ptr<Segment>> run, const Filter *rowFilter = nullptr)
+        : segments(std::move(run)), filter(rowFilter) { advance(); }
+
+    bool valid() const override { return isValid; }
+    std::string_view key() const override { return currentKey; }
+    std::string_view value() const override { return currentValue; }
+    bool tombstone() const override { return currentTombstone; }
+    void next() override { advance(); }
+};
+
+// Merge of several sources, ordered newest first: for each key only the
+// entry from the earliest source survives. Tombstones are either passed
+// on (compaction into a level with data below) or swallowed (reads).
+class MergingCursor
+{
+private:
+    std::vector<std::unique_ptr<LsmCursor>> sources;
+    bool skipTombstones;
+    std::string currentKey, currentValue;
+    bool currentTombstone = false;
+    bool isValid = false;
+
+public:
+    MergingCursor(std::vector<std::unique_ptr<LsmCursor>> inputs, bool dropTombstones)
+        : sources(std::move(inputs)), skipTombstones(dropTombstones) { next(); }
+
+    bool valid() const { return isValid; }
+    const std::string &key() const { return currentKey; }
+    const std::string &value() const { return currentValue; }
+    bool tombstone() const { return currentTombstone; }
+
+    void next()
+    {
+        while (true)
+        {
+            LsmCursor *winner = nullptr;
+            for (auto &source : sources)
+            {
+                if (source->valid() && (!winner || source->key() < winner->key()))
+                    winner = source.get();
+            }
+            if (!winner)
+            {
+                isValid = false;
+                return;
+            }
+
+            currentKey.assign(winner->key());
+            currentTombstone = winner->tombstone();
+            currentValue.assign(currentTombstone ? std::string_view() : winner->value());
+            for (auto &source : sources)
+            {
+                if (source->valid() && source->key() == currentKey)
+                    source->next();
+            }
+            if (!(skipTombstones && currentTombstone))
+            {
+                isValid = true;
+                return;
+            }
+        }
+    }
+};
+
+// Token bucket on bytes: callers sleep once they run ahead of the rate
+class RateLimiter
+{
+private:
+    double bytesPerSecond;
+    std::chrono::steady_clock::time_point ready = std::chrono::steady_clock::now();
+
+public:
+    explicit RateLimiter(double rate) : bytesPerSecond(rate) {}
+
+    void request(size_t bytes)
+    {
+        if (bytesPerSecond <= 0)
+            return;
+        auto now = std::chrono::steady_clock::now();
+        // Up to 100 ms of idle time may be spent as a burst
+        ready = std::max(ready, now - std::chrono::milliseconds(100));
+        ready += std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(static_cast<double>(bytes) / bytesPerSecond));
+        if (ready > now)
+            std::this_thread::sleep_until(ready);
+    }
+};
+
+constexpr size_t LSM_LEVELS = 7;
+
+// Everything a reader of an LsmTree needs, replaced as a whole on every
+// change. Holding one keeps its memtables and segments alive, so every
+// read through it sees the same data however the tree has moved on.
+struct LsmVersion
+{
+    std::shared_ptr<Memtable> active;
+    std::shared_ptr<const Memtable> frozen; // being flushed, if any
+    std::vector<std::vector<std::shared_ptr<Segment>>> levels = std::vector<std::vector<std::shared_ptr<Segment>>>(LSM_LEVELS);
+};
+
+class LsmTree
+{
+private:
+    static constexpr size_t LEVELS = LSM_LEVELS;
+    static constexpr size_t L0_TRIGGER = 4;  // level 0 segments that start a compaction
+    static constexpr size_t L0_STOP = 12;    // level 0 segments that stall writers
+    static constexpr uint64_t LEVEL1_BYTES = 64ull * 1024 * 1024;
+    static constexpr uint64_t LEVEL_RATIO = 10;
+    static constexpr uint64_t TARGET_SEGMENT_BYTES = 8ull * 1024 * 1024;
+
+    using Version = LsmVersion;
+
+    struct Compaction
+    {
+        size_t level; // inputs come from level and level + 1
+        std::vector<std::shared_ptr<Segment>> upper, lower;
+        bool bottommost;
+    };
+
+    std::string dir;
+    const RowFormat *format;
+    size_t memtableBytes;
+    RateLimiter limiter;
+
+    mutable std::mutex mutex;
+    std::condition_variable changed;
+    std::shared_ptr<const Version> current;
+    uint64_t nextSeq = 1;
+    uint64_t nextNumber = 1;
+    std::vector<std::string> compactPointer = std::vector<std::string>(LEVELS);
+    bool stopping = false;
+    bool failed = false;
+    std::thread worker;
+
+    std::string segmentPath(uint64_t number) const { return dir + "/" + std::to_string(number) + ".seg"; }
+    std::string manifestPath() const { return dir + "/MANIFEST"; }
+
+    std::shared_ptr<const Version> snapshot() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return current;
+    }
+
+    static uint64_t levelBytes(const std::vector<std::shared_ptr<Segment>> &level)
+    {
+        uint64_t total = 0;
+        for (const auto &segment : level)
+            total += segment->getFileSize();
+        return total;
+    }
+
+    static uint64_t levelLimit(size_t level)
+    {
+        uint64_t limit = LEVEL1_BYTES;
+        for (size_t i = 1; i < level; ++i)
+            limit *= LEVEL_RATIO;
+        return limit;
+    }
+
+    // Replace the manifest with the segments of version; caller holds mutex
+    bool writeManifest(const Version &version)
+    {
+        std::string tmpPath = manifestPath() + ".tmp";
+        {
+            std::ofstream out(tmpPath, std::ios::trunc);
+            for (size_t level = 0; level < LEVELS; ++level)
+            {
+                for (const auto &segment : version.levels[level])
+                    out << level << " " << segment->getNumber() << "\n";
+            }
+            out.flush();
+            if (!out.good())
+                return false;
+        }
+        int fd = ::open(tmpPath.c_str(), O_RDONLY);
+        bool synced = fd >= 0 && ::fdatasync(fd) == 0;
+        if (fd >= 0)
+            ::close(fd);
+        if (!synced)
+            return false;
+        // Runs on the background thread too: report failure, never throw
+        std::error_code error;
+        std::filesystem::rename(tmpPath, manifestPath(), error);
+        if (error)
+            return false;
+        int dirFd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+        synced = dirFd >= 0 && ::fsync(dirFd) == 0;
+        if (dirFd >= 0)
+            ::close(dirFd);
+        return synced;
+    }
+
+    // Write the frozen memtable to a new level 0 segment
+    void flushFrozen()
+    {
+        std::shared_ptr<const Memtable> frozen;
+        uint64_t number;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            frozen = current->frozen;
+            if (!frozen)
+                return;
+            number = nextNumber++;
+        }
+
+        std::shared_ptr<Segment> segment;
+        if (!frozen->empty())
+        {
+            SegmentWriter writer(segmentPath(number), format);
+            bool ok = writer.isOpen();
+            for (MemtableCursor cursor(frozen); ok && cursor.valid(); cursor.next())
+                ok = writer.add(cursor.key(), cursor.tombstone(), cursor.value());
+            ok = ok && writer.finish();
+            segment = ok ? Segment::open(segmentPath(number), number) : nullptr;
+            if (!segment)
+            {
+                // Keep the memtable; the rows are still covered by the WAL
+                std::lock_guard<std::mutex> lock(mutex);
+                failed = true;
+                changed.notify_all();
+                return;
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        auto next = std::make_shared<Version>(*current);
+        next->frozen = nullptr;
+        if (segment)
+            next->levels[0].push_back(segment);
+        if (segment && !writeManifest(*next))
+        {
+            failed = true;
+            changed.notify_all();
+            return;
+        }
+        current = next;
+        changed.notify_all();
+    }
+
+    // Most urgent compaction, if any level is over its limit; caller holds mutex
+    bool pickCompaction(Compaction &job)
+    {
+        const Version &version = *current;
+        double bestScore = 1.0;
+        size_t best = LEVELS;
+        for (size_t level = 0; level + 1 < LEVELS; ++level)
+        {
+            double score = level == 0 ? static_cast<double>(version.levels[0].size()) / L0_TRIGGER
+                                      : static_cast<double>(levelBytes(version.levels[level])) / levelLimit(level);
+            if (score >= bestScore)
+            {
+                bestScore = score;
+                best = level;
+            }
+        }
+        if (best == LEVELS)
+            return false;
+
+        job = Compaction{best, {}, {}, true};
+        if (best == 0)
+        {
+            job.upper = version.levels[0];
+        }
+        else
+        {
+            // Round-robin through the level by key so every range gets its turn
+            const auto &level = version.levels[best];
+            auto it = std::find_if(level.begin(), level.end(), [this, best](const auto &segment)
+                                   { return segment->getSmallest() > compactPointer[best]; });
+            job.upper.push_back(it == level.end() ? level.front() : *it);
+            compactPointer[best] = job.upper.back()->getLargest();
+        }
+
+        std::string low = job.upper.front()->getSmallest(), high = job.upper.front()->getLargest();
+        for (const auto &segment : job.upper)
+        {
+            low = std::min(low, segment->getSmallest());
+            high = std::max(high, segment->getLargest());
+        }
+        for (const auto &segment : version.levels[best + 1])
+        {
+            if (segment->overlaps(low, high))
+                job.lower.push_back(segment);
+        }
+        for (size_t deeper = best + 2; deeper < LEVELS; ++deeper)
+        {
+            for (const auto &segment : version.levels[deeper])
+                job.bottommost = job.bottommost && !segment->overlaps(low, high);
+        }
+        return true;
+    }
+
+    void runCompaction(const Compaction &job)
+    {
+        std::vector<std::unique_ptr<LsmCursor>> inputs;
+        for (auto it = job.upper.rbegin(); it != job.upper.rend() && job.level == 0; ++it)
+            inputs.push_back(std::make_unique<RunCursor>(std::vector<std::shared_ptr<Segment>>{*it}));
+        if (job.level != 0)
+            inputs.push_back(std::make_unique<RunCursor>(job.upper));
+        inputs.push_back(std::make_unique<RunCursor>(job.lower));
+        MergingCursor cursor(std::move(inputs), job.bottommost);
+
+        std::vector<std::shared_ptr<Segment>> outputs;
+        auto throttle = [this](size_t bytes)
+        { limiter.request(bytes); };
+        while (cursor.valid())
+        {
+            uint64_t number;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                number = nextNumber++;
+            }
+            SegmentWriter writer(segmentPath(number), format, throttle);
+            bool ok = writer.isOpen();
+            for (; ok && cursor.valid() && writer.bytesWritten() < TARGET_SEGMENT_BYTES; cursor.next())
+                ok = writer.add(cursor.key(), cursor.tombstone(), cursor.value());
+            std::shared_ptr<Segment> segment = ok && writer.finish() ? Segment::open(segmentPath(number), number) : nullptr;
+            if (!segment)
+            {
+                // Leave the inputs in place; the partial outputs are not in
+                // the manifest and go away with their last reference
+                std::error_code ignored;
+                std::filesystem::remove(segmentPath(number), ignored);
+                std::lock_guard<std::mutex> lock(mutex);
+                for (auto &output : outputs)
+                    output->markObsolete();
+                failed = true;
+                changed.notify_all();
+                return;
+            }
+            outputs.push_back(segment);
+
+            // A frozen memtable must not wait for the whole compaction
+            flushFrozen();
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        auto next = std::make_shared<Version>(*current);
+        auto removeInputs = [](std::vector<std::shared_ptr<Segment>> &level, const std::vector<std::shared_ptr<Segment>> &inputs)
+        {
+            level.erase(std::remove_if(level.begin(), level.end(), [&inputs](const auto &segment)
+                                       { return std::find(inputs.begin(), inputs.end(), segment) != inputs.end(); }),
+                        level.end());
+        };
+        removeInputs(next->levels[job.level], job.upper);
+        auto &target = next->levels[job.level + 1];
+        removeInputs(target, job.lower);
+        target.insert(target.end(), outputs.begin(), outputs.end());
+        std::sort(target.begin(), target.end(), [](const auto &a, const auto &b)
+                  { return a->getSmallest() < b->getSmallest(); });
+        if (!writeManifest(*next))
+        {
+            for (auto &output : outputs)
+                output->markObsolete();
+            failed = true;
+            changed.notify_all();
+            return;
+        }
+        for (const auto &segment : job.upper)
+            segment->markObsolete();
+        for (const auto &segment : job.lower)
+            segment->markObsolete();
+        current = next;
+        changed.notify_all();
+    }
+
+    void backgroundLoop()
+    {
+        while (true)
+        {
+            Compaction job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [this, &job]()
+                             { return stopping || (!failed && (current->frozen || pickCompaction(job))); });
+                if (stopping)
+                    return;
+                if (current->frozen)
+                {
+                    lock.unlock();
+                    flushFrozen();
+                    continue;
+                }
+            }
+            runCompaction(job);
+        }
+    }
+
+    void startWorker()
+    {
+        worker = std::thread(&LsmTree::backgroundLoop, this);
+    }
+
+    // Freeze the active memtable once the previous one is out; caller holds
+    // lock. Returns false if the tree has stopped working.
+    bool rotate(std::unique_lock<std::mutex> &lock)
+    {
+        changed.wait(lock, [this]()
+                     { return !current->frozen || failed; });
+        if (failed)
+            return false;
+        auto next = std::make_shared<Version>(*current);
+        next->frozen = next->active;
+        next->active = std::make_shared<Memtable>();
+        current = next;
+        changed.notify_all();
+        return true;
+    }
+
+    bool write(std::string_view key, std::string_view value, bool tombstone)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        // Level 0 backed up: let compaction catch up before growing it
+        changed.wait(lock, [this]()
+                     { return current->levels[0].size() < L0_STOP || failed || stopping; });
+        if (failed)
+            return false;
+        current->active->insert(key, value, tombstone, nextSeq++);
+        if (current->active->approximateBytes() >= memtableBytes)
+            return rotate(lock);
+        return true;
+    }
+
+public:
+    // rowFormat, if given, describes the values and enables zone maps
+    explicit LsmTree(const std::string &directory, const RowFormat *rowFormat = nullptr)
+        : dir(directory), format(rowFormat), memtableBytes(0), limiter(0)
+    {
+        // NOSQLITE_MEMTABLE_MB sizes each memtable; NOSQLITE_COMPACTION_MB_PER_SEC
+        // caps compaction writes (0 for no cap)
+        const char *env = std::getenv("NOSQLITE_MEMTABLE_MB");
+        memtableBytes = std::max<uint64_t>(env ? std::strtoull(env, nullptr, 10) : 32, 1) * 1024 * 1024;
+        env = std::getenv("NOSQLITE_COMPACTION_MB_PER_SEC");
+        limiter = RateLimiter((env ? std::strtod(env, nullptr) : 64.0) * 1024 * 1024);
+
+        auto initial = std::make_shared<Version>();
+        initial->active = std::make_shared<Memtable>();
+        current = initial;
+    }
+
+    ~LsmTree() { close(); }
+
+    LsmTree(const LsmTree &) = delete;
+    LsmTree &operator=(const LsmTree &) = delete;
+
+    // Start an empty tree
+    bool create()
+    {
+        std::error_code ec;
+        std::filesystem::remove_all(dir, ec);
+        if (!std::filesystem::create_directories(dir, ec))
+            return false;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!writeManifest(*current))
+                return false;
+        }
+        startWorker();
+        return true;
+    }
+
+    // Open the segments listed in the manifest and drop any others
+    bool open()
+    {
+        std::ifstream manifest(manifestPath());
+        if (!manifest.is_open())
+            return false;
+
+        auto version = std::make_shared<Version>();
+        version->active = std::make_shared<Memtable>();
+        std::set<uint64_t> live;
+        size_t level;
+        uint64_t number;
+        while (manifest >> level >> number)
+        {
+            auto segment = level < LEVELS ? Segment::open(segmentPath(number), number) : nullptr;
+            if (!segment)
+            {
+                std::cerr << "Missing or damaged segment " << segmentPath(number) << std::endl;
+                return false;
+            }
+            version->levels[level].push_back(segment);
+            live.insert(number);
+            nextNumber = std::max(nextNumber, number + 1);
+        }
+
+        for (const auto &entry : std::filesystem::directory_iterator(dir))
+        {
+            if (entry.path().extension() != ".seg")
+                continue;
+            uint64_t fileNumber = std::strtoull(entry.path().stem().string().c_str(), nullptr, 10);
+            nextNumber = std::max(nextNumber, fileNumber + 1);
+            if (!live.count(fileNumber))
+                std::filesystem::remove(entry.path());
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            current = version;
+        }
+        startWorker();
+        return true;
+    }
+
+    // Stop the background thread; unflushed memtable contents are dropped
+    void close()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        changed.notify_all();
+        if (worker.joinable())
+            worker.join();
+    }
+
+    // Close and remove the directory
+    void destroy()
+    {
+        close();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            current = nullptr;
+        }
+        std::error_code ec;
+        std::filesystem::remove_all(dir, ec);
+    }
+
+    bool put(std::string_view key, std::string_view value) { return write(key, value, false); }
+    bool remove(std::string_view key) { return write(key, {}, true); }
+
+    // Sequence number of the last write; reads bounded by it leave out
+    // everything written later
+    uint64_t lastSequence() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return nextSeq - 1;
+    }
+
+    // The current version, for a reader that needs several reads of the
+    // same state
+    std::shared_ptr<const LsmVersion> pinVersion() const { return snapshot(); }
+
+    // Newest live value of key as of write maxSeq, in version (by default
+    // the current one). Only memtable entries carry sequence numbers: a
+    // version pinned when maxSeq was the last write holds in its segments
+    // nothing written later, and the bound covers its memtables.
+    bool get(std::string_view key, std::string &value, uint64_t maxSeq = UINT64_MAX,
+             std::shared_ptr<const LsmVersion> version = nullptr) const
+    {
+        if (!version)
+            version = snapshot();
+        bool tombstone = false;
+        if (version->active->get(key, value, tombstone, maxSeq) ||
+            (version->frozen && version->frozen->get(key, value, tombstone, maxSeq)))
+            return !tombstone;
+
+        const auto &level0 = version->levels[0];
+        for (auto it = level0.rbegin(); it != level0.rend(); ++it)
+        {
+            if ((*it)->get(key, value, tombstone))
+                return !tombstone;
+        }
+        for (size_t level = 1; level < LEVELS; ++level)
+        {
+            const auto &run = version->levels[level];
+            auto it = std::lower_bound(run.begin(), run.end(), key, [](const auto &segment, std::string_view k)
+                                       { return segment->getLargest() < k; });
+            if (it != run.end() && (*it)->get(key, value, tombstone))
+                return !tombstone;
+        }
+        return false;
+    }
+
+    // Visit every live entry in key order from a consistent snapshot.
+    // Segment blocks whose zone map fails filter are skipped and segment
+    // rows that fail it are dropped, so some entries that fail it may be
+    // left out; the caller still filters what it gets. This relies on a key
+    // never being rewritten with a different value, which holds for tables
+    // since unique_ids are never reused.
+    // Entries written after maxSeq are left out of version, as in get.
+    void scan(const std::function<bool(std::string_view, std::string_view)> &visit,
+              const Filter *filter = nullptr, uint64_t maxSeq = UINT64_MAX,
+              std::shared_ptr<const LsmVersion> version = nullptr) const
+    {
+        for (auto cursor = openCursor(filter, maxSeq, std::move(version)); cursor->valid(); cursor->next())
+        {
+            if (!visit(cursor->key(), cursor->value()))
+                return;
+        }
+    }
+
+    // Blocks in every segment, and how many of them a scan with filter
+    // would pass by. Memtable entries are not in blocks and not counted.
+    void countSkippableBlocks(const Filter &filter, uint64_t &blocks, uint64_t &skippable) const
+    {
+        auto version = snapshot();
+        for (const auto &level : version->levels)
+        {
+            for (const auto &segment : level)
+            {
+                for (size_t i = 0; i < segment->blockCount(); ++i)
+                {
+                    ++blocks;
+                    skippable += segment->canSkipBlock(i, filter);
+                }
+            }
+        }
+    }
+
+    // The merge scan walks, for callers that pull entries one at a time.
+    // It holds the version's memtables and segments until destroyed.
+    std::unique_ptr<MergingCursor> openCursor(const Filter *filter = nullptr, uint64_t maxSeq = UINT64_MAX,
+                                              std::shared_ptr<const LsmVersion> version = nullptr) const
+    {
+        if (!version)
+            version = snapshot();
+        std::vector<std::unique_ptr<LsmCursor>> sources;
+        sources.push_back(std::make_unique<MemtableCursor>(version->active, maxSeq));
+        if (version->frozen)
+            sources.push_back(std::make_unique<MemtableCursor>(version->frozen, maxSeq));
+        const auto &level0 = version->levels[0];
+        for (auto it = level0.rbegin(); it != level0.rend(); ++it)
+            sources.push_back(std::make_unique<RunCursor>(std::vector<std::shared_ptr<Segment>>{*it}, filter));
+        for (size_t level = 1; level < LEVELS; ++level)
+        {
+            if (!version->levels[level].empty())
+                sources.push_back(std::make_unique<RunCursor>(version->levels[level], filter));
+        }
+
+        return std::make_unique<MergingCursor>(std::move(sources), true);
+    }
+
+    // Write the memtable out and wait until it is in the manifest. After
+    // this the WAL records for this tree are no longer needed.
+    bool flush()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (!current || failed)
+            return false;
+        if (!current->active->empty() && !rotate(lock))
+            return false;
+        changed.wait(lock, [this]()
+                     { return !current->frozen || failed || stopping; });
+        return !failed && !current->frozen;
+    }
+
+    // Segments per level, for diagnostics
+    std::vector<size_t> levelShape() const
+    {
+        auto version = snapshot();
+        std::vector<size_t> shape;
+        for (const auto &level : version->levels)
+            shape.push_back(level.size());
+        while (!shape.empty() && shape.back() == 0)
+            shape.pop_back();
+        return shape;
+    }
+};
+
+#endif // LSM_H
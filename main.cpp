@@ -1,6 +1,7 @@
 #include <iostream>
 #include <string>
 #include "helper.h"
+#include "server.h"
 
 void printHelp()
 {
@@ -9,17 +10,52 @@ void printHelp()
               << "  show                          - Show available databases\n"
               << "  create <database_name>        - Create a new database\n"
               << "  open <database_name>          - Open an existing database\n"
-              << "  create table <name> (attrs)   - Create a new table\n"
-              << "  insert into <table> (values)  - Insert data into table\n"
+              << "  create table <name> (attrs) [engine=lsm] - Create a new table\n"
+              << "      attrs: <col> [int32|int64|double|bool|timestamp|varchar(n)], ...\n"
+              << "  insert into <table> (values)[, (values)...] - Insert data into table\n"
+              << "  load into <table> from '<file.csv>' - Bulk load rows from a CSV file\n"
               << "  select from <table> [limit] [last] - Query data\n"
+              << "  select from <table> id:<value> - Look up one record by ID\n"
+              << "  select from <table> where <condition> [limit] [last] - Filter rows\n"
+              << "      conditions: <col> <op> <value>, <col> in (v1, ...), <col> between a and b,\n"
+              << "      joined with and/or and grouped with parentheses\n"
+              << "      either may add 'order by <col> [asc|desc]' before the limit to sort the rows\n"
+              << "  select from <a> join <b> on <a>.<col> = <b>.<col> [limit] - Hash join two tables\n"
+              << "  select <aggregates> from <table> [where ...] [group by <cols>] [limit]\n"
+              << "      aggregates: count(*), sum(c), min(c), max(c), avg(c) and grouped columns\n"
+              << "      any select may end in 'parallel <n>' to cap the threads its scan uses\n"
+              << "  create index <name> on <table>(<column>) - Create a B+tree index\n"
               << "  delete from <table> id:<value> - Delete record\n"
+              << "  explain [analyze] <statement> - Show the plan; analyze runs it and times each operator\n"
+              << "  prepare <name> as <statement> - Parse an insert, select or delete once; ? marks a parameter\n"
+              << "  execute <name> [(values)]     - Run a prepared statement with its parameters\n"
+              << "  deallocate <name>             - Forget a prepared statement\n"
               << "  drop <database/table_name>    - Drop database or table\n"
+              << "  set durability <mode>         - none, fsync or group <rows> <us>\n"
+              << "  checkpoint                    - Flush tables and truncate the log\n"
+              << "  show pool                     - Show buffer pool statistics\n"
+              << "  show scans                    - Show blocks skipped by zone maps and Bloom filters\n"
+              << "  stats                         - Show command latencies, rows and bytes read and written\n"
+              << "  set stats '<file>' <seconds>  - Append stats to a file periodically (set stats off stops)\n"
+              << "  set pool <mb> [clock|lru-k]   - Resize the buffer pool\n"
               << "  exit                          - Exit the program\n"
-              << "  help                          - Show this help message\n";
+              << "  help                          - Show this help message\n"
+              << "Run with --serve <socket> to serve many clients over a Unix socket,\n"
+              << "and with --connect <socket> for a client that sends one command per line.\n";
 }
 
-int main()
+int main(int argc, char *argv[])
 {
+    // nosqlite --serve <socket> | --connect <socket>
+    if (argc == 3 && std::string(argv[1]) == "--serve")
+    {
+        return Server(argv[2]).run();
+    }
+    if (argc == 3 && std::string(argv[1]) == "--connect")
+    {
+        return runClient(argv[2]);
+    }
+
     std::cout << "Simple Database Management System\n"
               << "Type 'help' for available commands\n";
 
@@ -64,12 +100,8 @@ int main()
             std::cout << "Password: ";
             std::getline(std::cin, password);
 
-            // Create a new User instance for login attempt
-            User loginUser;
-            if (loginUser.login(username, password))
+            if (queryHelper.login(username, password))
             {
-                // Update the queryHelper's current user on successful login
-                queryHelper.currentUser = std::make_shared<User>(loginUser);
                 std::cout << "Successfully logged in as " << username << std::endl;
             }
             else
@@ -89,7 +121,7 @@ int main()
         // Execute query and print result
         try
         {
-            std::string result = queryHelper.executeQuery(input);
+            std::string result = queryHelper.executeQuery(input, std::cout);
             std::cout << result << std::endl;
         }
         catch (const std::exception &e)
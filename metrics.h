@@ -0,0 +1,220 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Latencies in nanoseconds, counted in log-linear buckets as HDR histograms
+// do: every power of two is cut into SUB_BUCKETS equal buckets, so a
+// percentile is off by at most 1/SUB_BUCKETS of its value. Recording is a
+// few relaxed atomic adds and never locks.
+class LatencyHistogram
+{
+private:
+    static constexpr unsigned SUB_BITS = 4;
+    static constexpr uint64_t SUB_BUCKETS = 1u << SUB_BITS;
+    static constexpr size_t BUCKETS = (64 - SUB_BITS + 1) * SUB_BUCKETS;
+
+    std::array<std::atomic<uint64_t>, BUCKETS> buckets{};
+    std::atomic<uint64_t> total{0};
+    std::atomic<uint64_t> sum{0};
+    std::atomic<uint64_t> largest{0};
+
+    static size_t bucketOf(uint64_t value)
+    {
+        if (value < SUB_BUCKETS)
+            return static_cast<size_t>(value);
+        unsigned shift = 63 - __builtin_clzll(value) - SUB_BITS;
+        return (shift + 1) * SUB_BUCKETS + ((value >> shift) - SUB_BUCKETS);
+    }
+
+    // The largest value that falls in bucket
+    static uint64_t highestIn(size_t bucket)
+    {
+        size_t group = bucket / SUB_BUCKETS;
+        if (group == 0)
+            return bucket;
+        unsigned shift = static_cast<unsigned>(group - 1);
+        uint64_t low = (SUB_BUCKETS + bucket % SUB_BUCKETS) << shift;
+        return low + ((uint64_t(1) << shift) - 1);
+    }
+
+public:
+    void record(uint64_t nanos)
+    {
+        buckets[bucketOf(nanos)].fetch_add(1, std::memory_order_relaxed);
+        total.fetch_add(1, std::memory_order_relaxed);
+        sum.fetch_add(nanos, std::memory_order_relaxed);
+        uint64_t seen = largest.load(std::memory_order_relaxed);
+        while (nanos > seen && !largest.compare_exchange_weak(seen, nanos, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    uint64_t count() const { return total.load(std::memory_order_relaxed); }
+    uint64_t max() const { return largest.load(std::memory_order_relaxed); }
+    uint64_t mean() const
+    {
+        uint64_t n = count();
+        return n ? sum.load(std::memory_order_relaxed) / n : 0;
+    }
+
+    // The value below which fraction (0..1) of the recorded values fall.
+    // Recorders may run meanwhile, so this is approximate while they do.
+    uint64_t percentile(double fraction) const
+    {
+        uint64_t n = count();
+        if (n == 0)
+            return 0;
+        uint64_t rank = static_cast<uint64_t>(fraction * static_cast<double>(n) + 0.5);
+        rank = rank == 0 ? 1 : rank;
+        uint64_t seen = 0;
+        for (size_t i = 0; i < BUCKETS; ++i)
+        {
+            seen += buckets[i].load(std::memory_order_relaxed);
+            if (seen >= rank)
+                return std::min(highestIn(i), max());
+        }
+        return max();
+    }
+};
+
+struct IoStats
+{
+    uint64_t rowsRead;
+    uint64_t rowsWritten;
+    uint64_t bytesRead;
+    uint64_t bytesWritten;
+    uint64_t fileOpens;
+};
+
+// Process-wide counters of rows read by scans and lookups and written by
+// inserts and deletes, of bytes moved to and from table, segment and log
+// files, and a latency histogram per kind of command. A report can be
+// appended to a file at a fixed interval by a background thread.
+class Metrics
+{
+public:
+    static constexpr size_t MAX_COMMANDS = 32;
+
+private:
+    std::atomic<uint64_t> rowsReadCount{0};
+    std::atomic<uint64_t> rowsWrittenCount{0};
+    std::atomic<uint64_t> bytesReadCount{0};
+    std::atomic<uint64_t> bytesWrittenCount{0};
+    std::atomic<uint64_t> fileOpenCount{0};
+    std::array<LatencyHistogram, MAX_COMMANDS> commands;
+
+    std::mutex controlMutex; // serializes starting and stopping dumps
+    std::mutex dumpMutex;
+    std::condition_variable dumpChanged;
+    std::thread dumper;
+    uint64_t dumpGeneration = 0; // bumped to stop the current dumper
+
+    Metrics() = default;
+
+    ~Metrics() { stopDump(); }
+
+    void stopDumper()
+    {
+        std::thread stopping;
+        {
+            std::lock_guard<std::mutex> lock(dumpMutex);
+            ++dumpGeneration;
+            stopping = std::move(dumper);
+        }
+        dumpChanged.notify_all();
+        if (stopping.joinable())
+            stopping.join();
+    }
+
+public:
+    static Metrics &instance()
+    {
+        static Metrics metrics;
+        return metrics;
+    }
+
+    void rowsRead(uint64_t rows) { rowsReadCount.fetch_add(rows, std::memory_order_relaxed); }
+    void rowsWritten(uint64_t rows) { rowsWrittenCount.fetch_add(rows, std::memory_order_relaxed); }
+    void bytesRead(uint64_t bytes) { bytesReadCount.fetch_add(bytes, std::memory_order_relaxed); }
+    void bytesWritten(uint64_t bytes) { bytesWrittenCount.fetch_add(bytes, std::memory_order_relaxed); }
+    void fileOpened() { fileOpenCount.fetch_add(1, std::memory_order_relaxed); }
+
+    // The histogram of the command kind numbered kind (< MAX_COMMANDS)
+    LatencyHistogram &command(size_t kind) { return commands[kind]; }
+    const LatencyHistogram &command(size_t kind) const { return commands[kind]; }
+
+    IoStats io() const
+    {
+        return IoStats{rowsReadCount.load(), rowsWrittenCount.load(), bytesReadCount.load(),
+                       bytesWrittenCount.load(), fileOpenCount.load()};
+    }
+
+    // Append report() to path every seconds seconds, replacing any earlier
+    // dump. False if the file cannot be opened.
+    bool startDump(const std::string &path, uint32_t seconds, std::function<std::string()> report)
+    {
+        std::lock_guard<std::mutex> control(controlMutex);
+        stopDumper();
+        std::ofstream probe(path, std::ios::app);
+        if (!probe)
+            return false;
+        probe.close();
+
+        std::lock_guard<std::mutex> lock(dumpMutex);
+        uint64_t generation = dumpGeneration;
+        dumper = std::thread([this, path, seconds, report, generation]()
+                             {
+                                 std::unique_lock<std::mutex> lock(dumpMutex);
+                                 while (!dumpChanged.wait_for(lock, std::chrono::seconds(seconds), [&]()
+                                                              { return dumpGeneration != generation; }))
+                                 {
+                                     lock.unlock();
+                                     std::ofstream out(path, std::ios::app);
+                                     out << "# " << std::chrono::duration_cast<std::chrono::seconds>(
+                                                        std::chrono::system_clock::now().time_since_epoch())
+                                                        .count()
+                                         << "\n"
+                                         << report() << "\n";
+                                     lock.lock();
+                                 } });
+        return true;
+    }
+
+    void stopDump()
+    {
+        std::lock_guard<std::mutex> control(controlMutex);
+        stopDumper();
+    }
+};
+
+// Records the time from its construction to its destruction in a histogram
+class LatencyTimer
+{
+private:
+    LatencyHistogram &histogram;
+    std::chrono::steady_clock::time_point start;
+
+public:
+    explicit LatencyTimer(LatencyHistogram &target) : histogram(target), start(std::chrono::steady_clock::now()) {}
+    LatencyTimer(const LatencyTimer &) = delete;
+    LatencyTimer &operator=(const LatencyTimer &) = delete;
+
+    ~LatencyTimer()
+    {
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        histogram.record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+    }
+};
+
+#endif // METRICS_H
@@ -0,0 +1,115 @@
+#ifndef MVCC_H
+#define MVCC_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <utility>
+
+struct LsmVersion;
+
+// Process-wide commit clock. Every committed insert batch or delete takes
+// the next timestamp; a reader's snapshot is the last timestamp committed
+// when it began, and it sees exactly the changes committed at or before it.
+// Open snapshots are tracked so old row versions can be collected once no
+// snapshot can see them any more.
+class VersionClock
+{
+private:
+    std::atomic<uint64_t> clock{0};
+    std::mutex mutex;
+    std::multiset<uint64_t> active;
+
+    VersionClock() = default;
+
+public:
+    static VersionClock &instance()
+    {
+        static VersionClock versions;
+        return versions;
+    }
+
+    VersionClock(const VersionClock &) = delete;
+    VersionClock &operator=(const VersionClock &) = delete;
+
+    uint64_t commit() { return clock.fetch_add(1) + 1; }
+
+    uint64_t begin()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        uint64_t ts = clock.load();
+        active.insert(ts);
+        return ts;
+    }
+
+    void end(uint64_t ts)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = active.find(ts);
+        if (it != active.end())
+            active.erase(it);
+    }
+
+    // Versions deleted at or before this timestamp are invisible to every
+    // open snapshot
+    uint64_t oldestActive()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return active.empty() ? clock.load() : *active.begin();
+    }
+};
+
+// An open snapshot; ends when destroyed
+class Snapshot
+{
+private:
+    uint64_t ts = 0;
+    bool open = false;
+
+public:
+    Snapshot() = default;
+    explicit Snapshot(uint64_t timestamp) : ts(timestamp), open(true) {}
+    Snapshot(Snapshot &&other) noexcept : ts(other.ts), open(std::exchange(other.open, false)) {}
+    Snapshot &operator=(Snapshot &&other) noexcept
+    {
+        if (this != &other)
+        {
+            if (open)
+                VersionClock::instance().end(ts);
+            ts = other.ts;
+            open = std::exchange(other.open, false);
+        }
+        return *this;
+    }
+    Snapshot(const Snapshot &) = delete;
+    Snapshot &operator=(const Snapshot &) = delete;
+    ~Snapshot()
+    {
+        if (open)
+            VersionClock::instance().end(ts);
+    }
+
+    uint64_t timestamp() const { return ts; }
+};
+
+// What one reader of a table sees: the table as it stood when the snapshot
+// began. Heap rows are appended in commit order, so the rows committed by
+// then are exactly those before the published end (pageCount and the slot
+// count of the last page); LSM entries are cut off by sequence number in
+// the tree version published with them, which the view keeps alive so that
+// flushes and compactions after it began change nothing it reads.
+// Rows deleted after the snapshot stay visible to it.
+struct ReadView
+{
+    Snapshot snapshot;
+    uint32_t pageCount = 1;
+    uint16_t lastSlotCount = 0;
+    uint64_t lsmSequence = UINT64_MAX;
+    std::shared_ptr<const LsmVersion> lsmVersion;
+
+    uint64_t timestamp() const { return snapshot.timestamp(); }
+};
+
+#endif // MVCC_H
@@ -0,0 +1,292 @@
+#include "nosqlite.h"
+#include "db.h"
+#include "table.h"
+#include "types.h"
+
+namespace nosqlite
+{
+
+namespace
+{
+
+ColumnKind toKind(Type type)
+{
+    switch (type)
+    {
+    case Type::Int32:
+        return ColumnKind::Int32;
+    case Type::Int64:
+        return ColumnKind::Int64;
+    case Type::Double:
+        return ColumnKind::Double;
+    case Type::Bool:
+        return ColumnKind::Bool;
+    case Type::Timestamp:
+        return ColumnKind::Timestamp;
+    default:
+        return ColumnKind::Varchar;
+    }
+}
+
+Type fromKind(ColumnKind kind)
+{
+    switch (kind)
+    {
+    case ColumnKind::Int32:
+        return Type::Int32;
+    case ColumnKind::Int64:
+        return Type::Int64;
+    case ColumnKind::Double:
+        return Type::Double;
+    case ColumnKind::Bool:
+        return Type::Bool;
+    case ColumnKind::Timestamp:
+        return Type::Timestamp;
+    default:
+        return Type::Varchar;
+    }
+}
+
+} // namespace
+
+size_t RowBatch::size() const
+{
+    if (data.empty())
+        return idEnds.size();
+    const ColumnData &first = data.front();
+    switch (schema.front().type)
+    {
+    case Type::Double:
+        return first.doubles.size();
+    case Type::Varchar:
+        return first.ends.size();
+    default:
+        return first.ints.size();
+    }
+}
+
+void RowBatch::clear()
+{
+    for (auto &column : data)
+    {
+        column.ints.clear();
+        column.doubles.clear();
+        column.bytes.clear();
+        column.ends.clear();
+    }
+    idBytes.clear();
+    idEnds.clear();
+}
+
+void RowBatch::reserve(size_t rows)
+{
+    for (size_t i = 0; i < data.size(); ++i)
+    {
+        if (schema[i].type == Type::Double)
+            data[i].doubles.reserve(rows);
+        else if (schema[i].type == Type::Varchar)
+            data[i].ends.reserve(rows);
+        else
+            data[i].ints.reserve(rows);
+    }
+    idEnds.reserve(rows);
+}
+
+Cursor::Cursor() = default;
+Cursor::Cursor(Cursor &&) noexcept = default;
+Cursor &Cursor::operator=(Cursor &&) noexcept = default;
+Cursor::~Cursor() = default;
+
+bool Cursor::next(RowBatch &batch, size_t rows)
+{
+    batch.clear();
+    if (!table || !state)
+        return false;
+
+    bool more = table->readRecords(*state, rows, [&](std::string_view record)
+                                   { Table::decode(*table, record, batch); });
+    if (!more)
+        state.reset(); // the snapshot is not needed once the scan is done
+    return more;
+}
+
+void Table::decode(const ::Table &table, std::string_view record, RowBatch &batch)
+{
+    const RowFormat &format = table.getFormat();
+    const std::vector<ColumnType> &types = format.getTypes();
+    batch.idBytes += RowCodec::decodeId(record);
+    batch.idEnds.push_back(static_cast<uint32_t>(batch.idBytes.size()));
+    for (size_t i = 0; i < batch.data.size() && i < types.size(); ++i)
+    {
+        std::string_view bytes = format.field(record, i + 1);
+        if (format.isLegacy() || types[i].kind == ColumnKind::Varchar)
+            batch.addText(i, bytes);
+        else if (types[i].kind == ColumnKind::Double)
+            batch.addDouble(i, ValueCodec::decodeDouble(bytes));
+        else
+            batch.addInt(i, ValueCodec::decodeInteger(types[i], bytes));
+    }
+}
+
+std::string Table::name() const { return table ? table->getName() : std::string(); }
+
+std::vector<Column> Table::columns() const
+{
+    std::vector<Column> result;
+    if (!table)
+        return result;
+    const std::vector<std::string> &names = table->getSchema();
+    const std::vector<ColumnType> &types = table->getFormat().getTypes();
+    for (size_t i = 0; i < names.size(); ++i)
+    {
+        ColumnType type = i < types.size() ? types[i] : ColumnType{};
+        result.push_back(Column{names[i], fromKind(type.kind), type.length});
+    }
+    return result;
+}
+
+size_t Table::append(RowBatch &&rows, std::string *error)
+{
+    auto reject = [error](const std::string &reason) -> size_t
+    {
+        if (error)
+            *error = reason;
+        return 0;
+    };
+    if (!table)
+        return reject("No table");
+
+    const RowFormat &format = table->getFormat();
+    const std::vector<ColumnType> &types = format.getTypes();
+    if (rows.schema.size() != types.size())
+        return reject("Expected " + std::to_string(types.size()) + " columns");
+
+    // Every column must hold one value per row, where its type keeps them
+    size_t count = rows.size();
+    for (size_t i = 0; i < types.size(); ++i)
+    {
+        const RowBatch::ColumnData &column = rows.data[i];
+        size_t values = types[i].kind == ColumnKind::Double    ? column.doubles.size()
+                        : types[i].kind == ColumnKind::Varchar ? column.ends.size()
+                                                               : column.ints.size();
+        if (values != count)
+            return reject("Column '" + table->getSchema()[i] + "' holds " + std::to_string(values) + " " +
+                          types[i].name() + " values, expected " + std::to_string(count));
+    }
+    if (count == 0)
+        return 0;
+
+    std::vector<std::string> ids = IdGenerator::instance().next(count);
+    std::vector<std::string> records(count);
+    std::string reason;
+    std::string value;
+    for (size_t row = 0; row < count; ++row)
+    {
+        bool encoded = format.assemble(ids[row], [&](size_t i, std::string_view &stored)
+                                       {
+                                           const ColumnType &type = types[i];
+                                           const RowBatch::ColumnData &column = rows.data[i];
+                                           bool valid = true;
+                                           if (type.kind == ColumnKind::Varchar)
+                                           {
+                                               stored = RowBatch::slice(column.bytes, column.ends, row);
+                                               valid = type.length == 0 || stored.size() <= type.length;
+                                           }
+                                           else
+                                           {
+                                               valid = type.kind == ColumnKind::Double
+                                                           ? ValueCodec::encodeDouble(column.doubles[row], value)
+                                                           : ValueCodec::encodeInteger(type, column.ints[row], value);
+                                               stored = value;
+                                           }
+                                           if (!valid)
+                                               reason = "Row " + std::to_string(row + 1) + ": invalid " + type.name() +
+                                                        " value for column '" + table->getSchema()[i] + "'";
+                                           return valid; },
+                                       records[row], &reason);
+        if (!encoded)
+            return reject(reason);
+        if (records[row].size() > MAX_RECORD_SIZE)
+            return reject("Row " + std::to_string(row + 1) + ": row too large");
+    }
+
+    size_t appended = table->insertRecords(records, error);
+    database->maybeCheckpoint();
+    return appended;
+}
+
+bool Table::get(std::string_view id, RowBatch &row) const
+{
+    row.clear();
+    if (!table)
+        return false;
+
+    ReadView view = table->snapshot();
+    bool found = false;
+    table->lookupRecords(std::string(id), [&](RowId, std::string_view record)
+                         {
+                             decode(*table, record, row);
+                             found = true;
+                             return false; },
+                         &view);
+    return found;
+}
+
+Cursor Table::scan() const
+{
+    Cursor cursor;
+    if (table)
+    {
+        cursor.table = table;
+        cursor.state = table->openCursor();
+    }
+    return cursor;
+}
+
+Database Database::open(const std::string &name, const std::string &owner)
+{
+    Database db;
+    db.database = ::Database::open(name, owner);
+    return db;
+}
+
+std::vector<std::string> Database::tables() const
+{
+    std::vector<std::string> names;
+    for (const auto &entry : database->listTables())
+        names.push_back(entry.name);
+    return names;
+}
+
+Table Database::table(const std::string &name) const
+{
+    Table handle;
+    handle.table = database->getTable(name);
+    if (handle.table)
+        handle.database = database;
+    return handle;
+}
+
+Table Database::createTable(const std::string &name, const std::vector<Column> &columns, bool lsm)
+{
+    for (const auto &entry : database->listTables())
+    {
+        if (entry.name == name)
+            return Table();
+    }
+
+    std::vector<std::string> names;
+    std::vector<ColumnType> types;
+    for (const auto &column : columns)
+    {
+        names.push_back(column.name);
+        types.push_back(ColumnType{toKind(column.type), column.type == Type::Varchar ? column.length : uint16_t(0)});
+    }
+    if (!database->createTable(name, names, types, lsm ? TableEngine::Lsm : TableEngine::Heap))
+        return Table();
+    return table(name);
+}
+
+void Database::checkpoint() { database->checkpoint(); }
+
+} // namespace nosqlite
@@ -0,0 +1,219 @@
+#ifndef NOSQLITE_H
+#define NOSQLITE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// In-process access to nosqlite databases, built as libnosqlite. Rows go
+// in and come out as typed, column-major batches: nothing here formats or
+// parses text.
+//
+//   nosqlite::Database db = nosqlite::Database::open("metrics");
+//   nosqlite::Table t = db.createTable("events", {{"at", nosqlite::Type::Timestamp},
+//                                                 {"value", nosqlite::Type::Double}});
+//   nosqlite::RowBatch batch = t.newBatch();
+//   batch.addInt(0, micros);
+//   batch.addDouble(1, 0.5);
+//   t.append(std::move(batch));
+//
+//   nosqlite::Cursor cursor = t.scan();
+//   while (cursor.next(batch))
+//       for (double v : batch.doubles(1)) ...
+//
+// Databases live under database/<owner>/<name>/ relative to the working
+// directory, as for the command line; a database opened here shares its
+// tables, indexes and log with every other user of it in the process. One
+// created here is not added to the owner's account, so the command line
+// does not offer it.
+
+class Database;
+class Table;
+struct TableCursor;
+
+namespace nosqlite
+{
+
+enum class Type : uint8_t
+{
+    Int32,
+    Int64,
+    Double,
+    Bool,
+    Timestamp, // microseconds since the epoch
+    Varchar
+};
+
+struct Column
+{
+    std::string name;
+    Type type = Type::Varchar;
+    uint16_t length = 0; // varchar: most bytes allowed, 0 for no limit
+};
+
+// Contiguous values of one column (std::span before C++20)
+template <typename T>
+class Span
+{
+private:
+    const T *first = nullptr;
+    size_t count = 0;
+
+public:
+    Span() = default;
+    Span(const T *data, size_t size) : first(data), count(size) {}
+
+    const T *data() const { return first; }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    const T &operator[](size_t i) const { return first[i]; }
+    const T *begin() const { return first; }
+    const T *end() const { return first + count; }
+};
+
+// Rows held column by column. Int32, Int64, Bool (0 or 1) and Timestamp
+// columns hold int64_t, Double columns double and Varchar columns bytes
+// in one buffer per column. Columns are filled independently; the batch is
+// complete when all of them hold the same number of values. Batches read
+// from a table also carry each row's unique_id.
+class RowBatch
+{
+private:
+    struct ColumnData
+    {
+        std::vector<int64_t> ints;
+        std::vector<double> doubles;
+        std::string bytes;
+        std::vector<uint32_t> ends; // end of each value in bytes
+    };
+
+    std::vector<Column> schema;
+    std::vector<ColumnData> data;
+    std::string idBytes;
+    std::vector<uint32_t> idEnds;
+
+    static std::string_view slice(const std::string &bytes, const std::vector<uint32_t> &ends, size_t i)
+    {
+        uint32_t begin = i == 0 ? 0 : ends[i - 1];
+        return std::string_view(bytes).substr(begin, ends[i] - begin);
+    }
+
+    friend class Table;
+    friend class Cursor;
+
+public:
+    RowBatch() = default;
+    explicit RowBatch(std::vector<Column> columns) : schema(std::move(columns)), data(schema.size()) {}
+
+    const std::vector<Column> &columns() const { return schema; }
+
+    // Rows, as the number of values in the first column
+    size_t size() const;
+
+    // Drop every row, keeping the columns and the memory
+    void clear();
+    void reserve(size_t rows);
+
+    void addInt(size_t column, int64_t value) { data[column].ints.push_back(value); }
+    void addDouble(size_t column, double value) { data[column].doubles.push_back(value); }
+    void addText(size_t column, std::string_view value)
+    {
+        data[column].bytes.append(value.data(), value.size());
+        data[column].ends.push_back(static_cast<uint32_t>(data[column].bytes.size()));
+    }
+
+    Span<int64_t> ints(size_t column) const { return Span<int64_t>(data[column].ints.data(), data[column].ints.size()); }
+    Span<double> doubles(size_t column) const
+    {
+        return Span<double>(data[column].doubles.data(), data[column].doubles.size());
+    }
+    std::string_view text(size_t column, size_t row) const { return slice(data[column].bytes, data[column].ends, row); }
+    std::string_view id(size_t row) const { return slice(idBytes, idEnds, row); }
+};
+
+// A forward scan over a snapshot of one table, taken when the scan began;
+// rows committed later are not seen. The snapshot is held until the cursor
+// is destroyed.
+class Cursor
+{
+private:
+    std::shared_ptr<::Table> table;
+    std::unique_ptr<TableCursor> state;
+
+    friend class Table;
+
+public:
+    static constexpr size_t DEFAULT_ROWS = 4096;
+
+    Cursor();
+    Cursor(Cursor &&) noexcept;
+    Cursor &operator=(Cursor &&) noexcept;
+    ~Cursor();
+
+    // Replace batch's rows with the next ones, about rows of them (heap
+    // tables hand out whole pages). False when the scan is done.
+    bool next(RowBatch &batch, size_t rows = DEFAULT_ROWS);
+};
+
+class Table
+{
+private:
+    std::shared_ptr<::Database> database;
+    std::shared_ptr<::Table> table;
+
+    // Add one stored record to the end of batch
+    static void decode(const ::Table &table, std::string_view record, RowBatch &batch);
+
+    friend class Database;
+    friend class Cursor;
+
+public:
+    Table() = default;
+
+    // False for the handle of a table that was not found
+    explicit operator bool() const { return table != nullptr; }
+
+    std::string name() const;
+    std::vector<Column> columns() const;
+
+    // An empty batch with this table's columns
+    RowBatch newBatch() const { return RowBatch(columns()); }
+
+    // Append every row of rows as one logged batch, giving each a new
+    // unique_id. Returns the rows appended: all of them, or 0 with the
+    // reason in error if a value does not fit its column.
+    size_t append(RowBatch &&rows, std::string *error = nullptr);
+
+    // The row with unique_id id into row (cleared first); false if none
+    bool get(std::string_view id, RowBatch &row) const;
+
+    Cursor scan() const;
+};
+
+class Database
+{
+private:
+    std::shared_ptr<::Database> database;
+
+public:
+    // Open the database, creating it if it does not exist
+    static Database open(const std::string &name, const std::string &owner = "admin");
+
+    std::vector<std::string> tables() const;
+
+    // An empty handle if there is no such table
+    Table table(const std::string &name) const;
+
+    // An empty handle if the table exists or cannot be created
+    Table createTable(const std::string &name, const std::vector<Column> &columns, bool lsm = false);
+
+    // Make every table durable and restart the log
+    void checkpoint();
+};
+
+} // namespace nosqlite
+
+#endif // NOSQLITE_H
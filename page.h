@@ -0,0 +1,209 @@
+#ifndef PAGE_H
+#define PAGE_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// On-disk layout of a table file (<name>.tbl):
+//
+//   page 0      table header: magic, format version, page size, page/row
+//               counts and the schema (replaces the old CSV header line)
+//   page 1..n   slotted data pages
+//
+// A data page keeps a small header, a slot directory growing forward from
+// the header and record bytes growing backward from the end of the page.
+
+constexpr uint32_t PAGE_SIZE = 4096;
+constexpr uint32_t TABLE_FORMAT_VERSION = 2;
+// Version 1 tables predate column types: every column is text and records
+// use RowCodec's length-prefixed layout. They are still read and written.
+constexpr uint32_t LEGACY_TABLE_FORMAT_VERSION = 1;
+constexpr char TABLE_MAGIC[8] = {'N', 'S', 'Q', 'L', 'T', 'B', 'L', '\0'};
+
+struct PageHeader
+{
+    uint16_t slotCount;
+    uint16_t freeStart; // first byte after the slot directory
+    uint16_t freeEnd;   // first byte of record data
+    uint16_t flags;
+};
+
+struct Slot
+{
+    uint16_t offset;
+    uint16_t length;
+};
+
+// Largest record that still fits into an empty page together with its slot
+constexpr uint32_t MAX_RECORD_SIZE = PAGE_SIZE - sizeof(PageHeader) - sizeof(Slot);
+
+// High bit of Slot::length marks a deleted record (tombstone). The bytes
+// stay in place so row locations never move.
+constexpr uint16_t SLOT_TOMBSTONE = 0x8000;
+
+// Physical location of a row: data page and slot within it
+struct RowId
+{
+    uint32_t pageNo;
+    uint16_t slot;
+
+    bool operator==(const RowId &other) const { return pageNo == other.pageNo && slot == other.slot; }
+};
+
+// Little helpers for reading/writing fixed-width values into byte buffers
+template <typename T>
+inline void putValue(char *dst, T value) { std::memcpy(dst, &value, sizeof(T)); }
+
+template <typename T>
+inline T getValue(const char *src)
+{
+    T value;
+    std::memcpy(&value, src, sizeof(T));
+    return value;
+}
+
+class SlottedPage
+{
+private:
+    char *data;
+
+    PageHeader header() const { return getValue<PageHeader>(data); }
+    void setHeader(const PageHeader &h) { putValue(data, h); }
+
+public:
+    explicit SlottedPage(char *pageData) : data(pageData) {}
+
+    void init()
+    {
+        std::memset(data, 0, PAGE_SIZE);
+        setHeader(PageHeader{0, sizeof(PageHeader), static_cast<uint16_t>(PAGE_SIZE), 0});
+    }
+
+    uint16_t slotCount() const { return header().slotCount; }
+
+    // Raw header access, used by recovery to roll a page back to a
+    // checkpointed append point
+    PageHeader state() const { return header(); }
+    void restore(const PageHeader &h) { setHeader(h); }
+
+    uint32_t freeSpace() const
+    {
+        PageHeader h = header();
+        return h.freeEnd - h.freeStart;
+    }
+
+    bool canFit(size_t recordSize) const
+    {
+        return recordSize + sizeof(Slot) <= freeSpace();
+    }
+
+    // Returns the slot number of the stored record, or -1 if it does not fit
+    int insert(std::string_view record)
+    {
+        if (!canFit(record.size()))
+            return -1;
+
+        PageHeader h = header();
+        h.freeEnd -= static_cast<uint16_t>(record.size());
+        std::memcpy(data + h.freeEnd, record.data(), record.size());
+
+        Slot slot{h.freeEnd, static_cast<uint16_t>(record.size())};
+        putValue(data + h.freeStart, slot);
+        h.freeStart += sizeof(Slot);
+
+        int slotNo = h.slotCount++;
+        setHeader(h);
+        return slotNo;
+    }
+
+    std::string_view get(uint16_t slotNo) const
+    {
+        Slot slot = getValue<Slot>(data + sizeof(PageHeader) + slotNo * sizeof(Slot));
+        return std::string_view(data + slot.offset, slot.length & ~SLOT_TOMBSTONE);
+    }
+
+    bool isDeleted(uint16_t slotNo) const
+    {
+        Slot slot = getValue<Slot>(data + sizeof(PageHeader) + slotNo * sizeof(Slot));
+        return (slot.length & SLOT_TOMBSTONE) != 0;
+    }
+
+    // Mark a record deleted; returns false if it already was
+    bool erase(uint16_t slotNo)
+    {
+        char *entry = data + sizeof(PageHeader) + slotNo * sizeof(Slot);
+        Slot slot = getValue<Slot>(entry);
+        if (slotNo >= slotCount() || (slot.length & SLOT_TOMBSTONE))
+            return false;
+        slot.length |= SLOT_TOMBSTONE;
+        putValue(entry, slot);
+        return true;
+    }
+
+    // Clear a tombstone. Only done on a private copy of a page, to show a
+    // reader a row deleted after its snapshot.
+    void revive(uint16_t slotNo)
+    {
+        char *entry = data + sizeof(PageHeader) + slotNo * sizeof(Slot);
+        Slot slot = getValue<Slot>(entry);
+        slot.length &= ~SLOT_TOMBSTONE;
+        putValue(entry, slot);
+    }
+};
+
+// Version 1 row codec: every field (unique_id first) is stored as a u16
+// length followed by the raw bytes. Typed tables use RowFormat (types.h),
+// which keeps the same unique_id prefix so decodeId works for both.
+namespace RowCodec
+{
+    inline std::string encode(const std::string &uniqueId, const std::vector<std::string> &fields)
+    {
+        size_t size = sizeof(uint16_t) + uniqueId.size();
+        for (const auto &field : fields)
+            size += sizeof(uint16_t) + field.size();
+
+        std::string record(size, '\0');
+        char *out = record.data();
+        auto append = [&out](const std::string &value)
+        {
+            putValue(out, static_cast<uint16_t>(value.size()));
+            out += sizeof(uint16_t);
+            std::memcpy(out, value.data(), value.size());
+            out += value.size();
+        };
+
+        append(uniqueId);
+        for (const auto &field : fields)
+            append(field);
+        return record;
+    }
+
+    // The unique_id is always the first field
+    inline std::string_view decodeId(std::string_view record)
+    {
+        if (record.size() < sizeof(uint16_t))
+            return {};
+        uint16_t length = getValue<uint16_t>(record.data());
+        return record.substr(sizeof(uint16_t), length);
+    }
+
+    inline std::vector<std::string> decode(std::string_view record)
+    {
+        std::vector<std::string> fields;
+        const char *in = record.data();
+        const char *end = in + record.size();
+        while (in + sizeof(uint16_t) <= end)
+        {
+            uint16_t length = getValue<uint16_t>(in);
+            in += sizeof(uint16_t);
+            fields.emplace_back(in, length);
+            in += length;
+        }
+        return fields;
+    }
+}
+
+#endif // PAGE_H
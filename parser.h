@@ -0,0 +1,950 @@
+#ifndef PARSER_H
+#define PARSER_H
+
+#include <algorithm>
+#include <cctype>
+#include <cstddef>
+#include <iterator>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "types.h"
+#include "table.h"
+#include "filter.h"
+#include "aggregate.h"
+
+// Statements are read in one pass into tokens, then by recursive descent
+// into a Statement. normalizeStatement lifts the constants out of a token
+// stream, so statements that differ only in their constants parse to the
+// same Statement; the lifted values, like the `?` parameters of prepared
+// statements, are bound into a copy of it before it runs.
+
+enum class TokenKind
+{
+    Word,   // names, keywords and bare values
+    Number,
+    String, // quoted; text excludes the quotes
+    Param,  // ? or a constant lifted out by normalizeStatement
+    Symbol  // ( ) , ; and comparison operators
+};
+
+struct Token
+{
+    TokenKind kind = TokenKind::Word;
+    std::string_view text;
+    std::string_view raw; // as written, quotes included
+    bool spaceBefore = false;
+    size_t param = 0; // Param: its number within the statement
+};
+
+// [+-]digits[.digits][e[+-]digits], or with the digits after the point only
+inline bool isNumberText(std::string_view text)
+{
+    size_t i = 0;
+    auto digits = [&text, &i]()
+    {
+        size_t start = i;
+        while (i < text.size() && std::isdigit(static_cast<unsigned char>(text[i])))
+            ++i;
+        return i - start;
+    };
+
+    if (i < text.size() && (text[i] == '+' || text[i] == '-'))
+        ++i;
+    size_t mantissa = digits();
+    if (i < text.size() && text[i] == '.')
+    {
+        ++i;
+        mantissa += digits();
+    }
+    if (mantissa == 0)
+        return false;
+    if (i < text.size() && (text[i] == 'e' || text[i] == 'E'))
+    {
+        ++i;
+        if (i < text.size() && (text[i] == '+' || text[i] == '-'))
+            ++i;
+        if (digits() == 0)
+            return false;
+    }
+    return i == text.size();
+}
+
+inline bool sameWord(std::string_view text, std::string_view word)
+{
+    if (text.size() != word.size())
+        return false;
+    for (size_t i = 0; i < text.size(); ++i)
+    {
+        if (std::tolower(static_cast<unsigned char>(text[i])) != word[i])
+            return false;
+    }
+    return true;
+}
+
+// Split text into tokens. A word runs until whitespace, a quote or one of
+// ( ) , ; ? = < > !, so values such as 2024-01-31 or -1.5e3 stay whole; a
+// leading "id:" is split off the value it introduces. Tokens point into
+// text. False on an unterminated string or a stray '!'.
+inline bool tokenize(std::string_view text, std::vector<Token> &tokens, std::string &error)
+{
+    static constexpr std::string_view breaks = "(),;?=<>!'\"";
+
+    tokens.clear();
+    size_t pos = 0;
+    size_t params = 0;
+    bool space = false;
+    while (pos < text.size())
+    {
+        char c = text[pos];
+        if (std::isspace(static_cast<unsigned char>(c)))
+        {
+            space = true;
+            ++pos;
+            continue;
+        }
+
+        Token token;
+        token.spaceBefore = space;
+        space = false;
+        size_t start = pos;
+        if (c == '\'' || c == '"')
+        {
+            size_t close = text.find(c, pos + 1);
+            if (close == std::string_view::npos)
+            {
+                error = "Unterminated string at position " + std::to_string(pos + 1);
+                return false;
+            }
+            token.kind = TokenKind::String;
+            token.text = text.substr(pos + 1, close - pos - 1);
+            pos = close + 1;
+        }
+        else if (c == '?')
+        {
+            token.kind = TokenKind::Param;
+            token.param = params++;
+            ++pos;
+        }
+        else if (c == '=' || c == '<' || c == '>' || c == '!')
+        {
+            token.kind = TokenKind::Symbol;
+            char next = pos + 1 < text.size() ? text[pos + 1] : '\0';
+            pos += next == '=' || (c == '<' && next == '>') ? 2 : 1;
+            if (c == '!' && pos == start + 1)
+            {
+                error = "Unexpected '!' at position " + std::to_string(start + 1);
+                return false;
+            }
+        }
+        else if (breaks.find(c) != std::string_view::npos)
+        {
+            token.kind = TokenKind::Symbol;
+            ++pos;
+        }
+        else
+        {
+            while (pos < text.size() && !std::isspace(static_cast<unsigned char>(text[pos])) &&
+                   breaks.find(text[pos]) == std::string_view::npos)
+                ++pos;
+            if (pos - start > 3 && sameWord(text.substr(start, 3), "id:"))
+            {
+                token.text = token.raw = text.substr(start, 3);
+                tokens.push_back(token);
+                token = Token{};
+                start += 3;
+            }
+            token.kind = isNumberText(text.substr(start, pos - start)) ? TokenKind::Number : TokenKind::Word;
+        }
+
+        token.raw = text.substr(start, pos - start);
+        if (token.kind != TokenKind::String)
+            token.text = token.raw;
+        tokens.push_back(token);
+    }
+    return true;
+}
+
+// Is the word at i in value position: the operand of id:, a lone member of
+// an insert tuple, or the right-hand side of a comparison, between or in
+// after where? Only there do bare words stand for constants; elsewhere
+// they are names and keywords.
+inline bool isBareValue(const std::vector<Token> &tokens, size_t i, bool insert, bool where, bool inList)
+{
+    auto isSymbolAt = [&tokens](size_t at, std::string_view text)
+    { return at < tokens.size() && tokens[at].kind == TokenKind::Symbol && tokens[at].text == text; };
+    auto isWordAt = [&tokens](size_t at, std::string_view word)
+    { return at < tokens.size() && tokens[at].kind == TokenKind::Word && sameWord(tokens[at].text, word); };
+
+    if (i == 0)
+        return false;
+    bool loneItem = (isSymbolAt(i - 1, "(") || isSymbolAt(i - 1, ",")) &&
+                    (isSymbolAt(i + 1, ",") || isSymbolAt(i + 1, ")"));
+    if (isWordAt(i - 1, "id:") || (insert && loneItem))
+        return true;
+    if (!where)
+        return false;
+    if (inList && loneItem)
+        return true;
+    if (isWordAt(i - 1, "between") || (i >= 3 && isWordAt(i - 1, "and") && isWordAt(i - 3, "between")))
+        return true;
+    const Token &previous = tokens[i - 1];
+    return previous.kind == TokenKind::Symbol && previous.text != "(" && previous.text != ")" &&
+           previous.text != "," && previous.text != ";";
+}
+
+// Copy tokens into normalized with every constant replaced by a parameter:
+// numbers, strings and bare words in value position. The replaced values
+// are collected in literals (a `?` that was already there gets
+// std::nullopt). Returns the normalized text: each token as written, with
+// keywords in lower case and constants as ?, separated by one space
+// wherever the original had any. Equal normalized texts parse the same.
+inline std::string normalizeStatement(const std::vector<Token> &tokens, std::vector<Token> &normalized,
+                                      std::vector<std::optional<std::string>> &literals)
+{
+    static const std::string_view KEYWORDS[] = {"insert", "into", "select", "delete", "from", "where", "and",
+                                                 "or", "between", "in", "id:", "join", "on", "order", "by",
+                                                 "asc", "desc", "group", "last", "parallel"};
+
+    normalized = tokens;
+    literals.clear();
+    std::string key;
+    bool insert = !tokens.empty() && tokens.front().kind == TokenKind::Word && sameWord(tokens.front().text, "insert");
+    bool where = false, inList = false;
+    for (size_t i = 0; i < normalized.size(); ++i)
+    {
+        Token &token = normalized[i];
+        bool bareValue = token.kind == TokenKind::Word && isBareValue(tokens, i, insert, where, inList);
+        if (token.kind == TokenKind::Number || token.kind == TokenKind::String || bareValue)
+        {
+            literals.emplace_back(std::string(token.text));
+            token.kind = TokenKind::Param;
+        }
+        else if (token.kind == TokenKind::Param)
+        {
+            literals.emplace_back();
+        }
+        if (token.kind == TokenKind::Param)
+            token.param = literals.size() - 1;
+
+        if (token.spaceBefore && !key.empty())
+            key += ' ';
+        auto keyword = std::find_if(std::begin(KEYWORDS), std::end(KEYWORDS), [&token](std::string_view word)
+                                    { return token.kind == TokenKind::Word && sameWord(token.text, word); });
+        if (token.kind == TokenKind::Param)
+            key += '?';
+        else if (keyword != std::end(KEYWORDS))
+            key += *keyword;
+        else
+            key += token.text;
+
+        if (token.kind == TokenKind::Word && sameWord(token.text, "where"))
+            where = true;
+        else if (token.kind == TokenKind::Symbol && token.text == "(")
+            inList = where && i > 0 && tokens[i - 1].kind == TokenKind::Word && sameWord(tokens[i - 1].text, "in");
+        else if (token.kind == TokenKind::Symbol && token.text == ")")
+            inList = false;
+    }
+    return key;
+}
+
+enum class StatementKind
+{
+    Login,
+    Show,
+    ShowPool,
+    ShowScans,
+    Stats,
+    SetPool,
+    SetDurability,
+    SetStats,
+    CreateDatabase,
+    CreateTable,
+    CreateIndex,
+    Open,
+    Drop,
+    Checkpoint,
+    Insert,
+    Load,
+    Delete,
+    Select,
+    Aggregate,
+    Prepare,
+    Execute,
+    Deallocate,
+    Explain
+};
+
+// How the stats command names a kind of statement
+inline const char *statementName(StatementKind kind)
+{
+    static const char *const NAMES[] = {"login", "show", "show pool", "show scans", "stats", "set pool",
+                                        "set durability", "set stats", "create database", "create table",
+                                        "create index", "open", "drop", "checkpoint", "insert", "load",
+                                        "delete", "select", "aggregate", "prepare", "execute", "deallocate",
+                                        "explain"};
+    return NAMES[static_cast<size_t>(kind)];
+}
+
+// One parsed statement. Only the fields of its kind are set. Values the
+// statement compares or stores are value slots, numbered in the order the
+// parser read them; a parameter leaves its slot empty until bound.
+struct Statement
+{
+    StatementKind kind = StatementKind::Show;
+    std::string name;    // database, table or prepared statement; create index: the index
+    std::string table;   // create index
+    std::string column;  // create index
+    std::vector<std::string> columns; // create table
+    std::vector<ColumnType> types;
+    TableEngine engine = TableEngine::Heap;
+    std::vector<std::string> words; // set pool and set durability arguments, lower case
+
+    std::vector<std::vector<std::string>> rows; // insert; execute: one row of parameter values
+    std::string path;                          // load; set stats: the file to dump to
+    std::string id;                            // delete
+    bool hasFilter = false;
+    Filter filter; // select and aggregate; select id:<value> is unique_id = value
+    std::optional<std::string> limit;
+    std::optional<std::string> degree; // parallel N
+    bool last = false;
+    std::vector<OutputColumn> outputs; // aggregate
+    std::vector<std::string> groupBy;
+    std::string orderBy; // select: the column to sort by, empty for file order
+    std::string joinTable; // select ... join: the right table, and the columns of `on` as written
+    std::string joinLeft, joinRight;
+    bool descending = false;
+    std::string body; // prepare and explain: the statement text
+    bool analyze = false; // explain analyze
+
+    std::vector<size_t> paramSlots; // slot of each parameter, in parameter order
+};
+
+template <typename Visit>
+inline void forEachFilterValue(Filter &filter, Visit &visit)
+{
+    for (auto &value : filter.values)
+        visit(value);
+    for (auto &child : filter.children)
+        forEachFilterValue(child, visit);
+}
+
+// Visit every value slot in slot order
+template <typename Visit>
+inline void forEachSlot(Statement &statement, Visit visit)
+{
+    for (auto &row : statement.rows)
+    {
+        for (auto &value : row)
+            visit(value);
+    }
+    if (statement.kind == StatementKind::Load)
+        visit(statement.path);
+    if (statement.kind == StatementKind::Delete)
+        visit(statement.id);
+    if (statement.hasFilter)
+        forEachFilterValue(statement.filter, visit);
+    if (statement.limit)
+        visit(*statement.limit);
+    if (statement.degree)
+        visit(*statement.degree);
+}
+
+// Fill the parameter slots of statement, parameter i from values[i]
+inline void bindParameters(Statement &statement, const std::vector<std::string> &values)
+{
+    size_t slot = 0;
+    size_t next = 0;
+    forEachSlot(statement, [&](std::string &value)
+                {
+                    if (next < statement.paramSlots.size() && statement.paramSlots[next] == slot)
+                        value = values[next++];
+                    ++slot; });
+}
+
+class Parser
+{
+private:
+    const std::vector<Token> &tokens;
+    Statement &statement;
+    std::string &error;
+    bool allowParams;
+    size_t pos = 0;
+    size_t slots = 0;
+
+    static constexpr const char *FILTER_USAGE =
+        "Invalid where clause. Use: where column <op> value (=, !=, <, <=, >, >=), "
+        "column in (v1, v2, ...) or column between low and high, joined by and/or";
+
+    // Keep the first, most specific message
+    bool fail(const std::string &message)
+    {
+        if (error.empty())
+            error = message;
+        return false;
+    }
+
+    bool atEnd() const { return pos >= tokens.size(); }
+    const Token *peek() const { return atEnd() ? nullptr : &tokens[pos]; }
+
+    bool isSymbol(size_t at, std::string_view text) const
+    {
+        return at < tokens.size() && tokens[at].kind == TokenKind::Symbol && tokens[at].text == text;
+    }
+
+    bool isKeyword(size_t at, std::string_view word) const
+    {
+        return at < tokens.size() && tokens[at].kind == TokenKind::Word && sameWord(tokens[at].text, word);
+    }
+
+    // Consume a keyword (any case) or symbol if it comes next
+    bool keyword(std::string_view word)
+    {
+        if (!isKeyword(pos, word))
+            return false;
+        ++pos;
+        return true;
+    }
+
+    bool symbol(std::string_view text)
+    {
+        if (!isSymbol(pos, text))
+            return false;
+        ++pos;
+        return true;
+    }
+
+    bool name(std::string &out)
+    {
+        const Token *token = peek();
+        if (!token || (token->kind != TokenKind::Word && token->kind != TokenKind::Number))
+            return false;
+        out = std::string(token->text);
+        ++pos;
+        return true;
+    }
+
+    // Tokens [begin, end) exactly as written
+    std::string span(size_t begin, size_t end) const
+    {
+        if (begin >= end)
+            return "";
+        const char *first = tokens[begin].raw.data();
+        const Token &last = tokens[end - 1];
+        return std::string(first, last.raw.data() + last.raw.size() - first);
+    }
+
+    // Index of the first ',' or ')' at or after begin outside parentheses,
+    // or of the keyword stop if one is given
+    size_t itemEnd(size_t begin, std::string_view stop = {}) const
+    {
+        int depth = 0;
+        size_t at = begin;
+        for (; at < tokens.size(); ++at)
+        {
+            if (depth == 0 && (isSymbol(at, ",") || isSymbol(at, ")") || (!stop.empty() && isKeyword(at, stop))))
+                break;
+            if (isSymbol(at, "("))
+                ++depth;
+            else if (isSymbol(at, ")"))
+                --depth;
+        }
+        return at;
+    }
+
+    // Fill one value slot from token; a parameter leaves it empty
+    bool slot(const Token &token, std::string &out)
+    {
+        if (token.kind == TokenKind::Param)
+        {
+            if (!allowParams)
+                return fail("Parameters (?) are only allowed in prepared statements");
+            statement.paramSlots.push_back(slots);
+            out.clear();
+        }
+        else
+        {
+            out = std::string(token.text);
+        }
+        ++slots;
+        return true;
+    }
+
+    // One token: a number, a quoted string, a bare word or a parameter
+    bool value(std::string &out)
+    {
+        const Token *token = peek();
+        if (!token || token->kind == TokenKind::Symbol)
+            return false;
+        ++pos;
+        return slot(*token, out);
+    }
+
+    // A value in a parenthesised list: everything up to the next ',' or
+    // ')', as written, so unquoted values may hold spaces. A lone token is
+    // read as by value().
+    bool listValue(std::string &out)
+    {
+        size_t begin = pos;
+        pos = itemEnd(begin);
+        if (pos == begin + 1 && tokens[begin].kind != TokenKind::Symbol)
+            return slot(tokens[begin], out);
+        for (size_t at = begin; at < pos; ++at)
+        {
+            if (tokens[at].kind == TokenKind::Param)
+                return fail("A parameter must stand for a whole value");
+        }
+        out = span(begin, pos);
+        ++slots;
+        return true;
+    }
+
+    // '(' value, ... ')'
+    bool valueList(std::vector<std::string> &values)
+    {
+        if (!symbol("("))
+            return false;
+        do
+        {
+            values.emplace_back();
+            if (!listValue(values.back()))
+                return false;
+        } while (symbol(","));
+        return symbol(")");
+    }
+
+    bool filterPrimary(Filter &filter)
+    {
+        if (symbol("("))
+            return disjunction(filter) && symbol(")");
+        if (!name(filter.column))
+            return false;
+
+        if (keyword("between"))
+        {
+            filter.kind = Filter::Kind::Between;
+            filter.values.resize(2);
+            return value(filter.values[0]) && keyword("and") && value(filter.values[1]);
+        }
+
+        if (keyword("in"))
+        {
+            filter.kind = Filter::Kind::In;
+            if (!symbol("("))
+                return false;
+            do
+            {
+                filter.values.emplace_back();
+                if (!value(filter.values.back()))
+                    return false;
+            } while (symbol(","));
+            return symbol(")");
+        }
+
+        static const std::pair<std::string_view, CompareOp> operators[] = {
+            {"=", CompareOp::Eq}, {"==", CompareOp::Eq}, {"!=", CompareOp::Ne}, {"<>", CompareOp::Ne},
+            {"<", CompareOp::Lt}, {"<=", CompareOp::Le}, {">", CompareOp::Gt}, {">=", CompareOp::Ge}};
+        const Token *op = peek();
+        auto it = std::find_if(std::begin(operators), std::end(operators), [op](const auto &entry)
+                               { return op && op->kind == TokenKind::Symbol && op->text == entry.first; });
+        if (it == std::end(operators))
+            return false;
+        ++pos;
+        filter.kind = Filter::Kind::Compare;
+        filter.op = it->second;
+        filter.values.resize(1);
+        return value(filter.values[0]);
+    }
+
+    // Operands joined by one connective; a single operand is returned as is
+    template <typename Operand>
+    bool chain(Filter &filter, Filter::Kind kind, std::string_view connective, Operand operand)
+    {
+        Filter first;
+        if (!(this->*operand)(first))
+            return false;
+        if (!keyword(connective))
+        {
+            filter = std::move(first);
+            return true;
+        }
+
+        filter = Filter{};
+        filter.kind = kind;
+        filter.children.push_back(std::move(first));
+        do
+        {
+            filter.children.emplace_back();
+            if (!(this->*operand)(filter.children.back()))
+                return false;
+        } while (keyword(connective));
+        return true;
+    }
+
+    bool conjunction(Filter &filter) { return chain(filter, Filter::Kind::And, "and", &Parser::filterPrimary); }
+    bool disjunction(Filter &filter) { return chain(filter, Filter::Kind::Or, "or", &Parser::conjunction); }
+
+    // [where <condition>]; `and` binds tighter than `or`
+    bool whereClause()
+    {
+        if (!keyword("where"))
+            return true;
+        statement.hasFilter = true;
+        return disjunction(statement.filter) || fail(FILTER_USAGE);
+    }
+
+    // [limit] [last] [parallel N]
+    bool options(bool allowLast)
+    {
+        const Token *token = peek();
+        if (token && (token->kind == TokenKind::Number || token->kind == TokenKind::Param))
+        {
+            statement.limit.emplace();
+            ++pos;
+            if (!slot(*token, *statement.limit))
+                return false;
+        }
+        if (allowLast && keyword("last"))
+            statement.last = true;
+        if (keyword("parallel"))
+        {
+            statement.degree.emplace();
+            if (!value(*statement.degree))
+                return false;
+        }
+        return atEnd();
+    }
+
+    bool createTable()
+    {
+        statement.kind = StatementKind::CreateTable;
+        if (!name(statement.name) || !symbol("("))
+            return false;
+
+        // Each attribute is a name optionally followed by its type
+        do
+        {
+            statement.columns.emplace_back();
+            if (!name(statement.columns.back()))
+                return false;
+            size_t end = itemEnd(pos);
+            statement.types.emplace_back();
+            if (end > pos && !parseColumnType(span(pos, end), statement.types.back()))
+            {
+                return fail("Unknown type for column '" + statement.columns.back() +
+                            "'. Use int32, int64, double, bool, timestamp or varchar(n)");
+            }
+            pos = end;
+        } while (symbol(","));
+        if (!symbol(")"))
+            return false;
+
+        // Optional storage engine after the attribute list
+        if (atEnd())
+            return true;
+        size_t options = pos;
+        if (keyword("engine") && symbol("="))
+        {
+            if (keyword("lsm"))
+                statement.engine = TableEngine::Lsm;
+            else
+                keyword("heap");
+        }
+        if (!atEnd())
+        {
+            std::string text = span(options, tokens.size());
+            std::transform(text.begin(), text.end(), text.begin(), ::tolower);
+            return fail("Unknown table option '" + text + "'. Use engine=heap or engine=lsm");
+        }
+        return true;
+    }
+
+    // create index <name> on <table>(<column>)
+    bool createIndex()
+    {
+        statement.kind = StatementKind::CreateIndex;
+        return name(statement.name) && statement.name.find_first_of("/.") == std::string::npos &&
+               keyword("on") && name(statement.table) && symbol("(") && name(statement.column) &&
+               symbol(")") && atEnd();
+    }
+
+    bool insert()
+    {
+        statement.kind = StatementKind::Insert;
+        if (!keyword("into") || !name(statement.name))
+            return false;
+        do
+        {
+            statement.rows.emplace_back();
+            if (!valueList(statement.rows.back()))
+                return false;
+        } while (symbol(","));
+        return atEnd();
+    }
+
+    // select from <table> [where <condition> | id:<value>] [order by <col> [asc|desc]] [limit] [last]
+    // [parallel N], or select from <table> join <table> on <col> = <col> [limit] [parallel N]
+    bool select()
+    {
+        statement.kind = StatementKind::Select;
+        if (!name(statement.name))
+            return false;
+        if (keyword("join"))
+        {
+            return name(statement.joinTable) && keyword("on") && name(statement.joinLeft) && symbol("=") &&
+                   name(statement.joinRight) && options(false);
+        }
+        if (!whereClause())
+            return false;
+        if (!statement.hasFilter && keyword("id:"))
+        {
+            statement.hasFilter = true;
+            statement.filter.column = "unique_id";
+            statement.filter.values.resize(1);
+            if (!value(statement.filter.values[0]))
+                return false;
+        }
+        if (keyword("order"))
+        {
+            if (!keyword("by") || !name(statement.orderBy))
+                return false;
+            if (keyword("desc"))
+                statement.descending = true;
+            else
+                keyword("asc");
+        }
+        return options(true);
+    }
+
+    // Output items, each a column or an aggregate of one, as written
+    bool selectList()
+    {
+        static const std::pair<const char *, AggregateFunction> functions[] = {
+            {"count", AggregateFunction::Count}, {"sum", AggregateFunction::Sum}, {"min", AggregateFunction::Min},
+            {"max", AggregateFunction::Max}, {"avg", AggregateFunction::Avg}};
+
+        do
+        {
+            size_t begin = pos;
+            pos = itemEnd(begin, "from");
+            if (pos == begin)
+                return fail("Empty item in select list");
+
+            OutputColumn output;
+            output.label = span(begin, pos);
+            size_t open = begin;
+            while (open < pos && !isSymbol(open, "("))
+                ++open;
+            if (open == pos)
+            {
+                output.column = output.label;
+                statement.outputs.push_back(output);
+                continue;
+            }
+            if (!isSymbol(pos - 1, ")"))
+                return fail("Invalid select item '" + output.label + "'");
+
+            std::string function = span(begin, open);
+            std::transform(function.begin(), function.end(), function.begin(), ::tolower);
+            auto it = std::find_if(std::begin(functions), std::end(functions), [&function](const auto &entry)
+                                   { return function == entry.first; });
+            if (it == std::end(functions))
+                return fail("Unknown aggregate '" + function + "'. Use count, sum, min, max or avg");
+            output.isAggregate = true;
+            output.function = it->second;
+            output.column = span(open + 1, pos - 1);
+            if (output.column == "*")
+            {
+                if (output.function != AggregateFunction::Count)
+                    return fail(function + "(*) is not supported; only count(*)");
+                output.column.clear();
+            }
+            statement.outputs.push_back(output);
+        } while (symbol(","));
+        return true;
+    }
+
+    // select <list> from <table> [where <condition>] [group by <col>, ...] [limit] [parallel N]
+    bool aggregate()
+    {
+        statement.kind = StatementKind::Aggregate;
+        if (!selectList() || !keyword("from") || !name(statement.name) || !whereClause())
+            return false;
+        if (keyword("group"))
+        {
+            if (!keyword("by"))
+                return false;
+            do
+            {
+                statement.groupBy.emplace_back();
+                if (!name(statement.groupBy.back()))
+                    return false;
+            } while (symbol(","));
+        }
+        return options(false);
+    }
+
+    bool statementBody()
+    {
+        if (keyword("login"))
+        {
+            statement.kind = StatementKind::Login;
+            return atEnd() || fail("Usage: login");
+        }
+
+        if (keyword("show"))
+        {
+            statement.kind = keyword("pool")    ? StatementKind::ShowPool
+                             : keyword("scans") ? StatementKind::ShowScans
+                                                : StatementKind::Show;
+            return atEnd() || fail("Unknown command");
+        }
+
+        if (keyword("stats"))
+        {
+            statement.kind = StatementKind::Stats;
+            return atEnd() || fail("Usage: stats");
+        }
+
+        if (keyword("set"))
+        {
+            // set stats '<file>' <seconds> | set stats off
+            if (keyword("stats"))
+            {
+                statement.kind = StatementKind::SetStats;
+                if (keyword("off") && atEnd())
+                    return true;
+                statement.words.emplace_back();
+                return (value(statement.path) && value(statement.words.back()) && atEnd()) ||
+                       fail("Invalid syntax. Use: set stats '<file>' <seconds> or set stats off");
+            }
+            if (keyword("pool"))
+                statement.kind = StatementKind::SetPool;
+            else if (keyword("durability"))
+                statement.kind = StatementKind::SetDurability;
+            else
+                return fail("Unknown command");
+            for (; !atEnd(); ++pos)
+            {
+                statement.words.emplace_back(tokens[pos].raw);
+                std::string &word = statement.words.back();
+                std::transform(word.begin(), word.end(), word.begin(), ::tolower);
+            }
+            return true;
+        }
+
+        if (keyword("create"))
+        {
+            if (keyword("table"))
+                return createTable() ||
+                       fail("Invalid syntax. Use: create table name (attr1, attr2, ...) [engine=heap|lsm]");
+            if (keyword("index"))
+                return createIndex() || fail("Invalid syntax. Use: create index name on table_name(column)");
+            statement.kind = StatementKind::CreateDatabase;
+            return (name(statement.name) && atEnd()) || fail("Invalid syntax. Use: create <database_name>");
+        }
+
+        if (keyword("open") || keyword("drop") || keyword("deallocate"))
+        {
+            statement.kind = isKeyword(pos - 1, "open")   ? StatementKind::Open
+                             : isKeyword(pos - 1, "drop") ? StatementKind::Drop
+                                                          : StatementKind::Deallocate;
+            return (name(statement.name) && atEnd()) ||
+                   fail("Invalid syntax. Use: " + std::string(tokens[pos - 1].text) + " <name>");
+        }
+
+        if (keyword("checkpoint"))
+        {
+            statement.kind = StatementKind::Checkpoint;
+            return atEnd() || fail("Usage: checkpoint");
+        }
+
+        if (keyword("insert"))
+            return insert() || fail("Invalid syntax. Use: insert into table_name (value1, value2, ...)[, (...)]");
+
+        if (keyword("load"))
+        {
+            statement.kind = StatementKind::Load;
+            return (keyword("into") && name(statement.name) && keyword("from") && value(statement.path) &&
+                    atEnd()) ||
+                   fail("Invalid syntax. Use: load into table_name from '<file.csv>'");
+        }
+
+        if (keyword("delete"))
+        {
+            statement.kind = StatementKind::Delete;
+            return (keyword("from") && name(statement.name) && keyword("id:") && value(statement.id) && atEnd()) ||
+                   fail("Invalid syntax. Use: delete from table_name id:value");
+        }
+
+        if (keyword("select"))
+        {
+            if (keyword("from"))
+                return select() ||
+                       fail("Invalid syntax. Use: select from table_name [where condition | id:value] "
+                            "[order by c [asc|desc]] [limit] [last] [parallel N], or select from table_name "
+                            "join other on table_name.c = other.c [limit] [parallel N]");
+            return aggregate() ||
+                   fail("Invalid syntax. Use: select count(*)|sum(c)|min(c)|max(c)|avg(c)|c, ... "
+                        "from table_name [where condition] [group by c, ...] [limit] [parallel N]");
+        }
+
+        // explain [analyze] <statement>
+        if (keyword("explain"))
+        {
+            statement.kind = StatementKind::Explain;
+            statement.analyze = keyword("analyze");
+            if (atEnd())
+                return fail("Invalid syntax. Use: explain [analyze] statement");
+            statement.body = span(pos, tokens.size());
+            pos = tokens.size();
+            return true;
+        }
+
+        // prepare <name> as <statement>, execute <name> [(value, ...)]
+        if (keyword("prepare"))
+        {
+            statement.kind = StatementKind::Prepare;
+            if (!name(statement.name) || !keyword("as") || atEnd())
+                return fail("Invalid syntax. Use: prepare name as statement");
+            statement.body = span(pos, tokens.size());
+            pos = tokens.size();
+            return true;
+        }
+
+        if (keyword("execute"))
+        {
+            statement.kind = StatementKind::Execute;
+            if (!name(statement.name))
+                return fail("Invalid syntax. Use: execute name [(value1, value2, ...)]");
+            statement.rows.emplace_back();
+            return atEnd() || (valueList(statement.rows.back()) && atEnd()) ||
+                   fail("Invalid syntax. Use: execute name [(value1, value2, ...)]");
+        }
+
+        return fail("Unknown command");
+    }
+
+public:
+    Parser(const std::vector<Token> &source, Statement &target, std::string &message, bool parameters)
+        : tokens(source), statement(target), error(message), allowParams(parameters) {}
+
+    bool parse()
+    {
+        statement = Statement{};
+        error.clear();
+        return statementBody();
+    }
+};
+
+// Parse one statement from its tokens (without a trailing ';'). `?` is
+// accepted in value slots only if parameters is set. On failure error says
+// what is wrong, usually with the statement's syntax.
+inline bool parseStatement(const std::vector<Token> &tokens, Statement &statement, std::string &error,
+                           bool parameters = false)
+{
+    return Parser(tokens, statement, error, parameters).parse();
+}
+
+#endif // PARSER_H
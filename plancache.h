@@ -0,0 +1,80 @@
+#ifndef PLANCACHE_H
+#define PLANCACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include "parser.h"
+#include "planner.h"
+
+// A parsed statement with its parameters unbound, and the access path last
+// chosen for it. The path holds only while the database's schema version
+// is the one it was chosen under; a new index or table changes it.
+struct CachedStatement
+{
+    Statement statement;
+    uint64_t schemaVersion = 0; // 0: not planned yet
+    ScanPlan plan;              // filter constants unbound
+};
+
+// Least recently used cache of parsed statements keyed by their normalized
+// text (normalizeStatement), so a statement repeated with other constants
+// is tokenized but never parsed or planned again. One per session; not
+// thread-safe.
+class PlanCache
+{
+private:
+    using Entry = std::pair<std::string, std::shared_ptr<CachedStatement>>;
+
+    size_t capacity;
+    std::list<Entry> order; // most recently used first
+    std::unordered_map<std::string, std::list<Entry>::iterator> entries;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+
+public:
+    static constexpr size_t DEFAULT_CAPACITY = 256;
+
+    explicit PlanCache(size_t entryCapacity = DEFAULT_CAPACITY) : capacity(entryCapacity) {}
+
+    std::shared_ptr<CachedStatement> find(const std::string &key)
+    {
+        auto it = entries.find(key);
+        if (it == entries.end())
+        {
+            ++misses;
+            return nullptr;
+        }
+        ++hits;
+        order.splice(order.begin(), order, it->second);
+        return it->second->second;
+    }
+
+    void insert(const std::string &key, std::shared_ptr<CachedStatement> statement)
+    {
+        auto it = entries.find(key);
+        if (it != entries.end())
+        {
+            it->second->second = std::move(statement);
+            order.splice(order.begin(), order, it->second);
+            return;
+        }
+        order.emplace_front(key, std::move(statement));
+        entries[key] = order.begin();
+        if (order.size() > capacity)
+        {
+            entries.erase(order.back().first);
+            order.pop_back();
+        }
+    }
+
+    size_t size() const { return order.size(); }
+    uint64_t getHits() const { return hits; }
+    uint64_t getMisses() const { return misses; }
+};
+
+#endif // PLANCACHE_H
@@ -0,0 +1,438 @@
+#ifndef PLANNER_H
+#define PLANNER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "table.h"
+#include "filter.h"
+#include "threadpool.h"
+
+// How a select reads its table
+struct ScanPlan
+{
+    enum class Kind
+    {
+        FullScan,      // every page in file order, filter evaluated a page at a time
+        PrimaryLookup, // unique_id equality through the hash index
+        IndexScan      // range over a B+tree, rows fetched by location
+    };
+
+    Kind kind = Kind::FullScan;
+    bool hasFilter = false;
+    Filter filter;   // bound to the table's schema; always rechecked
+    std::string key; // PrimaryLookup: the unique_id
+    std::string indexName;
+    std::string indexColumn;
+    size_t term = 0; // the term of a top-level `and` that chose the path
+    bool hasLow = false, hasHigh = false;
+    bool lowInclusive = true, highInclusive = true;
+    std::string low, high; // stored-form bounds
+
+    std::string describe() const
+    {
+        std::string text = hasFilter ? filterText(filter) : "";
+        switch (kind)
+        {
+        case Kind::PrimaryLookup:
+            return "primary key lookup (" + text + ")";
+        case Kind::IndexScan:
+            return "index scan on " + indexName + " (" + text + ")";
+        default:
+            return hasFilter ? "full scan, filter " + text : "full scan";
+        }
+    }
+};
+
+// Choose between a full scan and an index. The filter itself, or one term
+// of a top-level `and`, picks the access path: unique_id equality goes to
+// the hash index; a comparison other than != or a between on a column with
+// a B+tree goes to it. Anything under an `or` needs a full scan. Only the
+// filter's shape counts, not its constants, so a chosen plan can be kept
+// and bound again for other values.
+inline void choosePlan(const Table &table, const Filter *filter, ScanPlan &plan)
+{
+    plan = ScanPlan{};
+    if (!filter)
+        return;
+
+    plan.hasFilter = true;
+    plan.filter = *filter;
+    size_t terms = filter->kind == Filter::Kind::And ? filter->children.size() : 1;
+    auto term = [filter](size_t i) -> const Filter &
+    { return filter->kind == Filter::Kind::And ? filter->children[i] : *filter; };
+
+    for (size_t i = 0; i < terms; ++i)
+    {
+        if (term(i).kind == Filter::Kind::Compare && term(i).column == "unique_id" && term(i).op == CompareOp::Eq)
+        {
+            plan.kind = ScanPlan::Kind::PrimaryLookup;
+            plan.term = i;
+            return;
+        }
+    }
+
+    for (size_t i = 0; i < terms; ++i)
+    {
+        const Filter &candidate = term(i);
+        bool rangeable = (candidate.kind == Filter::Kind::Compare && candidate.op != CompareOp::Ne) ||
+                         candidate.kind == Filter::Kind::Between;
+        std::string indexName = rangeable ? table.indexOn(candidate.column) : "";
+        if (indexName.empty())
+            continue;
+
+        plan.kind = ScanPlan::Kind::IndexScan;
+        plan.indexName = indexName;
+        plan.indexColumn = candidate.column;
+        plan.term = i;
+        return;
+    }
+}
+
+// Bind a chosen plan's filter to the table and take the lookup key or
+// index bounds from the term that picked the path. Returns false with a
+// message if the filter names an unknown column or a value its column type
+// rejects.
+inline bool bindPlan(const Table &table, ScanPlan &plan, std::string &error)
+{
+    if (!plan.hasFilter)
+        return true;
+    if (!bindFilter(plan.filter, table.getSchema(), table.getFormat(), error))
+        return false;
+
+    const Filter &term = plan.filter.kind == Filter::Kind::And ? plan.filter.children[plan.term] : plan.filter;
+    if (plan.kind == ScanPlan::Kind::PrimaryLookup)
+    {
+        plan.key = term.values[0];
+    }
+    else if (plan.kind == ScanPlan::Kind::IndexScan && term.kind == Filter::Kind::Between)
+    {
+        plan.hasLow = plan.hasHigh = true;
+        plan.low = term.keys[0];
+        plan.high = term.keys[1];
+    }
+    else if (plan.kind == ScanPlan::Kind::IndexScan)
+    {
+        const std::string &value = term.keys[0];
+        CompareOp op = term.op;
+        if (op == CompareOp::Eq || op == CompareOp::Gt || op == CompareOp::Ge)
+        {
+            plan.hasLow = true;
+            plan.low = value;
+            plan.lowInclusive = op != CompareOp::Gt;
+        }
+        if (op == CompareOp::Eq || op == CompareOp::Lt || op == CompareOp::Le)
+        {
+            plan.hasHigh = true;
+            plan.high = value;
+            plan.highInclusive = op != CompareOp::Lt;
+        }
+    }
+    return true;
+}
+
+inline bool planScan(const Table &table, const Filter *filter, ScanPlan &plan, std::string &error)
+{
+    choosePlan(table, filter, plan);
+    return bindPlan(table, plan, error);
+}
+
+// What explain analyze measures of one statement, by operator. Every
+// thread of a parallel scan or aggregation adds to the same counters, so
+// their times are summed over threads.
+struct QueryProfile
+{
+    std::atomic<uint64_t> scanNanos{0};       // reading and filtering, without downstream time
+    std::atomic<uint64_t> downstreamNanos{0}; // in whatever consumed the scan's rows
+    std::atomic<uint64_t> rowsRead{0};
+    std::atomic<uint64_t> rowsMatched{0};
+    std::atomic<uint64_t> mergeNanos{0}; // aggregation or sorting after the scan: merging, spills, result rows
+    std::atomic<uint64_t> groups{0};
+    std::atomic<uint64_t> spillBytes{0};
+    std::atomic<uint64_t> buildNanos{0}; // building a join's hash tables
+    std::atomic<uint64_t> buildRows{0};
+    std::atomic<uint64_t> outputNanos{0}; // writing result rows, where not downstream of the scan
+    std::atomic<uint64_t> rowsOut{0};
+    size_t threads = 1;
+
+    static uint64_t since(std::chrono::steady_clock::time_point start)
+    {
+        return static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+    }
+};
+
+// Where a scan starts and which way it walks. Only full scans honour
+// these; lookups and index scans always run in key order. Scans that make
+// up one statement share the statement's view; a scan without one takes
+// its own snapshot. With a profile, the scan times itself and counts its
+// rows.
+struct ScanOptions
+{
+    bool reverse = false;
+    RowId start{1, 0};              // first location visited by a forward full scan
+    uint32_t endPage = UINT32_MAX;  // forward full scans stop before this page
+    const ReadView *view = nullptr;
+    QueryProfile *profile = nullptr;
+};
+
+// Run a plan, handing every matching record and its location to visit
+// until it returns false. Index and lookup results are rechecked against
+// the whole filter, which may have more terms than the one that chose the
+// index.
+inline void executeScanRecords(const Table &table, const ScanPlan &plan, const RecordVisitor &visit,
+                               const ScanOptions &options = ScanOptions{})
+{
+    // Profiled, every row handed on is timed so the scan's own time can be
+    // told apart from its consumer's
+    QueryProfile *profile = options.profile;
+    auto started = std::chrono::steady_clock::now();
+    uint64_t matched = 0, downstream = 0;
+    RecordVisitor timed;
+    if (profile)
+    {
+        timed = [&visit, &matched, &downstream](RowId rid, std::string_view record)
+        {
+            auto start = std::chrono::steady_clock::now();
+            ++matched;
+            bool more = visit(rid, record);
+            downstream += QueryProfile::since(start);
+            return more;
+        };
+    }
+    const RecordVisitor &target = profile ? timed : visit;
+
+    const RowFormat &format = table.getFormat();
+    uint64_t rowsRead = 0;
+    auto finish = [&]()
+    {
+        Metrics::instance().rowsRead(rowsRead);
+        if (!profile)
+            return;
+        uint64_t total = QueryProfile::since(started);
+        profile->scanNanos += total > downstream ? total - downstream : 0;
+        profile->downstreamNanos += downstream;
+        profile->rowsRead += rowsRead;
+        profile->rowsMatched += matched;
+    };
+    auto check = [&plan, &format, &target, &rowsRead](RowId rid, std::string_view record)
+    {
+        ++rowsRead;
+        return (plan.hasFilter && !evaluateFilter(plan.filter, format, record)) || target(rid, record);
+    };
+
+    ReadView ownView;
+    const ReadView *view = options.view;
+    if (!view)
+    {
+        ownView = table.snapshot();
+        view = &ownView;
+    }
+
+    switch (plan.kind)
+    {
+    case ScanPlan::Kind::PrimaryLookup:
+        table.lookupRecords(plan.key, check, view);
+        finish();
+        return;
+
+    case ScanPlan::Kind::IndexScan:
+        table.indexRangeScan(plan.indexColumn, plan.hasLow ? &plan.low : nullptr, plan.lowInclusive,
+                             plan.hasHigh ? &plan.high : nullptr, plan.highInclusive, check, view);
+        finish();
+        return;
+
+    default:
+        break;
+    }
+
+    // Full scan: the filter runs over a page of rows at once and rows it
+    // rejects are never handed out
+    std::vector<bool> used;
+    if (plan.hasFilter)
+        RowBatch::collectColumns(plan.filter, used);
+
+    RowBatch batch;
+    Selection selection;
+    uint32_t from = options.reverse ? UINT32_MAX : options.start.pageNo;
+    table.forEachPage(from, options.reverse, [&](uint32_t pageNo, const SlottedPage &page)
+                      {
+                          if (!options.reverse && pageNo >= options.endPage)
+                              return false;
+                          batch.load(page, used, format);
+                          rowsRead += batch.size;
+                          if (plan.hasFilter)
+                              evaluateBatch(plan.filter, batch, selection);
+                          else
+                              selectAll(selection, batch.size);
+
+                          for (size_t i = 0; i < batch.size; ++i)
+                          {
+                              size_t row = options.reverse ? batch.size - 1 - i : i;
+                              if (!(selection[row / 64] >> (row % 64) & 1))
+                                  continue;
+                              RowId rid{pageNo, batch.slots[row]};
+                              if (!options.reverse && pageNo == options.start.pageNo && rid.slot < options.start.slot)
+                                  continue;
+                              if (!target(rid, batch.records[row]))
+                                  return false;
+                          }
+                          return true; },
+                      plan.hasFilter ? &plan.filter : nullptr, view);
+    finish();
+}
+
+// Same, with each matching row decoded to text fields
+inline void executeScan(const Table &table, const ScanPlan &plan, const RowVisitor &visit,
+                        const ScanOptions &options = ScanOptions{})
+{
+    const RowFormat &format = table.getFormat();
+    executeScanRecords(table, plan, [&format, &visit](RowId rid, std::string_view record)
+                       { return visit(rid, format.decode(record)); }, options);
+}
+
+// Matching rows of one morsel, rendered as text lines
+struct MorselOutput
+{
+    std::string text;
+    std::vector<uint32_t> rowEnds; // offset just past each row's line
+};
+
+constexpr uint32_t MORSEL_PAGES = 32;
+
+// Morsel-driven parallel full scan. The pages from options.start onward are
+// cut into morsels of MORSEL_PAGES pages. Up to degree pool threads take
+// morsels in page order, filter them and render each matching record with
+// render. A morsel stops after rowLimit rows. The calling thread hands the
+// outputs to consume strictly in page order, and the scan stops once
+// consume returns false. Only a few morsels per thread run ahead of the
+// consumer, so memory stays bounded however large the table is.
+inline void parallelScan(const Table &table, const ScanPlan &plan, size_t degree, const ScanOptions &options,
+                         size_t rowLimit, const std::function<void(std::string_view, std::string &)> &render,
+                         const std::function<bool(const MorselOutput &)> &consume)
+{
+    ReadView ownView;
+    const ReadView *view = options.view;
+    if (!view)
+    {
+        ownView = table.snapshot();
+        view = &ownView;
+    }
+
+    uint32_t first = std::max<uint32_t>(options.start.pageNo, 1);
+    uint32_t end = std::min(view->pageCount, options.endPage);
+    if (first >= end)
+        return;
+    size_t morsels = (end - first + MORSEL_PAGES - 1) / MORSEL_PAGES;
+    size_t window = std::max<size_t>(degree, 1) * 4;
+
+    std::vector<MorselOutput> outputs(window);
+    std::vector<bool> ready(window, false);
+    std::atomic<size_t> next{0};
+    size_t consumed = 0;
+    bool stop = false;
+    std::mutex mutex;
+    std::condition_variable changed;
+
+    // Stopping wakes both sides: workers quit, and the consumer gives up
+    // waiting on a morsel a failed worker will never deliver
+    auto halt = [&]()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        changed.notify_all();
+    };
+
+    auto scanMorsels = [&]()
+    {
+        size_t i;
+        while ((i = next.fetch_add(1)) < morsels)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [&]()
+                             { return stop || i < consumed + window; });
+                if (stop)
+                    return;
+            }
+
+            MorselOutput output;
+            ScanOptions range;
+            range.start = RowId{first + static_cast<uint32_t>(i) * MORSEL_PAGES, 0};
+            if (i == 0)
+                range.start.slot = options.start.slot;
+            range.endPage = std::min<uint32_t>(range.start.pageNo + MORSEL_PAGES, end);
+            range.view = view;
+            range.profile = options.profile;
+            executeScanRecords(table, plan, [&](RowId, std::string_view record)
+                               {
+                                   render(record, output.text);
+                                   output.rowEnds.push_back(static_cast<uint32_t>(output.text.size()));
+                                   return output.rowEnds.size() < rowLimit; },
+                               range);
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                outputs[i % window] = std::move(output);
+                ready[i % window] = true;
+            }
+            changed.notify_all();
+        }
+    };
+
+    // The group keeps the exception and rethrows it from wait()
+    auto worker = [&]()
+    {
+        try
+        {
+            scanMorsels();
+        }
+        catch (...)
+        {
+            halt();
+            throw;
+        }
+    };
+
+    TaskGroup group;
+    for (size_t t = 0; t < std::min(degree, morsels); ++t)
+        group.spawn(worker);
+
+    try
+    {
+        for (size_t k = 0; k < morsels; ++k)
+        {
+            MorselOutput output;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [&]()
+                             { return stop || ready[k % window]; });
+                if (!ready[k % window])
+                    break;
+                output = std::move(outputs[k % window]);
+                ready[k % window] = false;
+                consumed = k + 1;
+            }
+            changed.notify_all();
+            if (!consume(output))
+                break;
+        }
+    }
+    catch (...)
+    {
+        halt();
+        throw;
+    }
+
+    halt();
+    group.wait();
+}
+
+#endif // PLANNER_H
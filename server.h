@@ -0,0 +1,551 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <csignal>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "page.h"
+#include "helper.h"
+
+// Every request and response on the socket is a u32 payload length (host
+// byte order; the socket never leaves the machine) followed by the payload.
+// A request is one command as typed at the prompt; the response is the
+// text the prompt would have printed for it.
+constexpr uint32_t MAX_FRAME_BYTES = 64u << 20;
+
+inline void appendFrame(std::string &out, std::string_view payload)
+{
+    char length[sizeof(uint32_t)];
+    putValue(length, static_cast<uint32_t>(payload.size()));
+    out.append(length, sizeof(length));
+    out.append(payload);
+}
+
+// Multi-client server on a Unix domain socket. One thread runs an epoll
+// loop that accepts connections, reads request frames and writes response
+// frames; a pool of worker threads executes the requests. Each connection
+// is a session with its own login and open database, and runs one request
+// at a time in the order they arrived. Sessions of the same database share
+// one Database instance.
+//
+// Queries and inserts/deletes run concurrently: readers work on snapshots
+// and each table takes one writer at a time. Statements that change the
+// schema or settings (create, drop, set, checkpoint) run alone. SIGINT and
+// SIGTERM stop the server cleanly, checkpointing every open database.
+class Server
+{
+private:
+    struct Session
+    {
+        QueryHelper helper;
+        bool loggedIn = false;
+    };
+
+    struct Connection
+    {
+        int fd = -1;
+        std::string input, output;
+        std::deque<std::string> requests;
+        std::shared_ptr<Session> session;
+        bool busy = false;    // a worker is running one of its requests
+        bool closing = false; // close once the output is written
+        bool peerClosed = false; // no more input; close once every request is answered
+        uint32_t events = 0;     // the epoll registration
+    };
+
+    struct Job
+    {
+        uint64_t connection;
+        std::string request;
+        std::shared_ptr<Session> session;
+    };
+
+    struct Completion
+    {
+        uint64_t connection;
+        std::string response;
+        bool close;
+    };
+
+    // epoll ids below FIRST_CONNECTION are the server's own descriptors
+    static constexpr uint64_t LISTEN_ID = 0, WAKE_ID = 1, SIGNAL_ID = 2, FIRST_CONNECTION = 3;
+
+    std::string socketPath;
+    int listenFd = -1, epollFd = -1, wakeFd = -1, signalFd = -1;
+    std::unordered_map<uint64_t, Connection> connections;
+    uint64_t nextConnection = FIRST_CONNECTION;
+
+    std::mutex mutex; // guards jobs, completions and stopping
+    std::condition_variable jobReady;
+    std::deque<Job> jobs;
+    std::vector<Completion> completions;
+    bool stopping = false;
+    std::vector<std::thread> workers;
+
+    std::shared_mutex statementLock;
+
+    static size_t workerCount()
+    {
+        const char *env = std::getenv("NOSQLITE_SERVER_WORKERS");
+        long count = env ? std::strtol(env, nullptr, 10) : 0;
+        if (count > 0)
+            return static_cast<size_t>(count);
+        return std::max<size_t>(4, std::thread::hardware_concurrency());
+    }
+
+    static bool runsAlone(const std::string &query)
+    {
+        std::string lower = query.substr(0, 16);
+        std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+        for (const char *prefix : {"create", "drop", "set ", "checkpoint"})
+        {
+            if (lower.rfind(prefix, 0) == 0)
+                return true;
+        }
+        return false;
+    }
+
+    void watch(int fd, uint64_t id, uint32_t events, int op = EPOLL_CTL_ADD)
+    {
+        epoll_event event{};
+        event.events = events;
+        event.data.u64 = id;
+        ::epoll_ctl(epollFd, op, fd, &event);
+    }
+
+    std::string execute(Session &session, const std::string &request, bool &close)
+    {
+        std::string query = QueryHelper::trim(request);
+        if (query == "exit")
+        {
+            close = true;
+            return "Goodbye!";
+        }
+        if (query.rfind("login", 0) == 0)
+        {
+            std::istringstream words(query.substr(5));
+            std::string username, password;
+            words >> username >> password;
+            std::unique_lock<std::shared_mutex> lock(statementLock);
+            session.loggedIn = session.helper.login(username, password);
+            return session.loggedIn ? "Successfully logged in as " + username : "Login failed";
+        }
+        if (!session.loggedIn)
+            return "Not logged in. Send: login <username> <password>";
+
+        std::ostringstream out;
+        std::string result;
+        try
+        {
+            if (runsAlone(query))
+            {
+                std::unique_lock<std::shared_mutex> lock(statementLock);
+                result = session.helper.executeQuery(query, out);
+            }
+            else
+            {
+                std::shared_lock<std::shared_mutex> lock(statementLock);
+                result = session.helper.executeQuery(query, out);
+            }
+        }
+        catch (const std::exception &e)
+        {
+            result = "Error: " + std::string(e.what());
+        }
+        return out.str() + result;
+    }
+
+    void workerLoop()
+    {
+        while (true)
+        {
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                jobReady.wait(lock, [this]()
+                              { return stopping || !jobs.empty(); });
+                if (jobs.empty())
+                    return;
+                job = std::move(jobs.front());
+                jobs.pop_front();
+            }
+
+            bool close = false;
+            std::string response = execute(*job.session, job.request, close);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                completions.push_back(Completion{job.connection, std::move(response), close});
+            }
+            uint64_t one = 1;
+            ssize_t ignored = ::write(wakeFd, &one, sizeof(one));
+            (void)ignored;
+        }
+    }
+
+    // Hand the connection's next request to the workers unless one is running
+    void dispatch(uint64_t id, Connection &conn)
+    {
+        if (conn.busy || conn.closing || conn.requests.empty())
+            return;
+        conn.busy = true;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.push_back(Job{id, std::move(conn.requests.front()), conn.session});
+        }
+        conn.requests.pop_front();
+        jobReady.notify_one();
+    }
+
+    // Match the epoll registration to what the connection waits for. Once
+    // the peer has shut down its side the socket stays registered only while
+    // output is pending, since hang-ups are reported whatever the mask.
+    void updateWatch(uint64_t id, Connection &conn)
+    {
+        bool wantWrite = !conn.output.empty();
+        uint32_t events = (conn.peerClosed ? 0u : uint32_t(EPOLLIN | EPOLLRDHUP)) |
+                          (wantWrite ? uint32_t(EPOLLOUT) : 0u);
+        if (events == conn.events)
+            return;
+        if (events == 0)
+            ::epoll_ctl(epollFd, EPOLL_CTL_DEL, conn.fd, nullptr);
+        else
+            watch(conn.fd, id, events, conn.events == 0 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD);
+        conn.events = events;
+    }
+
+    void closeConnection(uint64_t id)
+    {
+        auto it = connections.find(id);
+        if (it == connections.end())
+            return;
+        if (it->second.events != 0)
+            ::epoll_ctl(epollFd, EPOLL_CTL_DEL, it->second.fd, nullptr);
+        ::close(it->second.fd);
+        connections.erase(it);
+    }
+
+    // Write as much output as the socket takes. False if the connection
+    // was closed.
+    bool flush(uint64_t id, Connection &conn)
+    {
+        size_t done = 0;
+        while (done < conn.output.size())
+        {
+            ssize_t sent = ::send(conn.fd, conn.output.data() + done, conn.output.size() - done, MSG_NOSIGNAL);
+            if (sent < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    break;
+                closeConnection(id);
+                return false;
+            }
+            done += static_cast<size_t>(sent);
+        }
+        conn.output.erase(0, done);
+
+        bool drained = conn.peerClosed && !conn.busy && conn.requests.empty();
+        if (conn.output.empty() && (conn.closing || drained))
+        {
+            closeConnection(id);
+            return false;
+        }
+        updateWatch(id, conn);
+        return true;
+    }
+
+    void acceptConnections()
+    {
+        while (true)
+        {
+            int fd = ::accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0)
+                return;
+            uint64_t id = nextConnection++;
+            Connection &conn = connections[id];
+            conn.fd = fd;
+            conn.session = std::make_shared<Session>();
+            updateWatch(id, conn);
+        }
+    }
+
+    void readRequests(uint64_t id, Connection &conn)
+    {
+        char buffer[64 * 1024];
+        while (true)
+        {
+            ssize_t received = ::recv(conn.fd, buffer, sizeof(buffer), 0);
+            if (received > 0)
+            {
+                conn.input.append(buffer, static_cast<size_t>(received));
+                continue;
+            }
+            if (received < 0 && errno == EINTR)
+                continue;
+            if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                break;
+            if (received == 0)
+            {
+                // Peer shut down its side: answer what it already sent
+                conn.peerClosed = true;
+                break;
+            }
+            // Socket failed; a running request finishes unseen
+            closeConnection(id);
+            return;
+        }
+
+        size_t pos = 0;
+        while (conn.input.size() - pos >= sizeof(uint32_t))
+        {
+            uint32_t length = getValue<uint32_t>(conn.input.data() + pos);
+            if (length > MAX_FRAME_BYTES)
+            {
+                closeConnection(id);
+                return;
+            }
+            if (conn.input.size() - pos - sizeof(uint32_t) < length)
+                break;
+            conn.requests.push_back(conn.input.substr(pos + sizeof(uint32_t), length));
+            pos += sizeof(uint32_t) + length;
+        }
+        conn.input.erase(0, pos);
+        dispatch(id, conn);
+        if (conn.peerClosed)
+            flush(id, conn);
+    }
+
+    void deliverCompletions()
+    {
+        uint64_t count;
+        ssize_t ignored = ::read(wakeFd, &count, sizeof(count));
+        (void)ignored;
+
+        std::vector<Completion> done;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            done.swap(completions);
+        }
+        for (auto &completion : done)
+        {
+            auto it = connections.find(completion.connection);
+            if (it == connections.end())
+                continue;
+            Connection &conn = it->second;
+            conn.busy = false;
+            conn.closing = conn.closing || completion.close;
+            appendFrame(conn.output, completion.response);
+            if (flush(completion.connection, conn))
+                dispatch(completion.connection, conn);
+        }
+    }
+
+    bool setUp()
+    {
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        if (socketPath.size() >= sizeof(address.sun_path))
+        {
+            std::cerr << "Socket path too long: " << socketPath << std::endl;
+            return false;
+        }
+        std::strcpy(address.sun_path, socketPath.c_str());
+        ::unlink(socketPath.c_str());
+
+        listenFd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (listenFd < 0 || ::bind(listenFd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 ||
+            ::listen(listenFd, SOMAXCONN) != 0)
+        {
+            std::cerr << "Cannot listen on " << socketPath << ": " << std::strerror(errno) << std::endl;
+            return false;
+        }
+
+        // Block the stop signals in every thread (workers and the scan pool
+        // inherit the mask) and take them through the event loop instead
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGINT);
+        sigaddset(&signals, SIGTERM);
+        pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+        signalFd = ::signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+        wakeFd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        epollFd = ::epoll_create1(EPOLL_CLOEXEC);
+        if (signalFd < 0 || wakeFd < 0 || epollFd < 0)
+        {
+            std::cerr << "Cannot set up the event loop: " << std::strerror(errno) << std::endl;
+            return false;
+        }
+        watch(listenFd, LISTEN_ID, EPOLLIN);
+        watch(wakeFd, WAKE_ID, EPOLLIN);
+        watch(signalFd, SIGNAL_ID, EPOLLIN);
+        return true;
+    }
+
+public:
+    explicit Server(const std::string &path) : socketPath(path) {}
+
+    Server(const Server &) = delete;
+    Server &operator=(const Server &) = delete;
+
+    ~Server()
+    {
+        for (int fd : {listenFd, epollFd, wakeFd, signalFd})
+        {
+            if (fd >= 0)
+                ::close(fd);
+        }
+    }
+
+    // Serve until SIGINT or SIGTERM. Returns the process exit status.
+    int run()
+    {
+        if (!setUp())
+            return 1;
+
+        size_t threads = workerCount();
+        for (size_t i = 0; i < threads; ++i)
+            workers.emplace_back([this]()
+                                 { workerLoop(); });
+        std::cout << "Serving on " << socketPath << " with " << threads << " workers" << std::endl;
+
+        bool running = true;
+        epoll_event events[64];
+        while (running)
+        {
+            int ready = ::epoll_wait(epollFd, events, 64, -1);
+            if (ready < 0 && errno == EINTR)
+                continue;
+            if (ready < 0)
+                break;
+            for (int i = 0; i < ready; ++i)
+            {
+                uint64_t id = events[i].data.u64;
+                if (id == LISTEN_ID)
+                {
+                    acceptConnections();
+                }
+                else if (id == WAKE_ID)
+                {
+                    deliverCompletions();
+                }
+                else if (id == SIGNAL_ID)
+                {
+                    running = false;
+                }
+                else
+                {
+                    auto it = connections.find(id);
+                    if (it == connections.end())
+                        continue;
+                    if (events[i].events & EPOLLOUT && !flush(id, it->second))
+                        continue;
+                    if (!it->second.peerClosed)
+                    {
+                        if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+                            readRequests(id, it->second);
+                    }
+                    else if (events[i].events & (EPOLLHUP | EPOLLERR))
+                    {
+                        flush(id, it->second); // fails and closes if the peer is gone
+                    }
+                }
+            }
+        }
+
+        std::cout << "Shutting down" << std::endl;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+            jobs.clear();
+        }
+        jobReady.notify_all();
+        for (auto &worker : workers)
+            worker.join();
+        workers.clear();
+        while (!connections.empty())
+            closeConnection(connections.begin()->first);
+        ::unlink(socketPath.c_str());
+        return 0;
+    }
+};
+
+// Line-oriented client: sends each line of standard input as one request
+// and prints the response
+inline int runClient(const std::string &path)
+{
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    std::strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || ::connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0)
+    {
+        std::cerr << "Cannot connect to " << path << ": " << std::strerror(errno) << std::endl;
+        return 1;
+    }
+
+    auto sendAll = [fd](const std::string &data)
+    {
+        for (size_t done = 0; done < data.size();)
+        {
+            ssize_t sent = ::send(fd, data.data() + done, data.size() - done, MSG_NOSIGNAL);
+            if (sent <= 0)
+                return false;
+            done += static_cast<size_t>(sent);
+        }
+        return true;
+    };
+    auto receiveAll = [fd](char *data, size_t size)
+    {
+        for (size_t done = 0; done < size;)
+        {
+            ssize_t received = ::recv(fd, data + done, size - done, 0);
+            if (received <= 0)
+                return false;
+            done += static_cast<size_t>(received);
+        }
+        return true;
+    };
+
+    std::string line;
+    while (std::getline(std::cin, line))
+    {
+        if (QueryHelper::trim(line).empty())
+            continue;
+        std::string frame;
+        appendFrame(frame, line);
+        char length[sizeof(uint32_t)];
+        if (!sendAll(frame) || !receiveAll(length, sizeof(length)))
+            break;
+        std::string response(getValue<uint32_t>(length), '\0');
+        if (!receiveAll(response.data(), response.size()))
+            break;
+        std::cout << response << std::endl;
+        if (QueryHelper::trim(line) == "exit")
+            break;
+    }
+    ::close(fd);
+    return 0;
+}
+
+#endif // SERVER_H
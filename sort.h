@@ -0,0 +1,547 @@
+#ifndef SORT_H
+#define SORT_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unistd.h>
+#include "page.h"
+#include "planner.h"
+#include "threadpool.h"
+#include "types.h"
+
+// Resolve the sort column against the table: its row position, unique_id
+// being 0
+inline bool bindSortColumn(const Table &table, const std::string &column, size_t &position, std::string &error)
+{
+    if (column == "unique_id")
+    {
+        position = 0;
+        return true;
+    }
+    const auto &schema = table.getSchema();
+    auto it = std::find(schema.begin(), schema.end(), column);
+    if (it == schema.end())
+    {
+        error = "Column '" + column + "' not found in table '" + table.getName() + "'";
+        return false;
+    }
+    position = (it - schema.begin()) + 1;
+    return true;
+}
+
+// order by for `select from <table> ...`.
+//
+// Rows compare on the stored bytes of the sort column, which order as the
+// values do (as text for tables in the legacy text format); equal keys keep
+// file order. With a limit of at most TOP_K_MAX rows every worker keeps only
+// its best rows in a bounded heap, so a top-K query holds K rows per worker
+// however large the table. Anything else is an external merge sort: every
+// worker buffers rows up to its share of the memory budget, sorts them and
+// writes them out as a run, and the runs are merged through a heap, in
+// several passes when there are more than MERGE_WAYS of them. A merge holds
+// one read buffer per run, so a table far larger than memory sorts in the
+// budget plus MERGE_WAYS buffers.
+class RowSorter
+{
+private:
+    static constexpr size_t PAGES_PER_TASK = 64;
+    static constexpr size_t TOP_K_MAX = 1 << 16;
+    static constexpr size_t MERGE_WAYS = 64;
+    static constexpr size_t IO_BUFFER = 1 << 16;
+    static constexpr size_t ROW_HEADER = 3 * sizeof(uint32_t) + sizeof(uint64_t);
+
+    // A buffered row: its record in the arena, its key within the record
+    // and its place in file order
+    struct Entry
+    {
+        size_t offset;
+        uint32_t length;
+        uint32_t keyOffset;
+        uint32_t keyLength;
+        uint64_t seq;
+    };
+
+    // A row kept by a top-K heap
+    struct Kept
+    {
+        std::string record;
+        uint32_t keyOffset;
+        uint32_t keyLength;
+        uint64_t seq;
+
+        std::string_view key() const { return std::string_view(record).substr(keyOffset, keyLength); }
+    };
+
+    struct Worker
+    {
+        std::string arena;
+        std::vector<Entry> entries;
+        std::vector<Kept> heap;
+        std::vector<std::string> runs; // spilled run files, each sorted
+        uint64_t rows = 0; // rows seen, also the file order of rows without a location
+
+        std::string_view record(const Entry &entry) const
+        {
+            return std::string_view(arena).substr(entry.offset, entry.length);
+        }
+        std::string_view key(const Entry &entry) const
+        {
+            return std::string_view(arena).substr(entry.offset + entry.keyOffset, entry.keyLength);
+        }
+        size_t bytes() const { return arena.size() + entries.size() * sizeof(Entry); }
+    };
+
+    // Reads a run file back one row at a time through a fixed buffer.
+    // Throws if the file cannot be opened or ends inside a row.
+    class RunReader
+    {
+    private:
+        std::string path;
+        std::vector<char> buffer;
+        std::ifstream in;
+        std::string current;
+        uint32_t keyOffset = 0;
+        uint32_t keyLength = 0;
+        uint64_t position = 0;
+        bool hasRow = false;
+
+    public:
+        explicit RunReader(const std::string &runPath) : path(runPath), buffer(IO_BUFFER)
+        {
+            in.rdbuf()->pubsetbuf(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+            in.open(path, std::ios::binary);
+            if (!in.is_open())
+                throw std::runtime_error("Cannot open sort run " + path);
+            next();
+        }
+
+        bool valid() const { return hasRow; }
+        std::string_view record() const { return current; }
+        std::string_view key() const { return std::string_view(current).substr(keyOffset, keyLength); }
+        uint64_t seq() const { return position; }
+
+        void next()
+        {
+            char header[ROW_HEADER];
+            hasRow = static_cast<bool>(in.read(header, sizeof(header)));
+            if (!hasRow)
+            {
+                if (in.gcount() != 0 || in.bad())
+                    throw std::runtime_error("Failed to read sort run " + path);
+                return;
+            }
+            uint32_t length = getValue<uint32_t>(header);
+            keyOffset = getValue<uint32_t>(header + sizeof(uint32_t));
+            keyLength = getValue<uint32_t>(header + 2 * sizeof(uint32_t));
+            position = getValue<uint64_t>(header + 3 * sizeof(uint32_t));
+            current.resize(length);
+            if (!in.read(current.data(), length))
+                throw std::runtime_error("Failed to read sort run " + path);
+        }
+    };
+
+    // Writes rows in order to a new run file; finish() completes it.
+    // Throws if the file cannot be created or written.
+    class RunWriter
+    {
+    private:
+        std::string path;
+        std::ofstream out;
+        std::string buffer;
+        QueryProfile *profile;
+
+        void flush()
+        {
+            out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+            if (!out)
+                throw std::runtime_error("Failed to write sort run " + path);
+            if (profile)
+                profile->spillBytes += buffer.size();
+            buffer.clear();
+        }
+
+    public:
+        RunWriter(const std::string &runPath, QueryProfile *queryProfile)
+            : path(runPath), out(runPath, std::ios::binary | std::ios::trunc), profile(queryProfile)
+        {
+            if (!out.is_open())
+                throw std::runtime_error("Cannot create sort run " + path);
+            buffer.reserve(IO_BUFFER);
+        }
+
+        void finish()
+        {
+            flush();
+            out.close();
+            if (!out)
+                throw std::runtime_error("Failed to write sort run " + path);
+        }
+
+        void add(std::string_view record, uint32_t keyOffset, uint32_t keyLength, uint64_t seq)
+        {
+            char header[ROW_HEADER];
+            putValue(header, static_cast<uint32_t>(record.size()));
+            putValue(header + sizeof(uint32_t), keyOffset);
+            putValue(header + 2 * sizeof(uint32_t), keyLength);
+            putValue(header + 3 * sizeof(uint32_t), seq);
+            buffer.append(header, sizeof(header));
+            buffer.append(record.data(), record.size());
+            if (buffer.size() >= IO_BUFFER)
+                flush();
+        }
+    };
+
+    // One input of a merge: a worker's sorted buffer or a run file
+    struct MergeSource
+    {
+        const Worker *memory = nullptr;
+        size_t index = 0;
+        std::unique_ptr<RunReader> file;
+
+        bool valid() const { return memory ? index < memory->entries.size() : file->valid(); }
+        std::string_view record() const { return memory ? memory->record(memory->entries[index]) : file->record(); }
+        std::string_view key() const { return memory ? memory->key(memory->entries[index]) : file->key(); }
+        uint64_t seq() const { return memory ? memory->entries[index].seq : file->seq(); }
+        void next()
+        {
+            if (memory)
+                ++index;
+            else
+                file->next();
+        }
+        uint32_t keyOffset() const { return static_cast<uint32_t>(key().data() - record().data()); }
+    };
+
+    const Table &table;
+    const ScanPlan &plan;
+    size_t keyPosition;
+    bool descending;
+    size_t memoryBudget = 0;
+    std::string spillPrefix;
+    std::atomic<size_t> nextRun{0};
+    std::mutex runsMutex;
+    std::vector<std::string> created; // every run file, removed when done
+    QueryProfile *profile = nullptr;
+
+    // Whether the row (a, seqA) comes out before (b, seqB)
+    bool before(std::string_view a, uint64_t seqA, std::string_view b, uint64_t seqB) const
+    {
+        int order = a.compare(b);
+        if (order != 0)
+            return descending ? order > 0 : order < 0;
+        return seqA < seqB;
+    }
+
+    std::string newRunPath()
+    {
+        std::string path = spillPrefix + std::to_string(nextRun.fetch_add(1));
+        std::lock_guard<std::mutex> lock(runsMutex);
+        created.push_back(path);
+        return path;
+    }
+
+    void sortEntries(Worker &worker) const
+    {
+        std::sort(worker.entries.begin(), worker.entries.end(), [this, &worker](const Entry &a, const Entry &b)
+                  { return before(worker.key(a), a.seq, worker.key(b), b.seq); });
+    }
+
+    // Sort a worker's buffer, write it out as a run and empty it
+    void spill(Worker &worker)
+    {
+        sortEntries(worker);
+        std::string path = newRunPath();
+        {
+            RunWriter writer(path, profile);
+            for (const Entry &entry : worker.entries)
+                writer.add(worker.record(entry), entry.keyOffset, entry.keyLength, entry.seq);
+            writer.finish();
+        }
+        worker.runs.push_back(path);
+        worker.arena.clear();
+        worker.entries.clear();
+    }
+
+    // Scan a range of the table into a worker, keeping at most keep rows
+    // when keep > 0, the ones that come first (or last when fromEnd), and
+    // spilling whenever it buffers more than share
+    void scanInto(Worker &worker, const ScanOptions &options, size_t keep, bool fromEnd, size_t share)
+    {
+        const RowFormat &format = table.getFormat();
+        auto worse = [this, fromEnd](const Kept &a, const Kept &b)
+        { return fromEnd ? before(b.key(), b.seq, a.key(), a.seq) : before(a.key(), a.seq, b.key(), b.seq); };
+
+        executeScanRecords(table, plan, [&](RowId rid, std::string_view record)
+                           {
+                               std::string_view key = format.field(record, keyPosition);
+                               uint32_t keyOffset = static_cast<uint32_t>(key.data() - record.data());
+                               uint64_t seq = rid.pageNo != 0 ? (static_cast<uint64_t>(rid.pageNo) << 16) | rid.slot
+                                                              : worker.rows;
+                               ++worker.rows;
+                               if (keep > 0)
+                               {
+                                   if (worker.heap.size() == keep)
+                                   {
+                                       const Kept &worst = worker.heap.front();
+                                       if (fromEnd ? !before(worst.key(), worst.seq, key, seq)
+                                                   : !before(key, seq, worst.key(), worst.seq))
+                                           return true;
+                                       std::pop_heap(worker.heap.begin(), worker.heap.end(), worse);
+                                       worker.heap.pop_back();
+                                   }
+                                   worker.heap.push_back(Kept{std::string(record), keyOffset,
+                                                              static_cast<uint32_t>(key.size()), seq});
+                                   std::push_heap(worker.heap.begin(), worker.heap.end(), worse);
+                                   return true;
+                               }
+
+                               worker.entries.push_back(Entry{worker.arena.size(), static_cast<uint32_t>(record.size()),
+                                                              keyOffset, static_cast<uint32_t>(key.size()), seq});
+                               worker.arena.append(record.data(), record.size());
+                               if (worker.bytes() > share)
+                                   spill(worker);
+                               return true; },
+                           options);
+    }
+
+    // Merge sources through a heap, handing rows to visit until it
+    // returns false
+    template <typename Visit>
+    void merge(std::vector<MergeSource> &sources, Visit visit) const
+    {
+        auto after = [this, &sources](size_t a, size_t b)
+        { return before(sources[b].key(), sources[b].seq(), sources[a].key(), sources[a].seq()); };
+        std::priority_queue<size_t, std::vector<size_t>, decltype(after)> heads(after);
+        for (size_t i = 0; i < sources.size(); ++i)
+        {
+            if (sources[i].valid())
+                heads.push(i);
+        }
+        while (!heads.empty())
+        {
+            size_t i = heads.top();
+            heads.pop();
+            if (!visit(sources[i]))
+                return;
+            sources[i].next();
+            if (sources[i].valid())
+                heads.push(i);
+        }
+    }
+
+    // Merge run files MERGE_WAYS at a time until at most ways are left
+    void reduceRuns(std::vector<std::string> &runs, size_t ways)
+    {
+        while (runs.size() > ways)
+        {
+            size_t group = std::min(MERGE_WAYS, runs.size() - ways + 1);
+            std::vector<MergeSource> sources(group);
+            for (size_t i = 0; i < group; ++i)
+                sources[i].file = std::make_unique<RunReader>(runs[i]);
+            std::string path = newRunPath();
+            {
+                RunWriter writer(path, profile);
+                merge(sources, [&writer](const MergeSource &source)
+                      { writer.add(source.record(), source.keyOffset(), static_cast<uint32_t>(source.key().size()),
+                                   source.seq());
+                        return true; });
+                writer.finish();
+            }
+            sources.clear();
+            for (size_t i = 0; i < group; ++i)
+                std::filesystem::remove(runs[i]);
+            runs.erase(runs.begin(), runs.begin() + static_cast<std::ptrdiff_t>(group));
+            runs.push_back(path);
+        }
+    }
+
+public:
+    // Sort the rows plan finds in table by the row position keyPosition
+    // (unique_id is 0)
+    RowSorter(const Table &source, const ScanPlan &scanPlan, size_t sortPosition, bool sortDescending)
+        : table(source), plan(scanPlan), keyPosition(sortPosition), descending(sortDescending)
+    {
+        // NOSQLITE_SORT_MEMORY_MB bounds the rows buffered in memory across
+        // all workers before they write runs
+        const char *env = std::getenv("NOSQLITE_SORT_MEMORY_MB");
+        size_t megabytes = env ? std::strtoull(env, nullptr, 10) : 256;
+        memoryBudget = std::max<size_t>(megabytes, 1) * 1024 * 1024;
+
+        static std::atomic<uint64_t> sorts{0};
+        std::filesystem::path base(table.getFilePath());
+        spillPrefix = (base.parent_path() / (table.getName() + ".sort." + std::to_string(::getpid()) + "." +
+                                             std::to_string(sorts.fetch_add(1)) + "."))
+                          .string();
+    }
+
+    RowSorter(const RowSorter &) = delete;
+    RowSorter &operator=(const RowSorter &) = delete;
+
+    ~RowSorter()
+    {
+        std::error_code ignored;
+        for (const auto &path : created)
+            std::filesystem::remove(path, ignored);
+    }
+
+    // Threads a sort with this degree (0 for the whole pool) scans a table
+    // of pages pages on, split as the hash aggregator splits its scans
+    static size_t threadsFor(const Table &table, const ScanPlan &plan, uint32_t pages, size_t degree)
+    {
+        if (plan.kind != ScanPlan::Kind::FullScan || table.getEngine() != TableEngine::Heap ||
+            pages <= PAGES_PER_TASK)
+            return 1;
+        if (degree == 0)
+            degree = ThreadPool::instance().size();
+        return std::clamp<size_t>(degree, 1, (pages + PAGES_PER_TASK - 1) / PAGES_PER_TASK);
+    }
+
+    // Whether a sort stopping after limit rows (negative for none) keeps
+    // them in a heap instead of sorting everything
+    static bool usesHeap(long limit) { return limit > 0 && static_cast<size_t>(limit) <= TOP_K_MAX; }
+
+    static constexpr size_t pagesPerTask() { return PAGES_PER_TASK; }
+    static constexpr size_t mergeWays() { return MERGE_WAYS; }
+    size_t getMemoryBudget() const { return memoryBudget; }
+
+    // Hand the sorted records to emit until it returns false, at most limit
+    // of them (negative for all); with fromEnd the last limit rows, still in
+    // sort order. Scans on up to degree pool threads (0 for the whole pool)
+    // over one snapshot. With a profile, buffering, sorting and merging are
+    // timed apart from emit. Returns the number of worker threads used.
+    // Throws std::runtime_error if a run file cannot be written or read
+    // back, possibly after some rows have gone to emit.
+    size_t run(const std::function<bool(std::string_view)> &emit, long limit = -1, bool fromEnd = false,
+               size_t degree = 0, QueryProfile *queryProfile = nullptr)
+    {
+        profile = queryProfile;
+        if (limit == 0)
+            return 1;
+        ReadView view = table.snapshot();
+        uint32_t pages = view.pageCount;
+        size_t threadCount = threadsFor(table, plan, pages, degree);
+        size_t share = memoryBudget / threadCount;
+        size_t keep = usesHeap(limit) ? static_cast<size_t>(limit) : 0;
+
+        std::vector<Worker> workers(threadCount);
+        std::atomic<uint32_t> nextPage{1};
+        if (threadCount == 1)
+        {
+            ScanOptions options;
+            options.view = &view;
+            options.profile = profile;
+            scanInto(workers[0], options, keep, fromEnd, share);
+        }
+        else
+        {
+            runParallel(threadCount, [&, this](size_t w)
+                        {
+                            uint32_t from;
+                            while ((from = nextPage.fetch_add(PAGES_PER_TASK)) < pages)
+                            {
+                                ScanOptions options;
+                                options.start = RowId{from, 0};
+                                options.endPage = from + PAGES_PER_TASK;
+                                options.view = &view;
+                                options.profile = profile;
+                                scanInto(workers[w], options, keep, fromEnd, share);
+                            } });
+        }
+        if (profile)
+            profile->threads = threadCount;
+
+        auto started = std::chrono::steady_clock::now();
+        uint64_t emitNanos = 0;
+        auto output = [this, &emit, &emitNanos](std::string_view record)
+        {
+            if (!profile)
+                return emit(record);
+            auto emitted = std::chrono::steady_clock::now();
+            bool more = emit(record);
+            emitNanos += QueryProfile::since(emitted);
+            return more;
+        };
+        auto finish = [this, &started, &emitNanos]()
+        {
+            if (!profile)
+                return;
+            uint64_t total = QueryProfile::since(started);
+            profile->mergeNanos += total - std::min(total, emitNanos);
+            profile->outputNanos += emitNanos;
+        };
+
+        if (keep > 0)
+        {
+            // The best rows overall are among every worker's best
+            std::vector<Kept> rows;
+            for (auto &worker : workers)
+            {
+                std::move(worker.heap.begin(), worker.heap.end(), std::back_inserter(rows));
+                std::vector<Kept>().swap(worker.heap);
+            }
+            std::sort(rows.begin(), rows.end(), [this](const Kept &a, const Kept &b)
+                      { return before(a.key(), a.seq, b.key(), b.seq); });
+            size_t first = fromEnd && rows.size() > keep ? rows.size() - keep : 0;
+            for (size_t i = first; i < rows.size() && i < first + keep; ++i)
+            {
+                if (!output(rows[i].record))
+                    break;
+            }
+            finish();
+            return threadCount;
+        }
+
+        // Sort what is still buffered, then merge it with the runs
+        runParallel(threadCount, [this, &workers](size_t w)
+                    { sortEntries(workers[w]); });
+        uint64_t total = 0;
+        std::vector<std::string> runs;
+        std::vector<MergeSource> sources;
+        for (auto &worker : workers)
+        {
+            total += worker.rows;
+            runs.insert(runs.end(), worker.runs.begin(), worker.runs.end());
+            if (!worker.entries.empty())
+            {
+                sources.emplace_back();
+                sources.back().memory = &worker;
+            }
+        }
+        reduceRuns(runs, std::max<size_t>(MERGE_WAYS > sources.size() ? MERGE_WAYS - sources.size() : 0, 2));
+        for (const auto &path : runs)
+        {
+            sources.emplace_back();
+            sources.back().file = std::make_unique<RunReader>(path);
+        }
+
+        uint64_t wanted = limit < 0 ? total : std::min<uint64_t>(total, static_cast<uint64_t>(limit));
+        uint64_t skip = fromEnd ? total - wanted : 0;
+        merge(sources, [&](const MergeSource &source)
+              {
+                  if (skip > 0)
+                  {
+                      --skip;
+                      return true;
+                  }
+                  --wanted;
+                  return output(source.record()) && wanted > 0; });
+        finish();
+        return threadCount;
+    }
+};
+
+#endif // SORT_H
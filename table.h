@@ -5,46 +5,856 @@
 #include <vector>
 #include <fstream>
 #include <sstream>
-#include <chrono>
-#include <random>
 #include <algorithm>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <condition_variable>
+#include <shared_mutex>
+#include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
+#include "page.h"
+#include "types.h"
+#include "idgen.h"
+#include "bufferpool.h"
+#include "wal.h"
+#include "hashindex.h"
+#include "btree.h"
+#include "lsm.h"
+#include "metrics.h"
+#include "zonemap.h"
+#include "mvcc.h"
+
+// Scan callback: row location and fields (unique_id first). Returning
+// false stops the scan.
+using RowVisitor = std::function<bool(RowId, const std::vector<std::string> &)>;
+
+// Same, but with the stored record, for callers that look at a few columns
+// through the table's RowFormat before decoding anything
+using RecordVisitor = std::function<bool(RowId, std::string_view)>;
+
+// How far a pulled scan has got: the next heap page of its view, or its
+// place in a merge over an LSM snapshot
+struct TableCursor
+{
+    ReadView view;
+    uint32_t nextPage = 1;
+    std::unique_ptr<MergingCursor> merge;
+};
+
+// Where a table keeps its rows. Heap tables append to slotted pages in the
+// .tbl file; LSM tables keep them in an LsmTree keyed by unique_id and use
+// the .tbl file for the header only. LSM rows have no stable location, so
+// they take no secondary indexes.
+enum class TableEngine : uint8_t
+{
+    Heap = 0,
+    Lsm = 1
+};
 
 class Table
 {
 private:
     std::string name;
     std::vector<std::string> schema;
+    std::vector<ColumnType> types;
+    RowFormat format;
+    uint32_t formatVersion = TABLE_FORMAT_VERSION;
+    std::string basePath;
     std::string filePath;
+    std::string legacyCsvPath;
+    uint32_t pageCount = 0; // including the header page
+    uint64_t rowCount = 0;
+    uint32_t fileId = 0;    // buffer pool handle, open for the table's lifetime
+    WriteAheadLog *wal = nullptr;
+    std::unique_ptr<HashIndex> primaryIndex; // unique_id -> RowId
+    bool indexStale = false;                 // set when recovery rewrote rows
+    TableEngine engine = TableEngine::Heap;
+    std::unique_ptr<LsmTree> lsm;            // engine=lsm only
+
+    // Heap tables: a zone map per ZONE_PAGES data pages, kept in memory and
+    // written to <table>.zm whenever the table is synced
+    static constexpr uint32_t ZONE_PAGES = 32;
+    static constexpr uint32_t ZONE_FILE_VERSION = 1;
+    std::vector<ZoneMap> zones;
+
+    // B+tree on one schema column; listed in <table>.indexes
+    struct SecondaryIndex
+    {
+        std::string name;
+        std::string column;
+        size_t position; // index into schema
+        std::unique_ptr<BPlusTree> tree;
+    };
+    std::vector<SecondaryIndex> secondaryIndexes;
+
+    // One writer at a time; readers never wait for it. A reader works on a
+    // ReadView and takes the shared side of the other locks only for short
+    // probes of the indexes, the zone maps or the recent deletes.
+    mutable std::mutex writeMutex;
+    mutable std::shared_mutex indexMutex;   // primary index and B+trees
+    mutable std::shared_mutex zoneMutex;    // zones
+    mutable std::shared_mutex versionMutex; // published state, recentDeletes
+    TableCheckpoint published{};            // where the last committed write ended
+    uint64_t publishedSequence = 0;         // LSM: the last committed write
+    std::shared_ptr<const LsmVersion> publishedVersion; // LSM: the tree as of that write
+
+    // Heap rows deleted while snapshots may still see them, by packed
+    // RowId, with the commit timestamp of the delete. The slot is
+    // tombstoned at once; snapshots older than the delete still see the row
+    // and its index entries stay until none of them is left, or until a
+    // sync, which drops them early and lists the row in unindexedDeletes.
+    std::unordered_map<uint64_t, uint64_t> recentDeletes;
+    std::unordered_set<uint64_t> unindexedDeletes;
+    std::atomic<size_t> recentDeleteCount{0};
+
+    // Writers take a ticket as they log their records under writeMutex,
+    // wait for the log without it, so concurrent writers share one group
+    // commit, and then apply and publish in ticket (that is, log) order
+    uint64_t nextTicket = 0;
+    uint64_t appliedTicket = 0;
+    mutable std::condition_variable applyTurn;
+
+    // A writer's turn to apply its logged change. Waits for every earlier
+    // ticket, holds writeMutex while in scope and passes the turn on
+    // however the writer leaves, including after a failed commit.
+    class ApplyTurn
+    {
+    private:
+        Table &table;
+        std::unique_lock<std::mutex> lock;
+
+    public:
+        ApplyTurn(Table &owner, uint64_t ticket) : table(owner), lock(owner.writeMutex)
+        {
+            table.applyTurn.wait(lock, [this, ticket]
+                                 { return table.appliedTicket + 1 == ticket; });
+        }
+
+        ~ApplyTurn()
+        {
+            ++table.appliedTicket;
+            table.applyTurn.notify_all();
+        }
+
+        ApplyTurn(const ApplyTurn &) = delete;
+        ApplyTurn &operator=(const ApplyTurn &) = delete;
+    };
+
+    // Wait for the log records up to lsn; a failed commit still takes its
+    // turn before rethrowing so the writers behind it are not held up
+    void commitLogged(uint64_t ticket, uint64_t lsn, uint32_t rows)
+    {
+        if (!wal)
+            return;
+        try
+        {
+            wal->commit(lsn, rows);
+        }
+        catch (...)
+        {
+            ApplyTurn turn(*this, ticket);
+            throw;
+        }
+    }
+
+    static uint64_t rowKey(RowId rid) { return (static_cast<uint64_t>(rid.pageNo) << 16) | rid.slot; }
 
     std::string generateUniqueId() const
     {
-        auto now = std::chrono::system_clock::now();
-        auto timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(
-                             now.time_since_epoch())
-                             .count();
+        return generateUniqueIds(1).front();
+    }
+
+    // Consecutive IDs for a batch, claimed from the process-wide generator
+    // in one step
+    std::vector<std::string> generateUniqueIds(size_t count) const
+    {
+        return IdGenerator::instance().next(count);
+    }
 
-        std::mt19937 gen(timestamp);
-        std::uniform_int_distribution<> dis(0, 35);
+    // Serialize the header page: magic, version, counters and schema
+    bool encodeHeader(char *page) const
+    {
+        std::memset(page, 0, PAGE_SIZE);
+        char *out = page;
+        std::memcpy(out, TABLE_MAGIC, sizeof(TABLE_MAGIC));
+        out += sizeof(TABLE_MAGIC);
+        putValue(out, formatVersion);
+        out += sizeof(uint32_t);
+        putValue(out, PAGE_SIZE);
+        out += sizeof(uint32_t);
+        putValue(out, pageCount);
+        out += sizeof(uint32_t);
+        putValue(out, rowCount);
+        out += sizeof(uint64_t);
+        putValue(out, static_cast<uint16_t>(schema.size()));
+        out += sizeof(uint16_t);
 
-        const std::string chars = "0123456789abcdefghijklmnopqrstuvwxyz";
-        std::string uniqueId;
-        for (int i = 0; i < 12; ++i)
+        // Version 2 follows each column name with its type and length
+        bool typed = formatVersion != LEGACY_TABLE_FORMAT_VERSION;
+        for (size_t i = 0; i < schema.size(); ++i)
         {
-            uniqueId += chars[dis(gen)];
+            const std::string &field = schema[i];
+            size_t typeSize = typed ? sizeof(uint8_t) + sizeof(uint16_t) : 0;
+            if (out + sizeof(uint16_t) + field.size() + typeSize > page + PAGE_SIZE)
+                return false;
+            putValue(out, static_cast<uint16_t>(field.size()));
+            out += sizeof(uint16_t);
+            std::memcpy(out, field.data(), field.size());
+            out += field.size();
+            if (typed)
+            {
+                putValue(out, static_cast<uint8_t>(types[i].kind));
+                out += sizeof(uint8_t);
+                putValue(out, types[i].length);
+                out += sizeof(uint16_t);
+            }
+        }
+        if (typed)
+        {
+            if (out + sizeof(uint8_t) > page + PAGE_SIZE)
+                return false;
+            putValue(out, static_cast<uint8_t>(engine));
         }
-        return uniqueId;
+        return true;
+    }
+
+    // Parse the header page. Every length is checked against the page, so a
+    // corrupt header is rejected instead of read past.
+    bool decodeHeader(const char *page)
+    {
+        const char *in = page;
+        const char *end = page + PAGE_SIZE;
+        auto fits = [&in, end](size_t bytes)
+        { return static_cast<size_t>(end - in) >= bytes; };
+        auto corrupt = [this]()
+        {
+            std::cerr << "Corrupt table header in " << filePath << std::endl;
+            return false;
+        };
+
+        if (std::memcmp(in, TABLE_MAGIC, sizeof(TABLE_MAGIC)) != 0)
+            return false;
+        in += sizeof(TABLE_MAGIC);
+
+        uint32_t version = getValue<uint32_t>(in);
+        in += sizeof(uint32_t);
+        uint32_t pageSize = getValue<uint32_t>(in);
+        in += sizeof(uint32_t);
+        if ((version != TABLE_FORMAT_VERSION && version != LEGACY_TABLE_FORMAT_VERSION) || pageSize != PAGE_SIZE)
+        {
+            std::cerr << "Unsupported table format in " << filePath << std::endl;
+            return false;
+        }
+
+        uint32_t pages = getValue<uint32_t>(in);
+        in += sizeof(uint32_t);
+        uint64_t rows = getValue<uint64_t>(in);
+        in += sizeof(uint64_t);
+        uint16_t columnCount = getValue<uint16_t>(in);
+        in += sizeof(uint16_t);
+        if (pages == 0)
+            return corrupt();
+
+        bool typed = version != LEGACY_TABLE_FORMAT_VERSION;
+        std::vector<std::string> names;
+        std::vector<ColumnType> columnTypes;
+        for (uint16_t i = 0; i < columnCount; ++i)
+        {
+            if (!fits(sizeof(uint16_t)))
+                return corrupt();
+            uint16_t length = getValue<uint16_t>(in);
+            in += sizeof(uint16_t);
+            if (!fits(length))
+                return corrupt();
+            names.emplace_back(in, length);
+            in += length;
+
+            ColumnType type;
+            if (typed)
+            {
+                if (!fits(sizeof(uint8_t) + sizeof(uint16_t)))
+                    return corrupt();
+                uint8_t kind = getValue<uint8_t>(in);
+                in += sizeof(uint8_t);
+                if (kind > static_cast<uint8_t>(ColumnKind::Timestamp))
+                    return corrupt();
+                type.kind = static_cast<ColumnKind>(kind);
+                type.length = getValue<uint16_t>(in);
+                in += sizeof(uint16_t);
+            }
+            columnTypes.push_back(type);
+        }
+        // Typed headers end with the engine; older ones have a zero there
+        TableEngine tableEngine = engine;
+        if (typed)
+        {
+            if (!fits(sizeof(uint8_t)) || getValue<uint8_t>(in) > static_cast<uint8_t>(TableEngine::Lsm))
+                return corrupt();
+            tableEngine = static_cast<TableEngine>(getValue<uint8_t>(in));
+        }
+
+        formatVersion = version;
+        pageCount = pages;
+        rowCount = rows;
+        schema = std::move(names);
+        types = std::move(columnTypes);
+        engine = tableEngine;
+        format = RowFormat(schema, types, !typed);
+        return true;
+    }
+
+    bool writeHeader(std::fstream &file) const
+    {
+        std::vector<char> page(PAGE_SIZE);
+        if (!encodeHeader(page.data()))
+            return false;
+        file.seekp(0);
+        file.write(page.data(), PAGE_SIZE);
+        return file.good();
+    }
+
+    // Refresh the cached header page; it reaches disk with the next flush
+    bool syncHeader()
+    {
+        PageGuard header(fileId, 0);
+        if (!encodeHeader(header.get()))
+            return false;
+        header.markDirty();
+        return true;
+    }
+
+    void openFile()
+    {
+        if (fileId == 0)
+            fileId = BufferPool::instance().openFile(filePath);
+    }
+
+    static void writePage(std::fstream &file, uint32_t pageNo, const std::vector<char> &page)
+    {
+        file.seekp(static_cast<std::streamoff>(pageNo) * PAGE_SIZE);
+        file.write(page.data(), PAGE_SIZE);
+    }
+
+    // Convert a legacy <name>.csv table into the paged format. The CSV is
+    // streamed one line at a time into a temporary file so memory stays at
+    // one page regardless of table size; the CSV is removed only once the
+    // new file is complete.
+    bool migrateFromCsv()
+    {
+        std::ifstream csv(legacyCsvPath);
+        if (!csv.is_open())
+            return false;
+
+        std::string line;
+        std::getline(csv, line);
+        std::stringstream ss(line);
+        std::string field;
+
+        // Skip unique_id
+        std::getline(ss, field, ',');
+
+        schema.clear();
+        while (std::getline(ss, field, ','))
+        {
+            schema.push_back(field);
+        }
+        if (schema.empty())
+            return false;
+
+        // CSV tables are untyped: keep them in the text record layout
+        types.assign(schema.size(), ColumnType{});
+        formatVersion = LEGACY_TABLE_FORMAT_VERSION;
+        format = RowFormat(schema, types, true);
+
+        // The temporary file goes away on every failure below
+        std::string tmpPath = filePath + ".tmp";
+        auto fail = [&tmpPath]()
+        {
+            std::error_code ignored;
+            std::filesystem::remove(tmpPath, ignored);
+            return false;
+        };
+        try
+        {
+            std::fstream out(tmpPath, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+            if (!out.is_open())
+                return fail();
+
+            pageCount = 1;
+            rowCount = 0;
+            std::vector<char> page(PAGE_SIZE);
+            SlottedPage slotted(page.data());
+            slotted.init();
+
+            while (std::getline(csv, line))
+            {
+                if (!line.empty() && line.back() == '\r')
+                    line.pop_back();
+                if (line.empty())
+                    continue;
+
+                // A row that cannot be carried over fails the whole
+                // migration so the CSV stays in place
+                std::vector<std::string> fields = splitCsvFields(line);
+                if (fields.size() != schema.size() + 1)
+                {
+                    std::cerr << "Row has " << fields.size() << " values, expected "
+                              << schema.size() + 1 << ": " << line << std::endl;
+                    out.close();
+                    return fail();
+                }
+
+                std::string uniqueId = fields.front();
+                fields.erase(fields.begin());
+                std::string record = RowCodec::encode(uniqueId, fields);
+                if (record.size() > MAX_RECORD_SIZE)
+                {
+                    std::cerr << "Row too large for a page: " << uniqueId << std::endl;
+                    out.close();
+                    return fail();
+                }
+
+                if (!slotted.canFit(record.size()))
+                {
+                    writePage(out, pageCount++, page);
+                    slotted.init();
+                }
+                slotted.insert(record);
+                ++rowCount;
+            }
+            if (slotted.slotCount() > 0)
+            {
+                writePage(out, pageCount++, page);
+            }
+
+            if (!writeHeader(out) || !out.flush())
+            {
+                out.close();
+                return fail();
+            }
+        }
+        catch (...)
+        {
+            fail();
+            throw;
+        }
+
+        // The new file and its name must be on disk before the CSV goes
+        int fd = ::open(tmpPath.c_str(), O_RDONLY);
+        bool synced = fd >= 0 && ::fdatasync(fd) == 0;
+        if (fd >= 0)
+            ::close(fd);
+        if (!synced)
+            return fail();
+
+        csv.close();
+        std::error_code error;
+        std::filesystem::rename(tmpPath, filePath, error);
+        if (error)
+            return fail();
+
+        std::string dir = std::filesystem::path(filePath).parent_path().string();
+        int dirFd = ::open(dir.empty() ? "." : dir.c_str(), O_RDONLY | O_DIRECTORY);
+        synced = dirFd >= 0 && ::fsync(dirFd) == 0;
+        if (dirFd >= 0)
+            ::close(dirFd);
+        if (!synced)
+            return false;
+        std::filesystem::remove(legacyCsvPath, error);
+        return true;
+    }
+
+    // Split a CSV line on commas, keeping empty fields, including a
+    // trailing one (std::getline would drop it)
+    static std::vector<std::string> splitCsvFields(const std::string &line)
+    {
+        std::vector<std::string> fields;
+        size_t start = 0;
+        while (true)
+        {
+            size_t comma = line.find(',', start);
+            if (comma == std::string::npos)
+            {
+                fields.push_back(line.substr(start));
+                return fields;
+            }
+            fields.push_back(line.substr(start, comma - start));
+            start = comma + 1;
+        }
+    }
+
+    // Append encoded records to the last data page, starting a new page
+    // whenever it fills up. The tail page stays pinned across the batch and
+    // the header is refreshed once at the end.
+    bool appendRecords(const std::vector<std::string> &records)
+    {
+        std::unique_lock<std::shared_mutex> zoneLock(zoneMutex);
+        std::unique_lock<std::shared_mutex> indexLock(indexMutex);
+        size_t next = 0;
+        while (next < records.size())
+        {
+            bool fresh = pageCount == 1;
+            uint32_t pageNo = fresh ? pageCount : pageCount - 1;
+            PageGuard page(fileId, pageNo);
+            SlottedPage slotted(page.get());
+            if (fresh)
+            {
+                slotted.init();
+                ++pageCount;
+            }
+
+            // Snapshot readers copy pages under versionMutex, so the tail
+            // page only changes while they are held off
+            size_t before = next;
+            std::vector<uint16_t> slots;
+            {
+                std::unique_lock<std::shared_mutex> versions(versionMutex);
+                int slot;
+                while (next < records.size() && (slot = slotted.insert(records[next])) >= 0)
+                {
+                    slots.push_back(static_cast<uint16_t>(slot));
+                    ++next;
+                }
+            }
+            for (size_t i = before; i < next; ++i)
+            {
+                RowId rid{pageNo, slots[i - before]};
+                zoneOf(pageNo).add(format, records[i]);
+                primaryIndex->insert(RowCodec::decodeId(records[i]), rid);
+                for (auto &index : secondaryIndexes)
+                    index.tree->insert(std::string(format.field(records[i], index.position + 1)), rid);
+            }
+            if (next > before)
+                page.markDirty();
+
+            rowCount += next - before;
+            if (next < records.size())
+            {
+                // Tail page is full: open a fresh one on the next pass
+                PageGuard nextPage(fileId, pageCount);
+                SlottedPage(nextPage.get()).init();
+                nextPage.markDirty();
+                ++pageCount;
+            }
+        }
+        return syncHeader();
+    }
+
+    std::string lsmPath() const { return basePath + name + ".lsm"; }
+    std::string zoneFilePath() const { return basePath + name + ".zm"; }
+
+    ZoneMap &zoneOf(uint32_t pageNo)
+    {
+        size_t zone = (pageNo - 1) / ZONE_PAGES;
+        if (zone >= zones.size())
+            zones.resize(zone + 1);
+        return zones[zone];
+    }
+
+    // u32 version | u32 page count | u64 row count | u32 zones | zone maps.
+    // The counts tie the file to the table state it describes.
+    void saveZones() const
+    {
+        std::string data;
+        char header[3 * sizeof(uint32_t) + sizeof(uint64_t)];
+        putValue(header, ZONE_FILE_VERSION);
+        putValue(header + 4, pageCount);
+        putValue(header + 8, rowCount);
+        putValue(header + 16, static_cast<uint32_t>(zones.size()));
+        data.append(header, sizeof(header));
+        for (const auto &zone : zones)
+            zone.encode(data);
+
+        std::string tmpPath = zoneFilePath() + ".tmp";
+        {
+            std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+            out.write(data.data(), static_cast<std::streamsize>(data.size()));
+        }
+        std::filesystem::rename(tmpPath, zoneFilePath());
+    }
+
+    // False if the file is missing or describes another state of the table
+    bool loadZones()
+    {
+        std::ifstream in(zoneFilePath(), std::ios::binary);
+        std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        const size_t headerSize = 3 * sizeof(uint32_t) + sizeof(uint64_t);
+        if (data.size() < headerSize || getValue<uint32_t>(data.data()) != ZONE_FILE_VERSION ||
+            getValue<uint32_t>(data.data() + 4) != pageCount || getValue<uint64_t>(data.data() + 8) != rowCount)
+            return false;
+
+        uint32_t count = getValue<uint32_t>(data.data() + 16);
+        const char *cursor = data.data() + headerSize;
+        const char *end = data.data() + data.size();
+        zones.assign(count, ZoneMap{});
+        for (auto &zone : zones)
+        {
+            if (!zone.decode(cursor, end))
+                return false;
+        }
+        return true;
+    }
+
+    void rebuildZones()
+    {
+        zones.clear();
+        for (uint32_t pageNo = 1; pageNo < pageCount; ++pageNo)
+        {
+            PageGuard page(fileId, pageNo);
+            SlottedPage slotted(page.get());
+            ZoneMap &zone = zoneOf(pageNo);
+            for (uint16_t slot = 0; slot < slotted.slotCount(); ++slot)
+            {
+                if (!slotted.isDeleted(slot))
+                    zone.add(format, slotted.get(slot));
+            }
+        }
+        saveZones();
+    }
+
+    std::string indexListPath() const { return basePath + name + ".indexes"; }
+
+    std::string indexFilePath(const std::string &indexName) const
+    {
+        return basePath + name + "." + indexName + ".idx";
+    }
+
+    void saveIndexList() const
+    {
+        std::ofstream list(indexListPath(), std::ios::trunc);
+        for (const auto &index : secondaryIndexes)
+        {
+            list << index.name << " " << index.column << "\n";
+        }
+    }
+
+    // Open every index listed next to the table, rebuilding stale ones
+    void loadIndexList()
+    {
+        std::ifstream list(indexListPath());
+        std::string indexName, column;
+        bool stale = false;
+        while (list >> indexName >> column)
+        {
+            auto it = std::find(schema.begin(), schema.end(), column);
+            if (it == schema.end())
+                continue;
+            SecondaryIndex index{indexName, column, static_cast<size_t>(it - schema.begin()),
+                                 std::make_unique<BPlusTree>(indexFilePath(indexName))};
+            stale = stale || !index.tree->open(pageCount, rowCount);
+            secondaryIndexes.push_back(std::move(index));
+        }
+        if (stale)
+            rebuildIndexes();
+    }
+
+    // Rebuild every index from one full scan: the hash index by insertion,
+    // the B+trees bottom-up from sorted entries. Also recounts live rows,
+    // since recovery may have left rowCount approximate.
+    void rebuildIndexes()
+    {
+        primaryIndex->create();
+        std::vector<std::vector<IndexEntry>> entries(secondaryIndexes.size());
+        rowCount = 0;
+        zones.clear();
+        for (uint32_t pageNo = 1; pageNo < pageCount; ++pageNo)
+        {
+            PageGuard page(fileId, pageNo);
+            SlottedPage slotted(page.get());
+            for (uint16_t slot = 0; slot < slotted.slotCount(); ++slot)
+            {
+                if (slotted.isDeleted(slot))
+                    continue;
+                RowId rid{pageNo, slot};
+                std::string_view record = slotted.get(slot);
+                primaryIndex->insert(RowCodec::decodeId(record), rid);
+                zoneOf(pageNo).add(format, record);
+                for (size_t i = 0; i < secondaryIndexes.size(); ++i)
+                {
+                    std::string key(format.field(record, secondaryIndexes[i].position + 1));
+                    entries[i].push_back(IndexEntry{std::move(key), rid});
+                }
+                ++rowCount;
+            }
+        }
+
+        for (size_t i = 0; i < secondaryIndexes.size(); ++i)
+        {
+            std::sort(entries[i].begin(), entries[i].end(), [](const IndexEntry &a, const IndexEntry &b)
+                      { return compareIndexEntry(a.key, a.rid, b.key, b.rid) < 0; });
+            secondaryIndexes[i].tree->bulkLoad(std::move(entries[i]));
+        }
+        syncHeader();
+        saveZones();
+        indexStale = false;
+    }
+
+    // Tombstone one row, leaving its index entries; false if already gone
+    bool tombstoneRow(RowId rid)
+    {
+        if (rid.pageNo == 0 || rid.pageNo >= pageCount)
+            return false;
+
+        PageGuard page(fileId, rid.pageNo);
+        SlottedPage slotted(page.get());
+        if (rid.slot >= slotted.slotCount() || !slotted.erase(rid.slot))
+            return false;
+        page.markDirty();
+        --rowCount;
+        return true;
+    }
+
+    void eraseIndexEntries(RowId rid)
+    {
+        PageGuard page(fileId, rid.pageNo);
+        std::string_view record = SlottedPage(page.get()).get(rid.slot);
+        primaryIndex->erase(RowCodec::decodeId(record), rid);
+        for (auto &index : secondaryIndexes)
+            index.tree->erase(std::string(format.field(record, index.position + 1)), rid);
+    }
+
+    // Tombstone one row and drop it from the index; false if already gone
+    bool eraseRow(RowId rid)
+    {
+        if (!tombstoneRow(rid))
+            return false;
+        eraseIndexEntries(rid);
+        return true;
+    }
+
+    // Make everything written so far visible to snapshots that begin from
+    // now on. Called at the end of every committed change, by the writer.
+    void publish()
+    {
+        TableCheckpoint state = checkpointState();
+        uint64_t sequence = lsm ? lsm->lastSequence() : 0;
+        // Pinned here rather than per snapshot: a flush after this could
+        // already hold writes that are not published yet
+        auto version = lsm ? lsm->pinVersion() : nullptr;
+        std::unique_lock<std::shared_mutex> lock(versionMutex);
+        VersionClock::instance().commit();
+        published = state;
+        publishedSequence = sequence;
+        publishedVersion = std::move(version);
+    }
+
+    // Forget deleted rows no open snapshot can see any more, together with
+    // their index entries. With force, every index entry goes, even where
+    // an old snapshot could still have found the row through it, but the
+    // rows stay visible to those snapshots' scans until they end.
+    void collectVersions(bool force = false)
+    {
+        if (recentDeleteCount.load() == 0)
+            return;
+        uint64_t oldest = VersionClock::instance().oldestActive();
+        std::unique_lock<std::shared_mutex> versions(versionMutex);
+        std::unique_lock<std::shared_mutex> indexes(indexMutex);
+        for (auto it = recentDeletes.begin(); it != recentDeletes.end();)
+        {
+            RowId rid{static_cast<uint32_t>(it->first >> 16), static_cast<uint16_t>(it->first & 0xFFFF)};
+            bool expired = it->second <= oldest;
+            if ((expired || force) && unindexedDeletes.insert(it->first).second)
+                eraseIndexEntries(rid);
+            if (expired)
+            {
+                unindexedDeletes.erase(it->first);
+                it = recentDeletes.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+        recentDeleteCount = recentDeletes.size();
+    }
+
+    // Can a reader with this view (or, without one, the writer) see the
+    // row on this page?
+    bool visible(const ReadView *view, RowId rid, const SlottedPage &page) const
+    {
+        uint32_t end = view ? view->pageCount : pageCount;
+        if (rid.pageNo == 0 || rid.pageNo >= end)
+            return false;
+        uint16_t slots = view && rid.pageNo == end - 1 ? view->lastSlotCount : page.slotCount();
+        if (rid.slot >= slots)
+            return false;
+        if (!view)
+            return !page.isDeleted(rid.slot);
+        // A delete stamps recentDeletes and the tombstone together under
+        // versionMutex; the record bytes themselves never change
+        std::shared_lock<std::shared_mutex> lock(versionMutex);
+        if (!page.isDeleted(rid.slot))
+            return true;
+        auto it = recentDeletes.find(rowKey(rid));
+        return it != recentDeletes.end() && it->second > view->timestamp();
+    }
+
+    // The page as a view sees it, on a private copy: rows appended after
+    // the snapshot cut off and rows deleted after it revived. The copy is
+    // taken under versionMutex, which writers hold while they change a page
+    // readers can see, so a delete committed later never reaches it.
+    char *pageAsOf(const ReadView &view, uint32_t pageNo, const char *data, std::vector<char> &copy) const
+    {
+        bool tail = pageNo == view.pageCount - 1;
+        std::shared_lock<std::shared_mutex> lock(versionMutex);
+        copy.assign(data, data + PAGE_SIZE);
+        SlottedPage page(copy.data());
+        uint16_t slots = tail ? view.lastSlotCount : page.slotCount();
+        if (tail)
+        {
+            PageHeader h = page.state();
+            h.slotCount = slots;
+            h.freeStart = static_cast<uint16_t>(sizeof(PageHeader) + slots * sizeof(Slot));
+            page.restore(h);
+        }
+        if (recentDeleteCount.load() == 0)
+            return copy.data();
+        for (uint16_t slot = 0; slot < slots; ++slot)
+        {
+            if (!page.isDeleted(slot))
+                continue;
+            auto it = recentDeletes.find(rowKey(RowId{pageNo, slot}));
+            if (it != recentDeletes.end() && it->second > view.timestamp())
+                page.revive(slot);
+        }
+        return copy.data();
     }
 
 public:
+    // Columns without a type are varchar
     Table(const std::string &tableName, const std::vector<std::string> &tableSchema,
-          const std::string &basePath)
-        : name(tableName), schema(tableSchema)
+          const std::string &basePath, const std::vector<ColumnType> &columnTypes = {},
+          TableEngine tableEngine = TableEngine::Heap)
+        : name(tableName), schema(tableSchema), types(columnTypes), basePath(basePath), engine(tableEngine)
+    {
+        types.resize(schema.size());
+        format = RowFormat(schema, types, false);
+        primaryIndex = std::make_unique<HashIndex>(basePath + tableName);
+        filePath = basePath + tableName + ".tbl";
+        legacyCsvPath = basePath + tableName + ".csv";
+    }
+
+    Table(const Table &) = delete;
+    Table &operator=(const Table &) = delete;
+
+    ~Table()
     {
-        filePath = basePath + tableName + ".csv";
+        if (fileId != 0)
+            BufferPool::instance().closeFile(fileId);
     }
 
     const std::string &getName() const { return name; }
     const std::vector<std::string> &getSchema() const { return schema; }
+    const std::vector<ColumnType> &getTypes() const { return types; }
+    const RowFormat &getFormat() const { return format; }
+    const std::string &getFilePath() const { return filePath; }
+    uint64_t getRowCount() const { return rowCount; }
+    uint32_t getPageCount() const { return pageCount; } // including the header page
+    TableEngine getEngine() const { return engine; }
+    uint32_t getFormatVersion() const { return formatVersion; }
 
     bool initialize()
     {
@@ -56,22 +866,34 @@ public:
             // Ensure the directory exists
             std::filesystem::create_directories(std::filesystem::path(filePath).parent_path());
 
-            std::ofstream file(filePath, std::ios::out);
-            if (!file.is_open())
             {
-                std::cerr << "Failed to open file: " << filePath << std::endl;
-                return false;
+                std::ofstream file(filePath, std::ios::out | std::ios::binary | std::ios::trunc);
+                if (!file.is_open())
+                {
+                    std::cerr << "Failed to open file: " << filePath << std::endl;
+                    return false;
+                }
             }
 
-            // Write schema header
-            file << "unique_id";
-            for (const auto &field : schema)
+            // Write header page with the schema
+            openFile();
+            pageCount = 1;
+            rowCount = 0;
+            if (!syncHeader())
             {
-                file << "," << field;
+                std::cerr << "Schema too large for header page: " << filePath << std::endl;
+                return false;
             }
-            file << std::endl;
-
-            file.close();
+            BufferPool::instance().flushFile(fileId);
+            if (engine == TableEngine::Lsm)
+            {
+                lsm = std::make_unique<LsmTree>(lsmPath(), &format);
+                return lsm->create();
+            }
+            primaryIndex->create();
+            primaryIndex->sync(pageCount, rowCount);
+            zones.clear();
+            saveZones();
 
             return true;
         }
@@ -84,48 +906,751 @@ public:
 
     bool load()
     {
-        std::ifstream file(filePath);
-        if (!file.is_open())
+        try
+        {
+            if (!std::filesystem::exists(filePath) && std::filesystem::exists(legacyCsvPath))
+            {
+                std::cout << "Converting " << legacyCsvPath << " to paged format..." << std::endl;
+                if (!migrateFromCsv())
+                {
+                    std::cerr << "Failed to convert table: " << legacyCsvPath << std::endl;
+                    return false;
+                }
+            }
+
+            if (!std::filesystem::exists(filePath))
+                return false;
+
+            openFile();
+            {
+                PageGuard header(fileId, 0);
+                if (!decodeHeader(header.get()))
+                    return false;
+            }
+
+            if (engine == TableEngine::Lsm)
+            {
+                lsm = std::make_unique<LsmTree>(lsmPath(), &format);
+                if (!lsm->open())
+                    return false;
+            }
+            else
+            {
+                if (!primaryIndex->open(pageCount, rowCount))
+                {
+                    rebuildIndexes();
+                }
+                loadIndexList();
+                if (!loadZones())
+                    rebuildZones();
+            }
+
+            publish();
+            return !schema.empty();
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Error in load(): " << e.what() << std::endl;
             return false;
+        }
+    }
 
-        std::string header;
-        std::getline(file, header);
+    // Inserts are logged to the database's WAL once attached
+    void attachLog(WriteAheadLog *log) { wal = log; }
 
-        // Parse schema from header
-        std::stringstream ss(header);
-        std::string field;
+    bool insertRow(const std::vector<std::string> &data)
+    {
+        return insertRows({data}) == 1;
+    }
 
-        // Skip unique_id
-        std::getline(ss, field, ',');
+    // Insert a batch with one ID-generation pass, one pass over the tail
+    // pages and a single log commit. The batch is all-or-nothing: any row
+    // with the wrong arity, a value its column type rejects or an oversized
+    // record rejects it up front, reporting the row and reason if asked.
+    // Returns the number of rows inserted; firstId, if given, receives the
+    // unique_id of the first.
+    size_t insertRows(const std::vector<std::vector<std::string>> &rows, std::string *error = nullptr,
+                      size_t *failedRow = nullptr, std::string *firstId = nullptr)
+    {
+        if (rows.empty() || fileId == 0)
+            return 0;
 
-        schema.clear();
-        while (std::getline(ss, field, ','))
+        auto reject = [error, failedRow](size_t row, const std::string &reason)
         {
-            schema.push_back(field);
+            if (error)
+                *error = reason;
+            if (failedRow)
+                *failedRow = row;
+            return 0;
+        };
+
+        for (size_t i = 0; i < rows.size(); ++i)
+        {
+            if (rows[i].size() != schema.size())
+                return reject(i, "Expected " + std::to_string(schema.size()) + " values");
         }
 
-        return !schema.empty();
+        std::vector<std::string> ids = generateUniqueIds(rows.size());
+        std::vector<std::string> records(rows.size());
+        std::string reason;
+        for (size_t i = 0; i < rows.size(); ++i)
+        {
+            if (!format.encode(ids[i], rows[i], records[i], &reason))
+                return reject(i, reason);
+            if (records[i].size() > MAX_RECORD_SIZE)
+                return reject(i, "Row too large");
+        }
+        if (firstId)
+            *firstId = ids.front();
+        return insertRecords(records, error);
     }
 
-    bool insertRow(const std::vector<std::string> &data)
+    // Append encoded records, each already carrying its unique_id, as one
+    // logged batch. Returns how many were appended: all or none. A storage
+    // error after the commit also returns 0; the log still holds the batch.
+    size_t insertRecords(const std::vector<std::string> &records, std::string *error = nullptr)
+    {
+        if (records.empty() || fileId == 0)
+            return 0;
+
+        // Log first: a commit that throws leaves the table untouched. Once
+        // it returns, recovery replays the batch even if applying it below
+        // fails part way.
+        uint64_t ticket, lsn = 0;
+        {
+            std::lock_guard<std::mutex> writer(writeMutex);
+            if (fileId == 0) // dropped meanwhile
+                return 0;
+            ticket = ++nextTicket;
+            if (wal)
+                lsn = wal->logInserts(name, records);
+        }
+        commitLogged(ticket, lsn, static_cast<uint32_t>(records.size()));
+
+        ApplyTurn turn(*this, ticket);
+        if (lsm)
+        {
+            size_t applied = 0;
+            while (applied < records.size() && lsm->put(RowCodec::decodeId(records[applied]), records[applied]))
+                ++applied;
+            rowCount += applied;
+            syncHeader();
+            if (applied < records.size())
+            {
+                publish();
+                if (error)
+                    *error = "Storage error";
+                return 0;
+            }
+        }
+        else if (!appendRecords(records))
+        {
+            publish();
+            return 0;
+        }
+        // Readers see the batch only once it is durable
+        publish();
+        collectVersions();
+        Metrics::instance().rowsWritten(records.size());
+        return records.size();
+    }
+
+    // Visit the records whose unique_id matches that the view sees; without
+    // a view, the live ones as the writer sees them
+    void lookupRecords(const std::string &id, const RecordVisitor &visit, const ReadView *view = nullptr) const
+    {
+        if (fileId == 0)
+            return;
+        if (lsm)
+        {
+            std::string record;
+            if (view ? lsm->get(id, record, view->lsmSequence, view->lsmVersion) : lsm->get(id, record))
+                visit(RowId{0, 0}, record);
+            return;
+        }
+        std::vector<RowId> rids;
+        {
+            std::shared_lock<std::shared_mutex> lock(indexMutex);
+            rids = primaryIndex->find(id);
+        }
+        for (const RowId &rid : rids)
+        {
+            if (rid.pageNo == 0 || rid.pageNo >= (view ? view->pageCount : pageCount))
+                continue;
+            PageGuard page(fileId, rid.pageNo);
+            SlottedPage slotted(page.get());
+            if (!visible(view, rid, slotted))
+                continue;
+            std::string_view record = slotted.get(rid.slot);
+            if (RowCodec::decodeId(record) == id && !visit(rid, record))
+                return;
+        }
+    }
+
+    // Live rows whose unique_id matches, with their locations
+    std::vector<std::pair<RowId, std::vector<std::string>>> lookup(const std::string &id) const
+    {
+        std::vector<std::pair<RowId, std::vector<std::string>>> matches;
+        lookupRecords(id, [this, &matches](RowId rid, std::string_view record)
+                      {
+                          matches.emplace_back(rid, format.decode(record));
+                          return true; });
+        return matches;
+    }
+
+    // Point lookup through the primary index
+    std::vector<std::vector<std::string>> findById(const std::string &id) const
+    {
+        std::vector<std::vector<std::string>> rows;
+        if (fileId == 0)
+            return rows;
+        for (auto &match : lookup(id))
+            rows.push_back(std::move(match.second));
+        return rows;
+    }
+
+    // Tombstone every live row with this unique_id. Returns the number of
+    // rows deleted.
+    size_t deleteById(const std::string &id)
+    {
+        if (fileId == 0)
+            return 0;
+
+        // Log first, as for inserts: a commit that throws must not leave a
+        // tombstone behind for the next publish or LSM flush. A delete that
+        // an earlier ticket beat to the same row logs it twice; replaying
+        // a delete is idempotent.
+        uint64_t ticket, lsn = 0;
+        std::vector<RowId> deleted;
+        {
+            std::lock_guard<std::mutex> writer(writeMutex);
+            if (fileId == 0) // dropped meanwhile
+                return 0;
+            if (lsm)
+            {
+                std::string record;
+                if (!lsm->get(id, record))
+                    return 0;
+                ticket = ++nextTicket;
+                if (wal)
+                    lsn = wal->logDeleteKeys(name, {id});
+            }
+            else
+            {
+                // Heap rows never move, so the locations stay valid until
+                // the turn comes to tombstone them
+                for (const auto &match : lookup(id))
+                    deleted.push_back(match.first);
+                if (deleted.empty())
+                    return 0;
+                ticket = ++nextTicket;
+                if (wal)
+                    lsn = wal->logDeletes(name, deleted);
+            }
+        }
+        commitLogged(ticket, lsn, lsm ? 1 : static_cast<uint32_t>(deleted.size()));
+
+        ApplyTurn turn(*this, ticket);
+        if (lsm)
+        {
+            std::string record;
+            if (!lsm->get(id, record) || !lsm->remove(id))
+                return 0;
+            --rowCount;
+            syncHeader();
+            publish();
+            Metrics::instance().rowsWritten(1);
+            return 1;
+        }
+
+        // Readers see the delete only once it is durable; the rows stay
+        // visible to older snapshots until collectVersions
+        {
+            std::unique_lock<std::shared_mutex> lock(versionMutex);
+            uint64_t ts = VersionClock::instance().commit();
+            std::vector<RowId> live;
+            for (RowId rid : deleted)
+            {
+                if (tombstoneRow(rid))
+                    live.push_back(rid);
+            }
+            deleted.swap(live);
+            for (RowId rid : deleted)
+                recentDeletes[rowKey(rid)] = ts;
+            recentDeleteCount = recentDeletes.size();
+        }
+        if (deleted.empty())
+            return 0;
+        syncHeader();
+        collectVersions();
+        Metrics::instance().rowsWritten(deleted.size());
+        return deleted.size();
+    }
+
+    // Recovery: re-apply an insert read back from the log
+    bool replayInsert(std::string_view record)
+    {
+        uint64_t id;
+        if (IdGenerator::parse(RowCodec::decodeId(record), id))
+            IdGenerator::instance().advancePast(id);
+        if (lsm)
+        {
+            if (!lsm->put(RowCodec::decodeId(record), record))
+                return false;
+            ++rowCount;
+            return syncHeader();
+        }
+        return fileId != 0 && appendRecords({std::string(record)});
+    }
+
+    // Recovery: re-apply a logged delete. Tombstones are idempotent.
+    void replayDelete(RowId rid)
+    {
+        if (fileId != 0 && eraseRow(rid))
+            syncHeader();
+    }
+
+    // Recovery: re-apply a delete logged by unique_id. Two sessions may
+    // both log a delete of the same row, so as live, only one that finds
+    // the row takes it off the count.
+    void replayDeleteKey(const std::string &id)
+    {
+        std::string record;
+        if (lsm && lsm->get(id, record) && lsm->remove(id))
+        {
+            --rowCount;
+            syncHeader();
+        }
+    }
+
+    // Recovery is done: bring the index back in line if rows were rolled
+    // back, and let readers see the recovered rows
+    void finishRecovery()
+    {
+        if (indexStale)
+            rebuildIndexes();
+        publish();
+    }
+
+    // Hold off writers, e.g. while a checkpoint records where the table ends.
+    // Every change already logged is applied first, so none is caught
+    // between the log and the table.
+    std::unique_lock<std::mutex> lockWrites() const
+    {
+        std::unique_lock<std::mutex> lock(writeMutex);
+        applyTurn.wait(lock, [this]
+                       { return appliedTicket == nextTicket; });
+        return lock;
+    }
+
+    // Open a snapshot of the table for one reader
+    ReadView snapshot() const
+    {
+        std::shared_lock<std::shared_mutex> lock(versionMutex);
+        ReadView view;
+        view.snapshot = Snapshot(VersionClock::instance().begin());
+        view.pageCount = std::max<uint32_t>(published.pageCount, 1);
+        view.lastSlotCount = published.lastSlotCount;
+        view.lsmSequence = lsm ? publishedSequence : UINT64_MAX;
+        view.lsmVersion = publishedVersion;
+        return view;
+    }
+
+    TableCheckpoint checkpointState() const
+    {
+        TableCheckpoint state{name, pageCount, rowCount, 0, 0, 0};
+        if (pageCount > 1)
+        {
+            PageGuard page(fileId, pageCount - 1);
+            PageHeader h = SlottedPage(page.get()).state();
+            state.lastSlotCount = h.slotCount;
+            state.lastFreeStart = h.freeStart;
+            state.lastFreeEnd = h.freeEnd;
+        }
+        return state;
+    }
+
+    // Recovery: forget everything appended after the checkpointed state.
+    // Pages past the old end are simply overwritten by the replayed inserts.
+    void rollbackTo(const TableCheckpoint &state)
+    {
+        // LSM segments only ever hold flushed data, and replaying inserts
+        // into the tree is idempotent; only the row count needs resetting
+        if (lsm)
+        {
+            rowCount = state.rowCount;
+            syncHeader();
+            return;
+        }
+
+        TableCheckpoint current = checkpointState();
+        if (current.pageCount == state.pageCount && current.rowCount == state.rowCount &&
+            current.lastSlotCount == state.lastSlotCount && current.lastFreeEnd == state.lastFreeEnd)
+            return;
+
+        // Index entries may point past the rollback point
+        indexStale = true;
+        pageCount = std::max<uint32_t>(state.pageCount, 1);
+        rowCount = state.rowCount;
+        if (pageCount > 1)
+        {
+            PageGuard page(fileId, pageCount - 1);
+            SlottedPage slotted(page.get());
+            PageHeader h = slotted.state();
+            h.slotCount = state.lastSlotCount;
+            h.freeStart = state.lastFreeStart;
+            h.freeEnd = state.lastFreeEnd;
+            slotted.restore(h);
+            page.markDirty();
+        }
+        syncHeader();
+    }
+
+    // Write back dirty pages and fdatasync the table file and its index.
+    // The caller holds lockWrites(). Index entries of recently deleted rows
+    // are dropped first so none outlives a restart.
+    void sync()
+    {
+        collectVersions(true);
+        if (fileId != 0 && lsm)
+        {
+            // The memtable is durable only through the log: a checkpoint
+            // must not truncate it unless the flush made it to a segment
+            if (!lsm->flush())
+                throw std::runtime_error("Failed to flush " + lsmPath());
+            syncHeader();
+            BufferPool::instance().syncFile(fileId);
+        }
+        else if (fileId != 0)
+        {
+            BufferPool::instance().syncFile(fileId);
+            {
+                std::unique_lock<std::shared_mutex> lock(indexMutex);
+                primaryIndex->sync(pageCount, rowCount);
+                for (auto &index : secondaryIndexes)
+                    index.tree->sync(pageCount, rowCount);
+            }
+            std::shared_lock<std::shared_mutex> lock(zoneMutex);
+            saveZones();
+        }
+    }
+
+    // Build a B+tree on one column from the existing rows (sorted bottom-up
+    // build) and register it next to the table
+    bool createIndex(const std::string &indexName, const std::string &column)
     {
-        if (data.size() != schema.size())
+        auto it = std::find(schema.begin(), schema.end(), column);
+        if (fileId == 0 || lsm || it == schema.end())
             return false;
 
-        std::ofstream file(filePath, std::ios::app);
-        if (!file.is_open())
+        // Only writers add indexes, so the check holds until the push_back
+        std::lock_guard<std::mutex> writer(writeMutex);
+        if (hasIndex(indexName) || !indexOn(column).empty())
             return false;
+        size_t position = it - schema.begin();
+        std::vector<IndexEntry> entries;
+        entries.reserve(rowCount);
+        forEachPage(1, false, [this, &entries, position](uint32_t pageNo, const SlottedPage &page)
+                    {
+                        for (uint16_t slot = 0; slot < page.slotCount(); ++slot)
+                        {
+                            if (!page.isDeleted(slot))
+                                entries.push_back(IndexEntry{std::string(format.field(page.get(slot), position + 1)),
+                                                             RowId{pageNo, slot}});
+                        }
+                        return true; });
+        std::sort(entries.begin(), entries.end(), [](const IndexEntry &a, const IndexEntry &b)
+                  { return compareIndexEntry(a.key, a.rid, b.key, b.rid) < 0; });
+
+        SecondaryIndex index{indexName, column, position, std::make_unique<BPlusTree>(indexFilePath(indexName))};
+        index.tree->bulkLoad(std::move(entries));
+        index.tree->sync(pageCount, rowCount);
+        {
+            std::unique_lock<std::shared_mutex> lock(indexMutex);
+            secondaryIndexes.push_back(std::move(index));
+        }
+        saveIndexList();
+        return true;
+    }
+
+    // createIndex may grow secondaryIndexes at any time, so every walk
+    // below holds indexMutex
+    bool hasIndex(const std::string &indexName) const
+    {
+        std::shared_lock<std::shared_mutex> lock(indexMutex);
+        for (const auto &index : secondaryIndexes)
+        {
+            if (index.name == indexName)
+                return true;
+        }
+        return false;
+    }
+
+    // Name of the index on a column, or empty if the column is unindexed
+    std::string indexOn(const std::string &column) const
+    {
+        std::shared_lock<std::shared_mutex> lock(indexMutex);
+        for (const auto &index : secondaryIndexes)
+        {
+            if (index.column == column)
+                return index.name;
+        }
+        return "";
+    }
+
+    std::vector<std::pair<std::string, std::string>> getIndexes() const
+    {
+        std::vector<std::pair<std::string, std::string>> result;
+        std::shared_lock<std::shared_mutex> lock(indexMutex);
+        for (const auto &index : secondaryIndexes)
+            result.emplace_back(index.name, index.column);
+        return result;
+    }
 
-        std::string uniqueId = generateUniqueId();
-        std::cout << "Generated unique ID: " << uniqueId << std::endl;
-        file << uniqueId;
-        for (const auto &field : data)
+    // Visit the records whose indexed column falls in the given range, in
+    // column order, as the view (or the writer) sees them. Bounds are
+    // stored-form keys (see ValueCodec). The locations are collected first
+    // so writers wait only for the index walk, not for the visits. Returns
+    // false if the column has no index.
+    bool indexRangeScan(const std::string &column, const std::string *low, bool lowInclusive,
+                        const std::string *high, bool highInclusive, const RecordVisitor &visit,
+                        const ReadView *view = nullptr) const
+    {
+        if (fileId == 0)
+            return false;
+        std::vector<RowId> rids;
+        {
+            std::shared_lock<std::shared_mutex> lock(indexMutex);
+            const SecondaryIndex *index = nullptr;
+            for (const auto &candidate : secondaryIndexes)
+            {
+                if (candidate.column == column)
+                    index = &candidate;
+            }
+            if (!index)
+                return false;
+            index->tree->scan(low, lowInclusive, high, highInclusive,
+                              [&rids](const std::string &, RowId rid)
+                              {
+                                  rids.push_back(rid);
+                                  return true;
+                              });
+        }
+        uint32_t end = view ? view->pageCount : pageCount;
+        for (const RowId &rid : rids)
         {
-            file << "," << field;
+            if (rid.pageNo == 0 || rid.pageNo >= end)
+                continue;
+            PageGuard page(fileId, rid.pageNo);
+            SlottedPage slotted(page.get());
+            if (visible(view, rid, slotted) && !visit(rid, slotted.get(rid.slot)))
+                break;
         }
-        file << std::endl;
         return true;
     }
+
+    // Close and delete every file belonging to the table
+    void dropFiles()
+    {
+        if (fileId != 0)
+        {
+            BufferPool::instance().closeFile(fileId);
+            fileId = 0;
+        }
+        if (lsm)
+            lsm->destroy();
+        {
+            std::unique_lock<std::shared_mutex> lock(indexMutex);
+            primaryIndex->destroy();
+            for (auto &index : secondaryIndexes)
+                index.tree->destroy();
+            secondaryIndexes.clear();
+        }
+        std::filesystem::remove(indexListPath());
+        std::filesystem::remove(zoneFilePath());
+        std::filesystem::remove(filePath);
+    }
+
+    // Write every dirty cached page of this table back to its file
+    void flush()
+    {
+        if (fileId != 0)
+            BufferPool::instance().flushFile(fileId);
+    }
+
+    // Visit every row (unique_id first) in file order. The callback returns
+    // false to stop the scan early.
+    void forEachRow(const std::function<bool(const std::vector<std::string> &)> &visit) const
+    {
+        forEachRowWithId([&visit](RowId, const std::vector<std::string> &fields)
+                         { return visit(fields); });
+    }
+
+    // Zones of heap pages or blocks of LSM segments, and how many of them
+    // a full scan with filter would pass by without reading
+    void countSkippableBlocks(const Filter &filter, uint64_t &blocks, uint64_t &skippable) const
+    {
+        if (lsm)
+        {
+            lsm->countSkippableBlocks(filter, blocks, skippable);
+            return;
+        }
+        std::shared_lock<std::shared_mutex> lock(zoneMutex);
+        for (const ZoneMap &zone : zones)
+        {
+            ++blocks;
+            skippable += !zoneMayMatch(filter, zone);
+        }
+    }
+
+    // Hand data pages to visit one at a time, pinned for the duration of the
+    // call, starting at page from and walking forward or backward. Returning
+    // false stops the walk. A scan never holds more than one page.
+    //
+    // LSM rows come out of the tree in unique_id order, packed into
+    // throwaway pages numbered from 1. A backward walk over them has to
+    // materialize every page first.
+    //
+    // With a bound filter, zones of pages (or LSM blocks) whose zone map
+    // rules the filter out are skipped, so the pages handed out may hold
+    // fewer non-matching rows; the caller still evaluates the filter.
+    //
+    // A reader passes its view and gets the pages as of its snapshot;
+    // without one the walk sees the current state, which only the writer
+    // may ask for.
+    void forEachPage(uint32_t from, bool reverse,
+                     const std::function<bool(uint32_t, const SlottedPage &)> &visit,
+                     const Filter *filter = nullptr, const ReadView *view = nullptr) const
+    {
+        ScanSkipCounters &counters = ScanSkipCounters::instance();
+        if (lsm)
+        {
+            std::vector<char> buffer(PAGE_SIZE);
+            SlottedPage page(buffer.data());
+            page.init();
+            std::vector<std::vector<char>> pages;
+            uint32_t pageNo = 1;
+            bool stopped = false;
+            auto finishPage = [&]()
+            {
+                bool keepGoing = true;
+                if (reverse)
+                    pages.push_back(buffer);
+                else if (pageNo >= from)
+                    keepGoing = visit(pageNo, page);
+                ++pageNo;
+                page.init();
+                return keepGoing;
+            };
+            lsm->scan([&](std::string_view, std::string_view record)
+                      {
+                          if (!page.canFit(record.size()) && !finishPage())
+                          {
+                              stopped = true;
+                              return false;
+                          }
+                          page.insert(record);
+                          return true; },
+                      filter, view ? view->lsmSequence : UINT64_MAX, view ? view->lsmVersion : nullptr);
+            if (!stopped && page.slotCount() > 0)
+                finishPage();
+
+            for (size_t i = std::min<size_t>(pages.size(), from); i-- > 0;)
+            {
+                if (!visit(static_cast<uint32_t>(i + 1), SlottedPage(pages[i].data())))
+                    return;
+            }
+            return;
+        }
+
+        uint32_t end = view ? view->pageCount : pageCount;
+        if (fileId == 0 || end <= 1)
+            return;
+
+        uint32_t pageNo = std::clamp<uint32_t>(from, 1, end - 1);
+        size_t checkedZone = SIZE_MAX;
+        std::vector<char> copy;
+        while (pageNo >= 1 && pageNo < end)
+        {
+            size_t zone = (pageNo - 1) / ZONE_PAGES;
+            if (filter && zone != checkedZone)
+            {
+                checkedZone = zone;
+                std::shared_lock<std::shared_mutex> lock(zoneMutex);
+                if (zone < zones.size())
+                {
+                    if (!zoneMayMatch(*filter, zones[zone]))
+                    {
+                        counters.blockSkipped();
+                        pageNo = reverse ? static_cast<uint32_t>(zone * ZONE_PAGES)
+                                         : static_cast<uint32_t>((zone + 1) * ZONE_PAGES + 1);
+                        continue;
+                    }
+                    counters.blockRead();
+                }
+            }
+
+            PageGuard page(fileId, pageNo);
+            SlottedPage slotted(view ? pageAsOf(*view, pageNo, page.get(), copy) : page.get());
+            if (!visit(pageNo, slotted))
+                return;
+            pageNo = reverse ? pageNo - 1 : pageNo + 1;
+        }
+    }
+
+    // A forward scan driven by the caller, reading from a snapshot taken now
+    std::unique_ptr<TableCursor> openCursor() const
+    {
+        auto cursor = std::make_unique<TableCursor>();
+        cursor->view = snapshot();
+        if (lsm)
+            cursor->merge = lsm->openCursor(nullptr, cursor->view.lsmSequence, cursor->view.lsmVersion);
+        return cursor;
+    }
+
+    // Hand visit the records after cursor's position until at least rows
+    // have gone out (heap pages are taken whole) or the table ends. False
+    // once there was nothing left to read.
+    bool readRecords(TableCursor &cursor, size_t rows, const std::function<void(std::string_view)> &visit) const
+    {
+        size_t taken = 0;
+        if (lsm)
+        {
+            for (; taken < rows && cursor.merge->valid(); ++taken, cursor.merge->next())
+                visit(cursor.merge->value());
+            Metrics::instance().rowsRead(taken);
+            return taken > 0;
+        }
+
+        std::vector<char> copy;
+        for (; taken < rows && fileId != 0 && cursor.nextPage < cursor.view.pageCount; ++cursor.nextPage)
+        {
+            PageGuard page(fileId, cursor.nextPage);
+            SlottedPage slotted(pageAsOf(cursor.view, cursor.nextPage, page.get(), copy));
+            for (uint16_t slot = 0; slot < slotted.slotCount(); ++slot)
+            {
+                if (!slotted.isDeleted(slot))
+                {
+                    visit(slotted.get(slot));
+                    ++taken;
+                }
+            }
+        }
+        Metrics::instance().rowsRead(taken);
+        return taken > 0;
+    }
+
+    void forEachRowWithId(const RowVisitor &visit) const
+    {
+        forEachPage(1, false, [this, &visit](uint32_t pageNo, const SlottedPage &page)
+                    {
+                        for (uint16_t slot = 0; slot < page.slotCount(); ++slot)
+                        {
+                            if (!page.isDeleted(slot) && !visit(RowId{pageNo, slot}, format.decode(page.get(slot))))
+                                return false;
+                        }
+                        return true; });
+    }
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,255 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Process-wide work-stealing pool. Every worker owns a task deque: it pops
+// its own work from the back and, when that runs dry, steals from the front
+// of the others'. Tasks submitted from outside the pool are dealt round-robin.
+// Threads waiting on a TaskGroup run queued tasks before they block, so
+// groups may be waited on from inside a task.
+//
+// The worker count is the number of cores, or NOSQLITE_THREADS.
+class ThreadPool
+{
+private:
+    using Task = std::function<void()>;
+
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> threads;
+    std::atomic<size_t> queued{0};
+    std::atomic<size_t> nextQueue{0};
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    bool stopping = false;
+
+    static size_t &currentWorker()
+    {
+        static thread_local size_t index = SIZE_MAX;
+        return index;
+    }
+
+    bool popLocal(size_t home, Task &task)
+    {
+        Queue &queue = *queues[home];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty())
+            return false;
+        task = std::move(queue.tasks.back());
+        queue.tasks.pop_back();
+        return true;
+    }
+
+    bool steal(size_t thief, Task &task)
+    {
+        for (size_t i = 1; i <= queues.size(); ++i)
+        {
+            Queue &queue = *queues[(thief + i) % queues.size()];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (!queue.tasks.empty())
+            {
+                task = std::move(queue.tasks.front());
+                queue.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void workerLoop(size_t index)
+    {
+        currentWorker() = index;
+        while (true)
+        {
+            if (runOne())
+                continue;
+
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            wake.wait(lock, [this]()
+                      { return stopping || queued.load() > 0; });
+            if (stopping && queued.load() == 0)
+                return;
+        }
+    }
+
+    ThreadPool()
+    {
+        const char *env = std::getenv("NOSQLITE_THREADS");
+        size_t count = env ? std::strtoull(env, nullptr, 10) : std::thread::hardware_concurrency();
+        count = std::max<size_t>(count, 1);
+        for (size_t i = 0; i < count; ++i)
+            queues.push_back(std::make_unique<Queue>());
+        for (size_t i = 0; i < count; ++i)
+            threads.emplace_back(&ThreadPool::workerLoop, this, i);
+    }
+
+public:
+    static ThreadPool &instance()
+    {
+        static ThreadPool pool;
+        return pool;
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto &thread : threads)
+            thread.join();
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    size_t size() const { return threads.size(); }
+
+    void submit(Task task)
+    {
+        size_t home = currentWorker();
+        if (home == SIZE_MAX)
+            home = nextQueue.fetch_add(1) % queues.size();
+        {
+            std::lock_guard<std::mutex> lock(queues[home]->mutex);
+            queues[home]->tasks.push_back(std::move(task));
+        }
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            queued.fetch_add(1);
+        }
+        wake.notify_one();
+    }
+
+    // Run one queued task on the calling thread; false if none was found
+    bool runOne()
+    {
+        size_t home = currentWorker();
+        Task task;
+        bool found = home != SIZE_MAX ? popLocal(home, task) || steal(home, task) : steal(0, task);
+        if (!found)
+            return false;
+        queued.fetch_sub(1);
+        task();
+        return true;
+    }
+};
+
+// Tasks that are waited for together. The first exception a task throws
+// is kept and rethrown by wait(); the other tasks still run to the end.
+class TaskGroup
+{
+private:
+    ThreadPool &pool;
+    std::mutex mutex;
+    std::condition_variable finished;
+    size_t outstanding = 0;
+    std::exception_ptr failure;
+
+    void runTask(const std::function<void()> &task)
+    {
+        try
+        {
+            task();
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!failure)
+                failure = std::current_exception();
+        }
+    }
+
+    // Help with queued work until every task has finished. With nothing
+    // to run, sleep until the last task ends, looking for new work each
+    // millisecond so tasks queued meanwhile are not left waiting.
+    void drain()
+    {
+        while (true)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (outstanding == 0)
+                    return;
+            }
+            if (pool.runOne())
+                continue;
+            std::unique_lock<std::mutex> lock(mutex);
+            finished.wait_for(lock, std::chrono::milliseconds(1), [this]()
+                              { return outstanding == 0; });
+        }
+    }
+
+public:
+    explicit TaskGroup(ThreadPool &threadPool = ThreadPool::instance()) : pool(threadPool) {}
+
+    ~TaskGroup() { drain(); }
+
+    TaskGroup(const TaskGroup &) = delete;
+    TaskGroup &operator=(const TaskGroup &) = delete;
+
+    void spawn(std::function<void()> task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ++outstanding;
+        }
+        pool.submit([this, task = std::move(task)]()
+                    {
+                        runTask(task);
+                        std::lock_guard<std::mutex> lock(mutex);
+                        if (--outstanding == 0)
+                            finished.notify_all(); });
+    }
+
+    // Run a task of the group on the calling thread
+    void run(const std::function<void()> &task) { runTask(task); }
+
+    // Wait for every task, then rethrow the first exception one threw
+    void wait()
+    {
+        drain();
+        std::exception_ptr first;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            first.swap(failure);
+        }
+        if (first)
+            std::rethrow_exception(first);
+    }
+};
+
+// Run body(slot) for slot 0..degree-1 on the pool, the calling thread
+// taking slot 0, and return once all have finished. Bodies usually pull
+// morsels from a shared counter until it runs out. Rethrows the first
+// exception a body threw.
+inline void runParallel(size_t degree, const std::function<void(size_t)> &body)
+{
+    TaskGroup group;
+    for (size_t slot = 1; slot < degree; ++slot)
+        group.spawn([&body, slot]()
+                    { body(slot); });
+    group.run([&body]()
+              { body(0); });
+    group.wait();
+}
+
+#endif // THREADPOOL_H
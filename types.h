@@ -0,0 +1,567 @@
+#ifndef TYPES_H
+#define TYPES_H
+
+#include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "page.h"
+
+// Column types. Every value is stored in a byte form whose unsigned byte
+// order matches the type's natural order ("memcomparable"), so records,
+// index keys and filter constants all compare with a plain memcmp:
+//
+//   int32            4 bytes big-endian, sign bit flipped
+//   int64            8 bytes big-endian, sign bit flipped
+//   timestamp        int64 microseconds since 1970-01-01 UTC
+//   double           8 bytes big-endian; sign bit flipped for positive
+//                    values, all bits flipped for negative ones
+//   bool             1 byte, 0 or 1
+//   varchar(n)       the raw bytes, at most n of them (no limit if n is 0)
+
+enum class ColumnKind : uint8_t
+{
+    Varchar = 0,
+    Int32 = 1,
+    Int64 = 2,
+    Double = 3,
+    Bool = 4,
+    Timestamp = 5
+};
+
+struct ColumnType
+{
+    ColumnKind kind = ColumnKind::Varchar;
+    uint16_t length = 0; // varchar limit, 0 for none
+
+    bool isFixed() const { return kind != ColumnKind::Varchar; }
+
+    // Bytes the column takes in a record's fixed area; a varchar stores
+    // the offset and length of its bytes there
+    uint16_t width() const
+    {
+        switch (kind)
+        {
+        case ColumnKind::Int32:
+            return 4;
+        case ColumnKind::Int64:
+        case ColumnKind::Double:
+        case ColumnKind::Timestamp:
+            return 8;
+        case ColumnKind::Bool:
+            return 1;
+        default:
+            return 2 * sizeof(uint16_t);
+        }
+    }
+
+    std::string name() const
+    {
+        switch (kind)
+        {
+        case ColumnKind::Int32:
+            return "int32";
+        case ColumnKind::Int64:
+            return "int64";
+        case ColumnKind::Double:
+            return "double";
+        case ColumnKind::Bool:
+            return "bool";
+        case ColumnKind::Timestamp:
+            return "timestamp";
+        default:
+            return length ? "varchar(" + std::to_string(length) + ")" : "varchar";
+        }
+    }
+};
+
+// Parse a type name as written in create table. Matching is
+// case-insensitive; int/integer and bigint are accepted as aliases.
+inline bool parseColumnType(const std::string &text, ColumnType &type)
+{
+    std::string lower;
+    for (char c : text)
+    {
+        if (!std::isspace(static_cast<unsigned char>(c)))
+            lower += static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    }
+
+    type = ColumnType{};
+    if (lower == "int32" || lower == "int" || lower == "integer")
+        type.kind = ColumnKind::Int32;
+    else if (lower == "int64" || lower == "bigint")
+        type.kind = ColumnKind::Int64;
+    else if (lower == "double")
+        type.kind = ColumnKind::Double;
+    else if (lower == "bool" || lower == "boolean")
+        type.kind = ColumnKind::Bool;
+    else if (lower == "timestamp")
+        type.kind = ColumnKind::Timestamp;
+    else if (lower == "varchar" || lower == "text")
+        type.kind = ColumnKind::Varchar;
+    else if (lower.compare(0, 8, "varchar(") == 0 && lower.back() == ')')
+    {
+        std::string digits = lower.substr(8, lower.size() - 9);
+        unsigned long length = 0;
+        auto [end, ec] = std::from_chars(digits.data(), digits.data() + digits.size(), length);
+        if (ec != std::errc() || end != digits.data() + digits.size() || length == 0 || length > MAX_RECORD_SIZE)
+            return false;
+        type.length = static_cast<uint16_t>(length);
+    }
+    else
+        return false;
+    return true;
+}
+
+namespace ValueCodec
+{
+    constexpr uint64_t SIGN64 = 0x8000000000000000ull;
+
+    inline void putBigEndian(std::string &out, uint64_t value, int bytes)
+    {
+        for (int i = bytes - 1; i >= 0; --i)
+            out += static_cast<char>((value >> (8 * i)) & 0xff);
+    }
+
+    inline uint64_t getBigEndian(std::string_view in)
+    {
+        uint64_t value = 0;
+        for (char c : in)
+            value = (value << 8) | static_cast<unsigned char>(c);
+        return value;
+    }
+
+    template <typename T>
+    inline bool parseInteger(const std::string &text, T &value)
+    {
+        const char *begin = text.data();
+        if (!text.empty() && text[0] == '+')
+            ++begin;
+        auto [end, ec] = std::from_chars(begin, text.data() + text.size(), value);
+        return ec == std::errc() && end == text.data() + text.size() && begin != end;
+    }
+
+    // Days since 1970-01-01 for a proleptic Gregorian date (H. Hinnant's
+    // days_from_civil) and back
+    inline int64_t daysFromCivil(int64_t y, unsigned m, unsigned d)
+    {
+        y -= m <= 2;
+        int64_t era = (y >= 0 ? y : y - 399) / 400;
+        unsigned yoe = static_cast<unsigned>(y - era * 400);
+        unsigned doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+        unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+        return era * 146097 + static_cast<int64_t>(doe) - 719468;
+    }
+
+    inline void civilFromDays(int64_t z, int64_t &y, unsigned &m, unsigned &d)
+    {
+        z += 719468;
+        int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+        unsigned doe = static_cast<unsigned>(z - era * 146097);
+        unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+        unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+        unsigned mp = (5 * doy + 2) / 153;
+        d = doy - (153 * mp + 2) / 5 + 1;
+        m = mp < 10 ? mp + 3 : mp - 9;
+        y = static_cast<int64_t>(yoe) + era * 400 + (m <= 2);
+    }
+
+    // YYYY-MM-DD[( |T)HH:MM[:SS[.ffffff]]][Z] to microseconds since the epoch
+    inline bool parseTimestamp(const std::string &text, int64_t &micros)
+    {
+        int year = 0;
+        unsigned month = 0, day = 0, hour = 0, minute = 0, second = 0, fraction = 0, digits = 0;
+        size_t pos = 0;
+        auto number = [&text, &pos](unsigned width, unsigned &out)
+        {
+            out = 0;
+            for (unsigned i = 0; i < width; ++i, ++pos)
+            {
+                if (pos >= text.size() || !std::isdigit(static_cast<unsigned char>(text[pos])))
+                    return false;
+                out = out * 10 + (text[pos] - '0');
+            }
+            return true;
+        };
+        auto expect = [&text, &pos](char c)
+        { return pos < text.size() && text[pos++] == c; };
+
+        unsigned y;
+        if (!number(4, y) || !expect('-') || !number(2, month) || !expect('-') || !number(2, day))
+            return false;
+        year = static_cast<int>(y);
+        if (pos < text.size() && (text[pos] == ' ' || text[pos] == 'T'))
+        {
+            ++pos;
+            if (!number(2, hour) || !expect(':') || !number(2, minute))
+                return false;
+            if (pos < text.size() && text[pos] == ':')
+            {
+                ++pos;
+                if (!number(2, second))
+                    return false;
+                if (pos < text.size() && text[pos] == '.')
+                {
+                    ++pos;
+                    while (pos < text.size() && std::isdigit(static_cast<unsigned char>(text[pos])))
+                    {
+                        if (digits++ < 6)
+                            fraction = fraction * 10 + (text[pos] - '0');
+                        ++pos;
+                    }
+                    if (digits == 0)
+                        return false;
+                    for (unsigned i = digits; i < 6; ++i)
+                        fraction *= 10;
+                }
+            }
+        }
+        if (pos < text.size() && text[pos] == 'Z')
+            ++pos;
+        if (pos != text.size())
+            return false;
+
+        static const unsigned monthDays[] = {31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+        bool leap = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+        if (month < 1 || month > 12 || day < 1 || day > monthDays[month - 1] ||
+            (month == 2 && day == 29 && !leap) || hour > 23 || minute > 59 || second > 59)
+            return false;
+
+        int64_t seconds = daysFromCivil(year, month, day) * 86400 + hour * 3600 + minute * 60 + second;
+        micros = seconds * 1000000 + fraction;
+        return true;
+    }
+
+    inline std::string formatTimestamp(int64_t micros)
+    {
+        int64_t seconds = micros >= 0 ? micros / 1000000 : (micros - 999999) / 1000000;
+        int64_t fraction = micros - seconds * 1000000;
+        int64_t days = seconds >= 0 ? seconds / 86400 : (seconds - 86399) / 86400;
+        int64_t secondOfDay = seconds - days * 86400;
+
+        int64_t year;
+        unsigned month, day;
+        civilFromDays(days, year, month, day);
+        char text[48];
+        int length = std::snprintf(text, sizeof(text), "%04lld-%02u-%02u %02lld:%02lld:%02lld",
+                                   static_cast<long long>(year), month, day,
+                                   static_cast<long long>(secondOfDay / 3600),
+                                   static_cast<long long>(secondOfDay / 60 % 60),
+                                   static_cast<long long>(secondOfDay % 60));
+        std::string result(text, length);
+        if (fraction != 0)
+        {
+            std::snprintf(text, sizeof(text), ".%06lld", static_cast<long long>(fraction));
+            std::string digits(text);
+            while (digits.back() == '0')
+                digits.pop_back();
+            result += digits;
+        }
+        return result;
+    }
+
+    // An integer, bool (0 or 1) or timestamp (microseconds) to stored
+    // bytes. False if it is out of the column's range.
+    inline bool encodeInteger(const ColumnType &type, int64_t value, std::string &out)
+    {
+        out.clear();
+        switch (type.kind)
+        {
+        case ColumnKind::Int32:
+            if (value < INT32_MIN || value > INT32_MAX)
+                return false;
+            putBigEndian(out, static_cast<uint32_t>(static_cast<int32_t>(value)) ^ 0x80000000u, 4);
+            return true;
+        case ColumnKind::Bool:
+            if (value != 0 && value != 1)
+                return false;
+            out += static_cast<char>(value);
+            return true;
+        default:
+            putBigEndian(out, static_cast<uint64_t>(value) ^ SIGN64, 8);
+            return true;
+        }
+    }
+
+    // Stored bytes of a double; false for infinities and NaN
+    inline bool encodeDouble(double value, std::string &out)
+    {
+        out.clear();
+        if (!std::isfinite(value))
+            return false;
+        if (value == 0)
+            value = 0; // one encoding for -0 and 0
+        uint64_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        bits = (bits & SIGN64) ? ~bits : bits ^ SIGN64;
+        putBigEndian(out, bits, 8);
+        return true;
+    }
+
+    // Text to stored bytes. Returns false if the text is not a valid value
+    // of the type.
+    inline bool encode(const ColumnType &type, const std::string &text, std::string &out)
+    {
+        out.clear();
+        switch (type.kind)
+        {
+        case ColumnKind::Int32:
+        {
+            int32_t value;
+            return parseInteger(text, value) && encodeInteger(type, value, out);
+        }
+        case ColumnKind::Int64:
+        {
+            int64_t value;
+            return parseInteger(text, value) && encodeInteger(type, value, out);
+        }
+        case ColumnKind::Timestamp:
+        {
+            int64_t value;
+            return parseTimestamp(text, value) && encodeInteger(type, value, out);
+        }
+        case ColumnKind::Double:
+        {
+            if (text.empty())
+                return false;
+            errno = 0;
+            char *end = nullptr;
+            double value = std::strtod(text.c_str(), &end);
+            if (end != text.c_str() + text.size() || errno == ERANGE)
+                return false;
+            return encodeDouble(value, out);
+        }
+        case ColumnKind::Bool:
+        {
+            std::string lower;
+            for (char c : text)
+                lower += static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+            if (lower == "true" || lower == "1")
+                return encodeInteger(type, 1, out);
+            if (lower == "false" || lower == "0")
+                return encodeInteger(type, 0, out);
+            return false;
+        }
+        default:
+            if (type.length != 0 && text.size() > type.length)
+                return false;
+            out = text;
+            return true;
+        }
+    }
+
+    // Stored integer, bool or timestamp bytes back to their value
+    inline int64_t decodeInteger(const ColumnType &type, std::string_view bytes)
+    {
+        switch (type.kind)
+        {
+        case ColumnKind::Int32:
+            return static_cast<int32_t>(static_cast<uint32_t>(getBigEndian(bytes)) ^ 0x80000000u);
+        case ColumnKind::Bool:
+            return !bytes.empty() && bytes[0];
+        default:
+            return static_cast<int64_t>(getBigEndian(bytes) ^ SIGN64);
+        }
+    }
+
+    inline double decodeDouble(std::string_view bytes)
+    {
+        uint64_t bits = getBigEndian(bytes);
+        bits = (bits & SIGN64) ? bits ^ SIGN64 : ~bits;
+        double value;
+        std::memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    // Shortest text that reads back as the same double
+    inline std::string formatDouble(double value)
+    {
+        char text[32];
+        auto result = std::to_chars(text, text + sizeof(text), value);
+        return std::string(text, result.ptr);
+    }
+
+    // Stored bytes back to text
+    inline std::string decode(const ColumnType &type, std::string_view bytes)
+    {
+        switch (type.kind)
+        {
+        case ColumnKind::Int32:
+        case ColumnKind::Int64:
+            return std::to_string(decodeInteger(type, bytes));
+        case ColumnKind::Timestamp:
+            return formatTimestamp(decodeInteger(type, bytes));
+        case ColumnKind::Double:
+            return formatDouble(decodeDouble(bytes));
+        case ColumnKind::Bool:
+            return !bytes.empty() && bytes[0] ? "true" : "false";
+        default:
+            return std::string(bytes);
+        }
+    }
+}
+
+// Record layout for a table's column types:
+//
+//   u16 length + unique_id bytes
+//   fixed area: each column in schema order at its type's width; a varchar
+//               holds u16 offset (from the record start) and u16 length
+//   heap:       varchar bytes
+//
+// so any column is found at a constant offset without walking the record.
+// Tables written before typed columns keep RowCodec's length-prefixed text
+// layout (every column a varchar); a legacy format reads and writes that.
+class RowFormat
+{
+private:
+    std::vector<std::string> names;
+    std::vector<ColumnType> types;
+    std::vector<uint16_t> offsets; // column offset within the fixed area
+    uint16_t fixedSize = 0;
+    bool legacy = false;
+
+public:
+    RowFormat() = default;
+
+    RowFormat(const std::vector<std::string> &columnNames, const std::vector<ColumnType> &columnTypes, bool legacyText)
+        : names(columnNames), types(columnTypes), legacy(legacyText)
+    {
+        types.resize(names.size());
+        for (const auto &type : types)
+        {
+            offsets.push_back(fixedSize);
+            fixedSize += type.width();
+        }
+    }
+
+    bool isLegacy() const { return legacy; }
+    uint16_t getFixedSize() const { return fixedSize; }
+    uint16_t offsetOf(size_t column) const { return offsets[column]; }
+    const std::vector<ColumnType> &getTypes() const { return types; }
+
+    // Type of a row position (unique_id is 0)
+    ColumnType typeAt(size_t position) const { return position == 0 ? ColumnType{} : types[position - 1]; }
+
+    // Encode one row; on an invalid value returns false and says why
+    bool encode(const std::string &uniqueId, const std::vector<std::string> &fields, std::string &record,
+                std::string *error = nullptr) const
+    {
+        std::string value;
+        return assemble(uniqueId, [&](size_t i, std::string_view &stored)
+                        {
+                            if (!ValueCodec::encode(types[i], fields[i], value))
+                            {
+                                if (error)
+                                    *error = "Invalid " + types[i].name() + " value '" + fields[i] +
+                                             "' for column '" + names[i] + "'";
+                                return false;
+                            }
+                            stored = legacy ? std::string_view(fields[i]) : std::string_view(value);
+                            return true; },
+                        record, error);
+    }
+
+    // Lay out one row from its values in stored form: storedValue(i, bytes)
+    // points bytes at column i, or returns false to give up. A legacy
+    // format stores text, so its values must be the text itself.
+    template <typename StoredValue>
+    bool assemble(const std::string &uniqueId, StoredValue storedValue, std::string &record,
+                  std::string *error = nullptr) const
+    {
+        std::string_view value;
+        if (legacy)
+        {
+            std::vector<std::string> fields;
+            for (size_t i = 0; i < types.size(); ++i)
+            {
+                if (!storedValue(i, value))
+                    return false;
+                fields.emplace_back(value);
+            }
+            record = RowCodec::encode(uniqueId, fields);
+            return true;
+        }
+
+        size_t fixedStart = sizeof(uint16_t) + uniqueId.size();
+        record.assign(fixedStart + fixedSize, '\0');
+        putValue(record.data(), static_cast<uint16_t>(uniqueId.size()));
+        std::memcpy(record.data() + sizeof(uint16_t), uniqueId.data(), uniqueId.size());
+
+        for (size_t i = 0; i < types.size(); ++i)
+        {
+            if (!storedValue(i, value))
+                return false;
+
+            char *slot = record.data() + fixedStart + offsets[i];
+            if (types[i].isFixed())
+            {
+                std::memcpy(slot, value.data(), value.size());
+                continue;
+            }
+            if (record.size() + value.size() > MAX_RECORD_SIZE)
+            {
+                if (error)
+                    *error = "Row too large";
+                return false;
+            }
+            putValue(slot, static_cast<uint16_t>(record.size()));
+            putValue(slot + sizeof(uint16_t), static_cast<uint16_t>(value.size()));
+            record += value;
+        }
+        return true;
+    }
+
+    // Stored bytes of one row position (unique_id is 0)
+    std::string_view field(std::string_view record, size_t position) const
+    {
+        std::string_view id = RowCodec::decodeId(record);
+        if (position == 0)
+            return id;
+
+        if (legacy)
+        {
+            const char *in = id.data() + id.size();
+            const char *end = record.data() + record.size();
+            for (size_t i = 1; in + sizeof(uint16_t) <= end; ++i)
+            {
+                uint16_t length = getValue<uint16_t>(in);
+                in += sizeof(uint16_t);
+                if (i == position)
+                    return std::string_view(in, length);
+                in += length;
+            }
+            return {};
+        }
+
+        const ColumnType &type = types[position - 1];
+        const char *slot = id.data() + id.size() + offsets[position - 1];
+        if (type.isFixed())
+            return std::string_view(slot, type.width());
+        uint16_t offset = getValue<uint16_t>(slot);
+        uint16_t length = getValue<uint16_t>(slot + sizeof(uint16_t));
+        return record.substr(offset, length);
+    }
+
+    // Every field as text, unique_id first
+    std::vector<std::string> decode(std::string_view record) const
+    {
+        if (legacy)
+            return RowCodec::decode(record);
+
+        std::vector<std::string> fields;
+        fields.reserve(types.size() + 1);
+        fields.emplace_back(RowCodec::decodeId(record));
+        for (size_t i = 0; i < types.size(); ++i)
+            fields.push_back(ValueCodec::decode(types[i], field(record, i + 1)));
+        return fields;
+    }
+};
+
+#endif // TYPES_H
@@ -3,6 +3,8 @@
 
 #include <string>
 #include <memory>
+#include <algorithm>
+#include <vector>
 #include <unordered_map>
 #include <filesystem>
 #include "db.h"
@@ -17,7 +19,6 @@ private:
     // Static method to initialize system with admin user
     static void initializeAdminIfNeeded()
     {
-        std::cout << "Initializing admin user and default database..." << std::endl;
         // Create account directory if it doesn't exist
         if (!std::filesystem::exists("account"))
         {
@@ -70,8 +71,6 @@ public:
         if (!verifyCredentials(inputName, inputPassword))
             return false;
 
-        std::cout << "User logged in: " << inputName << std::endl;
-
         name = inputName;
         password = inputPassword;
         loadDatabases();
@@ -120,15 +119,24 @@ public:
         return databases.find(dbName) != databases.end();
     }
 
+    // Databases are opened (and recovered) on first use
     std::shared_ptr<Database> getDatabase(const std::string &dbName)
     {
         auto it = databases.find(dbName);
-        return (it != databases.end()) ? it->second : nullptr;
+        if (it == databases.end())
+            return nullptr;
+        if (!it->second)
+            it->second = Database::open(dbName, name);
+        return it->second;
     }
 
-    std::unordered_map<std::string, std::shared_ptr<Database>> getDatabases() const
+    std::vector<std::string> getDatabaseNames() const
     {
-        return databases;
+        std::vector<std::string> names;
+        for (const auto &[dbName, db] : databases)
+            names.push_back(dbName);
+        std::sort(names.begin(), names.end());
+        return names;
     }
 
     bool createDatabase(const std::string &dbName)
@@ -136,8 +144,7 @@ public:
         if (hasDatabaseAccess(dbName))
             return false;
 
-        auto db = std::make_shared<Database>(dbName, name);
-        databases[dbName] = db;
+        databases[dbName] = Database::open(dbName, name);
 
         // Update user's database list in file
         return updateUserDatabases();
@@ -163,8 +170,6 @@ private:
         if (!userFile.is_open())
             return false;
 
-        std::cout << "Verifying credentials for user: " << inputName << std::endl;
-
         std::string storedPassword;
         std::getline(userFile, storedPassword);
         return storedPassword == inputPassword;
@@ -172,23 +177,18 @@ private:
 
     void loadDatabases()
     {
-        std::cout << "Loading user databases for: " << name << std::endl;
-
         std::string userFilePath = "account/" + name + "/" + name + ".csv";
         std::ifstream userFile(userFilePath);
         if (!userFile.is_open())
         {
-            std::cout << "Failed to open user file: " << userFilePath << std::endl;
+            std::cerr << "Failed to open user file: " << userFilePath << std::endl;
             return;
         }
 
         std::string password, dbLine;
 
         std::getline(userFile, password); // Skip password line
-        std::cout << "Read password line: " << password << std::endl;
-
         std::getline(userFile, dbLine);
-        std::cout << "Read database line: " << dbLine << std::endl;
 
         std::stringstream ss(dbLine);
         std::string dbName;
@@ -200,22 +200,20 @@ private:
 
             if (!dbName.empty())
             {
-                std::cout << "Adding database: " << dbName << std::endl;
-                databases[dbName] = std::make_shared<Database>(dbName, name);
+                databases[dbName] = nullptr;
             }
         }
 
         // If admin user and no databases, create default database
         if (name == "admin" && databases.empty())
         {
-            std::cout << "Creating default database for admin" << std::endl;
             try
             {
                 createDatabase("default");
             }
             catch (const std::exception &e)
             {
-                std::cout << "Error creating default database: " << e.what() << std::endl;
+                std::cerr << "Error creating default database: " << e.what() << std::endl;
             }
         }
     }
@@ -0,0 +1,514 @@
+#ifndef WAL_H
+#define WAL_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include "page.h"
+#include "metrics.h"
+
+// How long a commit waits before it is acknowledged:
+//   None   - records sit in memory and reach the OS in large batches
+//   Group  - commits wait until N rows are pending or T us have passed,
+//            then one fdatasync makes the whole batch durable
+//   Fsync  - every commit is synced before it returns
+enum class Durability
+{
+    None,
+    Group,
+    Fsync
+};
+
+struct DurabilityConfig
+{
+    Durability mode = Durability::Fsync;
+    uint32_t groupRows = 64;
+    uint32_t groupMicros = 1000;
+
+    std::string describe() const
+    {
+        switch (mode)
+        {
+        case Durability::None:
+            return "none";
+        case Durability::Group:
+            return "group(" + std::to_string(groupRows) + " rows / " + std::to_string(groupMicros) + " us)";
+        default:
+            return "fsync";
+        }
+    }
+};
+
+enum class WalRecordType : uint8_t
+{
+    Checkpoint = 1,
+    Insert = 2,
+    Delete = 3,
+    DeleteKey = 4 // delete by unique_id, for tables without row locations
+};
+
+// Position of a table's append point at checkpoint time. Recovery rolls the
+// table back to this state and replays every logged insert after it, so
+// pages that were written back before a crash never produce duplicates.
+struct TableCheckpoint
+{
+    std::string table;
+    uint32_t pageCount;
+    uint64_t rowCount;
+    uint16_t lastSlotCount;
+    uint16_t lastFreeStart;
+    uint16_t lastFreeEnd;
+};
+
+// Callbacks invoked while replaying the log, in log order
+struct WalReplayHandler
+{
+    std::function<void(const std::vector<TableCheckpoint> &)> onCheckpoint;
+    std::function<void(const std::string &, std::string_view)> onInsert;
+    std::function<void(const std::string &, RowId)> onDelete;
+    std::function<void(const std::string &, const std::string &)> onDeleteKey;
+};
+
+inline uint32_t crc32(const char *data, size_t length)
+{
+    static const auto table = []
+    {
+        std::vector<uint32_t> t(256);
+        for (uint32_t i = 0; i < 256; ++i)
+        {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k)
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            t[i] = c;
+        }
+        return t;
+    }();
+
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < length; ++i)
+        crc = table[(crc ^ static_cast<uint8_t>(data[i])) & 0xFF] ^ (crc >> 8);
+    return crc ^ 0xFFFFFFFFu;
+}
+
+// Per-database redo log (<db>/wal.log). Each record is
+//   u32 payload length | u32 crc32(payload) | payload
+// where the payload starts with the u64 LSN and the record type. The log
+// always begins with a checkpoint record; everything after it is replayed
+// on startup.
+class WriteAheadLog
+{
+private:
+    std::string path;
+    int fd = -1;
+    DurabilityConfig config;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::string buffer;          // encoded records not yet written
+    uint64_t nextLsn = 0;        // last LSN handed out
+    uint64_t durableLsn = 0;     // everything up to here is on disk
+    uint32_t pendingRows = 0;    // rows committed since the last sync
+    bool flushing = false;       // a leader is writing the buffer
+    uint64_t failedLsn = 0;      // records up to here may never reach disk
+    uint64_t logBytes = 0;
+
+    static constexpr size_t NONE_MODE_BUFFER = 1 << 20;
+
+    static void appendBytes(std::string &out, const void *data, size_t length)
+    {
+        out.append(static_cast<const char *>(data), length);
+    }
+
+    template <typename T>
+    static void appendValue(std::string &out, T value) { appendBytes(out, &value, sizeof(T)); }
+
+    static void appendString(std::string &out, std::string_view value)
+    {
+        appendValue(out, static_cast<uint16_t>(value.size()));
+        out.append(value);
+    }
+
+    void encodeRecord(std::string &out, uint64_t lsn, WalRecordType type, std::string_view body)
+    {
+        std::string payload;
+        payload.reserve(sizeof(uint64_t) + 1 + body.size());
+        appendValue(payload, lsn);
+        appendValue(payload, static_cast<uint8_t>(type));
+        payload.append(body);
+
+        appendValue(out, static_cast<uint32_t>(payload.size()));
+        appendValue(out, crc32(payload.data(), payload.size()));
+        out.append(payload);
+    }
+
+    void writeAll(int target, const std::string &data)
+    {
+        size_t offset = 0;
+        while (offset < data.size())
+        {
+            ssize_t written = ::write(target, data.data() + offset, data.size() - offset);
+            if (written < 0)
+                throw std::runtime_error("Failed to write log: " + path);
+            offset += static_cast<size_t>(written);
+        }
+        Metrics::instance().bytesWritten(data.size());
+    }
+
+    // Write the buffered records and, unless durability is off, sync them.
+    // Called by exactly one leader at a time with the mutex held on entry
+    // and exit; the I/O itself runs unlocked so other commits can queue up.
+    // On failure the file is cut back to where the batch began, so no torn
+    // record hides the ones written after it, and every commit of a record
+    // in the batch fails. If even that fails, so does every later commit.
+    void flushAsLeader(std::unique_lock<std::mutex> &lock, bool sync)
+    {
+        flushing = true;
+        std::string batch;
+        batch.swap(buffer);
+        uint64_t target = nextLsn;
+        pendingRows = 0;
+
+        lock.unlock();
+        try
+        {
+            writeAll(fd, batch);
+            if (sync && ::fdatasync(fd) != 0)
+                throw std::runtime_error("Failed to sync log: " + path);
+        }
+        catch (...)
+        {
+            bool truncated = ::ftruncate(fd, static_cast<off_t>(logBytes)) == 0;
+            lock.lock();
+            failedLsn = truncated ? std::max(failedLsn, target) : UINT64_MAX;
+            flushing = false;
+            cv.notify_all();
+            throw;
+        }
+        lock.lock();
+
+        logBytes += batch.size();
+        durableLsn = std::max(durableLsn, target);
+        flushing = false;
+        cv.notify_all();
+    }
+
+public:
+    explicit WriteAheadLog(const std::string &logPath) : path(logPath)
+    {
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (fd < 0)
+            throw std::runtime_error("Failed to open log: " + path);
+        Metrics::instance().fileOpened();
+        logBytes = std::filesystem::file_size(path);
+    }
+
+    ~WriteAheadLog()
+    {
+        if (fd >= 0)
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (!buffer.empty())
+            {
+                try
+                {
+                    flushAsLeader(lock, true);
+                }
+                catch (...)
+                {
+                }
+            }
+            ::close(fd);
+        }
+    }
+
+    WriteAheadLog(const WriteAheadLog &) = delete;
+    WriteAheadLog &operator=(const WriteAheadLog &) = delete;
+
+    void setDurability(const DurabilityConfig &newConfig)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        config = newConfig;
+    }
+
+    DurabilityConfig getDurability()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return config;
+    }
+
+    uint64_t sizeBytes()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return logBytes + buffer.size();
+    }
+
+    // Buffer inserts of encoded rows; returns the LSN of the last one. The
+    // rows are not acknowledged until commit() returns.
+    uint64_t logInserts(const std::string &table, const std::vector<std::string> &records)
+    {
+        std::string body;
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const auto &record : records)
+        {
+            body.clear();
+            appendString(body, table);
+            body.append(record);
+            encodeRecord(buffer, ++nextLsn, WalRecordType::Insert, body);
+        }
+        return nextLsn;
+    }
+
+    // Buffer tombstones for deleted rows; returns the LSN of the last one
+    uint64_t logDeletes(const std::string &table, const std::vector<RowId> &rows)
+    {
+        std::string body;
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const auto &rid : rows)
+        {
+            body.clear();
+            appendString(body, table);
+            appendValue(body, rid.pageNo);
+            appendValue(body, rid.slot);
+            encodeRecord(buffer, ++nextLsn, WalRecordType::Delete, body);
+        }
+        return nextLsn;
+    }
+
+    // Buffer deletes by unique_id; returns the LSN of the last one
+    uint64_t logDeleteKeys(const std::string &table, const std::vector<std::string> &ids)
+    {
+        std::string body;
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const auto &id : ids)
+        {
+            body.clear();
+            appendString(body, table);
+            appendString(body, id);
+            encodeRecord(buffer, ++nextLsn, WalRecordType::DeleteKey, body);
+        }
+        return nextLsn;
+    }
+
+    // Make the records up to lsn as durable as the configured mode demands.
+    // Concurrent committers piggyback on whichever one is currently syncing.
+    // Throws if a failed write took the records with it.
+    void commit(uint64_t lsn, uint32_t rows = 1)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        auto checkLost = [this, lsn]()
+        {
+            if (lsn <= failedLsn)
+                throw std::runtime_error("Failed to write log: " + path);
+        };
+        checkLost();
+        pendingRows += rows;
+
+        if (config.mode == Durability::None)
+        {
+            if (buffer.size() >= NONE_MODE_BUFFER && !flushing)
+                flushAsLeader(lock, false);
+            return;
+        }
+
+        if (config.mode == Durability::Group && pendingRows >= config.groupRows)
+            cv.notify_all();
+
+        while (durableLsn < lsn)
+        {
+            checkLost();
+            if (flushing)
+            {
+                cv.wait(lock);
+                continue;
+            }
+
+            if (config.mode == Durability::Group)
+            {
+                // Give other sessions a chance to join this batch
+                auto deadline = std::chrono::steady_clock::now() +
+                                std::chrono::microseconds(config.groupMicros);
+                cv.wait_until(lock, deadline, [this, lsn]
+                              { return pendingRows >= config.groupRows || flushing || durableLsn >= lsn; });
+                if (flushing || durableLsn >= lsn)
+                    continue;
+            }
+            flushAsLeader(lock, true);
+        }
+        // A later batch may have moved durableLsn past a lost one
+        checkLost();
+    }
+
+    // Write and sync everything buffered so far, regardless of mode
+    void sync()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (flushing)
+            cv.wait(lock);
+        flushAsLeader(lock, true);
+    }
+
+    // Replace the log with a single checkpoint record. The caller must have
+    // made every table durable up to the given state first. The new log is
+    // written next to the old one and renamed over it, so a crash leaves
+    // either the old log or the new one.
+    void checkpoint(const std::vector<TableCheckpoint> &tables)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (flushing)
+            cv.wait(lock);
+
+        std::string body;
+        appendValue(body, static_cast<uint32_t>(tables.size()));
+        for (const auto &t : tables)
+        {
+            appendString(body, t.table);
+            appendValue(body, t.pageCount);
+            appendValue(body, t.rowCount);
+            appendValue(body, t.lastSlotCount);
+            appendValue(body, t.lastFreeStart);
+            appendValue(body, t.lastFreeEnd);
+        }
+
+        std::string record;
+        encodeRecord(record, ++nextLsn, WalRecordType::Checkpoint, body);
+
+        std::string tmpPath = path + ".tmp";
+        int tmp = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (tmp < 0)
+            throw std::runtime_error("Failed to open log: " + tmpPath);
+        // The old log stays in place unless the new one is on disk
+        try
+        {
+            writeAll(tmp, record);
+            if (::fdatasync(tmp) != 0)
+                throw std::runtime_error("Failed to sync log: " + tmpPath);
+        }
+        catch (...)
+        {
+            ::close(tmp);
+            std::filesystem::remove(tmpPath);
+            throw;
+        }
+        ::close(tmp);
+        std::filesystem::rename(tmpPath, path);
+
+        std::string dir = std::filesystem::path(path).parent_path().string();
+        int dirFd = ::open(dir.empty() ? "." : dir.c_str(), O_RDONLY | O_DIRECTORY);
+        bool dirSynced = dirFd >= 0 && ::fsync(dirFd) == 0;
+        if (dirFd >= 0)
+            ::close(dirFd);
+
+        ::close(fd);
+        fd = ::open(path.c_str(), O_WRONLY | O_APPEND);
+        if (fd < 0)
+            throw std::runtime_error("Failed to reopen log: " + path);
+
+        buffer.clear();
+        pendingRows = 0;
+        durableLsn = nextLsn;
+        logBytes = record.size();
+
+        // The tables are durable either way: a crash before the rename
+        // reaches disk replays the old log over them
+        if (!dirSynced)
+            throw std::runtime_error("Failed to sync log directory: " + (dir.empty() ? std::string(".") : dir));
+    }
+
+    // Walk the log from the start. Replay stops at the first torn or
+    // corrupt record, which can only be an unacknowledged tail.
+    void replay(const WalReplayHandler &handler)
+    {
+        std::string contents;
+        {
+            int in = ::open(path.c_str(), O_RDONLY);
+            if (in < 0)
+                return;
+            char chunk[1 << 16];
+            ssize_t bytes;
+            while ((bytes = ::read(in, chunk, sizeof(chunk))) > 0)
+                contents.append(chunk, static_cast<size_t>(bytes));
+            ::close(in);
+        }
+
+        const char *in = contents.data();
+        const char *end = in + contents.size();
+        const size_t frame = 2 * sizeof(uint32_t);
+        while (in + frame <= end)
+        {
+            uint32_t length = getValue<uint32_t>(in);
+            uint32_t crc = getValue<uint32_t>(in + sizeof(uint32_t));
+            const char *payload = in + frame;
+            if (length < sizeof(uint64_t) + 1 || payload + length > end || crc32(payload, length) != crc)
+                break;
+            in = payload + length;
+
+            uint64_t lsn = getValue<uint64_t>(payload);
+            nextLsn = std::max(nextLsn, lsn);
+            auto type = static_cast<WalRecordType>(payload[sizeof(uint64_t)]);
+            const char *body = payload + sizeof(uint64_t) + 1;
+            const char *bodyEnd = payload + length;
+
+            auto readString = [&body]()
+            {
+                uint16_t size = getValue<uint16_t>(body);
+                body += sizeof(uint16_t);
+                std::string value(body, size);
+                body += size;
+                return value;
+            };
+
+            if (type == WalRecordType::Checkpoint)
+            {
+                std::vector<TableCheckpoint> tables;
+                uint32_t count = getValue<uint32_t>(body);
+                body += sizeof(uint32_t);
+                for (uint32_t i = 0; i < count; ++i)
+                {
+                    TableCheckpoint t;
+                    t.table = readString();
+                    t.pageCount = getValue<uint32_t>(body);
+                    body += sizeof(uint32_t);
+                    t.rowCount = getValue<uint64_t>(body);
+                    body += sizeof(uint64_t);
+                    t.lastSlotCount = getValue<uint16_t>(body);
+                    body += sizeof(uint16_t);
+                    t.lastFreeStart = getValue<uint16_t>(body);
+                    body += sizeof(uint16_t);
+                    t.lastFreeEnd = getValue<uint16_t>(body);
+                    body += sizeof(uint16_t);
+                    tables.push_back(t);
+                }
+                handler.onCheckpoint(tables);
+            }
+            else if (type == WalRecordType::Insert)
+            {
+                std::string table = readString();
+                handler.onInsert(table, std::string_view(body, bodyEnd - body));
+            }
+            else if (type == WalRecordType::Delete)
+            {
+                std::string table = readString();
+                RowId rid{getValue<uint32_t>(body), getValue<uint16_t>(body + sizeof(uint32_t))};
+                handler.onDelete(table, rid);
+            }
+            else if (type == WalRecordType::DeleteKey)
+            {
+                std::string table = readString();
+                handler.onDeleteKey(table, readString());
+            }
+        }
+        durableLsn = nextLsn;
+    }
+};
+
+#endif // WAL_H
@@ -0,0 +1,291 @@
+#ifndef ZONEMAP_H
+#define ZONEMAP_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "page.h"
+#include "types.h"
+#include "filter.h"
+
+// Min/max summary of every column (unique_id first) over a block of rows,
+// in stored form, so a scan can tell from the summary alone that no row of
+// the block can pass a filter. Deleting rows leaves the summary as it is;
+// it only ever grows wider than the live rows, never narrower.
+struct ZoneMap
+{
+    uint32_t rows = 0;
+    std::vector<std::string> min, max; // by column position
+
+    void add(const RowFormat &format, std::string_view record)
+    {
+        size_t columns = format.getTypes().size() + 1;
+        if (rows == 0)
+        {
+            min.resize(columns);
+            max.resize(columns);
+        }
+        for (size_t pos = 0; pos < columns; ++pos)
+        {
+            std::string_view field = format.field(record, pos);
+            if (rows == 0 || field < min[pos])
+                min[pos].assign(field);
+            if (rows == 0 || field > max[pos])
+                max[pos].assign(field);
+        }
+        ++rows;
+    }
+
+    // u32 rows | u16 columns | per column u16 length + min, u16 length + max
+    void encode(std::string &out) const
+    {
+        char header[sizeof(uint32_t) + sizeof(uint16_t)];
+        putValue(header, rows);
+        putValue(header + sizeof(uint32_t), static_cast<uint16_t>(min.size()));
+        out.append(header, sizeof(header));
+        for (size_t pos = 0; pos < min.size(); ++pos)
+        {
+            for (const std::string *value : {&min[pos], &max[pos]})
+            {
+                char length[sizeof(uint16_t)];
+                putValue(length, static_cast<uint16_t>(value->size()));
+                out.append(length, sizeof(length));
+                out += *value;
+            }
+        }
+    }
+
+    bool decode(const char *&in, const char *end)
+    {
+        if (end - in < static_cast<std::ptrdiff_t>(sizeof(uint32_t) + sizeof(uint16_t)))
+            return false;
+        rows = getValue<uint32_t>(in);
+        uint16_t columns = getValue<uint16_t>(in + sizeof(uint32_t));
+        in += sizeof(uint32_t) + sizeof(uint16_t);
+        min.assign(columns, "");
+        max.assign(columns, "");
+        for (size_t pos = 0; pos < columns; ++pos)
+        {
+            for (std::string *value : {&min[pos], &max[pos]})
+            {
+                if (end - in < static_cast<std::ptrdiff_t>(sizeof(uint16_t)))
+                    return false;
+                uint16_t length = getValue<uint16_t>(in);
+                in += sizeof(uint16_t);
+                if (end - in < length)
+                    return false;
+                value->assign(in, length);
+                in += length;
+            }
+        }
+        return true;
+    }
+};
+
+// Could any row summarised by zone pass filter? Only a definite "no" is
+// acted on, so anything the summary cannot decide counts as a match.
+inline bool zoneMayMatch(const Filter &filter, const ZoneMap &zone)
+{
+    if (zone.rows == 0)
+        return false;
+
+    switch (filter.kind)
+    {
+    case Filter::Kind::And:
+        for (const auto &child : filter.children)
+        {
+            if (!zoneMayMatch(child, zone))
+                return false;
+        }
+        return true;
+    case Filter::Kind::Or:
+        for (const auto &child : filter.children)
+        {
+            if (zoneMayMatch(child, zone))
+                return true;
+        }
+        return false;
+    default:
+        break;
+    }
+
+    if (filter.position >= zone.min.size())
+        return true;
+    const std::string &low = zone.min[filter.position];
+    const std::string &high = zone.max[filter.position];
+    switch (filter.kind)
+    {
+    case Filter::Kind::In:
+        for (const auto &key : filter.keys)
+        {
+            if (key >= low && key <= high)
+                return true;
+        }
+        return false;
+    case Filter::Kind::Between:
+        return filter.keys[0] <= high && filter.keys[1] >= low;
+    default:
+        break;
+    }
+
+    const std::string &key = filter.keys[0];
+    switch (filter.op)
+    {
+    case CompareOp::Eq:
+        return key >= low && key <= high;
+    case CompareOp::Ne:
+        return !(low == key && high == key);
+    case CompareOp::Lt:
+        return low < key;
+    case CompareOp::Le:
+        return low <= key;
+    case CompareOp::Gt:
+        return high > key;
+    default:
+        return high >= key;
+    }
+}
+
+// Bloom filter over a fixed set of keys, BITS_PER_KEY bits each (about a
+// 1% false positive rate). Probes use double hashing of one 64-bit hash.
+class BloomFilter
+{
+private:
+    static constexpr uint32_t BITS_PER_KEY = 10;
+    static constexpr uint32_t PROBES = 7;
+
+    std::vector<uint64_t> words;
+
+    static uint64_t hash(std::string_view key)
+    {
+        // FNV-1a, then a murmur3 finalizer to spread the low bits
+        uint64_t h = 1469598103934665603ull;
+        for (char c : key)
+        {
+            h ^= static_cast<uint8_t>(c);
+            h *= 1099511628211ull;
+        }
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ull;
+        h ^= h >> 33;
+        return h;
+    }
+
+public:
+    static uint64_t keyHash(std::string_view key) { return hash(key); }
+
+    // Build from the hashes of every key
+    void build(const std::vector<uint64_t> &hashes)
+    {
+        uint64_t bits = std::max<uint64_t>(hashes.size() * BITS_PER_KEY, 64);
+        words.assign((bits + 63) / 64, 0);
+        bits = words.size() * 64;
+        for (uint64_t h : hashes)
+        {
+            uint64_t step = (h >> 32) | 1;
+            for (uint32_t i = 0; i < PROBES; ++i, h += step)
+                words[(h % bits) / 64] |= 1ull << (h % 64);
+        }
+    }
+
+    bool mayContain(std::string_view key) const
+    {
+        if (words.empty())
+            return true;
+        uint64_t bits = words.size() * 64;
+        uint64_t h = hash(key);
+        uint64_t step = (h >> 32) | 1;
+        for (uint32_t i = 0; i < PROBES; ++i, h += step)
+        {
+            if (!(words[(h % bits) / 64] >> (h % 64) & 1))
+                return false;
+        }
+        return true;
+    }
+
+    // u32 word count, then the words
+    void encode(std::string &out) const
+    {
+        char count[sizeof(uint32_t)];
+        putValue(count, static_cast<uint32_t>(words.size()));
+        out.append(count, sizeof(count));
+        out.append(reinterpret_cast<const char *>(words.data()), words.size() * sizeof(uint64_t));
+    }
+
+    bool decode(const char *&in, const char *end)
+    {
+        if (end - in < static_cast<std::ptrdiff_t>(sizeof(uint32_t)))
+            return false;
+        uint32_t count = getValue<uint32_t>(in);
+        in += sizeof(uint32_t);
+        if (static_cast<size_t>(end - in) < count * sizeof(uint64_t))
+            return false;
+        words.resize(count);
+        std::memcpy(words.data(), in, count * sizeof(uint64_t));
+        in += count * sizeof(uint64_t);
+        return true;
+    }
+};
+
+struct ScanSkipStats
+{
+    uint64_t blocksRead;
+    uint64_t blocksSkipped;
+    uint64_t bloomProbes;
+    uint64_t bloomSkips;
+    uint64_t encodedRowsChecked;
+    uint64_t encodedRowsDropped;
+};
+
+// Process-wide counters of how much data zone maps and Bloom filters saved,
+// and how many rows of columnar LSM blocks a filter dropped before their
+// records were rebuilt. A block is a zone of heap pages or a block of an
+// LSM segment.
+class ScanSkipCounters
+{
+private:
+    std::atomic<uint64_t> blocksRead{0};
+    std::atomic<uint64_t> blocksSkipped{0};
+    std::atomic<uint64_t> bloomProbes{0};
+    std::atomic<uint64_t> bloomSkips{0};
+    std::atomic<uint64_t> encodedChecked{0};
+    std::atomic<uint64_t> encodedDropped{0};
+
+    ScanSkipCounters() = default;
+
+public:
+    static ScanSkipCounters &instance()
+    {
+        static ScanSkipCounters counters;
+        return counters;
+    }
+
+    void blockRead() { blocksRead.fetch_add(1, std::memory_order_relaxed); }
+    void blockSkipped() { blocksSkipped.fetch_add(1, std::memory_order_relaxed); }
+    void bloomProbe(bool skipped)
+    {
+        bloomProbes.fetch_add(1, std::memory_order_relaxed);
+        if (skipped)
+            bloomSkips.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void encodedRows(uint64_t checked, uint64_t dropped)
+    {
+        encodedChecked.fetch_add(checked, std::memory_order_relaxed);
+        encodedDropped.fetch_add(dropped, std::memory_order_relaxed);
+    }
+
+    ScanSkipStats stats() const
+    {
+        return ScanSkipStats{blocksRead.load(), blocksSkipped.load(), bloomProbes.load(), bloomSkips.load(),
+                             encodedChecked.load(), encodedDropped.load()};
+    }
+};
+
+#endif // ZONEMAP_H